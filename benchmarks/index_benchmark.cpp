@@ -0,0 +1,178 @@
+#include <database_module/descriptor_index.hpp>
+#include <database_module/mih_index.hpp>
+#include <database_module/hnsw_index.hpp>
+#include <config.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace MPG;
+
+namespace
+{
+    constexpr int descriptor_bytes = 32;
+    constexpr size_t knn = 2;
+    constexpr int queries_count = 200;
+
+    constexpr int views_per_keypoint = 3;
+
+    void flipBits(uint8_t* code, int bits_count, std::mt19937& rng)
+    {
+        for (int b = 0; b < bits_count; ++b)
+        {
+            const uint32_t bit = rng() % (descriptor_bytes * 8);
+            code[bit / 8] ^= static_cast<uint8_t>(1u << (bit % 8));
+        }
+    }
+
+    /**
+     * \brief Synthetic ORB-like data
+     *
+     * Every keypoint of exhibit is stored views_per_keypoint times (one per train image) with noise.
+     * Half of queries are noisy views of database keypoints, other half is background without match.
+     */
+    void makeData(size_t database_size, cv::Mat& database, cv::Mat& queries)
+    {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> view_noise(4, 20);
+        database = cv::Mat(static_cast<int>(database_size), descriptor_bytes, CV_8UC1);
+        std::vector<uint8_t> keypoint(descriptor_bytes);
+        for (size_t row = 0; row < database_size; ++row)
+        {
+            if (row % views_per_keypoint == 0)
+            {
+                for (auto& byte : keypoint)
+                    byte = static_cast<uint8_t>(rng());
+            }
+            std::memcpy(database.ptr<uint8_t>(static_cast<int>(row)), keypoint.data(), descriptor_bytes);
+            flipBits(database.ptr<uint8_t>(static_cast<int>(row)), view_noise(rng), rng);
+        }
+
+        queries = cv::Mat(queries_count, descriptor_bytes, CV_8UC1);
+        for (int q = 0; q < queries_count; ++q)
+        {
+            uint8_t* query = queries.ptr<uint8_t>(q);
+            if (q % 2 == 0)
+            {
+                std::memcpy(query, database.ptr<uint8_t>(static_cast<int>(rng() % database_size)), descriptor_bytes);
+                flipBits(query, view_noise(rng), rng);
+            }
+            else
+            {
+                for (int i = 0; i < descriptor_bytes; ++i)
+                    query[i] = static_cast<uint8_t>(rng());
+            }
+        }
+    }
+
+    double elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t countMismatches(const std::vector<HammingMatch>& expected, const std::vector<HammingMatch>& actual)
+    {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            if (expected[i].train_idx != actual[i].train_idx || expected[i].distance != actual[i].distance)
+                ++mismatches;
+        }
+        return mismatches;
+    }
+
+    /**
+     * \brief Recall@k: part of exact k nearest neighbours found by index
+     * \param[in] only_views Count only queries which are views of database keypoints (even queries)
+     */
+    double recallAtK(const std::vector<HammingMatch>& expected, const std::vector<HammingMatch>& actual, bool only_views)
+    {
+        size_t found = 0, total = 0;
+        for (size_t q = 0; q < expected.size() / knn; q += only_views ? 2 : 1)
+        {
+            for (size_t i = 0; i < knn; ++i)
+            {
+                const int train_idx = expected[q * knn + i].train_idx;
+                if (train_idx < 0)
+                    continue;
+                ++total;
+                for (size_t j = 0; j < knn; ++j)
+                {
+                    if (actual[q * knn + j].train_idx == train_idx)
+                    {
+                        ++found;
+                        break;
+                    }
+                }
+            }
+        }
+        return total == 0 ? 1. : static_cast<double>(found) / total;
+    }
+}
+
+/**
+ * \brief Benchmark of descriptor indexes against brute force
+ *
+ * Usage: index_benchmark [database sizes...] (default 10000 100000 1000000)
+ */
+int main(int argc, char** argv)
+{
+    std::vector<size_t> sizes = {10000, 100000, 1000000};
+    if (argc > 1)
+    {
+        sizes.clear();
+        for (int i = 1; i < argc; ++i)
+            sizes.push_back(std::stoul(argv[i]));
+    }
+
+    const size_t search_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1) - 1;
+    auto search_pool = search_threads > 0 ? std::make_shared<SearchPool>(search_threads) : nullptr;
+
+    std::cout << "hamming kernel: " << hammingKernelName(bestHammingKernel())
+              << ", search pool threads: " << search_threads << "\n";
+    for (size_t database_size : sizes)
+    {
+        cv::Mat database, queries;
+        makeData(database_size, database, queries);
+
+        Config conf;
+        std::vector<HammingMatch> expected;
+        const std::vector<std::pair<const char*, std::shared_ptr<SearchPool>>> variants = {
+            {"bruteforce", nullptr}, {"bruteforce", search_pool}, {"mih", nullptr}, {"hnsw", nullptr}};
+        // parallel brute force is skipped on one core (pool is nullptr, variant is the same as first)
+        for (const auto& [index_type, pool] : variants)
+        {
+            if (pool == nullptr && index_type == std::string("bruteforce") && !expected.empty())
+                continue;
+            conf.descriptor_index_type = index_type;
+            std::unique_ptr<DescriptorIndex> index = createDescriptorIndex(conf, pool);
+
+            auto start = std::chrono::steady_clock::now();
+            index->build(database);
+            const double build_ms = elapsedMs(start);
+
+            std::vector<HammingMatch> matches;
+            start = std::chrono::steady_clock::now();
+            index->knnSearch(queries, knn, matches);
+            const double search_ms = elapsedMs(start);
+
+            if (expected.empty())
+                expected = matches;
+
+            std::cout << "size " << database_size << " " << index->name() << (pool ? " (parallel)" : "")
+                      << ": build " << build_ms << " ms, search " << search_ms / queries_count << " ms/query"
+                      << ", mismatches with bruteforce " << countMismatches(expected, matches)
+                      << ", recall@" << knn << " " << recallAtK(expected, matches, false)
+                      << " (views " << recallAtK(expected, matches, true) << ")";
+            if (const MihIndex* mih = dynamic_cast<const MihIndex*>(index.get()))
+            {
+                std::cout << ", compared " << 100.0 * mih->distanceComputations() / (queries_count * database_size)
+                          << "% of database, bruteforce fallbacks " << mih->bruteForceFallbacks();
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
@@ -1,12 +1,19 @@
 #pragma once
 
 #include <database_module/database.hpp>
+#include <database_module/search_pool.hpp>
 #include <core_module/core_utils.hpp>
+#include <core_module/feature_extractor.hpp>
+#include <core_module/query_cache.hpp>
 #include <config.hpp>
 #include <logger.hpp>
+#include <object_pool.hpp>
 
 #include <opencv2/features2d/features2d.hpp>
 
+#include <atomic>
+#include <thread>
+
 namespace MPG
 
 {
@@ -19,14 +26,45 @@ class Core
 
 public:
 
-    using ORBPtr = cv::Ptr<cv::ORB>;
+    using ExtractorPool = ObjectPool<FeatureExtractor>;
+
+    /**
+     * \brief Counters of per-thread query buffers (image, keypoints, descriptors)
+     */
+    struct ScratchStats
+    {
+        uint64_t queries_count = 0;
+        uint64_t grown_buffer_queries_count = 0; // queries which grew (reallocated) at least one scratch buffer
+    };
 
-    Core(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log);
-    virtual std::optional<CoreResponse> getExhibit(std::vector<uint8_t>&& exhibit_image);
+    /**
+     * \brief State of database initialization
+     */
+    enum class State
+    {
+        Starting, // connecting to database and loading local database
+        Ready,
+        Failed
+    };
+
+    Core(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log, bool is_background_init = false);
+    State state() const;
+    ExtractorPool::Stats extractorPoolStats() const;
+    ScratchStats scratchStats() const;
+    QueryCache::Stats queryCacheStats() const;
+    ExhibitCache::Stats exhibitCacheStats() const;
+    virtual std::optional<CoreResponse> getExhibit(std::vector<uint8_t>&& exhibit_image,
+                                                   std::chrono::milliseconds time_budget = std::chrono::milliseconds(0),
+                                                   std::optional<ImageRendition> rendition = std::nullopt);
+    virtual ExhibitCache::Payload getExhibitImage(const std::string& exhibit_id,
+                                                  std::optional<ImageRendition> rendition = std::nullopt);
     virtual bool addExhibit(const CoreRequest& req);
     virtual bool deleteExhibit(const std::string& exhibit_id);
-    virtual std::optional<DatabaseChunk> getDatabaseChunk(const std::string& next_chunk_token);
-    virtual ~Core(){};
+    virtual std::optional<DatabaseChunk> getDatabaseChunk(const std::string& next_chunk_token,
+                                                          const ChunkFields& fields = ChunkFields());
+    virtual std::optional<DatabaseChunk> visitDatabaseChunk(const std::string& next_chunk_token, const ChunkFields& fields,
+                                                            const ExhibitRowVisitor& visitor);
+    virtual ~Core();
 
 
 protected:
@@ -36,14 +74,24 @@ protected:
     std::shared_ptr<Config> config;
     std::shared_ptr<Logger> logger;
 
-    bool initORBPool();
-    ORBPtr getORB();
-    void returnORB(ORBPtr orb);
-    ORBPool orb_pool;
+    bool initExtractorPool(FeatureType type);
+    void initDatabase();
+    ExtractorPool::Lease getExtractor();
+    std::unique_ptr<ExtractorPool> extractor_pool; // created for feature type of keyspace by initDatabase
+    std::unique_ptr<SearchPool> extraction_pool; // decodes and extracts train images of one exhibit in parallel
+    std::unique_ptr<QueryCache> query_cache; // nullptr if query_cache_size is 0
+    ImageRendition default_rendition = ImageRendition::Full; // of recognition responses, from default_image_rendition
+
+    std::atomic<uint64_t> scratch_queries_count{0};
+    std::atomic<uint64_t> scratch_grown_buffer_queries_count{0};
+
+    std::atomic<State> core_state{State::Starting};
+    std::thread init_thread;
 
 private:
     std::optional<CoreResponse> getCoreResponse(const DatabaseResponse& db_resp);
     std::optional<DatabaseRequest> getDatabaseRequest(const CoreRequest& db_resp);
+    void makeImageRenditions(DatabaseRequest& db_req);
 };
 
 
@@ -27,13 +27,4 @@ struct CoreRequest
     std::vector<std::vector<uint8_t>> exhibit_descriptor_images;
 };
 
-struct ORBPool
-{
-    std::mutex mtx;
-    std::condition_variable cv;
-    std::queue<cv::Ptr<cv::ORB>> pool;
-};
-
-
-
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <database_module/feature_type.hpp>
+
+#include <opencv2/features2d/features2d.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Detector and descriptor of binary features used for exhibits
+     */
+    class FeatureExtractor
+    {
+    public:
+
+        virtual ~FeatureExtractor() = default;
+
+        virtual bool detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& kps, cv::Mat& descriptors) = 0;
+        virtual FeatureType type() const = 0;
+        virtual size_t descriptorBytes() const = 0;
+    };
+
+    /**
+     * \brief Feature extractor of OpenCV detector, descriptor width is known at compile time
+     *
+     * Keeps at most kps_count the strongest keypoints of image (ORB does it itself, others are filtered by response)
+     */
+    template<FeatureType Type>
+    class BinaryFeatureExtractor : public FeatureExtractor
+    {
+    public:
+
+        static constexpr size_t descriptor_bytes = FeatureTraits<Type>::descriptor_bytes;
+
+        explicit BinaryFeatureExtractor(size_t kps_count);
+
+        bool detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& kps, cv::Mat& descriptors) override;
+        FeatureType type() const override;
+        size_t descriptorBytes() const override;
+
+    private:
+
+        cv::Ptr<cv::Feature2D> detector;
+        size_t max_kps;
+    };
+
+    std::shared_ptr<FeatureExtractor> createFeatureExtractor(FeatureType type, size_t kps_count);
+
+}
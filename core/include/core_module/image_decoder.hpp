@@ -0,0 +1,19 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace MPG
+{
+
+    std::optional<cv::Size> readImageSize(const std::vector<uint8_t>& image);
+    int reducedDecodeScale(const cv::Size& size, size_t target_long_side);
+    cv::Mat decodeGrayscale(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels);
+    bool decodeGrayscale(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels, cv::Mat& decoded);
+    bool decodeColor(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels, cv::Mat& decoded);
+    bool encodeRendition(const cv::Mat& image, size_t long_side, bool is_webp, int quality, std::vector<uint8_t>& encoded);
+
+}
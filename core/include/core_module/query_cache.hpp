@@ -0,0 +1,95 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace MPG
+{
+
+    uint64_t differenceHash(const cv::Mat& image);
+
+    /**
+     * \brief Bounded cache of query results keyed by perceptual hash of query image
+     *
+     * Repeated photos of the same exhibit have close hashes, so lookup returns the nearest entry within
+     * max_distance bits. The least recently used entry is evicted, but only if exhibit of new entry was
+     * resolved at least as often as exhibit of victim (TinyLFU admission by count-min sketch of exhibit ids),
+     * so bursts of one-off photos don't wash out popular exhibits.
+     * Cache is bound to version of database content and is cleared when version changes.
+     */
+    class QueryCache
+    {
+    public:
+
+        /**
+         * \brief Cached result of query
+         */
+        struct Hit
+        {
+            std::string exhibit_id;
+            size_t confidence = 0;
+        };
+
+        /**
+         * \brief Cache counters
+         */
+        struct Stats
+        {
+            size_t capacity = 0;
+            size_t size = 0;
+            uint64_t lookups_count = 0;
+            uint64_t hits_count = 0;
+            uint64_t insertions_count = 0;
+            uint64_t rejections_count = 0;    // new entries not admitted by frequency
+            uint64_t invalidations_count = 0; // clears by change of database
+        };
+
+        QueryCache(size_t capacity, size_t max_distance);
+
+        QueryCache(const QueryCache&) = delete;
+        QueryCache& operator=(const QueryCache&) = delete;
+
+        std::optional<Hit> find(uint64_t image_hash, uint64_t version);
+        void insert(uint64_t image_hash, const std::string& exhibit_id, size_t confidence, uint64_t version);
+        Stats stats() const;
+
+    private:
+
+        struct Entry
+        {
+            std::string exhibit_id;
+            size_t confidence = 0;
+            uint64_t exhibit_key = 0; // hash of exhibit_id for sketch
+            uint64_t last_used = 0;
+        };
+
+        bool syncVersion(uint64_t version);
+        void recordAccess(uint64_t exhibit_key);
+        uint32_t estimateFrequency(uint64_t exhibit_key) const;
+
+        size_t entries_capacity;
+        size_t max_distance;
+
+        mutable std::mutex mtx;
+        std::vector<uint64_t> hashes; // separate from entries, so lookup scans contiguous array
+        std::vector<Entry> entries;
+        uint64_t tick = 0;
+        uint64_t cache_version = 0;
+
+        std::vector<uint8_t> sketch; // count-min sketch, sketch_depth rows of sketch_width counters
+        size_t sketch_width = 0;
+        size_t sketch_additions = 0;
+
+        uint64_t lookups_count = 0;
+        uint64_t hits_count = 0;
+        uint64_t insertions_count = 0;
+        uint64_t rejections_count = 0;
+        uint64_t invalidations_count = 0;
+    };
+
+}
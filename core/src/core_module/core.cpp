@@ -1,48 +1,212 @@
 #include <core_module/core.hpp>
+#include <core_module/image_decoder.hpp>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <numeric>
 
 
 namespace MPG
 {
 
+    namespace
+    {
+        /**
+         * \brief Buffers of query processing, one set per worker thread is reused by all its queries
+         */
+        struct QueryScratch
+        {
+            cv::Mat image;
+            std::vector<cv::KeyPoint> kps;
+            cv::Mat descriptors;
+            cv::Mat sorted_descriptors_buffer; // only grows, sorted descriptors are its first rows
+            std::vector<int> order;
+            std::vector<cv::Point2f> points;
+        };
+
+        thread_local QueryScratch query_scratch;
+
+        /**
+         * \brief Addresses of scratch buffers, address is changed only by reallocation of buffer
+         */
+        std::array<const void*, 6> scratchBuffers(const QueryScratch& scratch)
+        {
+            return {scratch.image.data, scratch.kps.data(), scratch.descriptors.data,
+                    scratch.sorted_descriptors_buffer.data, scratch.order.data(), scratch.points.data()};
+        }
+
+        /**
+         * \brief Function for get first rows of growing buffer
+         * \param[in,out] buffer Buffer, it's reallocated only if it has less rows or other width
+         * \param[in] rows Count of rows
+         * \param[in] cols Count of columns
+         * \param[in] type Matrix type
+         * \return Header of buffer rows (without copy)
+         */
+        cv::Mat scratchRows(cv::Mat& buffer, int rows, int cols, int type)
+        {
+            if (buffer.rows < rows || buffer.cols != cols || buffer.type() != type)
+                buffer.create(std::max(rows, buffer.rows), cols, type);
+            return buffer.rowRange(0, rows);
+        }
+    }
+
     /**
      * \brief Constructor of core class object
      * \param[in] conf Smart pointer to configuration of project
      * \param[in] log Smart pointer to global logger
+     * \param[in] is_background_init If true, database is initialized in background thread (see state())
      */
-    Core::Core(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log)
+    Core::Core(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log, bool is_background_init)
     {
         db = std::make_unique<DatabaseModule>(conf, log);
-        db->init();
 
         config = conf;
         logger = log;
-        initORBPool();
+        // extraction_threads = 0 means all cores (caller thread is one of them), but not more than feature extractors
+        const size_t extraction_threads = config->extraction_threads > 0 ? config->extraction_threads :
+                                          std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1),
+                                                           std::max<size_t>(config->orb_pool_size, 1)) - 1;
+        extraction_pool = std::make_unique<SearchPool>(extraction_threads);
+        if (config->query_cache_size > 0)
+            query_cache = std::make_unique<QueryCache>(config->query_cache_size, config->query_cache_max_distance);
+        if (std::optional<ImageRendition> rendition = imageRenditionFromName(config->default_image_rendition))
+            default_rendition = rendition.value();
+        else
+            logger->LogWarning("Core: unknown default_image_rendition " + config->default_image_rendition + ", full image is used");
+
+        if (is_background_init)
+            init_thread = std::thread(&Core::initDatabase, this);
+        else
+            initDatabase();
+    }
+
+    Core::~Core()
+    {
+        db->stop(); // interrupts waiting for database connection
+        if (init_thread.joinable())
+            init_thread.join();
+    }
+
+    /**
+     * \brief Method for get state of database initialization
+     * \return Current state, requests can be processed only in State::Ready
+     */
+    Core::State Core::state() const
+    {
+        return core_state.load(std::memory_order_acquire);
+    }
+
+    /**
+     * \brief Internal method for connect to database and load local database
+     */
+    void Core::initDatabase()
+    {
+        const auto started_at = std::chrono::steady_clock::now();
+        const bool is_initialized = db->init() && initExtractorPool(db->featureType());
+        core_state.store(is_initialized ? State::Ready : State::Failed, std::memory_order_release);
+
+        const auto init_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at);
+        if (is_initialized)
+            logger->LogInfo("Core: database is ready in " + std::to_string(init_ms.count()) + " ms");
+        else
+            logger->LogCritical("Core: database initialization failed");
     }
 
 
      /**
      * \brief Method for get object info by its image
      * \param[in] exhibit_image Object image (.jpg)
+     * \param[in] time_budget Time for matching (0 means default from config)
+     * \param[in] rendition Size of returned image (std::nullopt means default_image_rendition from config)
      * \return Object info if success or std::nullopt
      */
-    std::optional<CoreResponse> Core::getExhibit(std::vector<uint8_t>&& exhibit_image)
+    std::optional<CoreResponse> Core::getExhibit(std::vector<uint8_t>&& exhibit_image, std::chrono::milliseconds time_budget,
+                                                 std::optional<ImageRendition> rendition)
     {
-        std::vector<cv::KeyPoint> kps;
-        cv::Mat descr;
-        cv::Mat exhibit_image_mat = cv::imdecode(exhibit_image, cv::IMREAD_GRAYSCALE);
-        //kps.reserve(100);
-        ORBPtr orb = getORB();
-        orb->detectAndCompute(exhibit_image_mat, cv::noArray(), kps, descr);
-        returnORB(orb);
-        std::optional<DatabaseResponse> db_resp = db->getExhibit(descr);
+        if (state() != State::Ready)
+            return std::nullopt;
+        const ImageRendition image_rendition = rendition.value_or(default_rendition);
+
+        QueryScratch& scratch = query_scratch;
+        const std::array<const void*, 6> buffers_before = scratchBuffers(scratch);
+        if (!decodeGrayscale(exhibit_image, config->image_long_side, config->max_image_pixels, scratch.image))
+        {
+            logger->LogError("Core: query image has unsupported format, is damaged or bigger than max_image_pixels");
+            return std::nullopt;
+        }
+
+        // repeated photo is answered by cached exhibit without extraction and matching
+        const uint64_t changes_version = db->changesVersion();
+        const uint64_t image_hash = query_cache ? differenceHash(scratch.image) : 0;
+        if (query_cache)
+        {
+            if (std::optional<QueryCache::Hit> hit = query_cache->find(image_hash, changes_version))
+            {
+                std::optional<DatabaseResponse> cached_resp = db->getExhibitById(hit->exhibit_id, hit->confidence, image_rendition);
+                if (cached_resp)
+                    return getCoreResponse(cached_resp.value());
+            }
+        }
+
+        scratch.kps.reserve(config->orb_kps_count);
+        if (!getExtractor()->detectAndCompute(scratch.image, scratch.kps, scratch.descriptors))
+        {
+            logger->LogError("Core: feature extractor returned descriptors of unexpected width");
+            return std::nullopt;
+        }
+
+        // database matches the strongest keypoints first and can stop before the weakest ones
+        const std::vector<cv::KeyPoint>& kps = scratch.kps;
+        scratch.order.resize(kps.size());
+        std::iota(scratch.order.begin(), scratch.order.end(), 0);
+        std::sort(scratch.order.begin(), scratch.order.end(), [&](int a, int b)
+                  { return kps[a].response > kps[b].response; });
+        cv::Mat sorted_descr;
+        if (!scratch.descriptors.empty())
+            sorted_descr = scratchRows(scratch.sorted_descriptors_buffer, scratch.descriptors.rows,
+                                       scratch.descriptors.cols, scratch.descriptors.type());
+        const size_t row_bytes = scratch.descriptors.cols * scratch.descriptors.elemSize();
+        scratch.points.clear();
+        scratch.points.reserve(kps.size());
+        for (size_t i = 0; i < scratch.order.size(); ++i)
+        {
+            std::memcpy(sorted_descr.ptr(static_cast<int>(i)), scratch.descriptors.ptr(scratch.order[i]), row_bytes);
+            scratch.points.push_back(kps[scratch.order[i]].pt);
+        }
+
+        scratch_queries_count.fetch_add(1, std::memory_order_relaxed);
+        if (scratchBuffers(scratch) != buffers_before)
+            scratch_grown_buffer_queries_count.fetch_add(1, std::memory_order_relaxed);
+
+        std::optional<DatabaseResponse> db_resp = db->getExhibit(sorted_descr, scratch.points, time_budget, image_rendition);
 
         if (!db_resp)
             return std::nullopt;
 
+        if (query_cache)
+            query_cache->insert(image_hash, db_resp->exhibit_id, db_resp->percentage_of_confidance, changes_version);
         return getCoreResponse(db_resp.value());
     }
 
 
+    /**
+     * \brief Method for get image of object by its id (without recognition)
+     * \param[in] exhibit_id Object id (cass uuid in string format)
+     * \param[in] rendition Size of image (std::nullopt means default_image_rendition from config)
+     * \return Payload with encoded image and its ETag, shared with exhibit cache, or nullptr (e.g. object isn't found)
+     */
+    ExhibitCache::Payload Core::getExhibitImage(const std::string& exhibit_id, std::optional<ImageRendition> rendition)
+    {
+        if (state() != State::Ready)
+            return nullptr;
+        return db->getExhibitPayload(exhibit_id, rendition.value_or(default_rendition));
+    }
+
+
     /**
      * \brief Method for add new object to system
      * \param[in] req Object info
@@ -50,6 +214,9 @@ namespace MPG
      */
     bool Core::addExhibit(const CoreRequest& req)
     {
+        if (state() != State::Ready)
+            return false;
+
         std::optional<DatabaseRequest> db_req = getDatabaseRequest(req);
 
         if (!db_req)
@@ -64,53 +231,76 @@ namespace MPG
 
 
     /**
-     * \brief Internal method for init ORB detectors pool
+     * \brief Internal method for init feature extractors pool
+     * \param[in] type Feature type of keyspace
      * \return true if success
      */
-    bool Core::initORBPool()
+    bool Core::initExtractorPool(FeatureType type)
     {
-        orb_pool.pool = std::queue<ORBPtr>();
-        const size_t pool_size = config->orb_pool_size;
-
-        for (size_t i = 0; i < pool_size; ++i)
-        {
-            ORBPtr orb = cv::ORB::create(config->orb_kps_count);
-            
-            orb_pool.pool.push(orb);
-        }
+        const size_t kps_count = config->orb_kps_count;
+        extractor_pool = std::make_unique<ExtractorPool>(config->orb_pool_size, [type, kps_count]
+                                                         { return createFeatureExtractor(type, kps_count); });
+        logger->LogInfo(std::string("Core: ") + std::to_string(extractor_pool->capacity()) + " " + featureTypeName(type) + " feature extractors");
         return true;
     }
 
 
     /**
-     * \brief Internal method for get ORB detector from pool
-     * \return ORB detector (wait untill at least one will be available)
-     * 
-     * Don't forget to return detector to pool!
+     * \brief Internal method for get feature extractor from pool
+     * \return Lease of extractor (wait untill at least one will be available), extractor is returned to pool with lease
      */
-    Core::ORBPtr Core::getORB()
+    Core::ExtractorPool::Lease Core::getExtractor()
     {
-        std::unique_lock<std::mutex> ul(orb_pool.mtx);
-        orb_pool.cv.wait(ul, [this]
-                              { return !orb_pool.pool.empty(); });
+        return extractor_pool->acquire();
+    }
 
-        ORBPtr orb = orb_pool.pool.front();
-        orb_pool.pool.pop();
 
-        return orb;
+    /**
+     * \brief Method for get counters of feature extractors pool
+     * \return Pool capacity, occupancy and waiting time (zeros while database isn't ready)
+     */
+    Core::ExtractorPool::Stats Core::extractorPoolStats() const
+    {
+        if (state() != State::Ready)
+            return ExtractorPool::Stats();
+        return extractor_pool->stats();
     }
 
 
     /**
-     * \brief Internal method for return ORB detector to pool
-     * \param[in] orb ORB detector object
+     * \brief Method for get counters of per-thread query buffers
+     * \return Count of queries and count of queries which had to grow some scratch buffer
+     *
+     * In steady state count of growing queries stops increasing: buffers keep capacity of previous queries of worker thread
      */
-    void Core::returnORB(ORBPtr orb)
+    Core::ScratchStats Core::scratchStats() const
     {
-        std::lock_guard<std::mutex> lg(orb_pool.mtx);
-        orb_pool.pool.push(orb);
+        ScratchStats stats;
+        stats.queries_count = scratch_queries_count.load(std::memory_order_relaxed);
+        stats.grown_buffer_queries_count = scratch_grown_buffer_queries_count.load(std::memory_order_relaxed);
+        return stats;
+    }
 
-        orb_pool.cv.notify_one();
+
+    /**
+     * \brief Method for get counters of query results cache
+     * \return Cache size and hit counters (zeros if cache is disabled)
+     */
+    QueryCache::Stats Core::queryCacheStats() const
+    {
+        if (!query_cache)
+            return QueryCache::Stats();
+        return query_cache->stats();
+    }
+
+
+    /**
+     * \brief Method for get counters of exhibit payloads cache of database module
+     * \return Cache size in bytes, hit and eviction counters (zeros if cache is disabled)
+     */
+    ExhibitCache::Stats Core::exhibitCacheStats() const
+    {
+        return db->exhibitCacheStats();
     }
 
 
@@ -127,6 +317,7 @@ namespace MPG
         resp.exhibit_description = std::move(db_resp.exhibit_description);
         resp.exhibit_name = std::move(db_resp.exhibit_name);
         resp.exhibit_image = std::move(db_resp.exhibit_image);
+        resp.percentage_of_confidance = db_resp.percentage_of_confidance;
 
         return resp;
     }
@@ -142,40 +333,114 @@ namespace MPG
         db_req.exhibit_description = std::move(req.exhibit_description);
         db_req.exhibit_title = std::move(req.exhibit_title);
         db_req.exhibit_image = std::move(req.exhibit_main_image);
-        cv::Ptr<cv::ORB> orb = getORB();
-        cv::Mat all_descriptor;
-        std::vector<cv::KeyPoint> all_kps;
 
-        for (const auto image_buffer : req.exhibit_descriptor_images)
+        struct ImageFeatures
         {
-            cv::Mat image = cv::imdecode(image_buffer, cv::IMREAD_COLOR);
-            cv::Mat curr_descriptor;
             std::vector<cv::KeyPoint> kps;
-            orb->detectAndCompute(image, cv::noArray(), kps, curr_descriptor);
-
-            all_descriptor.push_back(curr_descriptor);
-            all_kps.insert(all_kps.end(), kps.begin(), kps.end());
+            cv::Mat descriptors;
+        };
+        const std::vector<std::vector<uint8_t>>& images = req.exhibit_descriptor_images;
+        std::vector<ImageFeatures> features(images.size()); // one slot per image, so workers don't share anything
+        std::atomic<bool> is_failed{false};
+
+        // every participant takes own extractor, so parallelism is bounded by extractors pool too
+        SearchPool::QueryScope query_scope(*extraction_pool);
+        const size_t participants = std::min(query_scope.parallelism(), std::max<size_t>(config->orb_pool_size, 1));
+        extraction_pool->run(images.size(), participants, [&](size_t image_index, size_t)
+        {
+            if (is_failed.load(std::memory_order_relaxed))
+                return;
+            cv::Mat image = decodeGrayscale(images[image_index], config->image_long_side, config->max_image_pixels);
+            if (image.empty())
+            {
+                is_failed.store(true, std::memory_order_relaxed);
+                return;
+            }
+            if (!getExtractor()->detectAndCompute(image, features[image_index].kps, features[image_index].descriptors))
+                is_failed.store(true, std::memory_order_relaxed);
+        });
+
+        if (is_failed.load())
+        {
+            logger->LogError("Core: train image has unsupported format, is damaged, bigger than max_image_pixels or its features failed");
+            return std::nullopt;
         }
 
-        std::vector<int> indices(all_kps.size());
-        std::iota(indices.begin(), indices.end(), 0);
-
-        std::sort(indices.begin(), indices.end(), [&](int a, int b)
-                  { return all_kps[a].response > all_kps[b].response; });
+        struct FeatureRef
+        {
+            float response;
+            uint32_t image_index;
+            uint32_t row;
+        };
+        size_t kps_count = 0;
+        for (const ImageFeatures& image_features : features)
+            kps_count += image_features.kps.size();
+        std::vector<FeatureRef> refs;
+        refs.reserve(kps_count);
+        for (size_t i = 0; i < features.size(); ++i)
+            for (size_t row = 0; row < features[i].kps.size(); ++row)
+                refs.push_back({features[i].kps[row].response, static_cast<uint32_t>(i), static_cast<uint32_t>(row)});
+
+        // only the strongest top_n are needed, and database expects them sorted from the strongest
+        const size_t top_n = std::min(config->max_descriptor_size, refs.size());
+        auto is_stronger = [](const FeatureRef& a, const FeatureRef& b) { return a.response > b.response; };
+        std::nth_element(refs.begin(), refs.begin() + top_n, refs.end(), is_stronger);
+        std::sort(refs.begin(), refs.begin() + top_n, is_stronger);
 
-        int top_n = std::min(static_cast<int>(config->max_descriptor_size), static_cast<int>(indices.size()));
         cv::Mat final_descriptors;
-
-        for (int i = 0; i < top_n; ++i)
+        if (top_n > 0)
+        {
+            const cv::Mat& first_descriptors = features[refs.front().image_index].descriptors;
+            final_descriptors.create(static_cast<int>(top_n), first_descriptors.cols, first_descriptors.type());
+        }
+        db_req.exhibit_keypoints.reserve(top_n);
+        for (size_t i = 0; i < top_n; ++i)
         {
-            final_descriptors.push_back(all_descriptor.row(indices[i]));
+            const ImageFeatures& image_features = features[refs[i].image_index];
+            image_features.descriptors.row(static_cast<int>(refs[i].row)).copyTo(final_descriptors.row(static_cast<int>(i)));
+            db_req.exhibit_keypoints.push_back(image_features.kps[refs[i].row].pt);
         }
 
         db_req.exhibit_descriptor = std::move(final_descriptors);
+        makeImageRenditions(db_req);
 
         return db_req;
     }
 
+    /**
+     * \brief Internal method for generate thumbnail and mobile renditions of main image
+     * \param[in,out] db_req Object info with main image, renditions are added to it
+     *
+     * Rendition which isn't smaller than main image isn't stored (main image is returned instead), as well as
+     * renditions of image which can't be decoded
+     */
+    void Core::makeImageRenditions(DatabaseRequest& db_req)
+    {
+        // the biggest rendition determines decoding scale
+        cv::Mat main_image;
+        if (!decodeColor(db_req.exhibit_image, config->mobile_long_side, config->max_image_pixels, main_image))
+        {
+            logger->LogWarning("Core: main image has unsupported format or is damaged, its renditions aren't generated");
+            return;
+        }
+
+        const bool is_webp = config->rendition_format == "webp" && cv::haveImageWriter(".webp");
+        if (config->rendition_format == "webp" && !is_webp)
+            logger->LogWarning("Core: OpenCV has no WebP encoder, renditions are encoded to JPEG");
+        const int quality = static_cast<int>(std::clamp<size_t>(config->rendition_quality, 1, 100));
+
+        std::pair<size_t, std::vector<uint8_t>*> renditions[] = {{config->thumbnail_long_side, &db_req.exhibit_thumbnail_image},
+                                                                 {config->mobile_long_side, &db_req.exhibit_mobile_image}};
+        for (auto& [long_side, encoded] : renditions)
+        {
+            if (!encodeRendition(main_image, long_side, is_webp, quality, *encoded) || encoded->size() >= db_req.exhibit_image.size())
+                encoded->clear();
+        }
+        logger->LogInfo("Core: main image " + std::to_string(db_req.exhibit_image.size()) + " bytes, thumbnail " +
+                        std::to_string(db_req.exhibit_thumbnail_image.size()) + " bytes, mobile " +
+                        std::to_string(db_req.exhibit_mobile_image.size()) + " bytes");
+    }
+
     /**
      * \brief Method for delete object from database by its id
      * \param[in] exhibit_id Object id (cass uuid in string format)
@@ -183,17 +448,37 @@ namespace MPG
      */
     bool Core::deleteExhibit(const std::string& exhibit_id)
     {
+        if (state() != State::Ready)
+            return false;
         return db->deleteExhibit(exhibit_id);
     }
 
     /**
      * \brief Method for get database chunk
      * \param[in] next_chunk_token Cassandra token for next chunk(page)
+     * \param[in] fields Columns of exhibits in chunk
      * \return Database chunk if success or std::nullopt
      */
-    std::optional<DatabaseChunk> Core::getDatabaseChunk(const std::string& next_chunk_token)
+    std::optional<DatabaseChunk> Core::getDatabaseChunk(const std::string& next_chunk_token, const ChunkFields& fields)
     {
-        return db->getDatabaseChunk(next_chunk_token);
+        if (state() != State::Ready)
+            return std::nullopt;
+        return db->getDatabaseChunk(next_chunk_token, fields);
+
+    }
 
+    /**
+     * \brief Method for read database chunk row by row without copy of rows
+     * \param[in] next_chunk_token Cassandra token for next chunk(page)
+     * \param[in] fields Columns of exhibits in chunk
+     * \param[in] visitor Function called for every exhibit of chunk
+     * \return Database chunk without exhibits (next chunk token) if success or std::nullopt
+     */
+    std::optional<DatabaseChunk> Core::visitDatabaseChunk(const std::string& next_chunk_token, const ChunkFields& fields,
+                                                          const ExhibitRowVisitor& visitor)
+    {
+        if (state() != State::Ready)
+            return std::nullopt;
+        return db->visitDatabaseChunk(next_chunk_token, fields, visitor);
     }
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include <core_module/feature_extractor.hpp>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Constructor of feature extractor
+     * \param[in] kps_count Max count of keypoints of one image
+     */
+    template<FeatureType Type>
+    BinaryFeatureExtractor<Type>::BinaryFeatureExtractor(size_t kps_count)
+        : max_kps(kps_count)
+    {
+        if constexpr (Type == FeatureType::ORB)
+            detector = cv::ORB::create(static_cast<int>(kps_count));
+        else if constexpr (Type == FeatureType::BRISK)
+            detector = cv::BRISK::create();
+        else
+            detector = cv::AKAZE::create(cv::AKAZE::DESCRIPTOR_MLDB, 0, 3); // full size descriptor
+    }
+
+    /**
+     * \brief Method for detect keypoints of image and compute their descriptors
+     * \param[in] image Grayscale image
+     * \param[out] kps Keypoints
+     * \param[out] descriptors Descriptors (CV_8UC1, descriptorBytes() per row, one row for every keypoint)
+     * \return false if detector returned descriptors of unexpected width
+     */
+    template<FeatureType Type>
+    bool BinaryFeatureExtractor<Type>::detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& kps, cv::Mat& descriptors)
+    {
+        if constexpr (Type == FeatureType::ORB)
+        {
+            detector->detectAndCompute(image, cv::noArray(), kps, descriptors);
+        }
+        else
+        {
+            detector->detect(image, kps);
+            cv::KeyPointsFilter::retainBest(kps, static_cast<int>(max_kps));
+            detector->compute(image, kps, descriptors);
+        }
+        if (!descriptors.empty() && (descriptors.type() != CV_8UC1 || static_cast<size_t>(descriptors.cols) != descriptor_bytes))
+        {
+            kps.clear();
+            descriptors.release();
+            return false;
+        }
+        return true;
+    }
+
+    template<FeatureType Type>
+    FeatureType BinaryFeatureExtractor<Type>::type() const
+    {
+        return Type;
+    }
+
+    template<FeatureType Type>
+    size_t BinaryFeatureExtractor<Type>::descriptorBytes() const
+    {
+        return descriptor_bytes;
+    }
+
+    template class BinaryFeatureExtractor<FeatureType::ORB>;
+    template class BinaryFeatureExtractor<FeatureType::BRISK>;
+    template class BinaryFeatureExtractor<FeatureType::AKAZE>;
+
+    /**
+     * \brief Function for create feature extractor of feature type
+     * \param[in] type Feature type
+     * \param[in] kps_count Max count of keypoints of one image
+     * \return Feature extractor
+     */
+    std::shared_ptr<FeatureExtractor> createFeatureExtractor(FeatureType type, size_t kps_count)
+    {
+        switch (type)
+        {
+        case FeatureType::BRISK:
+            return std::make_shared<BinaryFeatureExtractor<FeatureType::BRISK>>(kps_count);
+        case FeatureType::AKAZE:
+            return std::make_shared<BinaryFeatureExtractor<FeatureType::AKAZE>>(kps_count);
+        default:
+            return std::make_shared<BinaryFeatureExtractor<FeatureType::ORB>>(kps_count);
+        }
+    }
+
+}
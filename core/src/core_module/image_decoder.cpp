@@ -0,0 +1,270 @@
+#include <core_module/image_decoder.hpp>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        uint32_t readBigEndian(const uint8_t* bytes, size_t count)
+        {
+            uint32_t value = 0;
+            for (size_t i = 0; i < count; ++i)
+                value = (value << 8) | bytes[i];
+            return value;
+        }
+
+        uint32_t readLittleEndian(const uint8_t* bytes, size_t count)
+        {
+            uint32_t value = 0;
+            for (size_t i = count; i > 0; --i)
+                value = (value << 8) | bytes[i - 1];
+            return value;
+        }
+
+        /**
+         * \brief Size from the first chunk of WebP (lossy VP8, lossless VP8L or extended VP8X)
+         */
+        std::optional<cv::Size> readWebpSize(const std::vector<uint8_t>& image)
+        {
+            if (image.size() >= 30 && std::equal(image.begin() + 12, image.begin() + 16, "VP8 "))
+                return cv::Size(static_cast<int>(readLittleEndian(&image[26], 2) & 0x3FFF),
+                                static_cast<int>(readLittleEndian(&image[28], 2) & 0x3FFF));
+            if (image.size() >= 25 && std::equal(image.begin() + 12, image.begin() + 16, "VP8L"))
+            {
+                const uint32_t bits = readLittleEndian(&image[21], 4);
+                return cv::Size(static_cast<int>((bits & 0x3FFF) + 1), static_cast<int>(((bits >> 14) & 0x3FFF) + 1));
+            }
+            if (image.size() >= 30 && std::equal(image.begin() + 12, image.begin() + 16, "VP8X"))
+                return cv::Size(static_cast<int>(readLittleEndian(&image[24], 3) + 1),
+                                static_cast<int>(readLittleEndian(&image[27], 3) + 1));
+            return std::nullopt;
+        }
+
+        /**
+         * \brief Size from the first SOF segment of JPEG (markers before it are skipped by their lengths)
+         */
+        std::optional<cv::Size> readJpegSize(const std::vector<uint8_t>& image)
+        {
+            size_t pos = 2; // after SOI
+            while (pos + 4 <= image.size())
+            {
+                if (image[pos] != 0xFF)
+                    return std::nullopt;
+                const uint8_t marker = image[pos + 1];
+                if (marker == 0xFF) // fill byte
+                {
+                    ++pos;
+                    continue;
+                }
+                if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) // markers without segment
+                {
+                    pos += 2;
+                    continue;
+                }
+                if (marker == 0xD9 || marker == 0xDA) // image data before frame header
+                    return std::nullopt;
+
+                const size_t segment_size = readBigEndian(&image[pos + 2], 2);
+                const bool is_frame_header = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+                if (is_frame_header)
+                {
+                    if (segment_size < 7 || pos + 9 > image.size())
+                        return std::nullopt;
+                    const int height = static_cast<int>(readBigEndian(&image[pos + 5], 2));
+                    const int width = static_cast<int>(readBigEndian(&image[pos + 7], 2));
+                    return cv::Size(width, height);
+                }
+                pos += 2 + segment_size;
+            }
+            return std::nullopt;
+        }
+
+        /**
+         * \brief Decode image whose size isn't known from header (e.g. TIFF) at full resolution, then downscale
+         *
+         * Pixel budget is checked after decoding, allocation of decoder is bounded by OpenCV limit
+         * (OPENCV_IO_MAX_IMAGE_PIXELS)
+         */
+        bool decodeFull(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels, bool is_color, cv::Mat& decoded)
+        {
+            if (cv::imdecode(image, is_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE, &decoded).empty())
+                return false;
+            if (max_pixels > 0 && decoded.total() > max_pixels)
+            {
+                decoded.release();
+                return false;
+            }
+            // the same resolution as reduced decoding of image with known size
+            const int scale = reducedDecodeScale(decoded.size(), target_long_side);
+            if (scale > 1)
+            {
+                const cv::Mat full = decoded;
+                cv::resize(full, decoded, cv::Size(std::max(1, full.cols / scale), std::max(1, full.rows / scale)), 0, 0, cv::INTER_AREA);
+            }
+            return true;
+        }
+
+        /**
+         * \brief Decode near target resolution, see decodeGrayscale
+         */
+        bool decodeReduced(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels, bool is_color, cv::Mat& decoded)
+        {
+            const std::optional<cv::Size> size = readImageSize(image);
+            if (!size.has_value())
+                return decodeFull(image, target_long_side, max_pixels, is_color, decoded);
+            if (size->width <= 0 || size->height <= 0)
+                return false;
+            if (max_pixels > 0 && static_cast<uint64_t>(size->width) * static_cast<uint64_t>(size->height) > max_pixels)
+                return false;
+
+            int flags = is_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+            switch (reducedDecodeScale(size.value(), target_long_side))
+            {
+            case 2:
+                flags = is_color ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_REDUCED_GRAYSCALE_2;
+                break;
+            case 4:
+                flags = is_color ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_GRAYSCALE_4;
+                break;
+            case 8:
+                flags = is_color ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_REDUCED_GRAYSCALE_8;
+                break;
+            default:
+                break;
+            }
+            // on failure imdecode returns empty matrix and can leave buffer unchanged
+            return !cv::imdecode(image, flags, &decoded).empty();
+        }
+    }
+
+    /**
+     * \brief Function for read image size from header without decoding
+     * \param[in] image Encoded image (JPEG, PNG, WebP or BMP)
+     * \return Image size or std::nullopt if format isn't one of them or header is damaged
+     */
+    std::optional<cv::Size> readImageSize(const std::vector<uint8_t>& image)
+    {
+        if (image.size() >= 4 && image[0] == 0xFF && image[1] == 0xD8)
+            return readJpegSize(image);
+
+        constexpr uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+        if (image.size() >= 24 && std::equal(png_signature, png_signature + 8, image.begin()) &&
+            std::equal(image.begin() + 12, image.begin() + 16, "IHDR"))
+        {
+            const uint32_t width = readBigEndian(&image[16], 4);
+            const uint32_t height = readBigEndian(&image[20], 4);
+            if (width > INT32_MAX || height > INT32_MAX)
+                return std::nullopt;
+            return cv::Size(static_cast<int>(width), static_cast<int>(height));
+        }
+
+        if (image.size() >= 16 && std::equal(image.begin(), image.begin() + 4, "RIFF") &&
+            std::equal(image.begin() + 8, image.begin() + 12, "WEBP"))
+            return readWebpSize(image);
+
+        if (image.size() >= 26 && image[0] == 'B' && image[1] == 'M')
+        {
+            // height is negative for top-down bitmap
+            const int32_t width = static_cast<int32_t>(readLittleEndian(&image[18], 4));
+            const int32_t height = static_cast<int32_t>(readLittleEndian(&image[22], 4));
+            if (width == INT32_MIN || height == INT32_MIN)
+                return std::nullopt;
+            return cv::Size(width, std::abs(height));
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * \brief Function for choose scale of reduced decoding (JPEG is scaled in DCT domain)
+     * \param[in] size Image size
+     * \param[in] target_long_side Desired long side of decoded image (0 means full resolution)
+     * \return The biggest of 1, 2, 4, 8 which keeps long side not less than target
+     */
+    int reducedDecodeScale(const cv::Size& size, size_t target_long_side)
+    {
+        if (target_long_side == 0)
+            return 1;
+        const size_t long_side = static_cast<size_t>(std::max(size.width, size.height));
+        int scale = 1;
+        while (scale < 8 && long_side / (2 * scale) >= target_long_side)
+            scale *= 2;
+        return scale;
+    }
+
+    /**
+     * \brief Function for decode grayscale image near target resolution
+     * \param[in] image Encoded image (any format supported by OpenCV)
+     * \param[in] target_long_side Desired long side of decoded image (0 means full resolution)
+     * \param[in] max_pixels Maximal pixels count of encoded image (0 means unlimited)
+     * \return Decoded image or empty matrix if format isn't supported or image is bigger than max_pixels
+     *
+     * Size of JPEG, PNG, WebP and BMP is read from header, so their images over budget (decompression bombs)
+     * are rejected before allocation. Other formats are decoded at full resolution and checked after decoding.
+     */
+    cv::Mat decodeGrayscale(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels)
+    {
+        cv::Mat decoded;
+        decodeGrayscale(image, target_long_side, max_pixels, decoded);
+        return decoded;
+    }
+
+    /**
+     * \brief Function for decode grayscale image near target resolution into existing buffer
+     * \param[in] image Encoded image (any format supported by OpenCV)
+     * \param[in] target_long_side Desired long side of decoded image (0 means full resolution)
+     * \param[in] max_pixels Maximal pixels count of encoded image (0 means unlimited)
+     * \param[in,out] decoded Decoded image, its memory is reused if decoded size is the same
+     * \return false if format isn't supported, image is bigger than max_pixels or damaged
+     */
+    bool decodeGrayscale(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels, cv::Mat& decoded)
+    {
+        return decodeReduced(image, target_long_side, max_pixels, false, decoded);
+    }
+
+    /**
+     * \brief Function for decode color image near target resolution (for renditions of main image)
+     * \param[in] image Encoded image (any format supported by OpenCV)
+     * \param[in] target_long_side Desired long side of decoded image (0 means full resolution)
+     * \param[in] max_pixels Maximal pixels count of encoded image (0 means unlimited)
+     * \param[out] decoded Decoded BGR image
+     * \return false if format isn't supported, image is bigger than max_pixels or damaged
+     */
+    bool decodeColor(const std::vector<uint8_t>& image, size_t target_long_side, size_t max_pixels, cv::Mat& decoded)
+    {
+        return decodeReduced(image, target_long_side, max_pixels, true, decoded);
+    }
+
+    /**
+     * \brief Function for encode downscaled copy of image
+     * \param[in] image Decoded image
+     * \param[in] long_side Maximal long side of rendition (image isn't upscaled, 0 keeps size)
+     * \param[in] is_webp If true, rendition is encoded to WebP, else to JPEG
+     * \param[in] quality Encoding quality (1-100)
+     * \param[out] encoded Encoded rendition
+     * \return true if successful
+     */
+    bool encodeRendition(const cv::Mat& image, size_t long_side, bool is_webp, int quality, std::vector<uint8_t>& encoded)
+    {
+        if (image.empty())
+            return false;
+        cv::Mat resized = image;
+        const size_t image_long_side = static_cast<size_t>(std::max(image.cols, image.rows));
+        if (long_side > 0 && image_long_side > long_side)
+        {
+            const double scale = static_cast<double>(long_side) / static_cast<double>(image_long_side);
+            const cv::Size size(std::max(1, static_cast<int>(image.cols * scale + 0.5)), std::max(1, static_cast<int>(image.rows * scale + 0.5)));
+            cv::resize(image, resized, size, 0, 0, cv::INTER_AREA);
+        }
+        const std::vector<int> params = {is_webp ? cv::IMWRITE_WEBP_QUALITY : cv::IMWRITE_JPEG_QUALITY, quality};
+        return cv::imencode(is_webp ? ".webp" : ".jpg", resized, encoded, params);
+    }
+
+}
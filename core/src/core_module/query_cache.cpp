@@ -0,0 +1,220 @@
+#include <core_module/query_cache.hpp>
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <functional>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        constexpr size_t sketch_depth = 4;
+        constexpr uint8_t sketch_max_count = 15;
+
+        uint64_t mix(uint64_t value)
+        {
+            // splitmix64 finalizer
+            value += 0x9E3779B97F4A7C15ull;
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+    }
+
+    /**
+     * \brief Function for compute 64 bits difference hash (dHash) of image
+     * \param[in] image Grayscale image (8 bits per pixel)
+     * \return Hash, bit is set if pixel of 9x8 downscaled image is brighter than its right neighbour
+     *
+     * Hash doesn't depend on resolution and compression, and small changes of exposure or framing change only a few bits
+     */
+    uint64_t differenceHash(const cv::Mat& image)
+    {
+        thread_local cv::Mat downscaled;
+        cv::resize(image, downscaled, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+        uint64_t hash = 0;
+        for (int row = 0; row < 8; ++row)
+        {
+            const uint8_t* pixels = downscaled.ptr<uint8_t>(row);
+            for (int col = 0; col < 8; ++col)
+                hash = (hash << 1) | (pixels[col] > pixels[col + 1] ? 1 : 0);
+        }
+        return hash;
+    }
+
+    /**
+     * \brief Constructor of cache
+     * \param[in] capacity Maximal count of entries
+     * \param[in] max_distance Maximal hamming distance between hashes of query and entry for hit
+     */
+    QueryCache::QueryCache(size_t capacity, size_t max_distance)
+        : entries_capacity(std::max<size_t>(capacity, 1)), max_distance(max_distance)
+    {
+        hashes.reserve(entries_capacity);
+        entries.reserve(entries_capacity);
+
+        sketch_width = 64;
+        while (sketch_width < 2 * entries_capacity)
+            sketch_width *= 2;
+        sketch.assign(sketch_depth * sketch_width, 0);
+    }
+
+    /**
+     * \brief Method for find result of query with similar image
+     * \param[in] image_hash differenceHash of query image
+     * \param[in] version Version of database content at the start of query
+     * \return The nearest entry within max_distance or std::nullopt
+     */
+    std::optional<QueryCache::Hit> QueryCache::find(uint64_t image_hash, uint64_t version)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        ++lookups_count;
+        if (!syncVersion(version))
+            return std::nullopt;
+
+        size_t best_index = hashes.size();
+        size_t best_distance = max_distance + 1;
+        for (size_t i = 0; i < hashes.size() && best_distance > 0; ++i)
+        {
+            const size_t distance = static_cast<size_t>(__builtin_popcountll(hashes[i] ^ image_hash));
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best_index = i;
+            }
+        }
+        if (best_index == hashes.size())
+            return std::nullopt;
+
+        Entry& entry = entries[best_index];
+        entry.last_used = ++tick;
+        recordAccess(entry.exhibit_key);
+        ++hits_count;
+        return Hit{entry.exhibit_id, entry.confidence};
+    }
+
+    /**
+     * \brief Method for add result of query
+     * \param[in] image_hash differenceHash of query image
+     * \param[in] exhibit_id Found exhibit
+     * \param[in] confidence Confidence of found exhibit
+     * \param[in] version Version of database content at the start of query (result of older version isn't added)
+     */
+    void QueryCache::insert(uint64_t image_hash, const std::string& exhibit_id, size_t confidence, uint64_t version)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (!syncVersion(version))
+            return;
+
+        const uint64_t exhibit_key = std::hash<std::string>{}(exhibit_id);
+        recordAccess(exhibit_key);
+
+        auto same_hash = std::find(hashes.begin(), hashes.end(), image_hash);
+        size_t index = static_cast<size_t>(same_hash - hashes.begin());
+        if (same_hash == hashes.end())
+        {
+            if (hashes.size() < entries_capacity)
+            {
+                hashes.push_back(image_hash);
+                entries.emplace_back();
+            }
+            else
+            {
+                index = static_cast<size_t>(std::min_element(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+                                                             { return a.last_used < b.last_used; }) - entries.begin());
+                if (estimateFrequency(exhibit_key) < estimateFrequency(entries[index].exhibit_key))
+                {
+                    ++rejections_count;
+                    return;
+                }
+                hashes[index] = image_hash;
+            }
+        }
+
+        Entry& entry = entries[index];
+        entry.exhibit_id = exhibit_id;
+        entry.confidence = confidence;
+        entry.exhibit_key = exhibit_key;
+        entry.last_used = ++tick;
+        ++insertions_count;
+    }
+
+    /**
+     * \brief Method for get cache counters
+     * \return Counters, hit rate is hits_count / lookups_count
+     */
+    QueryCache::Stats QueryCache::stats() const
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        Stats result;
+        result.capacity = entries_capacity;
+        result.size = entries.size();
+        result.lookups_count = lookups_count;
+        result.hits_count = hits_count;
+        result.insertions_count = insertions_count;
+        result.rejections_count = rejections_count;
+        result.invalidations_count = invalidations_count;
+        return result;
+    }
+
+    /**
+     * \brief Internal method for clear cache if database content changed (mtx must be locked)
+     * \param[in] version Version of database content seen by caller
+     * \return false if caller's version is older than cache, its results may be already deleted
+     */
+    bool QueryCache::syncVersion(uint64_t version)
+    {
+        if (version < cache_version)
+            return false;
+        if (version > cache_version)
+        {
+            if (!entries.empty())
+                ++invalidations_count;
+            hashes.clear();
+            entries.clear();
+            cache_version = version;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method for count access to exhibit in sketch (mtx must be locked)
+     * \param[in] exhibit_key Hash of exhibit id
+     *
+     * After 10 accesses per entry all counters are halved, so old popularity fades
+     */
+    void QueryCache::recordAccess(uint64_t exhibit_key)
+    {
+        for (size_t row = 0; row < sketch_depth; ++row)
+        {
+            uint8_t& counter = sketch[row * sketch_width + (mix(exhibit_key + row) & (sketch_width - 1))];
+            if (counter < sketch_max_count)
+                ++counter;
+        }
+
+        if (++sketch_additions >= 10 * entries_capacity)
+        {
+            for (uint8_t& counter : sketch)
+                counter /= 2;
+            sketch_additions /= 2;
+        }
+    }
+
+    /**
+     * \brief Internal method for estimate count of accesses to exhibit (mtx must be locked)
+     * \param[in] exhibit_key Hash of exhibit id
+     * \return Minimal counter of exhibit over sketch rows (count-min estimation, never less than real count before aging)
+     */
+    uint32_t QueryCache::estimateFrequency(uint64_t exhibit_key) const
+    {
+        uint32_t frequency = sketch_max_count;
+        for (size_t row = 0; row < sketch_depth; ++row)
+            frequency = std::min<uint32_t>(frequency, sketch[row * sketch_width + (mix(exhibit_key + row) & (sketch_width - 1))]);
+        return frequency;
+    }
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <database_module/vocabulary_tree.hpp>
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace MPG
+{
+
+    /**
+     * \brief Image level retrieval of exhibits by bag of visual words
+     *
+     * Keeps TF-IDF weighted inverted file from visual word to exhibits, query returns
+     * ordinals (see SegmentedIndex) of the most similar exhibits. Ordinals aren't changed by compaction,
+     * so index can be newer than snapshot pinned by search, which resolves them to its own rows. Similarity is
+     * histogram intersection of L1 normalized vectors (the same as DBoW2 L1 score).
+     * IDF weights are fixed at build time, exhibits added later use them too.
+     */
+    class BowIndex
+    {
+    public:
+
+        using ExhibitOrdinal = uint32_t;
+
+        bool build(const cv::Mat& descriptors, const std::vector<ExhibitOrdinal>& row_ordinals,
+                   size_t branching, size_t depth, size_t iterations);
+        void addExhibit(ExhibitOrdinal ordinal, const cv::Mat& descriptors);
+        bool removeExhibit(ExhibitOrdinal ordinal);
+        void shortlist(const cv::Mat& query, size_t max_size, std::vector<ExhibitOrdinal>& ordinals) const;
+
+        size_t exhibitsCount() const;
+        size_t wordsCount() const;
+        bool empty() const;
+
+    private:
+
+        struct Posting
+        {
+            uint32_t exhibit;
+            float weight;
+        };
+
+        struct Exhibit
+        {
+            ExhibitOrdinal ordinal;
+            std::vector<uint32_t> words;
+            bool is_removed;
+        };
+
+        void weightWords(std::vector<uint32_t>& words, std::vector<std::pair<uint32_t, float>>& weights) const;
+
+        VocabularyTree vocabulary;
+        std::vector<float> idf;
+        std::vector<std::vector<Posting>> postings;
+
+        std::vector<Exhibit> exhibits;
+        std::vector<uint32_t> free_exhibit_slots;
+        std::unordered_map<ExhibitOrdinal, uint32_t> exhibit_slots;
+    };
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <database_module/database_utils.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Change of exhibit read from changelog (mpg_keyspace.exhibit_changes)
+     */
+    struct ExhibitChange
+    {
+        CassUuid id;
+        bool is_deleted = false; // false if exhibit was added or changed
+    };
+
+    /**
+     * \brief Versions of changelog entries which are already in local database
+     *
+     * Changelog is read with clock skew margin, so the same entries are read by several polls, and own changes
+     * are in local database before they are read. Versions older than sync time are never read again and
+     * are forgotten.
+     */
+    class AppliedChanges
+    {
+    public:
+
+        bool markApplied(const CassUuid& version, int64_t version_us);
+        void forgetBefore(int64_t synced_at_us);
+        size_t size() const;
+
+    private:
+
+        mutable std::mutex mtx;
+        std::unordered_map<CassUuid, int64_t, std::hash<CassUuid>, CassUuidEqual> versions; // version to its time in us
+    };
+
+    std::vector<ExhibitChange> lastChanges(const std::vector<ExhibitChange>& changes);
+
+}
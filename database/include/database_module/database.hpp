@@ -1,10 +1,26 @@
 #pragma once
 
 #include <database_module/database_utils.hpp>
+#include <database_module/segmented_index.hpp>
+#include <database_module/bow_index.hpp>
+#include <database_module/feature_type.hpp>
+#include <database_module/exhibit_cache.hpp>
+#include <database_module/database_chunk.hpp>
+#include <database_module/changelog.hpp>
+#include <database_module/image_rendition.hpp>
+#include <database_module/geometric_verifier.hpp>
+#include <database_module/snapshot_file.hpp>
+#include <database_module/shard_protocol.hpp>
 #include <config.hpp>
 #include <logger.hpp>
 #include <cassandra.h>
+#include <array>
+#include <chrono>
+#include <atomic>
 #include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
 
 /**
 * \brief Namespace for MPG classes and functions
@@ -25,12 +41,10 @@ protected:
     using StatementPtr = std::unique_ptr <CassStatement, CassStatementDeleter>;
     using IteratorPtr = std::unique_ptr <CassIterator, CassIteratorDeleter>;
     using IdGeneratorPtr = std::unique_ptr <CassUuidGen, CassUuidGenDeleter>;
+    using PreparedPtr = std::unique_ptr <const CassPrepared, CassPreparedDeleter>;
 
     using QueryResultPtr = QueryResultHandler; 
 
-    using MatcherPtr = cv::Ptr<cv::DescriptorMatcher>;
-
-
 public:
 
     DatabaseModule();
@@ -39,11 +53,24 @@ public:
     virtual ~DatabaseModule();
 
     virtual bool init();
-
-    virtual std::optional<DatabaseResponse> getExhibit(const cv::Mat& description);
+    void stop();
+    FeatureType featureType() const;
+    uint64_t changesVersion() const;
+    ExhibitCache::Stats exhibitCacheStats() const;
+
+    virtual std::optional<DatabaseResponse> getExhibit(const cv::Mat& description,
+                                                       const std::vector<cv::Point2f>& keypoints = std::vector<cv::Point2f>(),
+                                                       std::chrono::milliseconds time_budget = std::chrono::milliseconds(0),
+                                                       ImageRendition rendition = ImageRendition::Full);
+    virtual std::optional<DatabaseResponse> getExhibitById(const std::string& exhibit_id, size_t confidence,
+                                                           ImageRendition rendition = ImageRendition::Full);
+    virtual ExhibitCache::Payload getExhibitPayload(const std::string& exhibit_id, ImageRendition rendition);
     virtual bool addExhibit(const DatabaseRequest& exhibit_data);
     virtual bool deleteExhibit(const std::string& exhibit_idid);
-    virtual std::optional<DatabaseChunk> getDatabaseChunk(const std::string& next_chunk_token);
+    virtual std::optional<DatabaseChunk> getDatabaseChunk(const std::string& next_chunk_token,
+                                                          const ChunkFields& fields = ChunkFields());
+    virtual std::optional<DatabaseChunk> visitDatabaseChunk(const std::string& next_chunk_token, const ChunkFields& fields,
+                                                            const ExhibitRowVisitor& visitor);
 
 
 protected:
@@ -51,7 +78,11 @@ protected:
     virtual bool ConnectToDatabase(size_t max_retries = 10, size_t retry_delay_ms = 5000);
     virtual bool loadDatabase();
 
-    virtual std::optional<CassUuid> findExhibitUuid(const cv::Mat& description);
+    virtual std::optional<CassUuid> findExhibitUuid(const cv::Mat& description, const std::vector<cv::Point2f>& keypoints,
+                                                    std::chrono::steady_clock::time_point deadline, size_t& confidence);
+    bool searchCandidates(const cv::Mat& exhibit_descriptor, const std::vector<cv::Point2f>& exhibit_keypoints,
+                          std::chrono::steady_clock::time_point deadline, std::vector<ExhibitCandidate>& candidates);
+    const ExhibitCandidate* selectCandidate(const std::vector<ExhibitCandidate>& candidates) const;
 
 
     ClusterPtr cluster_ptr;
@@ -59,30 +90,112 @@ protected:
     IdGeneratorPtr id_generator_ptr;
 
 
-    cv::Mat local_database_descriptor;
-    std::vector<CassUuid> local_descriptor_to_id_map;
+    std::unique_ptr<SegmentedIndex> local_database;
+    std::shared_ptr<SearchPool> search_pool;
+    std::unique_ptr<BowIndex> bow_index;
 
     std::shared_ptr<Config> config;
     std::shared_ptr<Logger> logger;
 
 private:
 
+    /**
+     * \brief Decoded rows of one token range of exhibits table
+     */
+    struct TokenRangeRows
+    {
+        std::vector<uint8_t> descriptors;
+        std::vector<cv::Point2f> keypoints; // NaN if exhibit has no keypoints
+        std::vector<std::pair<CassUuid, RowRange>> exhibits; // rows relative to range
+    };
+
+    /**
+     * \brief Columns of exhibit row, data points into cassandra result
+     */
+    struct ExhibitRow
+    {
+        CassUuid id;
+        const cass_byte_t* descriptor_data = nullptr;
+        const cass_byte_t* keypoints_data = nullptr; // nullptr if exhibit has no keypoints
+        int rows_count = 0;
+    };
+
+    bool initFeatureType();
+    bool prepareStatements();
+    bool loadFullDatabase();
+    bool loadTokenRange(int64_t first_token, int64_t last_token, TokenRangeRows& rows);
+    bool readExhibitRow(const CassRow* row, ExhibitRow& exhibit);
     bool loadDatabaseHelper(const CassRow* row);
+    bool unloadExhibit(const CassUuid& id);
+    bool loadSnapshot();
+    bool catchUpDatabase();
+    bool loadExhibits(const std::vector<CassUuid>& ids);
+    bool saveSnapshot();
+
+    bool writeChange(const CassUuid& id, bool is_deleted);
+    bool applyChangelog();
+    void changelogLoop();
 
     static void logCallback(const CassLogMessage* message, void* data);
 
     void logError(CassError err, const std::string& context);
+    std::optional<DatabaseResponse> fetchExhibit(const CassUuid& exhibit_id, size_t confidence, ImageRendition rendition);
+    std::optional<DatabaseResponse> readExhibit(const CassUuid& exhibit_id, ImageRendition rendition);
+    std::optional<bool> isExhibitStored(const CassUuid& exhibit_id);
+    StatementPtr exhibitPayloadStatement(ImageRendition rendition, const CassUuid& exhibit_id);
+    std::optional<DatabaseResponse> readExhibitPayload(const CassRow* row, const CassUuid& exhibit_id);
+    void prefetchExhibitCache();
+    void saveHotExhibits();
     std::optional<DatabaseResponse> getExhibitHelper(const CassRow* row);
-    std::optional<DatabaseResponse> getDatabaseChunkHelper(const CassRow* row);
-
-    bool initMatchersPool();
-    PooledMatcher getMatcher();
-    void returnMatcher(PooledMatcher matcher);
-
-    std::shared_ptr<MatcherPool> matchers_pool;
-    std::mutex matchers_pool_switch_mtx;
-
-    std::mutex local_database_mtx;
+    bool getDatabaseChunkHelper(const CassRow* row, const ChunkFields& fields, char (&id_str)[CASS_UUID_STRING_LENGTH],
+                                ExhibitRowView& exhibit);
+
+    bool initDescriptorIndex();
+    bool initBowIndex();
+    bool shortlistExhibits(const cv::Mat& exhibit_descriptor, std::vector<SegmentedIndex::ExhibitOrdinal>& shortlist);
+    bool knnSearchShortlist(const SegmentedIndex::Snapshot& snapshot, const std::vector<SegmentedIndex::ExhibitOrdinal>& shortlist,
+                            const cv::Mat& exhibit_descriptor, size_t k, std::vector<HammingMatch>& knn_matches);
+    void verifyCandidates(const SegmentedIndex::Snapshot& snapshot, const std::vector<cv::Point2f>& exhibit_keypoints,
+                          const std::vector<HammingMatch>& knn_matches, size_t k,
+                          const std::vector<SegmentedIndex::ExhibitOrdinal>& ordinals, std::vector<ExhibitCandidate>& candidates);
+
+    bool initShards();
+    bool isShardExhibit(const CassUuid& id) const;
+
+    bool compactLocalDatabase();
+    void compactionLoop();
+    void requestCompaction();
+
+    FeatureType feature_type = FeatureType::ORB; // stored in keyspace settings, set by init
+    int descriptor_bytes = FeatureTraits<FeatureType::ORB>::descriptor_bytes;
+
+    std::mutex local_database_mtx; // serializes writers, readers use snapshots
+    std::shared_mutex bow_mtx;
+
+    std::thread compaction_thread;
+    std::mutex compaction_mtx;
+    std::condition_variable compaction_cv;
+    bool is_compaction_requested = false;
+    bool is_compaction_stopped = false; // set by stop(), wakes compaction thread
+
+    std::mutex stop_mtx;
+    std::condition_variable stop_cv; // wakes connection retries and changelog polling
+    bool is_stopped = false;
+
+    std::atomic<int64_t> synced_at_us{0}; // changes of exhibits table written before this time are in local database
+    std::atomic<bool> is_snapshot_dirty{false};
+    std::atomic<uint64_t> changes_version{0}; // incremented after every add or delete applied to local database
+
+    std::array<PreparedPtr, image_renditions_count> get_exhibit_prepared; // selects of exhibit payload by id, nullptr if preparing failed
+    std::unique_ptr<ExhibitCache> exhibit_cache; // nullptr if exhibit_cache_bytes is 0
+    std::unique_ptr<ChunkPageSizer> chunk_page_sizer;
+    std::chrono::steady_clock::time_point snapshot_saved_at;
+
+    std::thread changelog_thread;
+    AppliedChanges applied_changes; // changes read or written after synced_at_us - clock skew, they aren't applied again
+
+    std::unique_ptr<ShardServer> shard_server;               // answers queries of front process
+    std::vector<std::unique_ptr<ShardClient>> shard_clients; // other shards, queried by this process
 
 };
 
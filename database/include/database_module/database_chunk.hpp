@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace MPG
+{
+
+    /**
+     * \brief Columns of exhibits returned in database chunk (id is always returned)
+     */
+    struct ChunkFields
+    {
+        bool title = true;
+        bool description = true;
+        bool image = true;
+    };
+
+    /**
+     * \brief Exhibit row of database chunk, fields point into Cassandra result and are valid only in visitor call
+     */
+    struct ExhibitRowView
+    {
+        std::string_view exhibit_id;
+        std::string_view exhibit_name;        // empty if title isn't selected
+        std::string_view exhibit_description; // empty if description isn't selected
+        const uint8_t* exhibit_image = nullptr; // nullptr if image isn't selected
+        size_t exhibit_image_size = 0;
+
+        size_t bytes() const
+        {
+            return exhibit_id.size() + exhibit_name.size() + exhibit_description.size() + exhibit_image_size;
+        }
+    };
+
+    using ExhibitRowVisitor = std::function<void(const ExhibitRowView&)>;
+
+    std::optional<ChunkFields> chunkFieldsFromNames(const std::string& names);
+    std::string chunkSelectQuery(const ChunkFields& fields);
+
+    /**
+     * \brief Chooser of database chunk page size by byte budget
+     *
+     * Cassandra pages by rows and paging token exists only at page boundaries, so rows count of the next page
+     * is budget divided by average size of rows of previous pages. Rows with and without image are estimated
+     * separately, since they differ by orders of magnitude. Until the first page is read fixed rows count is used.
+     */
+    class ChunkPageSizer
+    {
+    public:
+
+        ChunkPageSizer(size_t budget_bytes, size_t fixed_rows, size_t max_rows);
+
+        size_t pageRows(bool has_image) const;
+        void record(bool has_image, size_t rows_count, size_t bytes);
+
+    private:
+
+        size_t budget_bytes; // 0 means fixed rows count
+        size_t fixed_rows;
+        size_t max_rows;
+        std::array<std::atomic<size_t>, 2> row_bytes; // estimate for rows without and with image, 0 if unknown
+    };
+
+}
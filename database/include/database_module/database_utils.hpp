@@ -9,6 +9,7 @@
 #include <condition_variable>
 #include <queue>
 #include <memory>
+#include <limits>
 
 namespace MPG
 {
@@ -44,6 +45,14 @@ namespace MPG
         }
     };
 
+    struct CassPreparedDeleter
+    {
+        void operator()(const CassPrepared *ptr) const
+        {
+            cass_prepared_free(ptr);
+        }
+    };
+
     struct CassIteratorDeleter
     {
         void operator()(CassIterator *ptr) const
@@ -89,6 +98,7 @@ namespace MPG
         std::string exhibit_name;
         std::string exhibit_description;
         std::vector<uint8_t> exhibit_image;
+        std::string exhibit_image_etag; // computed when payload is read from database
         size_t percentage_of_confidance;
     };
 
@@ -97,27 +107,47 @@ namespace MPG
         std::string exhibit_title;
         std::string exhibit_description;
         std::vector<uint8_t> exhibit_image;
+        std::vector<uint8_t> exhibit_thumbnail_image; // empty if rendition isn't generated, full image is returned instead
+        std::vector<uint8_t> exhibit_mobile_image;
         cv::Mat exhibit_descriptor;
+        std::vector<cv::Point2f> exhibit_keypoints; // keypoint of every descriptor row (in descriptor image)
     };
 
-    struct DatabaseChunk
+    struct RowRange
     {
-        std::vector<DatabaseResponse> exhibits;
-        std::string next_chunk_token;
-        bool is_last_chunk;
+        int first_row;
+        int rows_count;
     };
 
-    struct MatcherPool
+    /**
+     * \brief Inclusive range of Murmur3 tokens (token(id) of exhibits table)
+     */
+    struct TokenRange
     {
-        std::mutex mtx;
-        std::condition_variable cv;
-        std::queue<cv::Ptr<cv::DescriptorMatcher>> pool;
+        int64_t first_token;
+        int64_t last_token;
     };
 
-    struct PooledMatcher
+    /**
+     * \brief Function for split token ring into equal ranges without gaps and overlaps
+     * \param[in] range Index of range (less than ranges_count)
+     * \param[in] ranges_count Count of ranges
+     * \return Range, the first one starts at minimal token and the last one ends at maximal token
+     */
+    inline TokenRange tokenRange(size_t range, size_t ranges_count)
+    {
+        const uint64_t step = std::numeric_limits<uint64_t>::max() / ranges_count;
+        const uint64_t first_token = static_cast<uint64_t>(std::numeric_limits<int64_t>::min()) + range * step;
+        const uint64_t last_token = range + 1 == ranges_count ? static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) :
+                                    first_token + step - 1;
+        return {static_cast<int64_t>(first_token), static_cast<int64_t>(last_token)};
+    }
+
+    struct DatabaseChunk
     {
-        cv::Ptr<cv::DescriptorMatcher> matcher;
-        std::shared_ptr<MatcherPool> origin_pool_ptr;
+        std::vector<DatabaseResponse> exhibits;
+        std::string next_chunk_token;
+        bool is_last_chunk;
     };
 
 }
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <database_module/hamming_matcher.hpp>
+#include <database_module/search_pool.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MPG
+{
+
+    struct Config;
+
+    /**
+     * \brief Interface of k nearest neighbours index over local database descriptors
+     *
+     * Index doesn't copy descriptors, it keeps cv::Mat header (so data must not be changed while index is used).
+     * Search methods are const and can be called from many threads at the same time.
+     */
+    class DescriptorIndex
+    {
+    public:
+
+        virtual ~DescriptorIndex() = default;
+
+        virtual bool build(const cv::Mat& descriptors) = 0;
+        virtual bool knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const = 0;
+        virtual size_t size() const = 0;
+        virtual std::string name() const = 0;
+    };
+
+    /**
+     * \brief Exact index which compares query with every database descriptor (see hammingKnnMatch)
+     *
+     * With search pool database is split into shards of shard_rows, which are searched in parallel
+     * and per shard neighbours are merged (result is the same as single thread search).
+     */
+    class BruteForceIndex : public DescriptorIndex
+    {
+    public:
+
+        BruteForceIndex() = default;
+        BruteForceIndex(const std::shared_ptr<SearchPool>& pool, size_t shard_rows);
+
+        bool build(const cv::Mat& descriptors) override;
+        bool knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const override;
+        size_t size() const override;
+        std::string name() const override;
+
+    private:
+
+        cv::Mat database_descriptors;
+        std::shared_ptr<SearchPool> search_pool;
+        size_t shard_rows = 0;
+    };
+
+    std::unique_ptr<DescriptorIndex> createDescriptorIndex(const Config& conf,
+                                                           const std::shared_ptr<SearchPool>& search_pool = nullptr);
+
+}
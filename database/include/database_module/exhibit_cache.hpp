@@ -0,0 +1,120 @@
+#pragma once
+
+#include <database_module/database_utils.hpp>
+#include <database_module/image_rendition.hpp>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief LRU cache of exhibit payloads (image rendition, title, description) bounded by size in bytes
+     *
+     * Exhibit is admitted only on its second miss since doorkeeper reset (one-off exhibits don't evict popular ones)
+     * and if its payload is not bigger than 1/8 of capacity. Readers get shared payload without copy under lock.
+     * Every erase increments generation, payload read before it isn't inserted, so deleted or changed exhibit
+     * can't return to cache by racing read.
+     */
+    class ExhibitCache
+    {
+    public:
+
+        using Payload = std::shared_ptr<const DatabaseResponse>;
+
+        /**
+         * \brief Cache counters
+         */
+        struct Stats
+        {
+            size_t capacity_bytes = 0;
+            size_t size_bytes = 0;
+            size_t entries_count = 0;
+            uint64_t hits_count = 0;
+            uint64_t misses_count = 0;
+            uint64_t insertions_count = 0;
+            uint64_t rejections_count = 0;   // payloads not admitted (the first miss or too big)
+            uint64_t evictions_count = 0;
+            uint64_t invalidations_count = 0; // erased cached exhibits (deleted or changed)
+        };
+
+        explicit ExhibitCache(size_t capacity_bytes);
+
+        ExhibitCache(const ExhibitCache&) = delete;
+        ExhibitCache& operator=(const ExhibitCache&) = delete;
+
+        Payload find(const CassUuid& id, ImageRendition rendition);
+        uint64_t generation() const;
+        bool insert(const CassUuid& id, ImageRendition rendition, const DatabaseResponse& payload, uint64_t read_generation,
+                    bool is_forced = false);
+        bool insert(const CassUuid& id, ImageRendition rendition, const Payload& payload, uint64_t read_generation,
+                    bool is_forced = false);
+        void erase(const CassUuid& id);
+        std::vector<CassUuid> hottest(size_t count) const;
+        Stats stats() const;
+
+        static size_t payloadBytes(const DatabaseResponse& payload);
+
+    private:
+
+        /**
+         * \brief Every rendition of exhibit is cached separately
+         */
+        struct Key
+        {
+            CassUuid id;
+            ImageRendition rendition;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const noexcept
+            {
+                return std::hash<CassUuid>{}(key.id) * image_renditions_count + static_cast<size_t>(key.rendition);
+            }
+        };
+
+        struct KeyEqual
+        {
+            bool operator()(const Key& lhs, const Key& rhs) const
+            {
+                return CassUuidEqual{}(lhs.id, rhs.id) && lhs.rendition == rhs.rendition;
+            }
+        };
+
+        struct Entry
+        {
+            Key key;
+            Payload payload;
+            size_t bytes = 0;
+            uint64_t hits_count = 0;
+        };
+
+        bool isAdmitted(const Key& key, size_t bytes, uint64_t read_generation, bool is_forced);
+        void store(const Key& key, Payload payload, size_t bytes);
+        void evict(size_t required_bytes);
+
+        size_t capacity_bytes;
+        size_t size_bytes = 0;
+
+        mutable std::mutex mtx;
+        std::list<Entry> lru; // the most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash, KeyEqual> entries;
+        std::unordered_set<Key, KeyHash, KeyEqual> doorkeeper; // missed once since reset
+        uint64_t erase_generation = 0;
+
+        uint64_t hits_count = 0;
+        uint64_t misses_count = 0;
+        uint64_t insertions_count = 0;
+        uint64_t rejections_count = 0;
+        uint64_t evictions_count = 0;
+        uint64_t invalidations_count = 0;
+    };
+
+}
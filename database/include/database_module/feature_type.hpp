@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+namespace MPG
+{
+
+    /**
+     * \brief Binary feature detectors which can be used for exhibits (one per keyspace)
+     */
+    enum class FeatureType
+    {
+        ORB,
+        BRISK,
+        AKAZE // MLDB descriptor of full size
+    };
+
+    /**
+     * \brief Compile-time properties of feature type, descriptor width selects specialized hamming kernels
+     */
+    template<FeatureType Type>
+    struct FeatureTraits;
+
+    template<>
+    struct FeatureTraits<FeatureType::ORB>
+    {
+        static constexpr size_t descriptor_bytes = 32;
+    };
+
+    template<>
+    struct FeatureTraits<FeatureType::BRISK>
+    {
+        static constexpr size_t descriptor_bytes = 64;
+    };
+
+    template<>
+    struct FeatureTraits<FeatureType::AKAZE>
+    {
+        static constexpr size_t descriptor_bytes = 61; // 486 bits
+    };
+
+    std::optional<FeatureType> featureTypeFromName(const std::string& name);
+    const char* featureTypeName(FeatureType type);
+    size_t featureDescriptorBytes(FeatureType type);
+
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Point correspondences between query image and one candidate exhibit
+     */
+    struct PointCorrespondences
+    {
+        std::vector<cv::Point2f> query_points;
+        std::vector<cv::Point2f> train_points;
+    };
+
+    size_t countHomographyInliers(const PointCorrespondences& correspondences, double reprojection_error);
+
+}
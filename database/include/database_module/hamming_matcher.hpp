@@ -0,0 +1,311 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MPG_HAMMING_X86 1
+#include <immintrin.h>
+#endif
+
+namespace MPG
+{
+
+    /**
+     * \brief One neighbour found by hamming matcher (flat analogue of cv::DMatch)
+     *
+     * train_idx is -1 if train set has less rows than requested k
+     */
+    struct HammingMatch
+    {
+        int train_idx;
+        int distance;
+    };
+
+    /**
+     * \brief Popcount implementations available for hamming matcher
+     */
+    enum class HammingKernel
+    {
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    HammingKernel bestHammingKernel();
+    std::vector<HammingKernel> supportedHammingKernels();
+    const char* hammingKernelName(HammingKernel kernel);
+
+    bool hammingKnnMatch(const cv::Mat& query, const cv::Mat& train, size_t k, std::vector<HammingMatch>& matches);
+    bool hammingKnnMatch(HammingKernel kernel, const cv::Mat& query, const cv::Mat& train, size_t k,
+                         std::vector<HammingMatch>& matches);
+
+    void resetKnnMatches(std::vector<HammingMatch>& matches, size_t query_rows, size_t k);
+    void mergeKnnMatches(std::vector<HammingMatch>& matches, const std::vector<HammingMatch>& part_matches,
+                         size_t k, int part_first_row);
+
+    namespace hamming_detail
+    {
+        constexpr size_t train_block_rows = 4096; // 128 KB of ORB rows, stays in L2 while all queries scan it
+
+        inline uint64_t load64(const uint8_t* ptr)
+        {
+            uint64_t value;
+            std::memcpy(&value, ptr, sizeof(value));
+            return value;
+        }
+
+        /**
+         * \brief Insert candidate to sorted top-k list
+         *
+         * Equal distances keep train order, it is the same rule as in cv::batchDistance,
+         * so results are bit-exact with cv::BFMatcher
+         */
+        template<size_t K>
+        inline void pushCandidate(HammingMatch* top, int train_idx, int distance)
+        {
+            if (distance >= top[K - 1].distance)
+                return;
+            size_t pos = K - 1;
+            while (pos > 0 && top[pos - 1].distance > distance)
+            {
+                top[pos] = top[pos - 1];
+                --pos;
+            }
+            top[pos] = {train_idx, distance};
+        }
+
+        template<size_t Bytes>
+        inline int tailDistance(const uint8_t* a, const uint8_t* b, size_t from)
+        {
+            int distance = 0;
+            size_t i = from;
+            for (; i + 8 <= Bytes; i += 8)
+                distance += __builtin_popcountll(load64(a + i) ^ load64(b + i));
+            for (; i < Bytes; ++i)
+                distance += __builtin_popcount(static_cast<unsigned>(a[i] ^ b[i]));
+            return distance;
+        }
+
+        template<size_t Bytes>
+        inline int distanceScalar(const uint8_t* a, const uint8_t* b)
+        {
+            return tailDistance<Bytes>(a, b, 0);
+        }
+
+        template<size_t Bytes, size_t K>
+        void scanScalar(const uint8_t* query, size_t query_rows, size_t query_step,
+                        const uint8_t* train, size_t train_begin, size_t train_end, size_t train_step,
+                        HammingMatch* out)
+        {
+            for (size_t q = 0; q < query_rows; ++q)
+            {
+                const uint8_t* query_row = query + q * query_step;
+                HammingMatch* top = out + q * K;
+                for (size_t t = train_begin; t < train_end; ++t)
+                    pushCandidate<K>(top, static_cast<int>(t), distanceScalar<Bytes>(query_row, train + t * train_step));
+            }
+        }
+
+        template<size_t Bytes>
+        void rowsDistancesScalar(const uint8_t* query, const uint8_t* train, size_t train_step,
+                                 const uint32_t* rows, size_t count, int* distances)
+        {
+            for (size_t i = 0; i < count; ++i)
+                distances[i] = distanceScalar<Bytes>(query, train + rows[i] * train_step);
+        }
+
+#ifdef MPG_HAMMING_X86
+
+        __attribute__((target("avx2,popcnt")))
+        inline __m256i popcountBytesAVX2(__m256i v)
+        {
+            const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i low_mask = _mm256_set1_epi8(0x0f);
+            __m256i low = _mm256_and_si256(v, low_mask);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            return _mm256_add_epi8(_mm256_shuffle_epi8(lut, low), _mm256_shuffle_epi8(lut, high));
+        }
+
+        __attribute__((target("avx2,popcnt")))
+        inline int horizontalSumAVX2(__m256i v)
+        {
+            __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            return static_cast<int>(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+        }
+
+        template<size_t Bytes>
+        __attribute__((target("avx2,popcnt")))
+        inline int distanceAVX2(const uint8_t* a, const uint8_t* b)
+        {
+            constexpr size_t blocks = Bytes / 32;
+            static_assert(blocks < 32, "per-byte popcount accumulator would overflow");
+            int distance = 0;
+            if constexpr (blocks > 0)
+            {
+                __m256i acc = _mm256_setzero_si256();
+                for (size_t i = 0; i < blocks; ++i)
+                {
+                    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i * 32));
+                    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i * 32));
+                    acc = _mm256_add_epi8(acc, popcountBytesAVX2(_mm256_xor_si256(va, vb)));
+                }
+                distance = horizontalSumAVX2(_mm256_sad_epu8(acc, _mm256_setzero_si256()));
+            }
+            return distance + tailDistance<Bytes>(a, b, blocks * 32);
+        }
+
+        template<size_t Bytes, size_t K>
+        __attribute__((target("avx2,popcnt")))
+        void scanAVX2(const uint8_t* query, size_t query_rows, size_t query_step,
+                      const uint8_t* train, size_t train_begin, size_t train_end, size_t train_step,
+                      HammingMatch* out)
+        {
+            for (size_t q = 0; q < query_rows; ++q)
+            {
+                const uint8_t* query_row = query + q * query_step;
+                HammingMatch* top = out + q * K;
+                for (size_t t = train_begin; t < train_end; ++t)
+                    pushCandidate<K>(top, static_cast<int>(t), distanceAVX2<Bytes>(query_row, train + t * train_step));
+            }
+        }
+
+        template<size_t Bytes>
+        __attribute__((target("avx2,popcnt")))
+        void rowsDistancesAVX2(const uint8_t* query, const uint8_t* train, size_t train_step,
+                               const uint32_t* rows, size_t count, int* distances)
+        {
+            for (size_t i = 0; i < count; ++i)
+                distances[i] = distanceAVX2<Bytes>(query, train + rows[i] * train_step);
+        }
+
+        template<size_t Bytes>
+        __attribute__((target("avx512f,avx512vl,avx512vpopcntdq,avx2,popcnt")))
+        inline int distanceAVX512(const uint8_t* a, const uint8_t* b)
+        {
+            constexpr size_t blocks = Bytes / 32;
+            int distance = 0;
+            if constexpr (blocks > 0)
+            {
+                __m256i acc = _mm256_setzero_si256();
+                for (size_t i = 0; i < blocks; ++i)
+                {
+                    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i * 32));
+                    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i * 32));
+                    acc = _mm256_add_epi64(acc, _mm256_popcnt_epi64(_mm256_xor_si256(va, vb)));
+                }
+                __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+                distance = static_cast<int>(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+            }
+            return distance + tailDistance<Bytes>(a, b, blocks * 32);
+        }
+
+        template<size_t Bytes, size_t K>
+        __attribute__((target("avx512f,avx512vl,avx512vpopcntdq,avx2,popcnt")))
+        void scanAVX512(const uint8_t* query, size_t query_rows, size_t query_step,
+                        const uint8_t* train, size_t train_begin, size_t train_end, size_t train_step,
+                        HammingMatch* out)
+        {
+            for (size_t q = 0; q < query_rows; ++q)
+            {
+                const uint8_t* query_row = query + q * query_step;
+                HammingMatch* top = out + q * K;
+                for (size_t t = train_begin; t < train_end; ++t)
+                    pushCandidate<K>(top, static_cast<int>(t), distanceAVX512<Bytes>(query_row, train + t * train_step));
+            }
+        }
+
+        template<size_t Bytes>
+        __attribute__((target("avx512f,avx512vl,avx512vpopcntdq,avx2,popcnt")))
+        void rowsDistancesAVX512(const uint8_t* query, const uint8_t* train, size_t train_step,
+                                 const uint32_t* rows, size_t count, int* distances)
+        {
+            for (size_t i = 0; i < count; ++i)
+                distances[i] = distanceAVX512<Bytes>(query, train + rows[i] * train_step);
+        }
+
+#endif
+
+    }
+
+    /**
+     * \brief Brute force hamming k nearest neighbours search, specialized by descriptor length and k
+     * \param[in] kernel Popcount implementation (must be supported by CPU, see supportedHammingKernels)
+     * \param[in] query Pointer to first query descriptor
+     * \param[in] query_rows Count of query descriptors
+     * \param[in] query_step Distance in bytes between query rows
+     * \param[in] train Pointer to first train descriptor
+     * \param[in] train_rows Count of train descriptors
+     * \param[in] train_step Distance in bytes between train rows
+     * \param[out] out Flat buffer with query_rows * K elements, neighbours of query i are out[i * K .. i * K + K)
+     *
+     * Train rows are scanned by blocks, so one block is reused from cache by all query rows
+     */
+    template<size_t Bytes, size_t K>
+    void hammingKnnMatch(HammingKernel kernel,
+                         const uint8_t* query, size_t query_rows, size_t query_step,
+                         const uint8_t* train, size_t train_rows, size_t train_step,
+                         HammingMatch* out)
+    {
+        static_assert(K > 0, "k must be positive");
+
+        for (size_t i = 0; i < query_rows * K; ++i)
+            out[i] = {-1, INT_MAX};
+
+        for (size_t begin = 0; begin < train_rows; begin += hamming_detail::train_block_rows)
+        {
+            const size_t end = std::min(train_rows, begin + hamming_detail::train_block_rows);
+            switch (kernel)
+            {
+#ifdef MPG_HAMMING_X86
+            case HammingKernel::AVX512:
+                hamming_detail::scanAVX512<Bytes, K>(query, query_rows, query_step, train, begin, end, train_step, out);
+                break;
+            case HammingKernel::AVX2:
+                hamming_detail::scanAVX2<Bytes, K>(query, query_rows, query_step, train, begin, end, train_step, out);
+                break;
+#endif
+            default:
+                hamming_detail::scanScalar<Bytes, K>(query, query_rows, query_step, train, begin, end, train_step, out);
+                break;
+            }
+        }
+    }
+
+    /**
+     * \brief Hamming distances from one query descriptor to listed train rows (for index candidates verification)
+     * \param[in] kernel Popcount implementation (must be supported by CPU, see supportedHammingKernels)
+     * \param[in] query Pointer to query descriptor
+     * \param[in] train Pointer to first train descriptor
+     * \param[in] train_step Distance in bytes between train rows
+     * \param[in] rows Indices of train rows
+     * \param[in] count Count of indices
+     * \param[out] distances Buffer for count distances
+     */
+    template<size_t Bytes>
+    void hammingDistances(HammingKernel kernel, const uint8_t* query, const uint8_t* train, size_t train_step,
+                          const uint32_t* rows, size_t count, int* distances)
+    {
+        switch (kernel)
+        {
+#ifdef MPG_HAMMING_X86
+        case HammingKernel::AVX512:
+            hamming_detail::rowsDistancesAVX512<Bytes>(query, train, train_step, rows, count, distances);
+            break;
+        case HammingKernel::AVX2:
+            hamming_detail::rowsDistancesAVX2<Bytes>(query, train, train_step, rows, count, distances);
+            break;
+#endif
+        default:
+            hamming_detail::rowsDistancesScalar<Bytes>(query, train, train_step, rows, count, distances);
+            break;
+        }
+    }
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <database_module/descriptor_index.hpp>
+#include <database_module/feature_type.hpp>
+
+#include <cstdint>
+#include <random>
+#include <utility>
+
+namespace MPG
+{
+
+    /**
+     * \brief Approximate hamming index based on hierarchical navigable small world graph (Malkov & Yashunin)
+     *
+     * Rows can be inserted incrementally (add), but segments of SegmentedIndex are immutable after publish,
+     * so graph is built once for sealed segment and new exhibits go to brute force tail.
+     * Quality/speed trade-off is set by M, efConstruction and efSearch (see config).
+     */
+    class HnswIndex : public DescriptorIndex
+    {
+    public:
+
+        static constexpr size_t descriptor_bytes = FeatureTraits<FeatureType::ORB>::descriptor_bytes;
+        static constexpr size_t max_levels = 16;
+
+        HnswIndex(size_t m, size_t ef_construction, size_t ef_search);
+
+        bool build(const cv::Mat& descriptors) override;
+        bool add(const cv::Mat& descriptors, int first_row);
+        bool knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const override;
+        size_t size() const override;
+        std::string name() const override;
+
+    private:
+
+        using Candidate = std::pair<int, uint32_t>; // (distance, row)
+
+        void insert(uint32_t row);
+        void greedySearch(const uint8_t* query, Candidate& entry, size_t level) const;
+        void searchLayer(const uint8_t* query, const std::vector<Candidate>& entries, size_t ef, size_t level,
+                         std::vector<Candidate>& nearest) const;
+        void selectNeighbours(std::vector<Candidate>& candidates, size_t max_count) const;
+        void connect(uint32_t row, uint32_t neighbour, size_t level);
+
+        uint32_t* links(uint32_t row, size_t level);
+        const uint32_t* links(uint32_t row, size_t level) const;
+        size_t maxLinks(size_t level) const;
+        const uint8_t* descriptor(uint32_t row) const;
+        int distance(const uint8_t* query, uint32_t row) const;
+
+        size_t max_links;
+        size_t max_links_level0;
+        size_t ef_construction;
+        size_t ef_search;
+        double level_multiplier;
+
+        cv::Mat database_descriptors;
+        size_t rows_count = 0;
+
+        std::vector<uint8_t> levels;
+        std::vector<uint32_t> links_level0;             // (max_links_level0 + 1) per row: count, neighbours
+        std::vector<std::vector<uint32_t>> links_upper; // (max_links + 1) per upper level of row
+
+        uint32_t entry_point = 0;
+        size_t top_level = 0;
+        std::mt19937 level_generator;
+    };
+
+}
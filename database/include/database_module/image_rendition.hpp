@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Stored sizes of exhibit main image, renditions are generated at ingest
+     */
+    enum class ImageRendition
+    {
+        Thumbnail,
+        Mobile,
+        Full // image as uploaded
+    };
+
+    constexpr size_t image_renditions_count = 3;
+
+    std::optional<ImageRendition> imageRenditionFromName(const std::string& name);
+    const char* imageRenditionName(ImageRendition rendition);
+    const char* imageRenditionColumn(ImageRendition rendition);
+    std::string imageETag(const std::vector<uint8_t>& image);
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <database_module/descriptor_index.hpp>
+#include <database_module/feature_type.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+namespace MPG
+{
+
+    /**
+     * \brief Exact hamming index based on multi-index hashing (Norouzi et al.)
+     *
+     * Every 256-bit ORB code is split into 16 substrings of 16 bits, each substring has own
+     * direct-addressed hash table (CSR buckets). Query probes buckets of growing hamming radius
+     * and stops when nothing closer than found k-th neighbour can be left (pigeonhole principle).
+     * Results are the same as brute force (ties are resolved by smaller row index).
+     */
+    class MihIndex : public DescriptorIndex
+    {
+    public:
+
+        static constexpr size_t descriptor_bytes = FeatureTraits<FeatureType::ORB>::descriptor_bytes;
+        static constexpr size_t substring_bits = 16;
+        static constexpr size_t substrings_count = descriptor_bytes * 8 / substring_bits;
+        static constexpr size_t buckets_count = size_t(1) << substring_bits;
+        static constexpr size_t random_access_cost = 8; // bucket probe or candidate check vs one row of linear scan
+
+        bool build(const cv::Mat& descriptors) override;
+        bool knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const override;
+        size_t size() const override;
+        std::string name() const override;
+
+        uint64_t distanceComputations() const;
+        uint64_t bruteForceFallbacks() const;
+
+    private:
+
+        template<size_t K>
+        void searchOne(const uint8_t* query, size_t k, HammingMatch* top) const;
+        void scanAll(const uint8_t* query, size_t k, HammingMatch* top) const;
+
+        cv::Mat database_descriptors;
+
+        std::vector<uint32_t> bucket_offsets; // substrings_count * (buckets_count + 1)
+        std::vector<uint32_t> bucket_rows;    // substrings_count * rows
+
+        mutable std::atomic<uint64_t> distance_computations{0};
+        mutable std::atomic<uint64_t> brute_force_fallbacks{0};
+    };
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Epoch based reclamation for RcuPointer (one domain per process)
+     *
+     * Reader pins current global epoch in its own slot while it uses published values.
+     * Value retired at epoch E can be deleted when no reader is pinned at epoch <= E.
+     */
+    class EpochDomain
+    {
+    public:
+
+        static constexpr size_t max_readers = 1024;
+
+        static EpochDomain& instance();
+
+        void enter();
+        void leave();
+        uint64_t advance();
+        bool isReclaimable(uint64_t retire_epoch) const;
+
+    private:
+
+        struct alignas(64) ReaderSlot
+        {
+            std::atomic<uint64_t> epoch{0}; // 0 means reader is not pinned
+            std::atomic<bool> is_used{false};
+        };
+
+        struct ThreadReader
+        {
+            ReaderSlot* slot = nullptr;
+            size_t nesting = 0;
+            ~ThreadReader();
+        };
+
+        EpochDomain() = default;
+        static ThreadReader& threadReader();
+        ReaderSlot* claimSlot();
+
+        std::atomic<uint64_t> global_epoch{1};
+        std::atomic<size_t> slots_count{0}; // slots after this one were never used
+        ReaderSlot slots[max_readers];
+    };
+
+    /**
+     * \brief Pointer to immutable value, which readers use without locks (read-copy-update)
+     *
+     * Writer publishes new value atomically (writers must be serialized by caller), old value is deleted
+     * when all readers which could see it have left (see EpochDomain).
+     */
+    template <typename T>
+    class RcuPointer
+    {
+    public:
+
+        /**
+         * \brief Pinned value, it isn't deleted while guard exists
+         */
+        class ReadGuard
+        {
+        public:
+
+            explicit ReadGuard(const RcuPointer& pointer)
+            {
+                EpochDomain::instance().enter();
+                value = pointer.current.load();
+            }
+
+            ~ReadGuard()
+            {
+                EpochDomain::instance().leave();
+            }
+
+            ReadGuard(const ReadGuard&) = delete;
+            ReadGuard& operator=(const ReadGuard&) = delete;
+
+            const T* operator->() const { return value; }
+            const T& operator*() const { return *value; }
+            const T* get() const { return value; }
+
+        private:
+
+            const T* value;
+        };
+
+        explicit RcuPointer(std::unique_ptr<const T> value) : current(value.release())
+        {
+        }
+
+        ~RcuPointer()
+        {
+            delete current.load();
+            for (auto& [retire_epoch, value] : retired)
+                delete value;
+        }
+
+        RcuPointer(const RcuPointer&) = delete;
+        RcuPointer& operator=(const RcuPointer&) = delete;
+
+        ReadGuard read() const
+        {
+            return ReadGuard(*this);
+        }
+
+        /**
+         * \brief Current value for writer (writers are serialized, so it can't be replaced while used)
+         */
+        const T& writerValue() const
+        {
+            return *current.load();
+        }
+
+        void publish(std::unique_ptr<const T> value)
+        {
+            const T* old_value = current.exchange(value.release());
+            retired.push_back({EpochDomain::instance().advance(), old_value});
+            reclaim();
+        }
+
+        /**
+         * \brief Method for delete retired values which can't be used by readers any more
+         * \return Count of values which are still retired
+         */
+        size_t reclaim()
+        {
+            EpochDomain& domain = EpochDomain::instance();
+            size_t kept = 0;
+            for (auto& [retire_epoch, value] : retired)
+            {
+                if (domain.isReclaimable(retire_epoch))
+                    delete value;
+                else
+                    retired[kept++] = {retire_epoch, value};
+            }
+            retired.resize(kept);
+            return kept;
+        }
+
+    private:
+
+        std::atomic<const T*> current;
+        std::vector<std::pair<uint64_t, const T*>> retired;
+    };
+
+}
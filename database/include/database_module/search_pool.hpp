@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Worker pool shared by searches, which splits one query into tasks (database shards)
+     *
+     * Caller thread always takes part in its search, workers only help. Count of helpers of one query
+     * depends on count of queries in flight: at low load one query uses all workers, at high load
+     * every query is searched by its own thread only (no splitting overhead).
+     * Running query doesn't allocate: job lives on caller stack and task isn't copied.
+     */
+    class SearchPool
+    {
+    public:
+
+        /**
+         * \brief RAII registration of query in flight
+         */
+        class QueryScope
+        {
+        public:
+
+            explicit QueryScope(SearchPool& pool);
+            ~QueryScope();
+
+            QueryScope(const QueryScope&) = delete;
+            QueryScope& operator=(const QueryScope&) = delete;
+
+            size_t parallelism() const;
+
+        private:
+
+            SearchPool& search_pool;
+            size_t queries_in_flight;
+        };
+
+        explicit SearchPool(size_t threads_count);
+        ~SearchPool();
+
+        SearchPool(const SearchPool&) = delete;
+        SearchPool& operator=(const SearchPool&) = delete;
+
+        /**
+         * \brief Method for run tasks on caller thread and up to participants - 1 workers
+         * \param[in] tasks_count Count of tasks
+         * \param[in] participants Max count of threads (caller included)
+         * \param[in] task Function (task index, participant index), participant index is less than participants
+         *
+         * Returns when all tasks are done. If workers are busy, caller does all tasks itself.
+         */
+        template <typename Task>
+        void run(size_t tasks_count, size_t participants, const Task& task)
+        {
+            runJob(tasks_count, participants, &task, [](const void* context, size_t task_idx, size_t participant)
+            {
+                (*static_cast<const Task*>(context))(task_idx, participant);
+            });
+        }
+
+        size_t threadsCount() const;
+        size_t queriesInFlight() const;
+
+    private:
+
+        using TaskInvoker = void (*)(const void* context, size_t task_idx, size_t participant);
+
+        struct Job
+        {
+            const void* context;
+            TaskInvoker invoke;
+            size_t tasks_count;
+            std::atomic<size_t> next_task{0};
+            std::atomic<size_t> next_participant{1}; // participant 0 is caller
+            size_t active_helpers = 0;               // workers which took job from queue, guarded by pool mtx
+            std::condition_variable cv;              // waits on pool mtx for active_helpers == 0
+        };
+
+        void runJob(size_t tasks_count, size_t participants, const void* context, TaskInvoker invoke);
+        static void work(Job& job, size_t participant);
+        void workerLoop();
+
+        std::vector<std::thread> workers;
+        std::vector<Job*> jobs; // one entry per requested helper, entries before first_job are taken
+        size_t first_job = 0;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool is_stopped = false;
+
+        std::atomic<size_t> queries_count{0};
+    };
+
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <database_module/database_utils.hpp>
+#include <database_module/descriptor_index.hpp>
+#include <database_module/feature_type.hpp>
+#include <database_module/rcu_pointer.hpp>
+
+#include <functional>
+#include <unordered_map>
+
+namespace MPG
+{
+
+    /**
+     * \brief Local database of descriptors split into append-only segments (LSM tree like)
+     *
+     * New exhibits are appended to small mutable tail (searched by brute force), full tail is sealed.
+     * Deleted exhibits are only marked in deletion bitmap of their segment (tombstones).
+     * Background compaction rewrites sealed segments without deleted rows, merges small ones
+     * and builds index of configured type for them. So add and delete cost O(exhibit descriptors).
+     *
+     * Readers search immutable snapshot of segments without locks (see RcuPointer), every change
+     * publishes new snapshot, which shares unchanged segments with previous one. Rows of all segments
+     * are numbered one after another, rows are renumbered only by compaction.
+     * Exhibits are numbered by dense ordinals in order of addition, rows store ordinals instead of ids
+     * (ordinals of deleted exhibits aren't reused, old snapshots can still refer to them).
+     * Writer methods must be serialized by caller.
+     */
+    class SegmentedIndex
+    {
+    public:
+
+        using ExhibitOrdinal = uint32_t;
+
+        /**
+         * \brief Segment of snapshot, it isn't changed after publish
+         *
+         * Tail segments of different snapshots share buffers (descriptors_buffer, keypoints_buffer, row_ordinals, deleted_rows),
+         * new rows are written after rows of published segments, so readers never see them.
+         */
+        struct Segment
+        {
+            cv::Mat descriptors;                                // rows of segment
+            cv::Mat descriptors_buffer;                         // tail only, descriptors are its first rows
+            cv::Mat keypoints;                                  // CV_32FC2, point of every row (NaN if unknown)
+            cv::Mat keypoints_buffer;                           // tail only, keypoints are its first rows
+            std::shared_ptr<std::vector<ExhibitOrdinal>> row_ordinals; // at least descriptors.rows
+            std::shared_ptr<std::vector<uint8_t>> deleted_rows; // at least descriptors.rows
+            std::vector<RowRange> live_ranges;                  // rows without tombstones, sorted
+            size_t deleted_count = 0;
+            std::shared_ptr<const DescriptorIndex> index;
+            bool is_bruteforce = true;
+            bool is_sealed = false;
+            bool is_indexed = false; // index of configured type is built
+            int first_row = 0;
+            std::shared_ptr<const void> storage; // owner of external descriptors and keypoints memory (mapped file)
+        };
+
+        /**
+         * \brief Immutable state of index used by readers
+         */
+        class Snapshot
+        {
+        public:
+
+            bool knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const;
+            ExhibitOrdinal rowOrdinal(int row) const;
+            const CassUuid& ordinalExhibit(ExhibitOrdinal ordinal) const;
+            const CassUuid& rowExhibit(int row) const;
+            cv::Point2f rowKeypoint(int row) const;
+            bool ordinalRows(ExhibitOrdinal ordinal, RowRange& rows) const;
+            bool rangeDescriptors(const RowRange& rows, cv::Mat& descriptors) const;
+            void exportLiveRows(cv::Mat& descriptors, std::vector<ExhibitOrdinal>& row_ordinals) const;
+
+            using LiveRangeVisitor = std::function<void(const cv::Mat& descriptors, const cv::Mat& keypoints,
+                                                        const ExhibitOrdinal* row_ordinals)>;
+            void visitLiveRanges(const LiveRangeVisitor& visitor) const;
+
+            size_t rowsCount() const;
+            size_t liveRowsCount() const;
+            size_t segmentsCount() const;
+            size_t ordinalsCount() const;
+            size_t descriptorBytes() const;
+
+        private:
+
+            friend class SegmentedIndex;
+
+            /**
+             * \brief Part of search run by one pool task: shard of brute force rows or whole indexed segment
+             */
+            struct SearchTask
+            {
+                const Segment* segment;
+                RowRange rows; // live rows of brute force segment, whole segment if is_scan is false
+                bool is_scan;
+            };
+
+            const Segment& segmentOfRow(int row) const;
+            bool searchTask(const SearchTask& task, const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const;
+            bool searchSegment(const Segment& segment, const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const;
+
+            std::vector<std::shared_ptr<const Segment>> segments; // the last one is tail
+            std::shared_ptr<std::vector<CassUuid>> ordinal_ids;    // shared like tail buffers, at least ordinals_count
+            size_t ordinals_count = 0;
+            int descriptor_bytes = 0;
+            std::shared_ptr<SearchPool> search_pool; // may be nullptr
+            size_t shard_rows = 1;                   // brute force rows of one task
+        };
+
+        using SnapshotGuard = RcuPointer<Snapshot>::ReadGuard;
+
+        /**
+         * \brief Rewrite of sequence of sealed segments into one
+         */
+        struct Compaction
+        {
+            size_t first_segment = 0;
+            std::vector<std::shared_ptr<const Segment>> sources;
+            std::shared_ptr<Segment> result;
+        };
+
+        /**
+         * \brief Exhibits over external memory loaded as sealed segments (see loadSealed)
+         */
+        struct SealedPart
+        {
+            cv::Mat descriptors;                                 // CV_8UC1
+            cv::Mat keypoints;                                   // CV_32FC2, one column
+            std::vector<std::pair<CassUuid, RowRange>> exhibits; // rows in part, sorted, without gaps
+            std::shared_ptr<const void> storage;                 // owner of descriptors and keypoints memory
+        };
+
+        using ExhibitOrdinals = std::unordered_map<CassUuid, ExhibitOrdinal, std::hash<CassUuid>, CassUuidEqual>;
+
+        SegmentedIndex(const Config& conf, const std::shared_ptr<SearchPool>& search_pool,
+                       size_t descriptor_bytes = FeatureTraits<FeatureType::ORB>::descriptor_bytes);
+
+        SnapshotGuard snapshot() const;
+
+        RowRange addExhibit(const CassUuid& id, const cv::Mat& descriptors,
+                            const std::vector<cv::Point2f>& keypoints = std::vector<cv::Point2f>());
+        bool loadSealed(const cv::Mat& descriptors, const cv::Mat& keypoints,
+                        const std::vector<std::pair<CassUuid, RowRange>>& exhibits, const std::shared_ptr<const void>& storage);
+        bool loadSealed(const std::vector<SealedPart>& parts);
+        bool removeExhibit(const CassUuid& id);
+        bool contains(const CassUuid& id) const;
+        const ExhibitOrdinals& exhibitOrdinals() const;
+        RowRange exhibitRows(ExhibitOrdinal ordinal) const;
+
+        bool prepareCompaction(Compaction& compaction) const;
+        bool buildCompaction(Compaction& compaction) const;
+        bool applyCompaction(Compaction& compaction);
+        size_t reclaim();
+
+        std::string indexName() const;
+
+    private:
+
+        std::shared_ptr<Segment> newTail(int first_row, size_t capacity) const;
+        bool needsCompaction(const Segment& segment) const;
+
+        RcuPointer<Snapshot> snapshots;
+        ExhibitOrdinals exhibit_ordinals;   // live exhibits only
+        std::vector<RowRange> ordinal_rows; // first_row is -1 for deleted exhibits
+
+        std::string index_type;
+        size_t segment_rows;
+        float compaction_deleted_ratio;
+        int descriptor_bytes;
+        std::shared_ptr<const Config> index_config;
+    };
+
+}
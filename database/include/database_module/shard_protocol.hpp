@@ -0,0 +1,163 @@
+#pragma once
+
+#include <database_module/database_utils.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+namespace MPG
+{
+
+    /**
+     * \brief Exhibit voted by query descriptors of one shard
+     */
+    struct ExhibitCandidate
+    {
+        CassUuid id;
+        uint32_t votes = 0;
+        uint32_t processed_rows = 0; // query rows searched by shard, votes are counted over them
+        uint32_t inliers = 0;        // homography inliers, valid only if is_verifiable
+        bool is_verifiable = false;  // exhibit has keypoints and query was verified
+    };
+
+    /**
+     * \brief Query of shard: descriptors sorted from the strongest keypoint and their keypoints
+     */
+    struct ShardQuery
+    {
+        cv::Mat descriptors;
+        std::vector<cv::Point2f> keypoints; // empty or one for every descriptor row
+        uint32_t time_budget_ms = 0;        // 0 means unlimited
+    };
+
+    size_t exhibitShard(const CassUuid& id, size_t shards_count);
+
+    bool encodeShardQuery(const ShardQuery& query, std::vector<uint8_t>& payload);
+    bool decodeShardQuery(const std::vector<uint8_t>& payload, ShardQuery& query);
+    void encodeShardResult(const std::vector<ExhibitCandidate>& candidates, std::vector<uint8_t>& payload);
+    bool decodeShardResult(const std::vector<uint8_t>& payload, std::vector<ExhibitCandidate>& candidates);
+
+    /**
+     * \brief TCP server of shard protocol, every connection is served by own thread
+     *
+     * Count of connections (and threads) is limited, connections above limit are closed at accept.
+     * Frame is 4 bytes magic, 4 bytes payload size and payload (little endian, shards run on one architecture).
+     * Connection can carry any count of query/result frames one after another.
+     */
+    class ShardServer
+    {
+    public:
+
+        using Handler = std::function<std::vector<ExhibitCandidate>(const ShardQuery& query)>;
+
+        ShardServer() = default;
+        ~ShardServer();
+
+        ShardServer(const ShardServer&) = delete;
+        ShardServer& operator=(const ShardServer&) = delete;
+
+        bool start(const std::string& address, uint16_t port, Handler query_handler, size_t max_connections);
+        void stop();
+        uint16_t port() const;
+        uint64_t rejectedConnections() const;
+
+    private:
+
+        struct Connection
+        {
+            int fd = -1;
+            std::thread thread;
+            std::atomic<bool> is_finished{false};
+        };
+
+        void acceptLoop();
+        void serveConnection(Connection& connection);
+
+        Handler handler;
+        int listen_fd = -1;
+        uint16_t listen_port = 0;
+        size_t connections_limit = 1;
+        std::atomic<uint64_t> rejected_connections{0};
+        std::atomic<bool> is_stopped{false};
+        std::thread accept_thread;
+        std::mutex connections_mtx;
+        std::list<std::unique_ptr<Connection>> connections; // finished ones are joined on next accept
+    };
+
+    /**
+     * \brief Client of one shard, keeps idle connections for next queries
+     */
+    class ShardClient
+    {
+    public:
+
+        ShardClient(const std::string& endpoint);
+        ~ShardClient();
+
+        ShardClient(const ShardClient&) = delete;
+        ShardClient& operator=(const ShardClient&) = delete;
+
+        bool query(const ShardQuery& shard_query, std::chrono::steady_clock::time_point deadline,
+                   std::vector<ExhibitCandidate>& candidates);
+        const std::string& endpoint() const;
+
+    private:
+
+        friend class ShardFanout;
+
+        int acquire(std::chrono::steady_clock::time_point deadline, bool& is_reused);
+        void release(int fd);
+        int connect(std::chrono::steady_clock::time_point deadline);
+
+        std::string shard_endpoint;
+        std::string host;
+        std::string port;
+        std::mutex idle_mtx;
+        std::vector<int> idle_fds;
+    };
+
+    /**
+     * \brief Query of several shards served by calling thread
+     *
+     * Query is sent to all shards, then caller searches its own part and their results are read by one poll
+     * loop over shard connections, so no thread is started per query. Object can be reused by next queries.
+     */
+    class ShardFanout
+    {
+    public:
+
+        void send(const std::vector<std::unique_ptr<ShardClient>>& clients, const ShardQuery& shard_query,
+                  std::chrono::steady_clock::time_point deadline);
+        void receive(std::vector<ExhibitCandidate>& candidates, std::vector<const ShardClient*>& failed_shards);
+
+    private:
+
+        struct PendingQuery
+        {
+            ShardClient* client = nullptr;
+            int fd = -1;
+            bool is_reused = false; // idle connection can be closed by restarted shard, then query is sent again
+        };
+
+        bool sendTo(ShardClient* client, bool is_idle_allowed);
+
+        std::chrono::steady_clock::time_point query_deadline;
+        std::vector<uint8_t> query_payload; // kept for queries sent again
+        std::vector<uint8_t> result_payload;
+        std::vector<PendingQuery> pending;
+        std::vector<pollfd> poll_fds;
+        std::vector<ExhibitCandidate> shard_candidates;
+        std::vector<const ShardClient*> unsent_shards; // failed before receive
+    };
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <database_module/segmented_index.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace MPG
+{
+
+    /**
+     * \brief Binary snapshot of local database for fast start (mapped to memory on load)
+     *
+     * Layout: header, exhibits table (id and rows of every exhibit), descriptors (padded to 8 bytes), keypoints.
+     * Rows of exhibits go one after another without gaps. Checksum covers everything after header.
+     */
+    class SnapshotFile
+    {
+    public:
+
+        static constexpr uint32_t version = 1;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t descriptor_bytes;
+            uint64_t exhibits_count;
+            uint64_t rows_count;
+            int64_t synced_at_us; // database changes written after this time aren't in snapshot
+            uint64_t checksum;
+        };
+
+        struct Exhibit
+        {
+            cass_uint64_t time_and_version;
+            cass_uint64_t clock_seq_and_node;
+            int32_t first_row;
+            int32_t rows_count;
+        };
+
+        SnapshotFile() = default;
+        ~SnapshotFile();
+
+        SnapshotFile(const SnapshotFile&) = delete;
+        SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+        static bool write(const std::string& path, const SegmentedIndex::Snapshot& snapshot, int64_t synced_at_us);
+
+        bool open(const std::string& path, size_t descriptor_bytes = FeatureTraits<FeatureType::ORB>::descriptor_bytes);
+
+        int64_t syncedAt() const;
+        std::vector<std::pair<CassUuid, RowRange>> exhibits() const;
+        cv::Mat descriptors() const;
+        cv::Mat keypoints() const;
+
+    private:
+
+        void close();
+
+        uint8_t* data = nullptr;
+        size_t size = 0;
+        const Header* header = nullptr;
+    };
+
+}
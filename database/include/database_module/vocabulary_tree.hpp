@@ -0,0 +1,51 @@
+#pragma once
+
+#include <database_module/feature_type.hpp>
+#include <database_module/hamming_matcher.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Hierarchical vocabulary of binary visual words (Nister & Stewenius tree, DBoW2 style)
+     *
+     * Every level is clustered by k-majority (k-means where centroid is bitwise majority of cluster),
+     * leaves of tree are visual words. Works with 32 bytes ORB descriptors.
+     */
+    class VocabularyTree
+    {
+    public:
+
+        static constexpr size_t descriptor_bytes = FeatureTraits<FeatureType::ORB>::descriptor_bytes;
+        static constexpr size_t max_training_descriptors = 200000;
+
+        bool train(const cv::Mat& descriptors, size_t branching_factor, size_t tree_depth, size_t max_iterations);
+        uint32_t quantize(const uint8_t* descriptor) const;
+        size_t wordsCount() const;
+        bool empty() const;
+
+    private:
+
+        struct Node
+        {
+            uint32_t first_child;
+            uint32_t children_count;
+            uint32_t word;
+        };
+
+        void trainNode(uint32_t node, std::vector<uint8_t>& rows, std::vector<uint8_t>& buffer,
+                       size_t begin, size_t end, size_t level);
+
+        std::vector<Node> nodes;
+        std::vector<uint8_t> centers; // descriptor_bytes per node, children of node are stored one after another
+        size_t words_count = 0;
+
+        size_t branching = 0;
+        size_t depth = 0;
+        size_t iterations = 0;
+    };
+
+}
@@ -0,0 +1,245 @@
+#include "database_module/bow_index.hpp"
+
+#include <cmath>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        struct BowScratch
+        {
+            std::vector<uint32_t> words;
+            std::vector<std::pair<uint32_t, float>> weights;
+            std::vector<float> scores;
+            std::vector<uint32_t> touched;
+        };
+
+        thread_local BowScratch bow_scratch;
+    }
+
+    /**
+     * \brief Method for train vocabulary and fill inverted file with all exhibits of local database
+     * \param[in] descriptors Local database descriptors (CV_8UC1, 32 bytes per row)
+     * \param[in] row_ordinals Exhibit ordinal of every descriptor row (rows of one exhibit go one after another)
+     * \param[in] branching Count of children of every vocabulary tree node
+     * \param[in] depth Count of vocabulary tree levels
+     * \param[in] iterations Limit of k-majority iterations for one node
+     * \return true if successful
+     */
+    bool BowIndex::build(const cv::Mat& descriptors, const std::vector<ExhibitOrdinal>& row_ordinals,
+                         size_t branching, size_t depth, size_t iterations)
+    {
+        idf.clear();
+        postings.clear();
+        exhibits.clear();
+        free_exhibit_slots.clear();
+        exhibit_slots.clear();
+
+        if (static_cast<size_t>(descriptors.rows) != row_ordinals.size() ||
+            !vocabulary.train(descriptors, branching, depth, iterations))
+        {
+            return false;
+        }
+
+        std::vector<std::vector<uint32_t>> exhibits_words;
+        for (size_t row = 0; row < row_ordinals.size(); ++row)
+        {
+            if (row == 0 || row_ordinals[row] != row_ordinals[row - 1])
+            {
+                exhibits.push_back({row_ordinals[row], {}, false});
+                exhibits_words.emplace_back();
+            }
+            exhibits_words.back().push_back(vocabulary.quantize(descriptors.ptr<uint8_t>(static_cast<int>(row))));
+        }
+
+        std::vector<uint32_t> document_frequency(vocabulary.wordsCount(), 0);
+        for (auto& words : exhibits_words)
+        {
+            std::sort(words.begin(), words.end());
+            for (size_t i = 0; i < words.size(); ++i)
+            {
+                if (i == 0 || words[i] != words[i - 1])
+                    ++document_frequency[words[i]];
+            }
+        }
+
+        const float exhibits_count = static_cast<float>(exhibits.size());
+        idf.resize(vocabulary.wordsCount());
+        for (size_t word = 0; word < idf.size(); ++word)
+            idf[word] = std::log(1.f + exhibits_count / std::max<uint32_t>(document_frequency[word], 1));
+
+        postings.resize(vocabulary.wordsCount());
+        std::vector<std::pair<uint32_t, float>> weights;
+        for (uint32_t slot = 0; slot < exhibits.size(); ++slot)
+        {
+            weightWords(exhibits_words[slot], weights);
+            for (const auto& [word, weight] : weights)
+            {
+                postings[word].push_back({slot, weight});
+                exhibits[slot].words.push_back(word);
+            }
+            exhibit_slots[exhibits[slot].ordinal] = slot;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method for get L1 normalized TF-IDF vector from words of image
+     * \param[in,out] words Visual words of all image descriptors (are sorted in place)
+     * \param[out] weights Pairs (word, weight) for unique words
+     */
+    void BowIndex::weightWords(std::vector<uint32_t>& words, std::vector<std::pair<uint32_t, float>>& weights) const
+    {
+        weights.clear();
+        std::sort(words.begin(), words.end());
+        float total_weight = 0.f;
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            if (i > 0 && words[i] == words[i - 1])
+                weights.back().second += idf[words[i]];
+            else
+                weights.push_back({words[i], idf[words[i]]});
+            total_weight += idf[words[i]];
+        }
+        if (total_weight > 0.f)
+        {
+            for (auto& weight : weights)
+                weight.second /= total_weight;
+        }
+    }
+
+    /**
+     * \brief Method for add new exhibit to inverted file (vocabulary must be built)
+     * \param[in] ordinal Exhibit ordinal in local database
+     * \param[in] descriptors Exhibit descriptors
+     */
+    void BowIndex::addExhibit(ExhibitOrdinal ordinal, const cv::Mat& descriptors)
+    {
+        if (vocabulary.empty())
+            return;
+
+        std::vector<uint32_t>& words = bow_scratch.words;
+        words.clear();
+        for (int row = 0; row < descriptors.rows; ++row)
+            words.push_back(vocabulary.quantize(descriptors.ptr<uint8_t>(row)));
+
+        uint32_t slot;
+        if (!free_exhibit_slots.empty())
+        {
+            slot = free_exhibit_slots.back();
+            free_exhibit_slots.pop_back();
+            exhibits[slot] = {ordinal, {}, false};
+        }
+        else
+        {
+            slot = static_cast<uint32_t>(exhibits.size());
+            exhibits.push_back({ordinal, {}, false});
+        }
+
+        std::vector<std::pair<uint32_t, float>>& weights = bow_scratch.weights;
+        weightWords(words, weights);
+        for (const auto& [word, weight] : weights)
+        {
+            postings[word].push_back({slot, weight});
+            exhibits[slot].words.push_back(word);
+        }
+        exhibit_slots[ordinal] = slot;
+    }
+
+    /**
+     * \brief Method for remove exhibit from inverted file
+     * \param[in] ordinal Exhibit ordinal
+     * \return true if exhibit was found
+     */
+    bool BowIndex::removeExhibit(ExhibitOrdinal ordinal)
+    {
+        auto slot_it = exhibit_slots.find(ordinal);
+        if (slot_it == exhibit_slots.end())
+            return false;
+
+        const uint32_t slot = slot_it->second;
+        Exhibit& removed = exhibits[slot];
+        for (uint32_t word : removed.words)
+        {
+            std::vector<Posting>& word_postings = postings[word];
+            for (size_t i = 0; i < word_postings.size(); ++i)
+            {
+                if (word_postings[i].exhibit == slot)
+                {
+                    word_postings[i] = word_postings.back();
+                    word_postings.pop_back();
+                    break;
+                }
+            }
+        }
+        removed.words.clear();
+        removed.is_removed = true;
+
+        free_exhibit_slots.push_back(slot);
+        exhibit_slots.erase(slot_it);
+        return true;
+    }
+
+    /**
+     * \brief Method for get the most similar exhibits for query image
+     * \param[in] query Query image descriptors
+     * \param[in] max_size Max count of exhibits in shortlist
+     * \param[out] ordinals Ordinals of shortlisted exhibits (sorted, so their rows go in order of local database)
+     */
+    void BowIndex::shortlist(const cv::Mat& query, size_t max_size, std::vector<ExhibitOrdinal>& ordinals) const
+    {
+        ordinals.clear();
+        if (vocabulary.empty() || query.empty())
+            return;
+
+        BowScratch& scratch = bow_scratch;
+        scratch.words.clear();
+        for (int row = 0; row < query.rows; ++row)
+            scratch.words.push_back(vocabulary.quantize(query.ptr<uint8_t>(row)));
+        weightWords(scratch.words, scratch.weights);
+
+        if (scratch.scores.size() < exhibits.size())
+            scratch.scores.resize(exhibits.size(), 0.f);
+        scratch.touched.clear();
+        for (const auto& [word, query_weight] : scratch.weights)
+        {
+            for (const Posting& posting : postings[word])
+            {
+                if (scratch.scores[posting.exhibit] == 0.f)
+                    scratch.touched.push_back(posting.exhibit);
+                scratch.scores[posting.exhibit] += std::min(query_weight, posting.weight);
+            }
+        }
+
+        const size_t shortlist_size = std::min(max_size, scratch.touched.size());
+        auto better = [&scratch](uint32_t a, uint32_t b)
+        {
+            return scratch.scores[a] > scratch.scores[b] || (scratch.scores[a] == scratch.scores[b] && a < b);
+        };
+        std::nth_element(scratch.touched.begin(), scratch.touched.begin() + shortlist_size, scratch.touched.end(), better);
+        for (size_t i = 0; i < shortlist_size; ++i)
+            ordinals.push_back(exhibits[scratch.touched[i]].ordinal);
+        std::sort(ordinals.begin(), ordinals.end());
+
+        for (uint32_t slot : scratch.touched)
+            scratch.scores[slot] = 0.f;
+    }
+
+    size_t BowIndex::exhibitsCount() const
+    {
+        return exhibit_slots.size();
+    }
+
+    size_t BowIndex::wordsCount() const
+    {
+        return vocabulary.wordsCount();
+    }
+
+    bool BowIndex::empty() const
+    {
+        return vocabulary.empty();
+    }
+
+}
@@ -0,0 +1,59 @@
+#include "database_module/changelog.hpp"
+
+#include <unordered_set>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Method for register version of change as applied
+     * \param[in] version Time uuid of change
+     * \param[in] version_us Time of change in us (forgetBefore compares it)
+     * \return true if version wasn't applied before, so change must be applied now
+     */
+    bool AppliedChanges::markApplied(const CassUuid& version, int64_t version_us)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        return versions.emplace(version, version_us).second;
+    }
+
+    /**
+     * \brief Method for forget versions which are never read again
+     * \param[in] synced_at_us Time of sync, changelog is read from it by the next poll
+     */
+    void AppliedChanges::forgetBefore(int64_t synced_at_us)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        for (auto it = versions.begin(); it != versions.end();)
+            it = it->second < synced_at_us ? versions.erase(it) : std::next(it);
+    }
+
+    /**
+     * \brief Method for get count of remembered versions
+     * \return Count of versions
+     */
+    size_t AppliedChanges::size() const
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        return versions.size();
+    }
+
+    /**
+     * \brief Function for reduce changes to the last change of every exhibit
+     * \param[in] changes Changes in version order
+     * \return Last changes, the latest first
+     */
+    std::vector<ExhibitChange> lastChanges(const std::vector<ExhibitChange>& changes)
+    {
+        std::unordered_set<CassUuid, std::hash<CassUuid>, CassUuidEqual> changed_ids;
+        std::vector<ExhibitChange> last_changes;
+        for (auto change_it = changes.rbegin(); change_it != changes.rend(); ++change_it)
+        {
+            if (changed_ids.insert(change_it->id).second)
+                last_changes.push_back(*change_it); // earlier changes of the same exhibit are overwritten
+        }
+        return last_changes;
+    }
+
+}
@@ -1,6 +1,10 @@
 #include "database_module/database.hpp"
-#include <iostream>
 #include <thread>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unordered_set>
 
 #include <opencv2/imgcodecs.hpp>
 
@@ -8,6 +12,32 @@
 namespace MPG
 {
 
+    namespace
+    {
+        // writetime of cassandra rows is set by clients, so their clocks can differ from ours
+        constexpr int64_t clock_skew_us = 60 * 1000 * 1000;
+        constexpr int catch_up_page_size = 5000;
+        constexpr size_t catch_up_window = 64; // concurrent queries for changed exhibits
+        constexpr size_t token_ranges_per_thread = 4;
+        constexpr int64_t changelog_bucket_us = int64_t(3600) * 1000 * 1000; // changelog partition per hour
+
+        /**
+         * \brief Select of exhibit payload with image of rendition in "image" column
+         */
+        std::string exhibitPayloadQuery(ImageRendition rendition)
+        {
+            if (rendition == ImageRendition::Full)
+                return "select image, title, description from mpg_keyspace.exhibits where id=?";
+            return std::string("select ") + imageRenditionColumn(rendition) + " as image, title, description from mpg_keyspace.exhibits where id=?";
+        }
+
+        int64_t currentTimeUs()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+    }
+
     /**
      * \brief Constructor of database class object
      * \param[in] conf Smart pointer to configuration of project
@@ -26,6 +56,10 @@ namespace MPG
         id_generator_ptr.reset(cass_uuid_gen_new());
         cass_cluster_set_contact_points(cluster_ptr.get(), config->database_host.c_str());
         cass_log_set_callback(DatabaseModule::logCallback, static_cast<void*>(logger.get()));
+        if (config->exhibit_cache_bytes > 0)
+            exhibit_cache = std::make_unique<ExhibitCache>(config->exhibit_cache_bytes);
+        chunk_page_sizer = std::make_unique<ChunkPageSizer>(config->database_chunk_bytes, config->database_chunk_size,
+                                                            config->database_chunk_max_rows);
         logger->LogInfo("Database module created");
     }
 
@@ -41,18 +75,199 @@ namespace MPG
             return false;
         }
 
+        if (!initFeatureType())
+        {
+            logger->LogCritical("Error init feature type\n");
+            return false;
+        }
+
+        if (!prepareStatements())
+            logger->LogWarning("DatabaseModule: statements aren't prepared, unprepared queries are used");
+
+        // search_threads = 0 means all cores (caller thread is one of them)
+        const size_t search_threads = config->search_threads > 0 ? config->search_threads :
+                                      std::max<size_t>(std::thread::hardware_concurrency(), 1) - 1;
+        if (!search_pool && search_threads > 0)
+            search_pool = std::make_shared<SearchPool>(search_threads);
+
+        {
+            std::lock_guard<std::mutex> lg(stop_mtx);
+            if (is_stopped)
+                return false;
+        }
+
         if (!loadDatabase())
         {
             logger->LogCritical("Error load local database\n");
             return false;
         }
 
-        if (!initMatchersPool())
+        if (!initDescriptorIndex())
         {
-            logger->LogCritical("Error init matchers pool\n");
+            logger->LogCritical("Error init descriptor index\n");
             return false;
         }
-        logger->LogInfo("Database module initialized");
+
+        if (config->bow_enabled && !initBowIndex())
+        {
+            logger->LogCritical("Error init bag of words index\n");
+            return false;
+        }
+
+        {
+            // threads aren't started after stop(), so destructor joins all started ones
+            std::lock_guard<std::mutex> lg(stop_mtx);
+            if (is_stopped)
+                return false;
+            if (!compaction_thread.joinable())
+                compaction_thread = std::thread(&DatabaseModule::compactionLoop, this);
+            if (!changelog_thread.joinable() && config->changelog_poll_ms > 0)
+                changelog_thread = std::thread(&DatabaseModule::changelogLoop, this);
+        }
+
+        if (!initShards())
+        {
+            logger->LogCritical("Error init shards\n");
+            return false;
+        }
+        prefetchExhibitCache();
+        logger->LogInfo(std::string("Database module initialized, hamming kernel: ") + hammingKernelName(bestHammingKernel()));
+        return true;
+    }
+
+    /**
+     * \brief Method for get feature type of keyspace
+     * \return Feature type which must be used for descriptors of added exhibits and queries (valid after init)
+     */
+    FeatureType DatabaseModule::featureType() const
+    {
+        return feature_type;
+    }
+
+    /**
+     * \brief Method for get version of local database content
+     * \return Counter which is incremented after every add or delete (own or read from changelog)
+     *
+     * Caches of query results are valid while version is the same
+     */
+    uint64_t DatabaseModule::changesVersion() const
+    {
+        return changes_version.load();
+    }
+
+    /**
+     * \brief Method for get counters of exhibit payloads cache
+     * \return Cache size and hit counters (zeros if cache is disabled)
+     */
+    ExhibitCache::Stats DatabaseModule::exhibitCacheStats() const
+    {
+        if (!exhibit_cache)
+            return ExhibitCache::Stats();
+        return exhibit_cache->stats();
+    }
+
+    /**
+     * \brief Internal method for read feature type of keyspace (the first server stores feature_type of its config)
+     * \return true if successful
+     *
+     * Descriptors of different feature types can't be matched, so feature type of keyspace wins over config.
+     * Keyspace without settings table (created before feature types) has ORB descriptors.
+     */
+    bool DatabaseModule::initFeatureType()
+    {
+        const std::optional<FeatureType> configured_type = featureTypeFromName(config->feature_type);
+        if (!configured_type)
+        {
+            logger->LogError("DatabaseModule: unknown feature type " + config->feature_type);
+            return false;
+        }
+
+        StatementPtr settings_statement_ptr;
+        settings_statement_ptr.reset(cass_statement_new(
+            "insert into mpg_keyspace.settings (name, value) values ('feature_type', ?) if not exists", 1));
+        cass_statement_bind_string(settings_statement_ptr.get(), 0, featureTypeName(configured_type.value()));
+        FuturePtr query_future_ptr;
+        query_future_ptr.reset(cass_session_execute(session_ptr.get(), settings_statement_ptr.get()));
+        CassError rc = cass_future_error_code(query_future_ptr.get());
+        if (rc != CASS_OK)
+        {
+            logError(rc, "Store feature type");
+            if (configured_type.value() != FeatureType::ORB)
+                return false;
+            logger->LogWarning("DatabaseModule: keyspace has no settings table, ORB features are used");
+            return true;
+        }
+
+        // not applied insert returns current value of keyspace
+        feature_type = configured_type.value();
+        QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+        const CassRow* row = cass_result_first_row(result.get());
+        cass_bool_t is_applied = cass_true;
+        if (row)
+            cass_value_get_bool(cass_row_get_column(row, 0), &is_applied);
+        if (row && is_applied == cass_false)
+        {
+            const char* value = nullptr;
+            size_t value_length = 0;
+            cass_value_get_string(cass_row_get_column_by_name(row, "value"), &value, &value_length);
+            const std::string stored_name(value ? value : "", value_length);
+            const std::optional<FeatureType> stored_type = featureTypeFromName(stored_name);
+            if (!stored_type)
+            {
+                logger->LogError("DatabaseModule: keyspace has unknown feature type " + stored_name);
+                return false;
+            }
+            if (stored_type.value() != configured_type.value())
+                logger->LogWarning("DatabaseModule: keyspace uses " + stored_name + " features, feature_type " +
+                                   config->feature_type + " of config is ignored");
+            feature_type = stored_type.value();
+        }
+        descriptor_bytes = static_cast<int>(featureDescriptorBytes(feature_type));
+        logger->LogInfo(std::string("DatabaseModule: ") + featureTypeName(feature_type) + " features, " +
+                        std::to_string(descriptor_bytes) + " bytes descriptors");
+        return true;
+    }
+
+    /**
+     * \brief Internal method for start shard server (shard_port) and create clients of other shards (shard_endpoints)
+     * \return true if successful
+     */
+    bool DatabaseModule::initShards()
+    {
+        if (config->shard_count == 0 || config->shard_index >= config->shard_count)
+        {
+            logger->LogError("DatabaseModule: shard_index " + std::to_string(config->shard_index) +
+                             " is out of shard_count " + std::to_string(config->shard_count));
+            return false;
+        }
+
+        if (config->shard_port > 0 && !shard_server)
+        {
+            shard_server = std::make_unique<ShardServer>();
+            auto handler = [this](const ShardQuery& query)
+            {
+                const auto deadline = query.time_budget_ms > 0 ?
+                    std::chrono::steady_clock::now() + std::chrono::milliseconds(query.time_budget_ms) :
+                    std::chrono::steady_clock::time_point::max();
+                std::vector<ExhibitCandidate> candidates;
+                searchCandidates(query.descriptors, query.keypoints, deadline, candidates);
+                return candidates;
+            };
+            if (!shard_server->start(config->shard_listen_address, static_cast<uint16_t>(config->shard_port), handler,
+                                     config->shard_max_connections))
+            {
+                logger->LogError("DatabaseModule: cannot listen shard address " + config->shard_listen_address +
+                                 " port " + std::to_string(config->shard_port));
+                return false;
+            }
+            logger->LogInfo("DatabaseModule: shard " + std::to_string(config->shard_index) + "/" +
+                            std::to_string(config->shard_count) + " listens " + config->shard_listen_address +
+                            " port " + std::to_string(shard_server->port()));
+        }
+
+        shard_clients.clear();
+        for (const std::string& endpoint : config->shard_endpoints)
+            shard_clients.push_back(std::make_unique<ShardClient>(endpoint));
         return true;
     }
 
@@ -77,201 +292,1206 @@ namespace MPG
             size_t message_length;
             cass_future_error_message(connect_future_ptr.get(), &message, &message_length);
             logger->LogWarning("Connection error: " + std::string(message, message_length));
-            std::this_thread::sleep_for(std::chrono::milliseconds(retry_delay_ms));
+            std::unique_lock<std::mutex> ul(stop_mtx);
+            if (stop_cv.wait_for(ul, std::chrono::milliseconds(retry_delay_ms), [this] { return is_stopped; }))
+                return false;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Method for stop background work of database module (waiting for connection, compaction)
+     *
+     * Can be called from any thread, init() returns false after it
+     */
+    void DatabaseModule::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lg(stop_mtx);
+            is_stopped = true;
+        }
+        stop_cv.notify_all();
+        {
+            std::lock_guard<std::mutex> lg(compaction_mtx);
+            is_compaction_stopped = true;
+        }
+        compaction_cv.notify_all();
+    }
+
+    DatabaseModule::~DatabaseModule()
+    {
+        stop();
+        if (shard_server)
+            shard_server->stop(); // waits for shard queries, which use local database
+        if (compaction_thread.joinable())
+            compaction_thread.join();
+        if (changelog_thread.joinable())
+            changelog_thread.join();
+        if (local_database && !config->snapshot_path.empty() && is_snapshot_dirty)
+            saveSnapshot();
+        saveHotExhibits();
+        logger->LogInfo("Finish work of database module");
+    }
+
+    
+    /**
+     * \brief Method for load local database (all descriptors and std::map for mapping descriptors and ids)
+     * \return true if loading successful
+     *
+     * If snapshot file is found, it's mapped and only exhibits changed after it are loaded from database
+     */
+    [[nodiscard]] bool DatabaseModule::loadDatabase()
+    {
+        local_database = std::make_unique<SegmentedIndex>(*config, search_pool, descriptor_bytes);
+        if (loadSnapshot())
+            return catchUpDatabase();
+
+        synced_at_us = currentTimeUs() - clock_skew_us;
+        if (!loadFullDatabase())
+            return false;
+        is_snapshot_dirty = true;
+        return true;
+    }
+
+    /**
+     * \brief Internal method for load all exhibits table into empty local database
+     * \return true if loading successful
+     *
+     * Murmur3 token ring is split into load_threads * token_ranges_per_thread ranges, which are scanned
+     * with paging by load_threads workers. Every range is decoded into its own contiguous buffers, which
+     * are loaded as sealed segments without copy (indexes are built by initDescriptorIndex, compaction merges
+     * small segments), so peak memory is one copy of descriptors.
+     */
+    bool DatabaseModule::loadFullDatabase()
+    {
+        const auto started_at = std::chrono::steady_clock::now();
+        const size_t threads_count = config->load_threads > 0 ? config->load_threads :
+                                     std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        const size_t ranges_count = threads_count * token_ranges_per_thread;
+        std::vector<TokenRangeRows> ranges(ranges_count);
+
+        // ranges are taken by workers one by one, so slow (big) ranges don't stall the others
+        std::atomic<size_t> next_range{0};
+        std::atomic<bool> is_failed{false};
+        auto worker = [&]()
+        {
+            for (size_t r = next_range++; r < ranges_count && !is_failed; r = next_range++)
+            {
+                const TokenRange tokens = tokenRange(r, ranges_count);
+                if (!loadTokenRange(tokens.first_token, tokens.last_token, ranges[r]))
+                    is_failed = true;
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads_count; ++i)
+            workers.emplace_back(worker);
+        worker();
+        for (std::thread& t : workers)
+            t.join();
+        if (is_failed)
+            return false;
+
+        size_t rows_count = 0, exhibits_count = 0;
+        std::vector<SegmentedIndex::SealedPart> parts;
+        parts.reserve(ranges_count);
+        for (TokenRangeRows& range : ranges)
+        {
+            if (range.exhibits.empty())
+                continue;
+            const int range_rows = static_cast<int>(range.keypoints.size());
+            rows_count += range_rows;
+            exhibits_count += range.exhibits.size();
+            // segments keep headers of range buffers, so buffers are owned by segments
+            auto storage = std::make_shared<TokenRangeRows>(std::move(range));
+            SegmentedIndex::SealedPart part;
+            part.descriptors = cv::Mat(range_rows, descriptor_bytes, CV_8UC1, storage->descriptors.data());
+            part.keypoints = cv::Mat(range_rows, 1, CV_32FC2, storage->keypoints.data());
+            part.exhibits = std::move(storage->exhibits);
+            part.storage = std::move(storage);
+            parts.push_back(std::move(part));
+        }
+        if (!local_database->loadSealed(parts))
+        {
+            logger->LogError("DatabaseModule: cannot load token ranges into local database");
+            return false;
+        }
+
+        const auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at);
+        logger->LogInfo("DatabaseModule: database loaded, exhibits " + std::to_string(exhibits_count) + ", rows " +
+                        std::to_string(rows_count) + " by " + std::to_string(threads_count) + " threads in " +
+                        std::to_string(load_ms.count()) + " ms");
+        return true;
+    }
+
+    /**
+     * \brief Internal method for scan one token range of exhibits table
+     * \param[in] first_token First token of range
+     * \param[in] last_token Last token of range (inclusive)
+     * \param[out] rows Decoded descriptors, keypoints and row ranges of exhibits (relative to range)
+     * \return true if successful
+     */
+    bool DatabaseModule::loadTokenRange(int64_t first_token, int64_t last_token, TokenRangeRows& rows)
+    {
+        StatementPtr scan_statement_ptr;
+        scan_statement_ptr.reset(cass_statement_new(
+            "select id, descriptor, keypoints from mpg_keyspace.exhibits where token(id) >= ? and token(id) <= ?", 2));
+        cass_statement_bind_int64(scan_statement_ptr.get(), 0, first_token);
+        cass_statement_bind_int64(scan_statement_ptr.get(), 1, last_token);
+        cass_statement_set_paging_size(scan_statement_ptr.get(), static_cast<int>(std::max<size_t>(config->load_page_size, 1)));
+
+        bool has_more_pages = true;
+        while (has_more_pages)
+        {
+            FuturePtr query_future_ptr;
+            query_future_ptr.reset(cass_session_execute(session_ptr.get(), scan_statement_ptr.get()));
+            CassError rc = cass_future_error_code(query_future_ptr.get());
+            if (rc != CASS_OK)
+            {
+                logError(rc, "Load database token range");
+                return false;
+            }
+
+            QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+            const size_t page_rows = cass_result_row_count(result.get());
+            rows.exhibits.reserve(rows.exhibits.size() + page_rows);
+            IteratorPtr iter;
+            iter.reset(cass_iterator_from_result(result.get()));
+            while (cass_iterator_next(iter.get()))
+            {
+                ExhibitRow exhibit;
+                if (!readExhibitRow(cass_iterator_get_row(iter.get()), exhibit))
+                    return false;
+                if (!isShardExhibit(exhibit.id))
+                    continue;
+                const int first_row = static_cast<int>(rows.keypoints.size());
+                rows.descriptors.insert(rows.descriptors.end(), exhibit.descriptor_data,
+                                        exhibit.descriptor_data + exhibit.rows_count * descriptor_bytes);
+                if (exhibit.keypoints_data)
+                {
+                    const cv::Point2f* keypoints_data = reinterpret_cast<const cv::Point2f*>(exhibit.keypoints_data);
+                    rows.keypoints.insert(rows.keypoints.end(), keypoints_data, keypoints_data + exhibit.rows_count);
+                }
+                else
+                {
+                    const float nan = std::numeric_limits<float>::quiet_NaN();
+                    rows.keypoints.resize(rows.keypoints.size() + exhibit.rows_count, cv::Point2f(nan, nan));
+                }
+                rows.exhibits.emplace_back(exhibit.id, RowRange{first_row, exhibit.rows_count});
+            }
+            logger->LogInfo("DatabaseModule: loaded page of " + std::to_string(page_rows) + " exhibits, token range [" +
+                            std::to_string(first_token) + ", " + std::to_string(last_token) + "] has " +
+                            std::to_string(rows.exhibits.size()) + " exhibits");
+
+            has_more_pages = cass_result_has_more_pages(result.get());
+            if (has_more_pages)
+                cass_statement_set_paging_state(scan_statement_ptr.get(), result.get());
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method for decode exhibit row of cassandra without copying
+     * \param[in] row Cassandra row with id, descriptor and keypoints columns
+     * \param[out] exhibit Pointers to data of row (valid while result of row is alive)
+     * \return true if descriptor size is valid
+     */
+    bool DatabaseModule::readExhibitRow(const CassRow* row, ExhibitRow& exhibit)
+    {
+        cass_value_get_uuid(cass_row_get_column_by_name(row, "id"), &exhibit.id);
+
+        const cass_byte_t *descriptor_data = nullptr;
+        size_t descriptor_size = 0;
+        cass_value_get_bytes(cass_row_get_column_by_name(row, "descriptor"), &descriptor_data, &descriptor_size);
+        if (descriptor_size % descriptor_bytes != 0)
+        {
+            logger->LogError("DatabaseModule: Descriptor size mismatch: expected multiple of " + std::to_string(descriptor_bytes) +
+                             ", got " + std::to_string(descriptor_size));
+            return false;
+        }
+        exhibit.descriptor_data = descriptor_data;
+        exhibit.rows_count = static_cast<int>(descriptor_size / descriptor_bytes);
+
+        // keypoints are stored as x, y floats of every descriptor row, exhibits added before have no keypoints
+        exhibit.keypoints_data = nullptr;
+        const CassValue* keypoints_value = cass_row_get_column_by_name(row, "keypoints");
+        const cass_byte_t *keypoints_data = nullptr;
+        size_t keypoints_size = 0;
+        if (keypoints_value && !cass_value_is_null(keypoints_value) &&
+            cass_value_get_bytes(keypoints_value, &keypoints_data, &keypoints_size) == CASS_OK &&
+            keypoints_size == exhibit.rows_count * sizeof(cv::Point2f))
+            exhibit.keypoints_data = keypoints_data;
+        return true;
+    }
+
+    /**
+     * \brief Internal method for loading database
+     * \param[in] row Cassanra row for getting data for local database
+     * Load one cassandra row (replaces exhibit if it's loaded already)
+     */
+    [[nodiscard]] bool DatabaseModule::loadDatabaseHelper(const CassRow* row)
+    {
+        ExhibitRow exhibit;
+        if (!readExhibitRow(row, exhibit))
+            return false;
+        if (!isShardExhibit(exhibit.id))
+            return true; // exhibit of other shard
+        cv::Mat descriptor = cv::Mat(exhibit.rows_count, descriptor_bytes, CV_8UC1,
+                                     const_cast<cass_byte_t*>(exhibit.descriptor_data)).clone();
+        std::vector<cv::Point2f> keypoints;
+        if (exhibit.keypoints_data)
+        {
+            keypoints.resize(exhibit.rows_count);
+            std::memcpy(keypoints.data(), exhibit.keypoints_data, exhibit.rows_count * sizeof(cv::Point2f));
+        }
+
+        std::lock_guard<std::mutex> lg(local_database_mtx);
+        unloadExhibit(exhibit.id); // exhibit changed after snapshot or by other replica
+        local_database->addExhibit(exhibit.id, descriptor, keypoints);
+        std::lock_guard<std::shared_mutex> bow_lg(bow_mtx);
+        if (bow_index && !bow_index->empty())
+            bow_index->addExhibit(local_database->exhibitOrdinals().at(exhibit.id), descriptor);
+        return true;
+    }
+
+    /**
+     * \brief Internal method for remove exhibit from local database and bag of words index
+     * \param[in] id Exhibit id
+     * \return true if exhibit was loaded
+     *
+     * local_database_mtx must be locked by caller
+     */
+    bool DatabaseModule::unloadExhibit(const CassUuid& id)
+    {
+        if (exhibit_cache)
+            exhibit_cache->erase(id);
+        auto ordinal_it = local_database->exhibitOrdinals().find(id);
+        if (ordinal_it == local_database->exhibitOrdinals().end())
+            return false;
+        const SegmentedIndex::ExhibitOrdinal ordinal = ordinal_it->second;
+        // rows are only marked as deleted, they are removed by background compaction
+        local_database->removeExhibit(id);
+        std::lock_guard<std::shared_mutex> bow_lg(bow_mtx);
+        if (bow_index)
+            bow_index->removeExhibit(ordinal);
+        return true;
+    }
+
+    /**
+     * \brief Internal method for load local database from snapshot file (see SnapshotFile)
+     * \return true if snapshot was loaded
+     */
+    bool DatabaseModule::loadSnapshot()
+    {
+        if (config->snapshot_path.empty())
+            return false;
+
+        const auto started_at = std::chrono::steady_clock::now();
+        auto snapshot_file = std::make_shared<SnapshotFile>();
+        if (!snapshot_file->open(config->snapshot_path, descriptor_bytes))
+        {
+            logger->LogWarning("DatabaseModule: snapshot " + config->snapshot_path + " not found or damaged, full load");
+            return false;
+        }
+        if (!local_database->loadSealed(snapshot_file->descriptors(), snapshot_file->keypoints(),
+                                        snapshot_file->exhibits(), snapshot_file))
+        {
+            logger->LogWarning("DatabaseModule: snapshot " + config->snapshot_path + " has invalid exhibits table, full load");
+            return false;
+        }
+        synced_at_us = snapshot_file->syncedAt();
+
+        const auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at);
+        logger->LogInfo("DatabaseModule: snapshot loaded, rows " + std::to_string(local_database->snapshot()->rowsCount()) +
+                        " in " + std::to_string(load_ms.count()) + " ms");
+        return true;
+    }
+
+    /**
+     * \brief Internal method for apply changes of exhibits table made after snapshot
+     * \return true if successful
+     *
+     * Changes are read from changelog if it still keeps them (see applyChangelog). Else only ids and write times
+     * are scanned, exhibits written after snapshot sync time are loaded, exhibits absent in table are deleted
+     */
+    bool DatabaseModule::catchUpDatabase()
+    {
+        const int64_t changelog_since_us = currentTimeUs() - static_cast<int64_t>(config->changelog_ttl_s) * 1000 * 1000 + clock_skew_us;
+        if (synced_at_us > changelog_since_us)
+        {
+            if (applyChangelog())
+                return true;
+            logger->LogWarning("DatabaseModule: cannot read changelog, scanning exhibits table");
+        }
+
+        const int64_t sync_started_us = currentTimeUs() - clock_skew_us;
+        std::unordered_set<CassUuid, std::hash<CassUuid>, CassUuidEqual> table_ids;
+        std::vector<CassUuid> changed_ids;
+
+        StatementPtr scan_statement_ptr;
+        scan_statement_ptr.reset(cass_statement_new("select id, writetime(descriptor) from mpg_keyspace.exhibits", 0));
+        cass_statement_set_paging_size(scan_statement_ptr.get(), catch_up_page_size);
+        bool has_more_pages = true;
+        while (has_more_pages)
+        {
+            FuturePtr query_future_ptr;
+            query_future_ptr.reset(cass_session_execute(session_ptr.get(), scan_statement_ptr.get()));
+
+            CassError rc = cass_future_error_code(query_future_ptr.get());
+            if (rc != CASS_OK)
+            {
+                const char *message;
+                size_t message_length;
+                cass_future_error_message(query_future_ptr.get(), &message, &message_length);
+
+                logger->LogError("DatabaseModule: catch up query error (" + std::string(cass_error_desc(rc)) + "): " +
+                                 std::string(message, message_length));
+                return false;
+            }
+
+            QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+            IteratorPtr iter;
+            iter.reset(cass_iterator_from_result(result.get()));
+            while (cass_iterator_next(iter.get()))
+            {
+                const CassRow* row = cass_iterator_get_row(iter.get());
+                CassUuid id;
+                cass_value_get_uuid(cass_row_get_column(row, 0), &id);
+                cass_int64_t write_time = 0;
+                const bool has_write_time = cass_value_get_int64(cass_row_get_column(row, 1), &write_time) == CASS_OK;
+                if (!isShardExhibit(id))
+                    continue;
+                table_ids.insert(id);
+                if (!has_write_time || write_time >= synced_at_us || !local_database->contains(id))
+                    changed_ids.push_back(id);
+            }
+
+            has_more_pages = cass_result_has_more_pages(result.get());
+            if (has_more_pages)
+                cass_statement_set_paging_state(scan_statement_ptr.get(), result.get());
+        }
+
+        std::vector<CassUuid> deleted_ids;
+        for (const auto& [id, ordinal] : local_database->exhibitOrdinals())
+        {
+            if (table_ids.find(id) == table_ids.end())
+                deleted_ids.push_back(id);
+        }
+        std::unique_lock<std::mutex> ul(local_database_mtx);
+        for (const CassUuid& id : deleted_ids)
+            unloadExhibit(id);
+        ul.unlock();
+
+        if (!loadExhibits(changed_ids))
+            return false;
+        synced_at_us = sync_started_us;
+        if (!changed_ids.empty() || !deleted_ids.empty())
+            is_snapshot_dirty = true;
+
+        logger->LogInfo("DatabaseModule: caught up with database, loaded " + std::to_string(changed_ids.size()) +
+                        " exhibits, deleted " + std::to_string(deleted_ids.size()) + " exhibits");
+        return true;
+    }
+
+    /**
+     * \brief Internal method for load exhibits by ids into local database (replaces loaded ones)
+     * \param[in] ids Exhibit ids
+     * \return true if successful
+     */
+    bool DatabaseModule::loadExhibits(const std::vector<CassUuid>& ids)
+    {
+        for (size_t first = 0; first < ids.size(); first += catch_up_window)
+        {
+            std::vector<FuturePtr> futures;
+            const size_t end = std::min(first + catch_up_window, ids.size());
+            for (size_t i = first; i < end; ++i)
+            {
+                StatementPtr load_exhibit_statement_ptr;
+                load_exhibit_statement_ptr.reset(
+                    cass_statement_new("select id, descriptor, keypoints from mpg_keyspace.exhibits where id=?", 1));
+                cass_statement_bind_uuid(load_exhibit_statement_ptr.get(), 0, ids[i]);
+                futures.emplace_back(cass_session_execute(session_ptr.get(), load_exhibit_statement_ptr.get()));
+            }
+
+            for (FuturePtr& query_future_ptr : futures)
+            {
+                CassError rc = cass_future_error_code(query_future_ptr.get());
+                if (rc != CASS_OK)
+                {
+                    logError(rc, "Load changed exhibit");
+                    return false;
+                }
+                QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+                const CassRow* row = cass_result_first_row(result.get());
+                if (row && !loadDatabaseHelper(row)) // no row if exhibit was deleted after scan
+                    return false;
+            }
+            logger->LogInfo("DatabaseModule: loaded " + std::to_string(end) + "/" + std::to_string(ids.size()) +
+                            " exhibits, local rows " + std::to_string(local_database->snapshot()->rowsCount()));
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method for write local database snapshot file (see SnapshotFile)
+     * \return true if successful
+     */
+    bool DatabaseModule::saveSnapshot()
+    {
+        const auto started_at = std::chrono::steady_clock::now();
+        is_snapshot_dirty = false;
+        // sync time is read before snapshot, so snapshot has all changes written before it
+        const int64_t snapshot_synced_at_us = synced_at_us;
+        // pinned snapshot delays deletion of snapshots replaced while file is written
+        SegmentedIndex::SnapshotGuard snapshot = local_database->snapshot();
+        if (!SnapshotFile::write(config->snapshot_path, *snapshot, snapshot_synced_at_us))
+        {
+            is_snapshot_dirty = true;
+            logger->LogError("DatabaseModule: cannot write snapshot " + config->snapshot_path);
+            return false;
+        }
+        snapshot_saved_at = std::chrono::steady_clock::now();
+
+        const auto save_ms = std::chrono::duration_cast<std::chrono::milliseconds>(snapshot_saved_at - started_at);
+        logger->LogInfo("DatabaseModule: snapshot saved, rows " + std::to_string(snapshot->liveRowsCount()) +
+                        " in " + std::to_string(save_ms.count()) + " ms");
+        return true;
+    }
+
+    /**
+     * \brief Internal method for write change of exhibit to changelog (mpg_keyspace.exhibit_changes)
+     * \param[in] id Exhibit id
+     * \param[in] is_deleted true if exhibit was deleted, false if it was added or changed
+     * \return true if successful
+     *
+     * Changes are partitioned by hour and ordered by time uuid version, they expire after changelog_ttl_s
+     */
+    bool DatabaseModule::writeChange(const CassUuid& id, bool is_deleted)
+    {
+        CassUuid version;
+        cass_uuid_gen_time(id_generator_ptr.get(), &version);
+        const int64_t version_us = static_cast<int64_t>(cass_uuid_timestamp(version)) * 1000;
+        applied_changes.markApplied(version, version_us); // own change is already in local database
+
+        StatementPtr change_statement_ptr;
+        change_statement_ptr.reset(cass_statement_new(
+            "insert into mpg_keyspace.exhibit_changes (bucket, version, id, deleted) values (?, ?, ?, ?) using ttl ?", 5));
+        cass_statement_bind_int64(change_statement_ptr.get(), 0, version_us / changelog_bucket_us);
+        cass_statement_bind_uuid(change_statement_ptr.get(), 1, version);
+        cass_statement_bind_uuid(change_statement_ptr.get(), 2, id);
+        cass_statement_bind_bool(change_statement_ptr.get(), 3, is_deleted ? cass_true : cass_false);
+        cass_statement_bind_int32(change_statement_ptr.get(), 4, static_cast<cass_int32_t>(config->changelog_ttl_s));
+
+        FuturePtr query_future_ptr;
+        query_future_ptr.reset(cass_session_execute(session_ptr.get(), change_statement_ptr.get()));
+        CassError rc = cass_future_error_code(query_future_ptr.get());
+        if (rc != CASS_OK)
+        {
+            logError(rc, "Write exhibit change");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method for apply changes written to changelog by all replicas since synced_at_us
+     * \return true if successful
+     *
+     * Only the last change of every exhibit is applied: deleted exhibits are removed, added and changed
+     * ones are loaded from exhibits table. Changes are read with clock skew margin, versions applied
+     * before are skipped.
+     */
+    bool DatabaseModule::applyChangelog()
+    {
+        const int64_t sync_started_us = currentTimeUs();
+        const int64_t from_us = synced_at_us;
+        CassUuid min_version;
+        cass_uuid_min_from_time(static_cast<cass_uint64_t>(std::max<int64_t>(from_us, 0) / 1000), &min_version);
+
+        std::vector<ExhibitChange> changes; // in version order
+        for (int64_t bucket = from_us / changelog_bucket_us; bucket <= (sync_started_us + clock_skew_us) / changelog_bucket_us; ++bucket)
+        {
+            StatementPtr changes_statement_ptr;
+            changes_statement_ptr.reset(cass_statement_new(
+                "select version, id, deleted from mpg_keyspace.exhibit_changes where bucket = ? and version >= ?", 2));
+            cass_statement_bind_int64(changes_statement_ptr.get(), 0, bucket);
+            cass_statement_bind_uuid(changes_statement_ptr.get(), 1, min_version);
+            cass_statement_set_paging_size(changes_statement_ptr.get(), catch_up_page_size);
+
+            bool has_more_pages = true;
+            while (has_more_pages)
+            {
+                FuturePtr query_future_ptr;
+                query_future_ptr.reset(cass_session_execute(session_ptr.get(), changes_statement_ptr.get()));
+                CassError rc = cass_future_error_code(query_future_ptr.get());
+                if (rc != CASS_OK)
+                {
+                    logError(rc, "Read exhibit changes");
+                    return false;
+                }
+
+                QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+                IteratorPtr iter;
+                iter.reset(cass_iterator_from_result(result.get()));
+                while (cass_iterator_next(iter.get()))
+                {
+                    const CassRow* row = cass_iterator_get_row(iter.get());
+                    CassUuid version, id;
+                    cass_bool_t is_deleted = cass_false;
+                    cass_value_get_uuid(cass_row_get_column(row, 0), &version);
+                    cass_value_get_uuid(cass_row_get_column(row, 1), &id);
+                    cass_value_get_bool(cass_row_get_column(row, 2), &is_deleted);
+                    const int64_t version_us = static_cast<int64_t>(cass_uuid_timestamp(version)) * 1000;
+                    if (applied_changes.markApplied(version, version_us))
+                        changes.push_back({id, is_deleted == cass_true});
+                }
+
+                has_more_pages = cass_result_has_more_pages(result.get());
+                if (has_more_pages)
+                    cass_statement_set_paging_state(changes_statement_ptr.get(), result.get());
+            }
+        }
+
+        const std::vector<ExhibitChange> last_changes = lastChanges(changes);
+        std::vector<CassUuid> loaded_ids;
+        size_t deleted_count = 0;
+        for (const auto& [id, is_deleted] : last_changes)
+        {
+            if (exhibit_cache)
+                exhibit_cache->erase(id); // also exhibits of other shards, their payloads are read by front process
+            if (is_deleted)
+            {
+                std::lock_guard<std::mutex> lg(local_database_mtx);
+                deleted_count += unloadExhibit(id) ? 1 : 0;
+            }
+            else
+            {
+                loaded_ids.push_back(id);
+            }
+        }
+        const bool is_loaded = loadExhibits(loaded_ids);
+        if (!last_changes.empty())
+            ++changes_version; // also changes of other shards, whose exhibits can be found by front process
+        if (!is_loaded)
+            return false;
+
+        // changes before new sync time are never read again
+        synced_at_us = sync_started_us - clock_skew_us;
+        applied_changes.forgetBefore(synced_at_us);
+
+        if (!loaded_ids.empty() || deleted_count > 0)
+        {
+            is_snapshot_dirty = true;
+            requestCompaction();
+            logger->LogInfo("DatabaseModule: applied changelog, loaded " + std::to_string(loaded_ids.size()) +
+                            " exhibits, deleted " + std::to_string(deleted_count) + " exhibits");
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method of background thread, which applies changes of other replicas every changelog_poll_ms
+     */
+    void DatabaseModule::changelogLoop()
+    {
+        const auto poll_interval = std::chrono::milliseconds(config->changelog_poll_ms);
+        std::unique_lock<std::mutex> ul(stop_mtx);
+        while (!stop_cv.wait_for(ul, poll_interval, [this]() { return is_stopped; }))
+        {
+            ul.unlock();
+            applyChangelog();
+            ul.lock();
+        }
+    }
+
+    /**
+     * \brief Internal method for searchind id of object by it's descriptor
+     * \param[in] exhibit_descriptor Descriptor of object (must be ORB, rows sorted from the strongest keypoint)
+     * \param[in] exhibit_keypoints Keypoint of every descriptor row (if empty, geometric verification is skipped)
+     * \param[in] deadline Time after which the best exhibit found so far is returned
+     * \param[out] confidence Percent of processed descriptor rows which voted for found exhibit
+     * \return id of object if search was successful or std::nullopt in other way
+     *
+     * If shard_endpoints are set, query is also sent to other shards (while local part is searched),
+     * shards which don't answer in shard_timeout_ms are skipped. The best candidate of all shards is returned.
+     */
+    [[nodiscard]] std::optional<CassUuid> DatabaseModule::findExhibitUuid(const cv::Mat& exhibit_descriptor,
+                                                                         const std::vector<cv::Point2f>& exhibit_keypoints,
+                                                                         std::chrono::steady_clock::time_point deadline,
+                                                                         size_t& confidence)
+    {
+        confidence = 0;
+        if (exhibit_descriptor.empty())
+        {
+            return std::nullopt;
+        }
+
+        // shards search while local part is searched, their results are read by one poll loop after it
+        thread_local ShardFanout shard_fanout;
+        thread_local ShardQuery shard_query;
+        if (!shard_clients.empty())
+        {
+            const auto shard_deadline = std::min(deadline, std::chrono::steady_clock::now() +
+                                                           std::chrono::milliseconds(config->shard_timeout_ms));
+            const auto shard_budget = std::chrono::duration_cast<std::chrono::milliseconds>(shard_deadline - std::chrono::steady_clock::now());
+            shard_query.descriptors = exhibit_descriptor;
+            shard_query.keypoints.clear();
+            if (exhibit_keypoints.size() == static_cast<size_t>(exhibit_descriptor.rows))
+                shard_query.keypoints = exhibit_keypoints;
+            // shard stops matching earlier than its deadline, so result has time to come back
+            shard_query.time_budget_ms = static_cast<uint32_t>(std::max<int64_t>(shard_budget.count() * 3 / 4, 1));
+            shard_fanout.send(shard_clients, shard_query, shard_deadline);
+            shard_query.descriptors.release(); // query descriptors aren't referenced after call
+        }
+
+        thread_local std::vector<ExhibitCandidate> candidates; // best candidate is returned by id, buffer is reused
+        const bool is_searched = searchCandidates(exhibit_descriptor, exhibit_keypoints, deadline, candidates);
+        if (!shard_clients.empty())
+        {
+            thread_local std::vector<const ShardClient*> failed_shards;
+            shard_fanout.receive(candidates, failed_shards);
+            for (const ShardClient* client : failed_shards)
+                logger->LogWarning("DatabaseModule: shard " + client->endpoint() + " didn't answer in time");
+        }
+        if (!is_searched)
+            return std::nullopt;
+
+        const ExhibitCandidate* best_candidate = selectCandidate(candidates);
+        if (best_candidate == nullptr)
+            return std::nullopt;
+        confidence = best_candidate->processed_rows > 0 ? 100 * best_candidate->votes / best_candidate->processed_rows : 0;
+        return best_candidate->id;
+    }
+
+    /**
+     * \brief Internal method for search the most voted exhibits of local database
+     * \param[in] exhibit_descriptor Descriptor of object (must be ORB, rows sorted from the strongest keypoint)
+     * \param[in] exhibit_keypoints Keypoint of every descriptor row (if empty, geometric verification is skipped)
+     * \param[in] deadline Time after which matching is stopped
+     * \param[out] candidates verification_candidates most voted exhibits (one if verification is off) sorted by votes
+     * \return false if descriptor can't be searched
+     *
+     * Descriptor rows are searched by batches of match_batch_rows and vote for exhibits of their nearest
+     * neighbours. Search stops when the leader can't be overtaken by remaining rows or deadline is reached.
+     * Candidates are verified by RANSAC homography between query and exhibit keypoints.
+     */
+    bool DatabaseModule::searchCandidates(const cv::Mat& exhibit_descriptor, const std::vector<cv::Point2f>& exhibit_keypoints,
+                                          std::chrono::steady_clock::time_point deadline, std::vector<ExhibitCandidate>& candidates)
+    {
+        candidates.clear();
+        if (exhibit_descriptor.empty())
+            return true;
+
+        thread_local std::vector<SegmentedIndex::ExhibitOrdinal> shortlist;
+        thread_local std::vector<HammingMatch> knn_matches;
+        thread_local std::vector<HammingMatch> batch_matches;
+        const size_t k = config->count_matches_knn;
+        const int rows_count = exhibit_descriptor.rows;
+        const int batch_rows = static_cast<int>(std::max<size_t>(config->match_batch_rows, 1));
+
+        // snapshot is pinned without locks, writers publish new snapshots meanwhile
+        SegmentedIndex::SnapshotGuard snapshot = local_database->snapshot();
+        const bool is_shortlisted = shortlistExhibits(exhibit_descriptor, shortlist);
+
+        //const float ratio_threshold = config->match_ratio_threshold;
+        // votes are counted in flat table indexed by exhibit ordinal, only voted entries are cleared after
+        thread_local std::vector<uint> votes;
+        thread_local std::vector<SegmentedIndex::ExhibitOrdinal> voted_ordinals;
+        if (votes.size() < snapshot->ordinalsCount())
+            votes.resize(snapshot->ordinalsCount(), 0);
+        voted_ordinals.clear();
+        knn_matches.clear();
+
+        SegmentedIndex::ExhibitOrdinal leader = 0;
+        uint leader_votes = 0, runner_up_votes = 0;
+        int processed_rows = 0;
+        while (processed_rows < rows_count)
+        {
+            const cv::Mat batch = exhibit_descriptor.rowRange(processed_rows, std::min(processed_rows + batch_rows, rows_count));
+            const bool is_searched = is_shortlisted ? knnSearchShortlist(*snapshot, shortlist, batch, k, batch_matches) :
+                                                      snapshot->knnSearch(batch, k, batch_matches);
+            if (!is_searched)
+            {
+                for (SegmentedIndex::ExhibitOrdinal ordinal : voted_ordinals)
+                    votes[ordinal] = 0;
+                logger->LogError("DatabaseModule: unsupported descriptor width " + std::to_string(exhibit_descriptor.cols) +
+                                 " or count_matches_knn " + std::to_string(k));
+                return false;
+            }
+            knn_matches.insert(knn_matches.end(), batch_matches.begin(), batch_matches.end());
+            processed_rows += batch.rows;
+
+            for (size_t i = 0; i < batch_matches.size(); i += k)
+            {
+                const int best_train_idx = batch_matches[i].train_idx;
+                if (best_train_idx < 0)
+                    continue;
+                const SegmentedIndex::ExhibitOrdinal ordinal = snapshot->rowOrdinal(best_train_idx);
+                if (votes[ordinal]++ == 0)
+                    voted_ordinals.push_back(ordinal);
+                if (ordinal == leader || votes[ordinal] <= leader_votes)
+                {
+                    if (ordinal == leader)
+                        leader_votes = votes[ordinal];
+                    else
+                        runner_up_votes = std::max(runner_up_votes, votes[ordinal]);
+                    continue;
+                }
+                runner_up_votes = leader_votes;
+                leader = ordinal;
+                leader_votes = votes[ordinal];
+            }
+
+            // remaining rows can't change the leader or there is no time for them
+            if (leader_votes - runner_up_votes > static_cast<uint>(rows_count - processed_rows))
+                break;
+            if (std::chrono::steady_clock::now() >= deadline)
+                break;
+        }
+
+        if (voted_ordinals.size() == 0)
+        {
+            return true;
+        }
+        const bool is_verified = config->verification_candidates > 0 &&
+                                 exhibit_keypoints.size() == static_cast<size_t>(rows_count);
+        const size_t candidates_count = is_verified ? std::min(config->verification_candidates, voted_ordinals.size()) : 1;
+        std::partial_sort(voted_ordinals.begin(), voted_ordinals.begin() + candidates_count, voted_ordinals.end(),
+                          [](SegmentedIndex::ExhibitOrdinal lhs, SegmentedIndex::ExhibitOrdinal rhs)
+                          { return votes[lhs] > votes[rhs]; });
+        thread_local std::vector<SegmentedIndex::ExhibitOrdinal> candidate_ordinals;
+        candidate_ordinals.assign(voted_ordinals.begin(), voted_ordinals.begin() + candidates_count);
+        for (SegmentedIndex::ExhibitOrdinal ordinal : candidate_ordinals)
+        {
+            ExhibitCandidate candidate;
+            candidate.id = snapshot->ordinalExhibit(ordinal);
+            candidate.votes = votes[ordinal];
+            candidate.processed_rows = static_cast<uint32_t>(processed_rows);
+            candidates.push_back(candidate);
+        }
+        if (is_verified)
+            verifyCandidates(*snapshot, exhibit_keypoints, knn_matches, k, candidate_ordinals, candidates);
+        for (SegmentedIndex::ExhibitOrdinal ordinal : voted_ordinals)
+            votes[ordinal] = 0;
+        return true;
+    }
+
+    /**
+     * \brief Internal method for geometric verification of the most voted exhibits
+     * \param[in] snapshot Snapshot used for search
+     * \param[in] exhibit_keypoints Keypoint of every query descriptor row
+     * \param[in] knn_matches Neighbours of processed query descriptor rows (rows of snapshot)
+     * \param[in] k Count of neighbours for each query descriptor row
+     * \param[in] ordinals Exhibit ordinals of candidates
+     * \param[in,out] candidates Candidates, homography inliers are set for exhibits with keypoints
+     *
+     * Every query row gives one correspondence for candidate: its nearest neighbour from this candidate.
+     * Exhibits added without keypoints can't be verified.
+     */
+    void DatabaseModule::verifyCandidates(const SegmentedIndex::Snapshot& snapshot, const std::vector<cv::Point2f>& exhibit_keypoints,
+                                          const std::vector<HammingMatch>& knn_matches, size_t k,
+                                          const std::vector<SegmentedIndex::ExhibitOrdinal>& ordinals,
+                                          std::vector<ExhibitCandidate>& candidates)
+    {
+        thread_local PointCorrespondences correspondences;
+
+        for (size_t c = 0; c < ordinals.size(); ++c)
+        {
+            const SegmentedIndex::ExhibitOrdinal ordinal = ordinals[c];
+            correspondences.query_points.clear();
+            correspondences.train_points.clear();
+            bool has_keypoints = false;
+            for (size_t q = 0; q < knn_matches.size() / k; ++q)
+            {
+                for (size_t i = 0; i < k; ++i)
+                {
+                    const HammingMatch& match = knn_matches[q * k + i];
+                    if (match.train_idx < 0 || snapshot.rowOrdinal(match.train_idx) != ordinal)
+                        continue;
+                    const cv::Point2f train_point = snapshot.rowKeypoint(match.train_idx);
+                    if (!std::isnan(train_point.x))
+                    {
+                        has_keypoints = true;
+                        correspondences.query_points.push_back(exhibit_keypoints[q]);
+                        correspondences.train_points.push_back(train_point);
+                    }
+                    break;
+                }
+            }
+
+            candidates[c].is_verifiable = has_keypoints;
+            if (has_keypoints)
+                candidates[c].inliers = static_cast<uint32_t>(countHomographyInliers(correspondences, config->verification_reprojection_error));
+        }
+    }
+
+    /**
+     * \brief Internal method for select found exhibit from candidates of all shards
+     * \param[in] candidates Candidates
+     * \return Verified candidate with the most homography inliers (at least verification_min_inliers), if there is
+     * no such candidate, unverifiable one with the most votes per processed row, or nullptr
+     */
+    const ExhibitCandidate* DatabaseModule::selectCandidate(const std::vector<ExhibitCandidate>& candidates) const
+    {
+        const ExhibitCandidate* best_verified = nullptr;
+        const ExhibitCandidate* best_unverifiable = nullptr;
+        for (const ExhibitCandidate& candidate : candidates)
+        {
+            if (candidate.is_verifiable)
+            {
+                if (candidate.inliers >= config->verification_min_inliers &&
+                    (best_verified == nullptr || candidate.inliers > best_verified->inliers))
+                    best_verified = &candidate;
+            }
+            else if (best_unverifiable == nullptr ||
+                     uint64_t(candidate.votes) * best_unverifiable->processed_rows >
+                     uint64_t(best_unverifiable->votes) * candidate.processed_rows)
+            {
+                best_unverifiable = &candidate;
+            }
+        }
+        return best_verified ? best_verified : best_unverifiable;
+    }
+
+    /**
+     * \brief Internal method for check if exhibit belongs to shard of this process (see shard_count, shard_index)
+     * \param[in] id Exhibit id
+     * \return true if exhibit is kept in local database
+     */
+    bool DatabaseModule::isShardExhibit(const CassUuid& id) const
+    {
+        return exhibitShard(id, config->shard_count) == config->shard_index;
+    }
+
+    /**
+     * \brief Method for getting object info from database by it's ORB descriptor
+     * \param[in] description ORB descriptor of object
+     * \param[in] keypoints Keypoint of every descriptor row (used for geometric verification, may be empty)
+     * \param[in] time_budget Time for matching (0 means match_time_budget_ms from config, which 0 is unlimited)
+     * \param[in] rendition Size of returned image
+     * \return Object info if successful or std::nullopt in another way
+     * In process of work call findExhibitUuid, descriptor rows should be sorted from the strongest keypoint
+     */
+    [[nodiscard]] std::optional<DatabaseResponse> DatabaseModule::getExhibit(const cv::Mat& description,
+                                                                             const std::vector<cv::Point2f>& keypoints,
+                                                                             std::chrono::milliseconds time_budget,
+                                                                             ImageRendition rendition)
+    {
+        /**
+         * table struct:
+         * * id CassUuid
+         * * descriptor blob
+         * * image blob
+         * * title text
+         * * desciption text
+         */
+        if (time_budget.count() <= 0)
+            time_budget = std::chrono::milliseconds(config->match_time_budget_ms);
+        const auto deadline = time_budget.count() > 0 ? std::chrono::steady_clock::now() + time_budget :
+                                                        std::chrono::steady_clock::time_point::max();
+        size_t confidence = 0;
+        std::optional<CassUuid> exhibit_id = findExhibitUuid(description, keypoints, deadline, confidence);
+        if (!exhibit_id.has_value())
+        {
+            logger->LogError("DatabaseModule: Couldn't found id for exhibit");
+            return std::nullopt;
+        }
+
+        return fetchExhibit(exhibit_id.value(), confidence, rendition);
+    }
+
+    /**
+     * \brief Method for getting object info from database by it's id (without matching)
+     * \param[in] exhibit_id id of object
+     * \param[in] confidence Confidence of response (e.g. confidence of cached match)
+     * \param[in] rendition Size of returned image
+     * \return Object info if successful or std::nullopt in another way (e.g. object is deleted)
+     */
+    [[nodiscard]] std::optional<DatabaseResponse> DatabaseModule::getExhibitById(const std::string& exhibit_id, size_t confidence,
+                                                                                 ImageRendition rendition)
+    {
+        CassUuid id;
+        if (cass_uuid_from_string(exhibit_id.c_str(), &id) != CASS_OK)
+        {
+            logger->LogError("DatabaseModule: invalid exhibit id " + exhibit_id);
+            return std::nullopt;
+        }
+        return fetchExhibit(id, confidence, rendition);
+    }
+
+    /**
+     * \brief Method for get shared payload of object by its id (without matching)
+     * \param[in] exhibit_id id of object
+     * \param[in] rendition Size of image
+     * \return Payload shared with exhibit cache, it has ETag of image, or nullptr (e.g. object is deleted)
+     *
+     * Cached payload isn't copied, so image can be sent directly from it
+     */
+    ExhibitCache::Payload DatabaseModule::getExhibitPayload(const std::string& exhibit_id, ImageRendition rendition)
+    {
+        CassUuid id;
+        if (cass_uuid_from_string(exhibit_id.c_str(), &id) != CASS_OK)
+        {
+            logger->LogError("DatabaseModule: invalid exhibit id " + exhibit_id);
+            return nullptr;
+        }
+
+        uint64_t cache_generation = 0;
+        if (exhibit_cache)
+        {
+            if (ExhibitCache::Payload payload = exhibit_cache->find(id, rendition))
+                return payload;
+            cache_generation = exhibit_cache->generation(); // read below can't return payload erased before it
+        }
+        std::optional<DatabaseResponse> resp = readExhibit(id, rendition);
+        if (!resp.has_value())
+            return nullptr;
+        auto payload = std::make_shared<const DatabaseResponse>(std::move(resp.value()));
+        if (exhibit_cache)
+            exhibit_cache->insert(id, rendition, payload, cache_generation);
+        return payload;
+    }
+
+    /**
+     * \brief Internal method for get object info from exhibit cache or exhibits table
+     * \param[in] exhibit_id id of object
+     * \param[in] confidence Confidence of response
+     * \param[in] rendition Size of returned image (full image if exhibit was added before renditions)
+     * \return Object info if successful or std::nullopt in another way
+     */
+    std::optional<DatabaseResponse> DatabaseModule::fetchExhibit(const CassUuid& exhibit_id, size_t confidence, ImageRendition rendition)
+    {
+        uint64_t cache_generation = 0;
+        if (exhibit_cache)
+        {
+            if (ExhibitCache::Payload payload = exhibit_cache->find(exhibit_id, rendition))
+            {
+                DatabaseResponse resp = *payload;
+                resp.percentage_of_confidance = confidence;
+                return resp;
+            }
+            cache_generation = exhibit_cache->generation(); // read below can't return payload erased before it
         }
-        return false;
-    }
 
-    DatabaseModule::~DatabaseModule()
-    {
-        logger->LogInfo("Finish work of database module");
+        std::optional<DatabaseResponse> resp = readExhibit(exhibit_id, rendition);
+        if (resp.has_value())
+        {
+            if (exhibit_cache)
+                exhibit_cache->insert(exhibit_id, rendition, resp.value(), cache_generation);
+            resp.value().percentage_of_confidance = confidence;
+        }
+        return resp;
     }
 
-    
     /**
-     * \brief Method for load local database (all descriptors and std::map for mapping descriptors and ids)
-     * \return true if loading successful
+     * \brief Internal method for read object info from exhibits table
+     * \param[in] exhibit_id id of object
+     * \param[in] rendition Size of returned image (full image if exhibit was added before renditions)
+     * \return Object info (with zero confidence) if successful or std::nullopt in another way
      */
-    [[nodiscard]] bool DatabaseModule::loadDatabase()
+    std::optional<DatabaseResponse> DatabaseModule::readExhibit(const CassUuid& exhibit_id, ImageRendition rendition)
     {
-        local_database_descriptor = cv::Mat(0, 32, CV_8UC1); // 32 - size of ORB descriptor
-        local_descriptor_to_id_map.clear();
+        ImageRendition read_rendition = rendition;
+        while (true)
+        {
+            StatementPtr get_exhibit_statement_ptr = exhibitPayloadStatement(read_rendition, exhibit_id);
+            FuturePtr query_future_ptr;
+            query_future_ptr.reset(cass_session_execute(session_ptr.get(), get_exhibit_statement_ptr.get()));
 
-        StatementPtr load_database_statement_ptr;
-        load_database_statement_ptr.reset(cass_statement_new("select id, descriptor from mpg_keyspace.exhibits", 0));
-        FuturePtr query_future_ptr;
-        query_future_ptr.reset(cass_session_execute(session_ptr.get(), load_database_statement_ptr.get()));
+            CassError rc = cass_future_error_code(query_future_ptr.get());
+            if (rc != CASS_OK)
+            {
+                const char *message;
+                size_t message_length;
+                cass_future_error_message(query_future_ptr.get(), &message, &message_length);
 
-        CassError rc = cass_future_error_code(query_future_ptr.get());
-        if (rc != CASS_OK)
-        {
-            const char *message;
-            size_t message_length;
-            cass_future_error_message(query_future_ptr.get(), &message, &message_length);
+                logger->LogError("DatabaseModule: Query error (" + std::string(cass_error_desc(rc)) + "): " + 
+                        std::string(message, message_length));
+                return std::nullopt;
+            }
 
-            logger->LogError("Query error (" + std::string(cass_error_desc(rc)) + "): " + std::string(message, message_length));
-            return false;
-        }
+            QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
 
-        QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
-        
-        IteratorPtr iter;
-        iter.reset(cass_iterator_from_result(result.get()));
+            const CassRow* row = cass_result_first_row(result.get());  
+            if (row == nullptr)
+            {
+                logger->LogError("DatabaseModule: nullptr cass row");
+                return std::nullopt;
+            }
 
-        while(cass_iterator_next(iter.get()))
-        {
-            const CassRow* row = cass_iterator_get_row(iter.get());
+            if (read_rendition != ImageRendition::Full && cass_value_is_null(cass_row_get_column_by_name(row, "image")))
+            {
+                read_rendition = ImageRendition::Full; // exhibit added before renditions were generated
+                continue;
+            }
 
-            if (!loadDatabaseHelper(row))
-                return false;
+            return readExhibitPayload(row, exhibit_id);
         }
-
-        return true;
     }
 
     /**
-     * \brief Internal method for loading database
-     * \param[in] row Cassanra row for getting data for local database
-     * Load one cassandra row
+     * \brief Internal method for check if exhibit row exists in exhibits table
+     * \param[in] exhibit_id id of object
+     * \return true if row exists, std::nullopt if query failed
      */
-    [[nodiscard]] bool DatabaseModule::loadDatabaseHelper(const CassRow* row)
+    std::optional<bool> DatabaseModule::isExhibitStored(const CassUuid& exhibit_id)
     {
-        CassUuid id;
-        cass_value_get_uuid(cass_row_get_column_by_name(row, "id"), &id);
+        StatementPtr select_id_statement_ptr;
+        select_id_statement_ptr.reset(cass_statement_new("select id from mpg_keyspace.exhibits where id=?", 1));
+        if (auto err = cass_statement_bind_uuid(select_id_statement_ptr.get(), 0, exhibit_id); err != CASS_OK)
+        {
+            logError(err, "Bind id to exhibit existence query");
+            return std::nullopt;
+        }
 
-        const cass_byte_t *descriptor_data = nullptr;
-        size_t descriptor_size = 0;
-        cass_value_get_bytes(cass_row_get_column_by_name(row, "descriptor"), &descriptor_data, &descriptor_size);
-        constexpr size_t descriptor_length = 32; // ORB descriptor for one keypoint has 32 bytes length
-        if (descriptor_size % descriptor_length != 0)
+        FuturePtr query_future_ptr;
+        query_future_ptr.reset(cass_session_execute(session_ptr.get(), select_id_statement_ptr.get()));
+        if (CassError rc = cass_future_error_code(query_future_ptr.get()); rc != CASS_OK)
         {
-            logger->LogError("DatabaseModule: Descriptor size mismatch: expected multiple of 32, got " + std::to_string(descriptor_size));
-            return false;
+            logError(rc, "Exhibit existence query");
+            return std::nullopt;
         }
-        const int num_keypoints = static_cast<int>(descriptor_size / descriptor_length);
-        std::vector<uint8_t> descriptor_buffer(descriptor_data, descriptor_data + descriptor_size);
-        cv::Mat descriptor_temp(num_keypoints, descriptor_length, CV_8UC1, descriptor_buffer.data());
-        cv::Mat descriptor = descriptor_temp.clone();
+        QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+        return cass_result_first_row(result.get()) != nullptr;
+    }
 
-        local_database_descriptor.push_back(descriptor);
-        for (int i = 0; i < descriptor.rows; ++i)
-            local_descriptor_to_id_map.push_back(id);
 
-        logger->LogInfo(std::string("Load database local_descriptor_to_id_map.size ") + std::to_string(local_descriptor_to_id_map.size()));
-        return true;
+    /**
+     * \brief Internal method for create select of exhibit payload (prepared if preparing succeeded)
+     * \param[in] rendition Size of image, it's returned in "image" column
+     * \param[in] exhibit_id id of object
+     * \return Statement with bound id
+     */
+    DatabaseModule::StatementPtr DatabaseModule::exhibitPayloadStatement(ImageRendition rendition, const CassUuid& exhibit_id)
+    {
+        StatementPtr statement_ptr;
+        const PreparedPtr& prepared = get_exhibit_prepared[static_cast<size_t>(rendition)];
+        if (prepared)
+            statement_ptr.reset(cass_prepared_bind(prepared.get()));
+        else
+            statement_ptr.reset(cass_statement_new(exhibitPayloadQuery(rendition).c_str(), 1));
+        cass_statement_bind_uuid(statement_ptr.get(), 0, exhibit_id);
+        return statement_ptr;
     }
 
     /**
-     * \brief Internal method for searchind id of object by it's descriptor
-     * \param[in] exhibit_descriptor Descriptor of object (must be ORB)
-     * \return id of object if search was successful or std::nullopt in other way
+     * \brief Internal method for get object info from row of payload select
+     * \param[in] row raw pointer to cassandra row with image, title and description
+     * \param[in] exhibit_id id of object
+     * \return object info (with zero confidence) if successful or std::nullopt in another way
      */
-    [[nodiscard]] std::optional<CassUuid> DatabaseModule::findExhibitUuid(const cv::Mat& exhibit_descriptor)
+    std::optional<DatabaseResponse> DatabaseModule::readExhibitPayload(const CassRow* row, const CassUuid& exhibit_id)
     {
-        PooledMatcher matcher = getMatcher();
-        std::vector< std::vector<cv::DMatch> > knn_matches;
-        //knn_matches.reserve(local_descriptor_to_id_map.size());
-        const int k = config->count_matches_knn;
-
-        matcher.matcher->knnMatch(exhibit_descriptor, knn_matches, k);
-        returnMatcher(matcher);       
-
-        if (knn_matches.size() == 0)
-        {
-            return std::nullopt;
-        }
-        
-        //const float ratio_threshold = config->match_ratio_threshold;
-        std::unordered_map<CassUuid, uint, std::hash<CassUuid>, CassUuidEqual> good_matches;
-
-        for (const auto& match: knn_matches)
+        std::optional<DatabaseResponse> resp = getExhibitHelper(row);
+        if (resp.has_value())
         {
-            CassUuid best_match_id = local_descriptor_to_id_map[match[0].trainIdx];
-            if (good_matches.find(best_match_id) == good_matches.end())
-                good_matches[best_match_id] = 1;
-            else
-                good_matches[best_match_id]++;
+            char id_str[37]; // 37 - size of cass uuid in string format
+            cass_uuid_string(exhibit_id, id_str);
+            resp.value().exhibit_id = std::string(id_str);
+            resp.value().exhibit_image_etag = imageETag(resp.value().exhibit_image); // cached with payload
+            resp.value().percentage_of_confidance = 0;
         }
+        return resp;
+    }
 
-        if (good_matches.size() == 0)
-        {
-            return std::nullopt;
-        }
-        CassUuid best_id;
-        uint best_count = 0;
-        for (const auto& [id, count]: good_matches)
+    /**
+     * \brief Internal method for prepare statements of hot read path (once per session)
+     * \return true if successful
+     */
+    bool DatabaseModule::prepareStatements()
+    {
+        for (size_t rendition = 0; rendition < image_renditions_count; ++rendition)
         {
-            if (count > best_count)
+            FuturePtr prepare_future_ptr;
+            prepare_future_ptr.reset(cass_session_prepare(session_ptr.get(),
+                                                          exhibitPayloadQuery(static_cast<ImageRendition>(rendition)).c_str()));
+            if (CassError rc = cass_future_error_code(prepare_future_ptr.get()); rc != CASS_OK)
             {
-                best_count = count;
-                best_id = id;
+                logError(rc, "Prepare exhibit select");
+                return false;
             }
+            get_exhibit_prepared[rendition].reset(cass_future_get_prepared(prepare_future_ptr.get()));
         }
-
-        return best_id;
+        return true;
     }
 
     /**
-     * \brief Method for getting object info from database by it's ORB descriptor
-     * \param[in] description ORB descriptor of object
-     * \return Object info if successful or std::nullopt in another way
-     * In process of work call findExhibitUuid
+     * \brief Internal method for fill exhibit cache by the most requested exhibits before restart
+     *
+     * Ids are read from file which is written next to snapshot on shutdown, payloads are read by concurrent queries
      */
-    [[nodiscard]] std::optional<DatabaseResponse> DatabaseModule::getExhibit(const cv::Mat& description)
+    void DatabaseModule::prefetchExhibitCache()
     {
-        /**
-         * table struct:
-         * * id CassUuid
-         * * descriptor blob
-         * * image blob
-         * * title text
-         * * desciption text
-         */
-        std::optional<CassUuid> exhibit_id = findExhibitUuid(description);
-        if (!exhibit_id.has_value())
+        if (!exhibit_cache || config->exhibit_cache_prefetch == 0 || config->snapshot_path.empty())
+            return;
+        std::ifstream stream(config->snapshot_path + ".hot");
+        if (!stream)
+            return;
+
+        std::vector<CassUuid> ids;
+        std::string line;
+        while (ids.size() < config->exhibit_cache_prefetch && std::getline(stream, line))
         {
-            logger->LogError("DatabaseModule: Couldn't found id for exhibit");
-            return std::nullopt;
+            CassUuid id;
+            if (cass_uuid_from_string(line.c_str(), &id) == CASS_OK)
+                ids.push_back(id);
         }
 
-
-        StatementPtr get_exhibit_statement_ptr;
-        get_exhibit_statement_ptr.reset(cass_statement_new("select image, title, description from mpg_keyspace.exhibits where id=?", 1));
-        cass_statement_bind_uuid(get_exhibit_statement_ptr.get(), 0, exhibit_id.value());
-        FuturePtr query_future_ptr;
-        query_future_ptr.reset(cass_session_execute(session_ptr.get(), get_exhibit_statement_ptr.get()));
-
-        CassError rc = cass_future_error_code(query_future_ptr.get());
-        if (rc != CASS_OK)
+        // responses of recognition use default rendition
+        const ImageRendition rendition = imageRenditionFromName(config->default_image_rendition).value_or(ImageRendition::Full);
+        const auto started_at = std::chrono::steady_clock::now();
+        size_t prefetched_count = 0;
+        for (size_t first = 0; first < ids.size(); first += catch_up_window)
         {
-            const char *message;
-            size_t message_length;
-            cass_future_error_message(query_future_ptr.get(), &message, &message_length);
+            const uint64_t cache_generation = exhibit_cache->generation();
+            std::vector<FuturePtr> futures;
+            const size_t end = std::min(first + catch_up_window, ids.size());
+            for (size_t i = first; i < end; ++i)
+            {
+                StatementPtr get_exhibit_statement_ptr = exhibitPayloadStatement(rendition, ids[i]);
+                futures.emplace_back(cass_session_execute(session_ptr.get(), get_exhibit_statement_ptr.get()));
+            }
 
-            logger->LogError("DatabaseModule: Query error (" + std::string(cass_error_desc(rc)) + "): " + 
-                    std::string(message, message_length));
-            return std::nullopt;
+            for (size_t i = first; i < end; ++i)
+            {
+                FuturePtr& query_future_ptr = futures[i - first];
+                if (cass_future_error_code(query_future_ptr.get()) != CASS_OK)
+                    continue; // prefetch is only optimization
+                QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
+                const CassRow* row = cass_result_first_row(result.get());
+                if (row == nullptr || cass_value_is_null(cass_row_get_column_by_name(row, "image")))
+                    continue; // exhibit was deleted or has no rendition
+                std::optional<DatabaseResponse> resp = readExhibitPayload(row, ids[i]);
+                if (resp.has_value() && exhibit_cache->insert(ids[i], rendition, std::make_shared<const DatabaseResponse>(
+                                                                  std::move(resp.value())), cache_generation, true))
+                    ++prefetched_count;
+            }
         }
 
-        QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
-
-        const CassRow* row = cass_result_first_row(result.get());  
-        if (row == nullptr)
-        {
-            logger->LogError("DatabaseModule: nullptr cass row");
-            return std::nullopt;
-        }
-            
+        const auto prefetch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at);
+        logger->LogInfo("DatabaseModule: prefetched " + std::to_string(prefetched_count) + " exhibits to cache in " +
+                        std::to_string(prefetch_ms.count()) + " ms");
+    }
 
-        std::optional resp = getExhibitHelper(row);
-        if (resp.has_value())
+    /**
+     * \brief Internal method for write ids of the most requested cached exhibits next to snapshot (read by prefetchExhibitCache)
+     */
+    void DatabaseModule::saveHotExhibits()
+    {
+        if (!exhibit_cache || config->exhibit_cache_prefetch == 0 || config->snapshot_path.empty())
+            return;
+        const std::vector<CassUuid> ids = exhibit_cache->hottest(config->exhibit_cache_prefetch);
+        if (ids.empty())
+            return;
+
+        std::ofstream stream(config->snapshot_path + ".hot", std::ios::trunc);
+        for (const CassUuid& id : ids)
         {
             char id_str[37]; // 37 - size of cass uuid in string format
-            cass_uuid_string(exhibit_id.value(), id_str);
-            resp.value().exhibit_id = std::string(id_str);
+            cass_uuid_string(id, id_str);
+            stream << id_str << '\n';
         }
-
-        return resp;
+        if (!stream)
+            logger->LogWarning("DatabaseModule: cannot write hot exhibits next to snapshot " + config->snapshot_path);
     }
 
     /**
@@ -336,24 +1556,27 @@ namespace MPG
      */
     [[nodiscard]] bool DatabaseModule::addExhibit(const DatabaseRequest& exhibit_data)
     {
+        if (exhibit_data.exhibit_descriptor.type() != CV_8UC1 || exhibit_data.exhibit_descriptor.cols != descriptor_bytes)
+        {
+            logger->LogError(std::string("DatabaseModule: descriptors of added exhibit aren't ") + featureTypeName(feature_type) + " descriptors");
+            return false;
+        }
         size_t title_size = exhibit_data.exhibit_title.size();
         size_t desc_size = exhibit_data.exhibit_description.size();
 
-        size_t image_size = exhibit_data.exhibit_image.size();
+        size_t image_size = exhibit_data.exhibit_image.size() + exhibit_data.exhibit_thumbnail_image.size() +
+                            exhibit_data.exhibit_mobile_image.size();
         size_t descriptor_size = exhibit_data.exhibit_descriptor.total() * exhibit_data.exhibit_descriptor.elemSize();
 
         size_t total_bytes = title_size + desc_size + image_size + descriptor_size;
 
         double total_mb = static_cast<double>(total_bytes) / (1024.0 * 1024.0);
         logger->LogInfo("Add exhibit request size: " + std::to_string(total_mb));
-        std::cout << sizeof(exhibit_data) << std::endl;
-
-        
-
 
         StatementPtr add_exhibit_statement_ptr;
         add_exhibit_statement_ptr.reset(
-            cass_statement_new("insert into mpg_keyspace.exhibits (id, image, title, description, descriptor) values (?, ?, ?, ?, ?)", 5));
+            cass_statement_new("insert into mpg_keyspace.exhibits (id, image, title, description, descriptor, keypoints, thumbnail, mobile_image) "
+                               "values (?, ?, ?, ?, ?, ?, ?, ?)", 8));
         CassUuid exhibit_id;
         cass_uuid_gen_random(id_generator_ptr.get(), &exhibit_id);
         if (auto err = cass_statement_bind_uuid(add_exhibit_statement_ptr.get(), 0, exhibit_id); err != CASS_OK)
@@ -386,6 +1609,32 @@ namespace MPG
             logError(err, "Bind image descriptor to add new exhibit query");
             return false;
         }
+        // keypoints are optional, exhibit without them isn't geometrically verified
+        const bool has_keypoints = exhibit_data.exhibit_keypoints.size() == static_cast<size_t>(exhibit_data.exhibit_descriptor.rows);
+        const CassError keypoints_err = has_keypoints ?
+            cass_statement_bind_bytes(add_exhibit_statement_ptr.get(), 5,
+                                      reinterpret_cast<const cass_byte_t*>(exhibit_data.exhibit_keypoints.data()),
+                                      exhibit_data.exhibit_keypoints.size() * sizeof(cv::Point2f)) :
+            cass_statement_bind_null(add_exhibit_statement_ptr.get(), 5);
+        if (keypoints_err != CASS_OK)
+        {
+            logError(keypoints_err, "Bind image keypoints to add new exhibit query");
+            return false;
+        }
+        // renditions are optional, full image is returned instead of missing one
+        const std::vector<uint8_t>* renditions[] = {&exhibit_data.exhibit_thumbnail_image, &exhibit_data.exhibit_mobile_image};
+        for (size_t i = 0; i < std::size(renditions); ++i)
+        {
+            const CassError rendition_err = renditions[i]->empty() ?
+                cass_statement_bind_null(add_exhibit_statement_ptr.get(), 6 + i) :
+                cass_statement_bind_bytes(add_exhibit_statement_ptr.get(), 6 + i,
+                                          reinterpret_cast<const cass_byte_t*>(renditions[i]->data()), renditions[i]->size());
+            if (rendition_err != CASS_OK)
+            {
+                logError(rendition_err, "Bind image rendition to add new exhibit query");
+                return false;
+            }
+        }
 
         FuturePtr query_future_ptr;
         query_future_ptr.reset(cass_session_execute(session_ptr.get(), add_exhibit_statement_ptr.get()));
@@ -401,19 +1650,34 @@ namespace MPG
                         std::string(message, message_length));
             return false;
         }
-
-        std::unique_lock<std::mutex> ul(local_database_mtx);
-        local_database_descriptor.push_back(exhibit_data.exhibit_descriptor);
-        for (int i = 0; i < exhibit_data.exhibit_descriptor.rows; ++i)
+        // change is written after exhibit, so other replicas which read it can load exhibit
+        if (!writeChange(exhibit_id, false))
+            logger->LogWarning("DatabaseModule: added exhibit isn't written to changelog");
+        if (!isShardExhibit(exhibit_id))
         {
-            local_descriptor_to_id_map.push_back(exhibit_id);
+            // shard of exhibit loads it from changelog
+            logger->LogInfo("DatabaseModule: exhibit is added to shard " + std::to_string(exhibitShard(exhibit_id, config->shard_count)));
+            return true;
         }
+
+        std::unique_lock<std::mutex> ul(local_database_mtx);
+        local_database->addExhibit(exhibit_id, exhibit_data.exhibit_descriptor, exhibit_data.exhibit_keypoints);
+        std::unique_lock<std::shared_mutex> bow_ul(bow_mtx);
+        const bool is_bow_trained = bow_index && !bow_index->empty();
+        if (is_bow_trained)
+            bow_index->addExhibit(local_database->exhibitOrdinals().at(exhibit_id), exhibit_data.exhibit_descriptor);
+        const bool is_bow_enabled = bow_index != nullptr;
+        bow_ul.unlock();
         ul.unlock();
+        ++changes_version;
+        const size_t rows_count = local_database->snapshot()->rowsCount();
 
-        logger->LogInfo(std::string
-            ("Add exhibit database local_descriptor_to_id_map.size ") + std::to_string(local_descriptor_to_id_map.size()));
+        logger->LogInfo(std::string("Add exhibit database local rows ") + std::to_string(rows_count));
+        is_snapshot_dirty = true;
+        requestCompaction();
 
-        initMatchersPool();
+        if (is_bow_enabled && !is_bow_trained)
+            initBowIndex(); // vocabulary couldn't be trained on empty database
 
         return true;
     }
@@ -426,15 +1690,24 @@ namespace MPG
     bool DatabaseModule::deleteExhibit(const std::string& exhibit_id)
     {
         CassUuid id;
-        cass_uuid_from_string(exhibit_id.c_str(), &id);
-        CassUuidEqual id_equal;
-        auto id_equal_pred = [&id, &id_equal](const CassUuid& other_id)
+        if (cass_uuid_from_string(exhibit_id.c_str(), &id) != CASS_OK)
         {
-            return id_equal(id, other_id);
-        };
+            logger->LogError("DatabaseModule: cannot delete exhibit, invalid id " + exhibit_id);
+            return false;
+        }
 
-        if (std::find_if(local_descriptor_to_id_map.begin(), local_descriptor_to_id_map.end(), id_equal_pred) == 
-                         local_descriptor_to_id_map.end())
+        std::unique_lock<std::mutex> ul(local_database_mtx);
+        bool is_found = local_database->contains(id);
+        ul.unlock();
+        // exhibit of other shard isn't kept locally, its row is checked before delete is written to changelog
+        if (!is_found && !isShardExhibit(id))
+        {
+            const std::optional<bool> is_stored = isExhibitStored(id);
+            if (!is_stored.has_value())
+                return false;
+            is_found = is_stored.value();
+        }
+        if (!is_found)
         {
             logger->LogError("DatabaseModule: cannot delete exhibit with id " + exhibit_id + ", not found");
             return false;
@@ -467,27 +1740,17 @@ namespace MPG
 
 
 
-        cv::Mat updated_descriptors;
-        std::vector<CassUuid> updated_id_map;
-        std::unique_lock<std::mutex> ul(local_database_mtx);
-        for (size_t i = 0; i < local_descriptor_to_id_map.size(); ++i)
-        {
-            if (!id_equal(local_descriptor_to_id_map[i], id))
-            {
-                updated_descriptors.push_back(local_database_descriptor.row(i));
-                updated_id_map.push_back(local_descriptor_to_id_map[i]);
-            }
-        }
+        if (!writeChange(id, true))
+            logger->LogWarning("DatabaseModule: delete of exhibit " + exhibit_id + " isn't written to changelog");
 
-        local_database_descriptor = std::move(updated_descriptors);
-        local_descriptor_to_id_map = std::move(updated_id_map);
+        ul.lock();
+        unloadExhibit(id);
         ul.unlock();
-        logger->LogInfo(std::string
-            ("Delete exhibit database local_descriptor_to_id_map.size ") + std::to_string(local_descriptor_to_id_map.size()));
-        logger->LogInfo(std::string
-            ("Delete exhibit database local_descriptor.rows ") + std::to_string(local_database_descriptor.rows));
-
-        initMatchersPool();
+        ++changes_version;
+        const size_t live_rows_count = local_database->snapshot()->liveRowsCount();
+        logger->LogInfo(std::string("Delete exhibit database local live rows ") + std::to_string(live_rows_count));
+        is_snapshot_dirty = true;
+        requestCompaction();
 
         return true;
     }
@@ -495,14 +1758,42 @@ namespace MPG
      /**
      * \brief Method for get data chunk from database
      * \param[in] next_chunk_token string version of next database page token (it is empty if you need first chunk)
+     * \param[in] fields Columns of exhibits in chunk
      * \return Chunk of database if successful, either std::nullopt
      */
-    std::optional<DatabaseChunk> DatabaseModule::getDatabaseChunk(const std::string& next_chunk_token)
+    std::optional<DatabaseChunk> DatabaseModule::getDatabaseChunk(const std::string& next_chunk_token, const ChunkFields& fields)
     {
-        std::string query = "select id, image, title, description from mpg_keyspace.exhibits";
+        std::vector<DatabaseResponse> exhibits;
+        auto chunk = visitDatabaseChunk(next_chunk_token, fields, [&exhibits](const ExhibitRowView& row)
+        {
+            DatabaseResponse response;
+            response.exhibit_id = std::string(row.exhibit_id);
+            response.exhibit_name = std::string(row.exhibit_name);
+            response.exhibit_description = std::string(row.exhibit_description);
+            response.exhibit_image.assign(row.exhibit_image, row.exhibit_image + row.exhibit_image_size);
+            exhibits.push_back(std::move(response));
+        });
+        if (chunk.has_value())
+            chunk->exhibits = std::move(exhibits);
+        return chunk;
+    }
+
+     /**
+     * \brief Method for read data chunk from database without copy of rows
+     * \param[in] next_chunk_token string version of next database page token (it is empty if you need first chunk)
+     * \param[in] fields Columns of exhibits in chunk, columns which aren't selected aren't read from Cassandra
+     * \param[in] visitor Function called for every row as it's decoded from Cassandra result
+     * \return Chunk of database without exhibits (next page token) if successful, either std::nullopt
+     *
+     * Rows count of page is chosen by database_chunk_bytes budget (database_chunk_size rows if it's 0)
+     */
+    std::optional<DatabaseChunk> DatabaseModule::visitDatabaseChunk(const std::string& next_chunk_token, const ChunkFields& fields,
+                                                                    const ExhibitRowVisitor& visitor)
+    {
+        const std::string query = chunkSelectQuery(fields);
         StatementPtr  get_chunk_statement(cass_statement_new(query.c_str(), 0));
-        const int chunk_size = config->database_chunk_size;
-        cass_statement_set_paging_size(get_chunk_statement.get(), chunk_size);
+        const size_t chunk_size = chunk_page_sizer->pageRows(fields.image);
+        cass_statement_set_paging_size(get_chunk_statement.get(), static_cast<int>(chunk_size));
 
         if (!next_chunk_token.empty())
         {
@@ -533,17 +1824,24 @@ namespace MPG
         QueryResultPtr result(cass_future_get_result(query_future_ptr.get()));
 
         DatabaseChunk chunk;
-        CassIterator *it = cass_iterator_from_result(result.get());
-        while (cass_iterator_next(it))
+        size_t rows_count = 0;
+        size_t rows_bytes = 0;
+        char id_str[CASS_UUID_STRING_LENGTH];
+        // visitor can throw (e.g. serialization of invalid UTF-8), iterator is freed anyway
+        IteratorPtr iter;
+        iter.reset(cass_iterator_from_result(result.get()));
+        while (cass_iterator_next(iter.get()))
         {
-            const CassRow *row = cass_iterator_get_row(it);
-            auto current_exhibit = getDatabaseChunkHelper(row);
-            if (current_exhibit.has_value())
+            const CassRow *row = cass_iterator_get_row(iter.get());
+            ExhibitRowView current_exhibit;
+            if (getDatabaseChunkHelper(row, fields, id_str, current_exhibit))
             {
-                chunk.exhibits.push_back(current_exhibit.value());
+                ++rows_count;
+                rows_bytes += current_exhibit.bytes();
+                visitor(current_exhibit);
             }
         }
-        cass_iterator_free(it);
+        chunk_page_sizer->record(fields.image, rows_count, rows_bytes);
 
         const char *paging_state = nullptr;
         size_t paging_state_length = 0;
@@ -565,122 +1863,253 @@ namespace MPG
      /**
      * \brief Internal method for get chunk record info from cassandra row
      * \param[in] row Raw pinter to cassandra row with record info
-     * \return Object info if successful or std::nullopt
+     * \param[in] fields Columns selected from database
+     * \param[out] id_str Buffer for string form of id, exhibit_id of row points to it
+     * \param[out] exhibit Object info, it points into row (image isn't copied)
+     * \return true if successful
      */
-    std::optional<DatabaseResponse> DatabaseModule::getDatabaseChunkHelper(const CassRow* row)
+    bool DatabaseModule::getDatabaseChunkHelper(const CassRow* row, const ChunkFields& fields,
+                                                char (&id_str)[CASS_UUID_STRING_LENGTH], ExhibitRowView& exhibit)
     {
         CassUuid id;
         if (CassError err = cass_value_get_uuid(cass_row_get_column_by_name(row, "id"), &id); err != CASS_OK)
         {
             logError(err, "Failed to get id from database row for chunk");
-            return std::nullopt;
+            return false;
         };
-        char id_str[37]; // 37 - cass uuid standart sise in string form
         cass_uuid_string(id, id_str);
-        std::string exhibit_id(id_str);
+        exhibit.exhibit_id = std::string_view(id_str);
 
-        const cass_byte_t *image_data = nullptr;
-        size_t image_size_bytes = 0;
-        if (CassError err = cass_value_get_bytes(cass_row_get_column_by_name(row, "image"), &image_data, &image_size_bytes); err != CASS_OK)
+        if (fields.image)
         {
-            logError(err, "Failed to get image from database row for chunk");
-            return std::nullopt;
-        };
-        
-        std::vector<uint8_t> image_buffer(image_data, image_data + image_size_bytes);
+            const cass_byte_t *image_data = nullptr;
+            size_t image_size_bytes = 0;
+            if (CassError err = cass_value_get_bytes(cass_row_get_column_by_name(row, "image"), &image_data, &image_size_bytes); err != CASS_OK)
+            {
+                logError(err, "Failed to get image from database row for chunk");
+                return false;
+            };
+            exhibit.exhibit_image = image_data;
+            exhibit.exhibit_image_size = image_size_bytes;
+        }
 
-        const char *title_data;
-        size_t title_length;
-        CassError err = cass_value_get_string(cass_row_get_column_by_name(row, "title"), &title_data, &title_length);
-        if (err != CASS_OK)
+        if (fields.title)
         {
-            logError(err, "Failed to get title from database row for chunk");
-            return std::nullopt;
+            const char *title_data;
+            size_t title_length;
+            CassError err = cass_value_get_string(cass_row_get_column_by_name(row, "title"), &title_data, &title_length);
+            if (err != CASS_OK)
+            {
+                logError(err, "Failed to get title from database row for chunk");
+                return false;
+            }
+            exhibit.exhibit_name = std::string_view(title_data, title_length);
         }
-        std::string exhibit_title(title_data, title_length);
 
-
-        const char *decription_data;
-        size_t description_length;
-        err = cass_value_get_string(cass_row_get_column_by_name(row, "description"), &decription_data, &description_length);
-        if (err != CASS_OK)
+        if (fields.description)
         {
-            logError(err, "Failed to get description from database row for chunk");
-            return std::nullopt;
+            const char *decription_data;
+            size_t description_length;
+            CassError err = cass_value_get_string(cass_row_get_column_by_name(row, "description"), &decription_data, &description_length);
+            if (err != CASS_OK)
+            {
+                logError(err, "Failed to get description from database row for chunk");
+                return false;
+            }
+            exhibit.exhibit_description = std::string_view(decription_data, description_length);
         }
-        std::string exhibit_description(decription_data, description_length);
-        
-        DatabaseResponse response;
-        response.exhibit_id = std::move(exhibit_id);
-        response.exhibit_description = std::move(exhibit_description);
-        response.exhibit_image = std::move(image_buffer);
-        response.exhibit_name = std::move(exhibit_title);
-        return response;
+        return true;
     }
 
 
      /**
-     * \brief Internal method for create and train cv matchers for searching objects in local database
+     * \brief Internal method for build descriptor index (type from config) for all sealed segments of local database
      * \return true if successful, either false
      */
-    bool DatabaseModule::initMatchersPool()
+    bool DatabaseModule::initDescriptorIndex()
     {
-        std::shared_ptr<MatcherPool> new_pool = std::make_shared<MatcherPool>();
-        const size_t pool_size = config->matchers_pool_size;
-
-        for (size_t i = 0; i < pool_size; ++i)
+        if (!createDescriptorIndex(*config))
         {
-            MatcherPtr matcher = cv::DescriptorMatcher::create(cv::DescriptorMatcher::BRUTEFORCE_HAMMING);
-            matcher->add(local_database_descriptor);
-            matcher->train();
-            new_pool->pool.push(matcher);
+            logger->LogError("DatabaseModule: unknown descriptor index type " + config->descriptor_index_type);
+            return false;
         }
 
+        while (compactLocalDatabase())
         {
-            std::lock_guard<std::mutex> lock(matchers_pool_switch_mtx);
-            matchers_pool = new_pool; 
         }
 
+        SegmentedIndex::SnapshotGuard snapshot = local_database->snapshot();
+        logger->LogInfo("DatabaseModule: " + local_database->indexName() + " descriptor index built over " +
+                        std::to_string(snapshot->liveRowsCount()) + " descriptors in " +
+                        std::to_string(snapshot->segmentsCount()) + " segments");
         return true;
     }
 
      /**
-     * \brief Internal method for get matcher from pool
-     * \return Matcher object (wait while it will be available)
-     * 
-     * Don't forget to return mathcer to pool!
+     * \brief Internal method for train vocabulary and build bag of words index over local database
+     * \return true if successful (empty database is not an error, index will be built on first add)
      */
-    PooledMatcher DatabaseModule::getMatcher()
+    bool DatabaseModule::initBowIndex()
     {
-        std::shared_ptr<MatcherPool> current_pool;
+        if (descriptor_bytes != VocabularyTree::descriptor_bytes)
         {
-            std::lock_guard<std::mutex> lock(matchers_pool_switch_mtx);
-            current_pool = matchers_pool;
+            logger->LogWarning(std::string("DatabaseModule: bag of words index supports only ORB features, it's disabled for ") +
+                               featureTypeName(feature_type));
+            return true;
         }
+        std::unique_ptr<BowIndex> index = std::make_unique<BowIndex>();
 
-        std::unique_lock<std::mutex> ul(current_pool->mtx);
-        current_pool->cv.wait(ul, [&current_pool]
-                              { return !current_pool->pool.empty(); });
+        cv::Mat live_descriptors;
+        std::vector<SegmentedIndex::ExhibitOrdinal> live_row_ordinals;
+        // writers wait while vocabulary is trained, search isn't blocked
+        std::unique_lock<std::mutex> ul(local_database_mtx);
+        local_database->snapshot()->exportLiveRows(live_descriptors, live_row_ordinals);
+        if (live_descriptors.rows > 0 &&
+            !index->build(live_descriptors, live_row_ordinals,
+                          config->bow_branching, config->bow_depth, config->bow_iterations))
+        {
+            logger->LogError("DatabaseModule: cannot build bag of words index");
+            return false;
+        }
+        const size_t words_count = index->wordsCount();
+        const size_t exhibits_count = index->exhibitsCount();
+        std::unique_lock<std::shared_mutex> bow_ul(bow_mtx);
+        bow_index = std::move(index);
+        bow_ul.unlock();
+        ul.unlock();
 
-        MatcherPtr matcher = current_pool->pool.front();
-        current_pool->pool.pop();
+        logger->LogInfo("DatabaseModule: bag of words index built, words " + std::to_string(words_count) +
+                        ", exhibits " + std::to_string(exhibits_count));
+        return true;
+    }
 
-        return {matcher, current_pool};
+     /**
+     * \brief Internal method for choose exhibits similar to query by bag of words index
+     * \param[in] exhibit_descriptor Query descriptors
+     * \param[out] shortlist Ordinals of shortlisted exhibits
+     * \return false if bag of words index isn't built
+     */
+    bool DatabaseModule::shortlistExhibits(const cv::Mat& exhibit_descriptor, std::vector<SegmentedIndex::ExhibitOrdinal>& shortlist)
+    {
+        std::shared_lock<std::shared_mutex> bow_sl(bow_mtx);
+        if (!bow_index || bow_index->empty())
+            return false;
+        bow_index->shortlist(exhibit_descriptor, config->bow_shortlist_size, shortlist);
+        return true;
     }
 
-    /**
-     * \brief Internal method for return matcher to pool
+     /**
+     * \brief Internal method for search nearest descriptors only in exhibits shortlisted by bag of words index
+     * \param[in] snapshot Pinned local database snapshot
+     * \param[in] shortlist Ordinals of shortlisted exhibits
+     * \param[in] exhibit_descriptor Query descriptors
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] knn_matches Flat buffer with neighbours (rows of snapshot)
+     * \return true if successful
+     *
+     * Bag of words index can be newer than snapshot, so rows of exhibits are resolved by snapshot,
+     * exhibits without live rows in it are skipped
+     */
+    bool DatabaseModule::knnSearchShortlist(const SegmentedIndex::Snapshot& snapshot,
+                                            const std::vector<SegmentedIndex::ExhibitOrdinal>& shortlist,
+                                            const cv::Mat& exhibit_descriptor, size_t k, std::vector<HammingMatch>& knn_matches)
+    {
+        thread_local std::vector<HammingMatch> range_matches;
+
+        resetKnnMatches(knn_matches, exhibit_descriptor.rows, k);
+        for (SegmentedIndex::ExhibitOrdinal ordinal : shortlist)
+        {
+            RowRange range;
+            cv::Mat range_descriptor;
+            if (!snapshot.ordinalRows(ordinal, range) || !snapshot.rangeDescriptors(range, range_descriptor))
+                continue;
+            if (!hammingKnnMatch(exhibit_descriptor, range_descriptor, k, range_matches))
+                return false;
+            mergeKnnMatches(knn_matches, range_matches, k, range.first_row);
+        }
+        return true;
+    }
+
+     /**
+     * \brief Internal method for one step of local database compaction (see SegmentedIndex)
+     * \return true if some segments were compacted
+     *
+     * New segment is built without locks, writers lock is taken only for publish of snapshot with it
      */
-    void DatabaseModule::returnMatcher(PooledMatcher matcher)
+    bool DatabaseModule::compactLocalDatabase()
     {
-        const auto &origin_pool = matcher.origin_pool_ptr;
+        SegmentedIndex::Compaction compaction;
+        if (!local_database->prepareCompaction(compaction))
+            return false;
+
+        if (!local_database->buildCompaction(compaction))
+        {
+            logger->LogError("DatabaseModule: cannot build " + local_database->indexName() + " index of compacted segment");
+            return false;
+        }
+
+        std::unique_lock<std::mutex> ul(local_database_mtx);
+        // bag of words index refers to exhibits by ordinals, which aren't changed by compaction
+        if (!local_database->applyCompaction(compaction))
+            return false;
+        const size_t retired_count = local_database->reclaim();
+        ul.unlock();
+
+        SegmentedIndex::SnapshotGuard snapshot = local_database->snapshot();
+        const size_t segments_count = snapshot->segmentsCount();
+        const size_t rows_count = snapshot->rowsCount();
+
+        logger->LogInfo("DatabaseModule: local database compacted, segments " + std::to_string(segments_count) +
+                        ", rows " + std::to_string(rows_count) + ", snapshots waiting for readers " +
+                        std::to_string(retired_count));
+        return true;
+    }
 
+     /**
+     * \brief Internal method of background thread, which compacts local database after add and delete
+     *
+     * If snapshot file is enabled, thread also rewrites it every snapshot_interval_s while local database changes
+     */
+    void DatabaseModule::compactionLoop()
+    {
+        const auto snapshot_interval = std::chrono::seconds(std::max<size_t>(config->snapshot_interval_s, 1));
+        const bool is_snapshot_enabled = !config->snapshot_path.empty();
+        std::unique_lock<std::mutex> ul(compaction_mtx);
+        while (true)
         {
-            std::lock_guard<std::mutex> lg(origin_pool->mtx);
-            origin_pool->pool.push(matcher.matcher);
+            const auto is_woken = [this]() { return is_compaction_stopped || is_compaction_requested; };
+            if (is_snapshot_enabled)
+                compaction_cv.wait_for(ul, snapshot_interval, is_woken);
+            else
+                compaction_cv.wait(ul, is_woken);
+            if (is_compaction_stopped)
+                return;
+            is_compaction_requested = false;
+            ul.unlock();
+
+            bool is_compacted = true;
+            while (is_compacted)
+            {
+                is_compacted = compactLocalDatabase();
+                std::lock_guard<std::mutex> lg(compaction_mtx);
+                if (is_compaction_stopped)
+                    is_compacted = false;
+            }
+
+            if (is_snapshot_enabled && is_snapshot_dirty &&
+                std::chrono::steady_clock::now() - snapshot_saved_at >= snapshot_interval)
+                saveSnapshot();
+            ul.lock();
         }
+    }
 
-        origin_pool->cv.notify_one();
+    void DatabaseModule::requestCompaction()
+    {
+        {
+            std::lock_guard<std::mutex> lg(compaction_mtx);
+            is_compaction_requested = true;
+        }
+        compaction_cv.notify_one();
     }
 
     void DatabaseModule::logCallback(const CassLogMessage* message, void* data)
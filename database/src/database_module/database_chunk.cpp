@@ -0,0 +1,104 @@
+#include "database_module/database_chunk.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Function for parse fields parameter of database chunk
+     * \param[in] names Comma separated field names ("id", "title", "description", "image"), spaces around names are
+     * ignored, empty means all fields
+     * \return Selected fields or std::nullopt if some name is unknown
+     */
+    std::optional<ChunkFields> chunkFieldsFromNames(const std::string& names)
+    {
+        if (names.empty())
+            return ChunkFields();
+
+        ChunkFields fields{false, false, false};
+        std::stringstream names_stream(names);
+        std::string name;
+        while (std::getline(names_stream, name, ','))
+        {
+            // "id, title" is accepted as well as "id,title"
+            const size_t first = name.find_first_not_of(" \t");
+            name = first == std::string::npos ? std::string() : name.substr(first, name.find_last_not_of(" \t") - first + 1);
+            if (name == "title")
+                fields.title = true;
+            else if (name == "description")
+                fields.description = true;
+            else if (name == "image")
+                fields.image = true;
+            else if (name != "id")
+                return std::nullopt;
+        }
+        return fields;
+    }
+
+    /**
+     * \brief Function for build select of database chunk, columns which aren't selected aren't read by Cassandra
+     * \param[in] fields Selected fields
+     * \return CQL query
+     */
+    std::string chunkSelectQuery(const ChunkFields& fields)
+    {
+        std::string query = "select id";
+        if (fields.title)
+            query += ", title";
+        if (fields.description)
+            query += ", description";
+        if (fields.image)
+            query += ", image";
+        return query + " from mpg_keyspace.exhibits";
+    }
+
+    /**
+     * \brief Constructor of page sizer
+     * \param[in] budget_bytes Desired size of exhibits in page (0 means fixed_rows rows in every page)
+     * \param[in] fixed_rows Rows count of page while average row size is unknown
+     * \param[in] max_rows Maximal rows count of page
+     */
+    ChunkPageSizer::ChunkPageSizer(size_t budget_bytes, size_t fixed_rows, size_t max_rows)
+        : budget_bytes(budget_bytes), fixed_rows(std::max<size_t>(fixed_rows, 1)),
+          max_rows(std::max<size_t>(max_rows, 1)), row_bytes{0, 0}
+    {
+    }
+
+    /**
+     * \brief Method for get rows count of the next page
+     * \param[in] has_image true if image is selected
+     * \return Rows count in [1, max_rows] (fixed_rows if budget is disabled)
+     */
+    size_t ChunkPageSizer::pageRows(bool has_image) const
+    {
+        if (budget_bytes == 0)
+            return fixed_rows;
+        const size_t estimate = row_bytes[has_image].load(std::memory_order_relaxed);
+        if (estimate == 0)
+            return std::min(fixed_rows, max_rows);
+        return std::clamp<size_t>(budget_bytes / estimate, 1, max_rows);
+    }
+
+    /**
+     * \brief Method for add read page to average row size
+     * \param[in] has_image true if image was selected
+     * \param[in] rows_count Count of rows in page
+     * \param[in] bytes Size of exhibits in page (ExhibitRowView::bytes)
+     *
+     * Average is exponential (new page has weight 1/4), so estimate follows changes of exhibits
+     */
+    void ChunkPageSizer::record(bool has_image, size_t rows_count, size_t bytes)
+    {
+        if (rows_count == 0)
+            return;
+        const size_t page_row_bytes = std::max<size_t>((bytes + rows_count - 1) / rows_count, 1);
+        const size_t estimate = row_bytes[has_image].load(std::memory_order_relaxed);
+        // concurrent pages may overwrite each other, estimate is only a hint
+        row_bytes[has_image].store(estimate == 0 ? page_row_bytes : (3 * estimate + page_row_bytes) / 4,
+                                   std::memory_order_relaxed);
+    }
+
+}
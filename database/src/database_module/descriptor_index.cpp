@@ -0,0 +1,115 @@
+#include "database_module/descriptor_index.hpp"
+#include "database_module/mih_index.hpp"
+#include "database_module/hnsw_index.hpp"
+
+#include <config.hpp>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Constructor of parallel brute force index
+     * \param[in] pool Search pool shared by indexes
+     * \param[in] shard_rows Count of database rows searched by one task
+     */
+    BruteForceIndex::BruteForceIndex(const std::shared_ptr<SearchPool>& pool, size_t shard_rows)
+        : search_pool(pool), shard_rows(std::max<size_t>(shard_rows, 1))
+    {
+    }
+
+    /**
+     * \brief Method for build brute force index (only keeps descriptors header)
+     * \param[in] descriptors Database descriptors (CV_8UC1, one descriptor per row)
+     * \return true if descriptors type is supported
+     */
+    bool BruteForceIndex::build(const cv::Mat& descriptors)
+    {
+        if (!descriptors.empty() && descriptors.type() != CV_8UC1)
+            return false;
+        database_descriptors = descriptors;
+        return true;
+    }
+
+    /**
+     * \brief Method for k nearest neighbours search over all database descriptors
+     * \param[in] query Query descriptors (CV_8UC1, one descriptor per row)
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] matches Flat buffer with query.rows * k neighbours
+     * \return true if search was successful
+     */
+    bool BruteForceIndex::knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const
+    {
+        if (database_descriptors.empty())
+        {
+            matches.assign(static_cast<size_t>(query.rows) * k, {-1, INT_MAX});
+            return true;
+        }
+
+        const size_t database_rows = database_descriptors.rows;
+        const size_t shards_count = search_pool ? (database_rows + shard_rows - 1) / shard_rows : 1;
+        if (shards_count < 2)
+            return hammingKnnMatch(query, database_descriptors, k, matches);
+
+        SearchPool::QueryScope query_scope(*search_pool);
+        const size_t participants = std::min(query_scope.parallelism(), shards_count);
+        if (participants < 2)
+            return hammingKnnMatch(query, database_descriptors, k, matches);
+
+        thread_local std::vector<std::vector<HammingMatch>> participant_matches;
+        if (participant_matches.size() < participants)
+            participant_matches.resize(participants);
+        for (size_t i = 0; i < participants; ++i)
+            resetKnnMatches(participant_matches[i], query.rows, k);
+
+        std::vector<std::vector<HammingMatch>>& results = participant_matches;
+        std::atomic<bool> is_ok(true);
+        search_pool->run(shards_count, participants, [&](size_t shard, size_t participant)
+        {
+            thread_local std::vector<HammingMatch> shard_matches;
+            const int first_row = static_cast<int>(shard * shard_rows);
+            const int last_row = static_cast<int>(std::min(database_rows, (shard + 1) * shard_rows));
+            if (!hammingKnnMatch(query, database_descriptors.rowRange(first_row, last_row), k, shard_matches))
+            {
+                is_ok = false;
+                return;
+            }
+            mergeKnnMatches(results[participant], shard_matches, k, first_row);
+        });
+        if (!is_ok)
+            return false;
+
+        matches.swap(participant_matches[0]);
+        for (size_t i = 1; i < participants; ++i)
+            mergeKnnMatches(matches, participant_matches[i], k, 0);
+        return true;
+    }
+
+    size_t BruteForceIndex::size() const
+    {
+        return database_descriptors.rows;
+    }
+
+    std::string BruteForceIndex::name() const
+    {
+        return "bruteforce";
+    }
+
+    /**
+     * \brief Function for create descriptor index selected in config
+     * \param[in] conf Project config (descriptor_index_type and index parameters fields)
+     * \param[in] search_pool Worker pool for parallel search (may be nullptr)
+     * \return Empty index or nullptr if index type is unknown
+     */
+    std::unique_ptr<DescriptorIndex> createDescriptorIndex(const Config& conf, const std::shared_ptr<SearchPool>& search_pool)
+    {
+        if (conf.descriptor_index_type == "bruteforce")
+            return std::make_unique<BruteForceIndex>(search_pool, conf.search_shard_rows);
+        if (conf.descriptor_index_type == "mih")
+            return std::make_unique<MihIndex>();
+        if (conf.descriptor_index_type == "hnsw")
+            return std::make_unique<HnswIndex>(conf.hnsw_m, conf.hnsw_ef_construction, conf.hnsw_ef_search);
+        return nullptr;
+    }
+
+}
@@ -0,0 +1,242 @@
+#include <database_module/exhibit_cache.hpp>
+
+#include <algorithm>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        constexpr size_t doorkeeper_capacity = 4096; // exhibits missed once, cleared when full
+        constexpr size_t entry_overhead_bytes = 128;  // list node, map node and payload control block
+    }
+
+    /**
+     * \brief Constructor of cache
+     * \param[in] capacity_bytes Maximal total size of cached payloads
+     */
+    ExhibitCache::ExhibitCache(size_t capacity_bytes) : capacity_bytes(capacity_bytes)
+    {
+    }
+
+    /**
+     * \brief Method for estimate memory used by cached payload
+     * \param[in] payload Exhibit payload
+     * \return Size of payload strings and image with bookkeeping overhead
+     */
+    size_t ExhibitCache::payloadBytes(const DatabaseResponse& payload)
+    {
+        return sizeof(DatabaseResponse) + entry_overhead_bytes + payload.exhibit_id.size() + payload.exhibit_name.size() +
+               payload.exhibit_description.size() + payload.exhibit_image.size() + payload.exhibit_image_etag.size();
+    }
+
+    /**
+     * \brief Method for find exhibit payload
+     * \param[in] id Exhibit id
+     * \param[in] rendition Size of image
+     * \return Shared payload or nullptr if exhibit isn't cached
+     */
+    ExhibitCache::Payload ExhibitCache::find(const CassUuid& id, ImageRendition rendition)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = entries.find(Key{id, rendition});
+        if (it == entries.end())
+        {
+            ++misses_count;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        ++it->second->hits_count;
+        ++hits_count;
+        return it->second->payload;
+    }
+
+    /**
+     * \brief Method for get erase generation, must be read before reading payload from database
+     * \return Count of erases
+     */
+    uint64_t ExhibitCache::generation() const
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        return erase_generation;
+    }
+
+    /**
+     * \brief Method for add exhibit payload read from database
+     * \param[in] id Exhibit id
+     * \param[in] rendition Size of image in payload
+     * \param[in] payload Exhibit payload (confidence isn't used), it's copied only if admitted
+     * \param[in] read_generation generation() before payload was read
+     * \param[in] is_forced If true, payload is admitted on the first miss (prefetch)
+     * \return true if payload is cached
+     */
+    bool ExhibitCache::insert(const CassUuid& id, ImageRendition rendition, const DatabaseResponse& payload,
+                              uint64_t read_generation, bool is_forced)
+    {
+        const Key key{id, rendition};
+        const size_t bytes = payloadBytes(payload);
+        std::unique_lock<std::mutex> ul(mtx);
+        if (!isAdmitted(key, bytes, read_generation, is_forced))
+            return false;
+        ul.unlock();
+
+        auto shared_payload = std::make_shared<const DatabaseResponse>(payload); // image is copied without lock
+        ul.lock();
+        if (read_generation != erase_generation || entries.count(key) > 0)
+            return false;
+        store(key, std::move(shared_payload), bytes);
+        return true;
+    }
+
+    /**
+     * \brief Method for add shared exhibit payload read from database
+     * \param[in] id Exhibit id
+     * \param[in] rendition Size of image in payload
+     * \param[in] payload Exhibit payload (confidence isn't used), cache shares it with caller without copy
+     * \param[in] read_generation generation() before payload was read
+     * \param[in] is_forced If true, payload is admitted on the first miss (prefetch)
+     * \return true if payload is cached
+     */
+    bool ExhibitCache::insert(const CassUuid& id, ImageRendition rendition, const Payload& payload,
+                              uint64_t read_generation, bool is_forced)
+    {
+        const Key key{id, rendition};
+        const size_t bytes = payloadBytes(*payload);
+        std::lock_guard<std::mutex> lg(mtx);
+        if (!isAdmitted(key, bytes, read_generation, is_forced))
+            return false;
+        store(key, payload, bytes);
+        return true;
+    }
+
+    /**
+     * \brief Method for remove all renditions of exhibit (exhibit is deleted or changed)
+     * \param[in] id Exhibit id
+     */
+    void ExhibitCache::erase(const CassUuid& id)
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        ++erase_generation;
+        for (size_t rendition = 0; rendition < image_renditions_count; ++rendition)
+        {
+            const Key key{id, static_cast<ImageRendition>(rendition)};
+            doorkeeper.erase(key);
+            auto it = entries.find(key);
+            if (it == entries.end())
+                continue;
+            size_bytes -= it->second->bytes;
+            lru.erase(it->second);
+            entries.erase(it);
+            ++invalidations_count;
+        }
+    }
+
+    /**
+     * \brief Method for get the most requested cached exhibits (for prefetch after restart)
+     * \param[in] count Maximal count of ids
+     * \return Ids sorted by hits count of their the most requested rendition, the most recently used first among equal
+     */
+    std::vector<CassUuid> ExhibitCache::hottest(size_t count) const
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        std::vector<const Entry*> sorted;
+        sorted.reserve(lru.size());
+        for (const Entry& entry : lru)
+            sorted.push_back(&entry);
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Entry* a, const Entry* b)
+                         { return a->hits_count > b->hits_count; });
+
+        std::vector<CassUuid> ids;
+        std::unordered_set<CassUuid, std::hash<CassUuid>, CassUuidEqual> added_ids;
+        for (size_t i = 0; i < sorted.size() && ids.size() < count; ++i)
+        {
+            if (added_ids.insert(sorted[i]->key.id).second)
+                ids.push_back(sorted[i]->key.id);
+        }
+        return ids;
+    }
+
+    /**
+     * \brief Method for get cache counters
+     * \return Counters, hit rate is hits_count / (hits_count + misses_count)
+     */
+    ExhibitCache::Stats ExhibitCache::stats() const
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        Stats result;
+        result.capacity_bytes = capacity_bytes;
+        result.size_bytes = size_bytes;
+        result.entries_count = entries.size();
+        result.hits_count = hits_count;
+        result.misses_count = misses_count;
+        result.insertions_count = insertions_count;
+        result.rejections_count = rejections_count;
+        result.evictions_count = evictions_count;
+        result.invalidations_count = invalidations_count;
+        return result;
+    }
+
+    /**
+     * \brief Internal method for check admission of payload (mtx must be locked)
+     * \param[in] key Exhibit id and rendition
+     * \param[in] bytes Size of payload (payloadBytes)
+     * \param[in] read_generation generation() before payload was read
+     * \param[in] is_forced If true, doorkeeper is skipped
+     * \return true if payload can be stored, rejected payloads are counted
+     */
+    bool ExhibitCache::isAdmitted(const Key& key, size_t bytes, uint64_t read_generation, bool is_forced)
+    {
+        if (read_generation != erase_generation || entries.count(key) > 0)
+            return false;
+        if (bytes > capacity_bytes / 8)
+        {
+            ++rejections_count;
+            return false;
+        }
+        if (!is_forced)
+        {
+            if (doorkeeper.size() >= doorkeeper_capacity)
+                doorkeeper.clear();
+            if (doorkeeper.insert(key).second)
+            {
+                ++rejections_count;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * \brief Internal method for add admitted payload as the most recently used (mtx must be locked)
+     * \param[in] key Exhibit id and rendition
+     * \param[in] payload Shared payload
+     * \param[in] bytes Size of payload (payloadBytes)
+     */
+    void ExhibitCache::store(const Key& key, Payload payload, size_t bytes)
+    {
+        doorkeeper.erase(key);
+        evict(bytes);
+        lru.push_front(Entry{key, std::move(payload), bytes, 0});
+        entries.emplace(key, lru.begin());
+        size_bytes += bytes;
+        ++insertions_count;
+    }
+
+    /**
+     * \brief Internal method for evict the least recently used payloads (mtx must be locked)
+     * \param[in] required_bytes Size of new payload, which must fit into capacity
+     */
+    void ExhibitCache::evict(size_t required_bytes)
+    {
+        while (!lru.empty() && size_bytes + required_bytes > capacity_bytes)
+        {
+            const Entry& victim = lru.back();
+            size_bytes -= victim.bytes;
+            entries.erase(victim.key);
+            lru.pop_back();
+            ++evictions_count;
+        }
+    }
+
+}
@@ -0,0 +1,59 @@
+#include "database_module/feature_type.hpp"
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Function for parse feature type name (feature_type config field, keyspace settings)
+     * \param[in] name Feature type name ("orb", "brisk" or "akaze")
+     * \return Feature type or std::nullopt if name is unknown
+     */
+    std::optional<FeatureType> featureTypeFromName(const std::string& name)
+    {
+        if (name == "orb")
+            return FeatureType::ORB;
+        if (name == "brisk")
+            return FeatureType::BRISK;
+        if (name == "akaze")
+            return FeatureType::AKAZE;
+        return std::nullopt;
+    }
+
+    /**
+     * \brief Function for get name of feature type
+     * \param[in] type Feature type
+     * \return Name which is accepted by featureTypeFromName
+     */
+    const char* featureTypeName(FeatureType type)
+    {
+        switch (type)
+        {
+        case FeatureType::BRISK:
+            return "brisk";
+        case FeatureType::AKAZE:
+            return "akaze";
+        default:
+            return "orb";
+        }
+    }
+
+    /**
+     * \brief Function for get descriptor width of feature type at runtime
+     * \param[in] type Feature type
+     * \return Bytes of one descriptor
+     */
+    size_t featureDescriptorBytes(FeatureType type)
+    {
+        switch (type)
+        {
+        case FeatureType::BRISK:
+            return FeatureTraits<FeatureType::BRISK>::descriptor_bytes;
+        case FeatureType::AKAZE:
+            return FeatureTraits<FeatureType::AKAZE>::descriptor_bytes;
+        default:
+            return FeatureTraits<FeatureType::ORB>::descriptor_bytes;
+        }
+    }
+
+}
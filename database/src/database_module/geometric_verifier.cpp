@@ -0,0 +1,47 @@
+#include "database_module/geometric_verifier.hpp"
+
+#include <opencv2/calib3d.hpp>
+
+#include <cmath>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        constexpr size_t homography_min_points = 4;
+        constexpr double max_scale_change = 100.0; // limit of area change for non degenerate homography
+    }
+
+    /**
+     * \brief Function for geometric verification of candidate exhibit by RANSAC homography
+     * \param[in] correspondences Keypoints of query and candidate matched by descriptors
+     * \param[in] reprojection_error Max distance in pixels between query point and projected train point for inlier
+     * \return Count of correspondences consistent with found homography (0 if homography wasn't found or it's degenerate)
+     */
+    size_t countHomographyInliers(const PointCorrespondences& correspondences, double reprojection_error)
+    {
+        if (correspondences.query_points.size() < homography_min_points ||
+            correspondences.query_points.size() != correspondences.train_points.size())
+            return 0;
+
+        std::vector<uint8_t> inliers_mask;
+        cv::Mat homography = cv::findHomography(correspondences.train_points, correspondences.query_points, cv::RANSAC,
+                                                reprojection_error, inliers_mask);
+        if (homography.empty())
+            return 0;
+
+        // flipped or collapsed mapping can't be a view of flat exhibit
+        const double determinant = homography.at<double>(0, 0) * homography.at<double>(1, 1) -
+                                   homography.at<double>(0, 1) * homography.at<double>(1, 0);
+        if (!std::isfinite(determinant) || determinant <= 1.0 / max_scale_change || determinant >= max_scale_change)
+            return 0;
+
+        size_t inliers_count = 0;
+        for (uint8_t is_inlier : inliers_mask)
+            inliers_count += is_inlier ? 1 : 0;
+        return inliers_count;
+    }
+
+}
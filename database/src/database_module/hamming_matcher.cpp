@@ -0,0 +1,186 @@
+#include "database_module/hamming_matcher.hpp"
+#include "database_module/feature_type.hpp"
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        template<size_t Bytes>
+        bool knnMatchFixedBytes(HammingKernel kernel, const cv::Mat& query, const cv::Mat& train, size_t k,
+                                std::vector<HammingMatch>& matches)
+        {
+            matches.resize(static_cast<size_t>(query.rows) * k);
+            const uint8_t* query_data = query.data;
+            const uint8_t* train_data = train.data;
+            const size_t query_rows = query.rows, query_step = query.step;
+            const size_t train_rows = train.rows, train_step = train.step;
+
+            switch (k)
+            {
+            case 1:
+                hammingKnnMatch<Bytes, 1>(kernel, query_data, query_rows, query_step, train_data, train_rows, train_step, matches.data());
+                return true;
+            case 2:
+                hammingKnnMatch<Bytes, 2>(kernel, query_data, query_rows, query_step, train_data, train_rows, train_step, matches.data());
+                return true;
+            case 3:
+                hammingKnnMatch<Bytes, 3>(kernel, query_data, query_rows, query_step, train_data, train_rows, train_step, matches.data());
+                return true;
+            case 4:
+                hammingKnnMatch<Bytes, 4>(kernel, query_data, query_rows, query_step, train_data, train_rows, train_step, matches.data());
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
+
+    /**
+     * \brief Method for choose the fastest popcount implementation supported by current CPU
+     * \return Hamming kernel type (detected once per process)
+     */
+    HammingKernel bestHammingKernel()
+    {
+        static const HammingKernel kernel = []
+        {
+            std::vector<HammingKernel> kernels = supportedHammingKernels();
+            return kernels.back();
+        }();
+        return kernel;
+    }
+
+    /**
+     * \brief Method for get all popcount implementations supported by current CPU
+     * \return Hamming kernels types from slowest to fastest (scalar is always available)
+     */
+    std::vector<HammingKernel> supportedHammingKernels()
+    {
+        std::vector<HammingKernel> kernels = {HammingKernel::Scalar};
+#ifdef MPG_HAMMING_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        {
+            kernels.push_back(HammingKernel::AVX2);
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                __builtin_cpu_supports("avx512vpopcntdq"))
+            {
+                kernels.push_back(HammingKernel::AVX512);
+            }
+        }
+#endif
+        return kernels;
+    }
+
+    /**
+     * \brief Method for get printable name of hamming kernel
+     * \param[in] kernel Hamming kernel type
+     * \return Kernel name
+     */
+    const char* hammingKernelName(HammingKernel kernel)
+    {
+        switch (kernel)
+        {
+        case HammingKernel::AVX512:
+            return "avx512-vpopcntdq";
+        case HammingKernel::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+        }
+    }
+
+    /**
+     * \brief Method for k nearest neighbours search of binary descriptors with the fastest available kernel
+     * \param[in] query Query descriptors (CV_8UC1, one descriptor per row)
+     * \param[in] train Train descriptors (CV_8UC1, same width as query)
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] matches Flat buffer with query.rows * k neighbours (can be reused between calls)
+     * \return true if descriptor width and k are supported
+     */
+    bool hammingKnnMatch(const cv::Mat& query, const cv::Mat& train, size_t k, std::vector<HammingMatch>& matches)
+    {
+        return hammingKnnMatch(bestHammingKernel(), query, train, k, matches);
+    }
+
+    /**
+     * \brief Method for k nearest neighbours search of binary descriptors with selected kernel
+     * \param[in] kernel Popcount implementation
+     * \param[in] query Query descriptors (CV_8UC1, one descriptor per row)
+     * \param[in] train Train descriptors (CV_8UC1, same width as query)
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] matches Flat buffer with query.rows * k neighbours (can be reused between calls)
+     * \return true if descriptor width and k are supported
+     */
+    bool hammingKnnMatch(HammingKernel kernel, const cv::Mat& query, const cv::Mat& train, size_t k,
+                         std::vector<HammingMatch>& matches)
+    {
+        if (query.type() != CV_8UC1 || train.type() != CV_8UC1 || query.cols != train.cols)
+            return false;
+
+        // every feature type gets kernels unrolled for its descriptor width
+        switch (query.cols)
+        {
+        case FeatureTraits<FeatureType::ORB>::descriptor_bytes:
+            return knnMatchFixedBytes<FeatureTraits<FeatureType::ORB>::descriptor_bytes>(kernel, query, train, k, matches);
+        case FeatureTraits<FeatureType::BRISK>::descriptor_bytes:
+            return knnMatchFixedBytes<FeatureTraits<FeatureType::BRISK>::descriptor_bytes>(kernel, query, train, k, matches);
+        case FeatureTraits<FeatureType::AKAZE>::descriptor_bytes:
+            return knnMatchFixedBytes<FeatureTraits<FeatureType::AKAZE>::descriptor_bytes>(kernel, query, train, k, matches);
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * \brief Method for prepare matches buffer for merging of partial results
+     * \param[out] matches Flat buffer, will have query_rows * k empty neighbours
+     * \param[in] query_rows Count of query descriptors
+     * \param[in] k Count of neighbours for each query descriptor
+     */
+    void resetKnnMatches(std::vector<HammingMatch>& matches, size_t query_rows, size_t k)
+    {
+        matches.assign(query_rows * k, {-1, INT_MAX});
+    }
+
+    /**
+     * \brief Method for merge k nearest neighbours found in part of train rows into total result
+     * \param[in,out] matches Total result (query_rows * k, sorted by distance for each query)
+     * \param[in] part_matches Result of search in train rows part (same layout, indices are local to part)
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[in] part_first_row Index of first part row in whole train set
+     *
+     * Neighbours are ordered by (distance, train row), so merge of parts gives the same result as one search
+     */
+    void mergeKnnMatches(std::vector<HammingMatch>& matches, const std::vector<HammingMatch>& part_matches,
+                         size_t k, int part_first_row)
+    {
+        for (size_t base = 0; base < matches.size(); base += k)
+        {
+            HammingMatch* top = matches.data() + base;
+            for (size_t j = 0; j < k; ++j)
+            {
+                const HammingMatch& part = part_matches[base + j];
+                if (part.train_idx < 0)
+                    break;
+                const HammingMatch candidate = {part.train_idx + part_first_row, part.distance};
+                auto closer = [&candidate](const HammingMatch& other)
+                {
+                    return candidate.distance < other.distance ||
+                           (candidate.distance == other.distance && candidate.train_idx < other.train_idx);
+                };
+                if (!closer(top[k - 1]))
+                    break;
+                size_t pos = k - 1;
+                while (pos > 0 && closer(top[pos - 1]))
+                {
+                    top[pos] = top[pos - 1];
+                    --pos;
+                }
+                top[pos] = candidate;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,393 @@
+#include "database_module/hnsw_index.hpp"
+
+#include <cmath>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        /**
+         * \brief Per thread buffers of graph search (visited rows are marked by search stamp)
+         */
+        struct HnswScratch
+        {
+            std::vector<uint32_t> visited;
+            uint32_t stamp = 0;
+            std::vector<std::pair<int, uint32_t>> candidates;
+            std::vector<std::pair<int, uint32_t>> nearest;
+            std::vector<std::pair<int, uint32_t>> entries;
+            std::vector<uint32_t> neighbours;
+            std::vector<int> distances;
+        };
+
+        thread_local HnswScratch hnsw_scratch;
+
+        void newSearchStamp(HnswScratch& scratch, size_t rows)
+        {
+            if (scratch.visited.size() < rows)
+                scratch.visited.resize(rows, 0);
+            if (++scratch.stamp == 0)
+            {
+                std::fill(scratch.visited.begin(), scratch.visited.end(), 0);
+                scratch.stamp = 1;
+            }
+        }
+    }
+
+    /**
+     * \brief Constructor of HNSW index
+     * \param[in] m Count of links of node on upper levels (level 0 has 2 * m)
+     * \param[in] ef_construction Size of dynamic candidates list while inserting
+     * \param[in] ef_search Size of dynamic candidates list while searching (at least k is used)
+     */
+    HnswIndex::HnswIndex(size_t m, size_t ef_construction, size_t ef_search)
+        : max_links(std::max<size_t>(m, 2)), max_links_level0(2 * std::max<size_t>(m, 2)),
+          ef_construction(std::max<size_t>(ef_construction, 1)), ef_search(std::max<size_t>(ef_search, 1)),
+          level_multiplier(1. / std::log(static_cast<double>(std::max<size_t>(m, 2)))),
+          level_generator(100)
+    {
+    }
+
+    /**
+     * \brief Method for build graph over all database descriptors
+     * \param[in] descriptors Database descriptors (CV_8UC1, 32 bytes per row)
+     * \return true if descriptors format is supported
+     */
+    bool HnswIndex::build(const cv::Mat& descriptors)
+    {
+        rows_count = 0;
+        levels.clear();
+        links_level0.clear();
+        links_upper.clear();
+        entry_point = 0;
+        top_level = 0;
+        level_generator.seed(100);
+        return add(descriptors, 0);
+    }
+
+    /**
+     * \brief Method for insert new rows into graph without rebuild
+     * \param[in] descriptors All database descriptors (rows before first_row must be the same as in index)
+     * \param[in] first_row First new row
+     * \return true if successful
+     */
+    bool HnswIndex::add(const cv::Mat& descriptors, int first_row)
+    {
+        if (!descriptors.empty() && (descriptors.type() != CV_8UC1 || descriptors.cols != descriptor_bytes))
+            return false;
+        if (static_cast<size_t>(first_row) != rows_count)
+            return build(descriptors);
+
+        database_descriptors = descriptors;
+        const size_t new_rows_count = descriptors.rows;
+        levels.resize(new_rows_count, 0);
+        links_level0.resize(new_rows_count * (max_links_level0 + 1), 0);
+        links_upper.resize(new_rows_count);
+
+        for (size_t row = rows_count; row < new_rows_count; ++row)
+        {
+            rows_count = row + 1;
+            insert(static_cast<uint32_t>(row));
+        }
+        rows_count = new_rows_count;
+        return true;
+    }
+
+    /**
+     * \brief Internal method for insert one row into graph (rows before it must be inserted)
+     * \param[in] row Row of database descriptors
+     */
+    void HnswIndex::insert(uint32_t row)
+    {
+        std::uniform_real_distribution<double> uniform(0., 1.);
+        const size_t level = std::min<size_t>(static_cast<size_t>(-std::log(1. - uniform(level_generator)) * level_multiplier),
+                                              max_levels - 1);
+        levels[row] = static_cast<uint8_t>(level);
+        links_upper[row].assign(level * (max_links + 1), 0);
+
+        if (row == 0)
+        {
+            entry_point = row;
+            top_level = level;
+            return;
+        }
+
+        const uint8_t* query = descriptor(row);
+        Candidate entry = {distance(query, entry_point), entry_point};
+        for (size_t l = top_level; l > level; --l)
+            greedySearch(query, entry, l);
+
+        std::vector<Candidate> entries = {entry};
+        std::vector<Candidate> nearest;
+        for (size_t l = std::min(level, top_level) + 1; l-- > 0;)
+        {
+            searchLayer(query, entries, ef_construction, l, nearest);
+            entries = nearest;
+
+            selectNeighbours(nearest, max_links);
+            uint32_t* row_links = links(row, l);
+            row_links[0] = static_cast<uint32_t>(nearest.size());
+            for (size_t i = 0; i < nearest.size(); ++i)
+                row_links[i + 1] = nearest[i].second;
+
+            for (const Candidate& neighbour : nearest)
+                connect(neighbour.second, row, l);
+        }
+
+        if (level > top_level)
+        {
+            top_level = level;
+            entry_point = row;
+        }
+    }
+
+    /**
+     * \brief Internal method for add backward link, too long links list is shrinked by neighbours heuristic
+     * \param[in] row Row which gets new link
+     * \param[in] neighbour Linked row
+     * \param[in] level Graph level
+     */
+    void HnswIndex::connect(uint32_t row, uint32_t neighbour, size_t level)
+    {
+        uint32_t* row_links = links(row, level);
+        const size_t max_count = maxLinks(level);
+        if (row_links[0] < max_count)
+        {
+            row_links[++row_links[0]] = neighbour;
+            return;
+        }
+
+        const uint8_t* base = descriptor(row);
+        std::vector<Candidate> candidates;
+        candidates.reserve(max_count + 1);
+        candidates.push_back({distance(base, neighbour), neighbour});
+        for (uint32_t i = 1; i <= row_links[0]; ++i)
+            candidates.push_back({distance(base, row_links[i]), row_links[i]});
+        std::sort(candidates.begin(), candidates.end());
+
+        selectNeighbours(candidates, max_count);
+        row_links[0] = static_cast<uint32_t>(candidates.size());
+        for (size_t i = 0; i < candidates.size(); ++i)
+            row_links[i + 1] = candidates[i].second;
+    }
+
+    /**
+     * \brief Internal method for neighbours selection heuristic (keeps candidates from different directions)
+     * \param[in,out] candidates Candidates sorted by distance to base row, selected neighbours on output
+     * \param[in] max_count Max count of neighbours
+     */
+    void HnswIndex::selectNeighbours(std::vector<Candidate>& candidates, size_t max_count) const
+    {
+        if (candidates.size() <= max_count)
+            return;
+
+        std::vector<Candidate> selected;
+        selected.reserve(max_count);
+        for (const Candidate& candidate : candidates)
+        {
+            if (selected.size() >= max_count)
+                break;
+            const uint8_t* candidate_descriptor = descriptor(candidate.second);
+            bool is_diverse = true;
+            for (const Candidate& other : selected)
+            {
+                if (distance(candidate_descriptor, other.second) < candidate.first)
+                {
+                    is_diverse = false;
+                    break;
+                }
+            }
+            if (is_diverse)
+                selected.push_back(candidate);
+        }
+        candidates = std::move(selected);
+    }
+
+    /**
+     * \brief Internal method for greedy descent on one level (search with ef = 1)
+     * \param[in] query Pointer to query descriptor
+     * \param[in,out] entry Entry row, the closest found row on output
+     * \param[in] level Graph level
+     */
+    void HnswIndex::greedySearch(const uint8_t* query, Candidate& entry, size_t level) const
+    {
+        HnswScratch& scratch = hnsw_scratch;
+        const HammingKernel kernel = bestHammingKernel();
+        bool is_changed = true;
+        while (is_changed)
+        {
+            is_changed = false;
+            const uint32_t* entry_links = links(entry.second, level);
+            const size_t count = entry_links[0];
+            scratch.distances.resize(count);
+            hammingDistances<descriptor_bytes>(kernel, query, database_descriptors.data, database_descriptors.step,
+                                               entry_links + 1, count, scratch.distances.data());
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Candidate candidate = {scratch.distances[i], entry_links[i + 1]};
+                if (candidate < entry)
+                {
+                    entry = candidate;
+                    is_changed = true;
+                }
+            }
+        }
+    }
+
+    /**
+     * \brief Internal method for beam search on one level
+     * \param[in] query Pointer to query descriptor
+     * \param[in] entries Entry rows with distances
+     * \param[in] ef Size of dynamic candidates list
+     * \param[in] level Graph level
+     * \param[out] nearest Up to ef the closest found rows sorted by (distance, row)
+     */
+    void HnswIndex::searchLayer(const uint8_t* query, const std::vector<Candidate>& entries, size_t ef, size_t level,
+                                std::vector<Candidate>& nearest) const
+    {
+        HnswScratch& scratch = hnsw_scratch;
+        newSearchStamp(scratch, rows_count);
+        const HammingKernel kernel = bestHammingKernel();
+
+        // candidates is min-heap, found is max-heap limited by ef
+        std::vector<Candidate>& candidates = scratch.candidates;
+        std::vector<Candidate>& found = scratch.nearest;
+        candidates.clear();
+        found.clear();
+        for (const Candidate& entry : entries)
+        {
+            scratch.visited[entry.second] = scratch.stamp;
+            candidates.push_back(entry);
+            found.push_back(entry);
+        }
+        std::make_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+        std::make_heap(found.begin(), found.end());
+        while (found.size() > ef)
+        {
+            std::pop_heap(found.begin(), found.end());
+            found.pop_back();
+        }
+
+        while (!candidates.empty())
+        {
+            const Candidate current = candidates.front();
+            if (found.size() >= ef && current.first > found.front().first)
+                break;
+            std::pop_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+            candidates.pop_back();
+
+            const uint32_t* current_links = links(current.second, level);
+            scratch.neighbours.clear();
+            for (uint32_t i = 1; i <= current_links[0]; ++i)
+            {
+                const uint32_t neighbour = current_links[i];
+                if (scratch.visited[neighbour] != scratch.stamp)
+                {
+                    scratch.visited[neighbour] = scratch.stamp;
+                    scratch.neighbours.push_back(neighbour);
+                }
+            }
+
+            scratch.distances.resize(scratch.neighbours.size());
+            hammingDistances<descriptor_bytes>(kernel, query, database_descriptors.data, database_descriptors.step,
+                                               scratch.neighbours.data(), scratch.neighbours.size(), scratch.distances.data());
+            for (size_t i = 0; i < scratch.neighbours.size(); ++i)
+            {
+                const Candidate candidate = {scratch.distances[i], scratch.neighbours[i]};
+                if (found.size() < ef || candidate < found.front())
+                {
+                    candidates.push_back(candidate);
+                    std::push_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+                    found.push_back(candidate);
+                    std::push_heap(found.begin(), found.end());
+                    if (found.size() > ef)
+                    {
+                        std::pop_heap(found.begin(), found.end());
+                        found.pop_back();
+                    }
+                }
+            }
+        }
+
+        nearest.assign(found.begin(), found.end());
+        std::sort(nearest.begin(), nearest.end());
+    }
+
+    /**
+     * \brief Method for approximate k nearest neighbours search
+     * \param[in] query Query descriptors (CV_8UC1, 32 bytes per row)
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] matches Flat buffer with query.rows * k neighbours
+     * \return true if query format is supported
+     */
+    bool HnswIndex::knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const
+    {
+        if (query.type() != CV_8UC1 || query.cols != descriptor_bytes || k == 0)
+            return false;
+
+        resetKnnMatches(matches, query.rows, k);
+        if (rows_count == 0)
+            return true;
+
+        HnswScratch& scratch = hnsw_scratch;
+        std::vector<Candidate> nearest;
+        for (int q = 0; q < query.rows; ++q)
+        {
+            const uint8_t* query_row = query.ptr<uint8_t>(q);
+            Candidate entry = {distance(query_row, entry_point), entry_point};
+            for (size_t l = top_level; l > 0; --l)
+                greedySearch(query_row, entry, l);
+
+            scratch.entries.assign(1, entry);
+            searchLayer(query_row, scratch.entries, std::max(ef_search, k), 0, nearest);
+            for (size_t i = 0; i < k && i < nearest.size(); ++i)
+                matches[q * k + i] = {static_cast<int>(nearest[i].second), nearest[i].first};
+        }
+        return true;
+    }
+
+    size_t HnswIndex::size() const
+    {
+        return rows_count;
+    }
+
+    std::string HnswIndex::name() const
+    {
+        return "hnsw";
+    }
+
+    uint32_t* HnswIndex::links(uint32_t row, size_t level)
+    {
+        if (level == 0)
+            return links_level0.data() + row * (max_links_level0 + 1);
+        return links_upper[row].data() + (level - 1) * (max_links + 1);
+    }
+
+    const uint32_t* HnswIndex::links(uint32_t row, size_t level) const
+    {
+        if (level == 0)
+            return links_level0.data() + row * (max_links_level0 + 1);
+        return links_upper[row].data() + (level - 1) * (max_links + 1);
+    }
+
+    size_t HnswIndex::maxLinks(size_t level) const
+    {
+        return level == 0 ? max_links_level0 : max_links;
+    }
+
+    const uint8_t* HnswIndex::descriptor(uint32_t row) const
+    {
+        return database_descriptors.ptr<uint8_t>(static_cast<int>(row));
+    }
+
+    int HnswIndex::distance(const uint8_t* query, uint32_t row) const
+    {
+        int result;
+        hammingDistances<descriptor_bytes>(bestHammingKernel(), query, database_descriptors.data, database_descriptors.step,
+                                           &row, 1, &result);
+        return result;
+    }
+
+}
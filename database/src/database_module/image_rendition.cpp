@@ -0,0 +1,94 @@
+#include "database_module/image_rendition.hpp"
+
+#include <cstring>
+#include <sstream>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Function for parse rendition name (image-size parameter, default_image_rendition config field)
+     * \param[in] name Rendition name ("thumbnail", "mobile" or "full")
+     * \return Rendition or std::nullopt if name is unknown
+     */
+    std::optional<ImageRendition> imageRenditionFromName(const std::string& name)
+    {
+        if (name == "thumbnail")
+            return ImageRendition::Thumbnail;
+        if (name == "mobile")
+            return ImageRendition::Mobile;
+        if (name == "full")
+            return ImageRendition::Full;
+        return std::nullopt;
+    }
+
+    /**
+     * \brief Function for get name of rendition
+     * \param[in] rendition Rendition
+     * \return Name which is accepted by imageRenditionFromName
+     */
+    const char* imageRenditionName(ImageRendition rendition)
+    {
+        switch (rendition)
+        {
+        case ImageRendition::Thumbnail:
+            return "thumbnail";
+        case ImageRendition::Mobile:
+            return "mobile";
+        default:
+            return "full";
+        }
+    }
+
+    /**
+     * \brief Function for get column of exhibits table which stores rendition
+     * \param[in] rendition Rendition
+     * \return Column name
+     */
+    const char* imageRenditionColumn(ImageRendition rendition)
+    {
+        switch (rendition)
+        {
+        case ImageRendition::Thumbnail:
+            return "thumbnail";
+        case ImageRendition::Mobile:
+            return "mobile_image";
+        default:
+            return "image";
+        }
+    }
+
+    /**
+     * \brief Function for compute strong ETag of encoded image
+     * \param[in] image Encoded image
+     * \return Quoted 64 bits hash of image with its size, the same on all servers
+     *
+     * Image is hashed by 8 bytes words (multiply-xorshift), so hash of several MB image takes about a millisecond.
+     * It's computed once when payload is read from database and is cached with payload.
+     */
+    std::string imageETag(const std::vector<uint8_t>& image)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        auto add_word = [&hash](uint64_t word)
+        {
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        };
+        const size_t words_bytes = image.size() / sizeof(uint64_t) * sizeof(uint64_t);
+        for (size_t offset = 0; offset < words_bytes; offset += sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, image.data() + offset, sizeof(word));
+            add_word(word);
+        }
+        uint64_t tail = 0;
+        if (image.size() > words_bytes)
+            std::memcpy(&tail, image.data() + words_bytes, image.size() - words_bytes);
+        add_word(tail);
+        std::ostringstream stream;
+        stream << '"' << std::hex << hash << '-' << image.size() << '"';
+        return stream.str();
+    }
+
+}
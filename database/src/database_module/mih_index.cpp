@@ -0,0 +1,313 @@
+#include "database_module/mih_index.hpp"
+
+#include <array>
+#include <numeric>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        /**
+         * \brief Per thread buffers of MIH search (visited rows are marked by query stamp, so they are never cleared)
+         */
+        struct MihScratch
+        {
+            std::vector<uint32_t> visited;
+            uint32_t stamp = 0;
+            std::vector<uint32_t> candidates;
+            std::vector<int> distances;
+        };
+
+        thread_local MihScratch mih_scratch;
+
+        using RadiusMasks = std::array<std::vector<uint16_t>, MihIndex::substring_bits + 1>;
+
+        /**
+         * \brief All 16-bit masks grouped by count of set bits (keys for probing buckets at given radius)
+         */
+        const RadiusMasks& masksByRadius()
+        {
+            static const RadiusMasks masks = []
+            {
+                RadiusMasks result;
+                for (uint32_t mask = 0; mask < MihIndex::buckets_count; ++mask)
+                    result[__builtin_popcount(mask)].push_back(static_cast<uint16_t>(mask));
+                return result;
+            }();
+            return masks;
+        }
+
+        inline uint16_t substring(const uint8_t* code, size_t index)
+        {
+            uint16_t value;
+            std::memcpy(&value, code + index * sizeof(value), sizeof(value));
+            return value;
+        }
+
+        /**
+         * \brief Insert candidate to top-k list ordered by (distance, row), candidates come in any order
+         *
+         * K is count of neighbours known at compile time or 0 if it is given by k
+         */
+        template<size_t K>
+        inline void pushOrdered(HammingMatch* top, size_t k, int row, int distance)
+        {
+            auto closer = [row, distance](const HammingMatch& other)
+            {
+                return distance < other.distance || (distance == other.distance && row < other.train_idx);
+            };
+
+            const size_t top_k = K > 0 ? K : k;
+            if (!closer(top[top_k - 1]))
+                return;
+            size_t pos = top_k - 1;
+            while (pos > 0 && closer(top[pos - 1]))
+            {
+                top[pos] = top[pos - 1];
+                --pos;
+            }
+            top[pos] = {row, distance};
+        }
+    }
+
+    /**
+     * \brief Method for build substring hash tables over database descriptors
+     * \param[in] descriptors Database descriptors (CV_8UC1, 32 bytes per row)
+     * \return true if descriptors format is supported
+     */
+    bool MihIndex::build(const cv::Mat& descriptors)
+    {
+        if (!descriptors.empty() && (descriptors.type() != CV_8UC1 || descriptors.cols != descriptor_bytes))
+            return false;
+
+        const size_t rows = descriptors.rows;
+        bucket_offsets.assign(substrings_count * (buckets_count + 1), 0);
+        bucket_rows.resize(substrings_count * rows);
+
+        std::vector<uint32_t> bucket_fill(buckets_count);
+        for (size_t s = 0; s < substrings_count; ++s)
+        {
+            uint32_t* offsets = bucket_offsets.data() + s * (buckets_count + 1);
+            for (size_t r = 0; r < rows; ++r)
+                ++offsets[substring(descriptors.ptr<uint8_t>(r), s) + 1];
+            for (size_t b = 0; b < buckets_count; ++b)
+                offsets[b + 1] += offsets[b];
+
+            std::copy(offsets, offsets + buckets_count, bucket_fill.begin());
+            uint32_t* table_rows = bucket_rows.data() + s * rows;
+            for (size_t r = 0; r < rows; ++r)
+                table_rows[bucket_fill[substring(descriptors.ptr<uint8_t>(r), s)]++] = static_cast<uint32_t>(r);
+        }
+
+        database_descriptors = descriptors;
+        return true;
+    }
+
+    /**
+     * \brief Internal method for compare query descriptor with every database row (k isn't limited)
+     * \param[in] query Pointer to query descriptor (32 bytes)
+     * \param[in] k Count of neighbours
+     * \param[out] top Buffer for k neighbours sorted by distance
+     */
+    void MihIndex::scanAll(const uint8_t* query, size_t k, HammingMatch* top) const
+    {
+        for (size_t i = 0; i < k; ++i)
+            top[i] = {-1, INT_MAX};
+
+        constexpr size_t block_rows = 4096;
+        const size_t rows = database_descriptors.rows;
+        MihScratch& scratch = mih_scratch;
+        scratch.candidates.resize(block_rows);
+        scratch.distances.resize(block_rows);
+        for (size_t begin = 0; begin < rows; begin += block_rows)
+        {
+            const size_t count = std::min(rows - begin, block_rows);
+            std::iota(scratch.candidates.begin(), scratch.candidates.begin() + count, static_cast<uint32_t>(begin));
+            hammingDistances<descriptor_bytes>(bestHammingKernel(), query, database_descriptors.data, database_descriptors.step,
+                                               scratch.candidates.data(), count, scratch.distances.data());
+            for (size_t i = 0; i < count; ++i)
+                pushOrdered<0>(top, k, static_cast<int>(begin + i), scratch.distances[i]);
+        }
+    }
+
+    /**
+     * \brief Internal method for search k nearest neighbours of one query descriptor
+     * \param[in] query Pointer to query descriptor (32 bytes)
+     * \param[in] k Count of neighbours (used only if K is 0)
+     * \param[out] top Buffer for k neighbours sorted by distance
+     *
+     * K is count of neighbours known at compile time (1..4) or 0 for any k.
+     * If probing would cost more than comparing with whole database, falls back to brute force
+     */
+    template<size_t K>
+    void MihIndex::searchOne(const uint8_t* query, size_t k, HammingMatch* top) const
+    {
+        const size_t top_k = K > 0 ? K : k;
+        for (size_t i = 0; i < top_k; ++i)
+            top[i] = {-1, INT_MAX};
+
+        const size_t rows = database_descriptors.rows;
+        if (rows == 0)
+            return;
+
+        const uint8_t* data = database_descriptors.data;
+        const size_t step = database_descriptors.step;
+        const HammingKernel kernel = bestHammingKernel();
+        const RadiusMasks& masks = masksByRadius();
+
+        MihScratch& scratch = mih_scratch;
+        if (scratch.visited.size() < rows)
+            scratch.visited.resize(rows, 0);
+        if (++scratch.stamp == 0)
+        {
+            std::fill(scratch.visited.begin(), scratch.visited.end(), 0);
+            scratch.stamp = 1;
+        }
+
+        std::array<uint16_t, substrings_count> query_substrings;
+        for (size_t s = 0; s < substrings_count; ++s)
+            query_substrings[s] = substring(query, s);
+
+        auto fallback = [&]()
+        {
+            brute_force_fallbacks.fetch_add(1, std::memory_order_relaxed);
+            distance_computations.fetch_add(rows, std::memory_order_relaxed);
+            if constexpr (K > 0)
+                hammingKnnMatch<descriptor_bytes, K>(kernel, query, 1, descriptor_bytes, data, rows, step, top);
+            else
+                scanAll(query, k, top);
+        };
+
+        size_t probes = 0;
+        for (size_t radius = 0; radius <= substring_bits; ++radius)
+        {
+            const size_t radius_probes = substrings_count * masks[radius].size();
+            if ((probes + radius_probes) * random_access_cost > rows)
+            {
+                fallback();
+                return;
+            }
+            probes += radius_probes;
+
+            scratch.candidates.clear();
+            for (size_t s = 0; s < substrings_count; ++s)
+            {
+                const uint32_t* offsets = bucket_offsets.data() + s * (buckets_count + 1);
+                const uint32_t* table_rows = bucket_rows.data() + s * rows;
+                for (uint16_t mask : masks[radius])
+                {
+                    const uint16_t key = query_substrings[s] ^ mask;
+                    for (uint32_t i = offsets[key]; i < offsets[key + 1]; ++i)
+                    {
+                        const uint32_t row = table_rows[i];
+                        if (scratch.visited[row] != scratch.stamp)
+                        {
+                            scratch.visited[row] = scratch.stamp;
+                            scratch.candidates.push_back(row);
+                        }
+                    }
+                }
+            }
+
+            const size_t candidates_count = scratch.candidates.size();
+            if (candidates_count > 0)
+            {
+                scratch.distances.resize(candidates_count);
+                hammingDistances<descriptor_bytes>(kernel, query, data, step, scratch.candidates.data(),
+                                                   candidates_count, scratch.distances.data());
+                distance_computations.fetch_add(candidates_count, std::memory_order_relaxed);
+                probes += candidates_count;
+                for (size_t i = 0; i < candidates_count; ++i)
+                    pushOrdered<K>(top, k, static_cast<int>(scratch.candidates[i]), scratch.distances[i]);
+            }
+
+            // one of substrings of any code closer than substrings_count * (radius + 1) is already probed
+            if (top[top_k - 1].distance < static_cast<int>(substrings_count * (radius + 1)))
+                return;
+
+            // k-th neighbour is already known, so the last radius is known too, don't probe if it is too far
+            if (top[top_k - 1].train_idx >= 0)
+            {
+                const size_t last_radius = std::min<size_t>(top[top_k - 1].distance / substrings_count, substring_bits);
+                size_t rest_probes = 0;
+                for (size_t r = radius + 1; r <= last_radius; ++r)
+                    rest_probes += substrings_count * masks[r].size();
+                if ((probes + rest_probes) * random_access_cost > rows)
+                {
+                    fallback();
+                    return;
+                }
+            }
+        }
+    }
+
+    /**
+     * \brief Method for exact k nearest neighbours search
+     * \param[in] query Query descriptors (CV_8UC1, 32 bytes per row)
+     * \param[in] k Count of neighbours for each query descriptor (1..4 are unrolled, bigger k is used by over-fetch
+     * of segments with deleted rows)
+     * \param[out] matches Flat buffer with query.rows * k neighbours
+     * \return true if query format is supported and k is positive
+     */
+    bool MihIndex::knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const
+    {
+        if (query.type() != CV_8UC1 || query.cols != descriptor_bytes || k == 0)
+            return false;
+
+        matches.resize(static_cast<size_t>(query.rows) * k);
+        auto search_all = [this, &query, &matches, k](auto k_constant)
+        {
+            constexpr size_t K = decltype(k_constant)::value;
+            for (int q = 0; q < query.rows; ++q)
+                searchOne<K>(query.ptr<uint8_t>(q), k, matches.data() + q * k);
+        };
+
+        switch (k)
+        {
+        case 1:
+            search_all(std::integral_constant<size_t, 1>());
+            return true;
+        case 2:
+            search_all(std::integral_constant<size_t, 2>());
+            return true;
+        case 3:
+            search_all(std::integral_constant<size_t, 3>());
+            return true;
+        case 4:
+            search_all(std::integral_constant<size_t, 4>());
+            return true;
+        default:
+            search_all(std::integral_constant<size_t, 0>());
+            return true;
+        }
+    }
+
+    size_t MihIndex::size() const
+    {
+        return database_descriptors.rows;
+    }
+
+    std::string MihIndex::name() const
+    {
+        return "mih";
+    }
+
+    /**
+     * \brief Method for get count of full hamming distances computed by index (for comparison with brute force)
+     */
+    uint64_t MihIndex::distanceComputations() const
+    {
+        return distance_computations.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Method for get count of queries answered by brute force because of too large search radius
+     */
+    uint64_t MihIndex::bruteForceFallbacks() const
+    {
+        return brute_force_fallbacks.load(std::memory_order_relaxed);
+    }
+
+}
@@ -0,0 +1,101 @@
+#include "database_module/rcu_pointer.hpp"
+
+#include <thread>
+
+
+namespace MPG
+{
+
+    EpochDomain& EpochDomain::instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    EpochDomain::ThreadReader::~ThreadReader()
+    {
+        if (slot)
+            slot->is_used.store(false);
+    }
+
+    EpochDomain::ThreadReader& EpochDomain::threadReader()
+    {
+        thread_local ThreadReader reader;
+        return reader;
+    }
+
+    /**
+     * \brief Internal method for take free reader slot for current thread
+     * \return Slot (if all slots are used, waits until some thread exits)
+     */
+    EpochDomain::ReaderSlot* EpochDomain::claimSlot()
+    {
+        while (true)
+        {
+            for (size_t i = 0; i < max_readers; ++i)
+            {
+                bool is_used = false;
+                if (slots[i].is_used.compare_exchange_strong(is_used, true))
+                {
+                    size_t count = slots_count.load();
+                    while (count < i + 1 && !slots_count.compare_exchange_weak(count, i + 1))
+                    {
+                    }
+                    return &slots[i];
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * \brief Method for pin current epoch by current thread (calls can be nested)
+     */
+    void EpochDomain::enter()
+    {
+        ThreadReader& reader = threadReader();
+        if (reader.nesting++ == 0)
+        {
+            if (!reader.slot)
+                reader.slot = claimSlot();
+            reader.slot->epoch.store(global_epoch.load());
+        }
+    }
+
+    /**
+     * \brief Method for unpin epoch by current thread
+     */
+    void EpochDomain::leave()
+    {
+        ThreadReader& reader = threadReader();
+        if (--reader.nesting == 0)
+            reader.slot->epoch.store(0);
+    }
+
+    /**
+     * \brief Method for start new epoch (called by writer after publish)
+     * \return Epoch which was current before (retire epoch of replaced value)
+     */
+    uint64_t EpochDomain::advance()
+    {
+        return global_epoch.fetch_add(1);
+    }
+
+    /**
+     * \brief Method for check that value retired at retire_epoch isn't used by readers
+     * \param[in] retire_epoch Retire epoch of value
+     * \return true if value can be deleted
+     */
+    bool EpochDomain::isReclaimable(uint64_t retire_epoch) const
+    {
+        const size_t count = slots_count.load();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint64_t epoch = slots[i].epoch.load();
+            if (epoch != 0 && epoch <= retire_epoch)
+                return false;
+        }
+        return true;
+    }
+
+}
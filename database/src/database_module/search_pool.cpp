@@ -0,0 +1,154 @@
+#include "database_module/search_pool.hpp"
+
+#include <algorithm>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Constructor of query registration
+     * \param[in] pool Search pool
+     */
+    SearchPool::QueryScope::QueryScope(SearchPool& pool)
+        : search_pool(pool), queries_in_flight(pool.queries_count.fetch_add(1) + 1)
+    {
+    }
+
+    SearchPool::QueryScope::~QueryScope()
+    {
+        search_pool.queries_count.fetch_sub(1);
+    }
+
+    /**
+     * \brief Method for get count of threads (caller included) which may search this query
+     * \return Share of pool threads for one query in flight, at least 1
+     */
+    size_t SearchPool::QueryScope::parallelism() const
+    {
+        return std::max<size_t>((search_pool.threadsCount() + 1) / queries_in_flight, 1);
+    }
+
+    /**
+     * \brief Constructor of search pool
+     * \param[in] threads_count Count of worker threads
+     */
+    SearchPool::SearchPool(size_t threads_count)
+    {
+        workers.reserve(threads_count);
+        for (size_t i = 0; i < threads_count; ++i)
+            workers.emplace_back(&SearchPool::workerLoop, this);
+    }
+
+    SearchPool::~SearchPool()
+    {
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            is_stopped = true;
+        }
+        cv.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    /**
+     * \brief Internal method for run job of run()
+     * \param[in] tasks_count Count of tasks
+     * \param[in] participants Max count of threads (caller included)
+     * \param[in] context Task of caller
+     * \param[in] invoke Function which calls task
+     *
+     * Entries of job which weren't taken by workers are removed before return, so job can live on caller stack
+     */
+    void SearchPool::runJob(size_t tasks_count, size_t participants, const void* context, TaskInvoker invoke)
+    {
+        Job job;
+        job.context = context;
+        job.invoke = invoke;
+        job.tasks_count = tasks_count;
+
+        const size_t helpers_count = std::min({participants, tasks_count, workers.size() + 1}) - 1;
+        if (helpers_count > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lg(mtx);
+                for (size_t i = 0; i < helpers_count; ++i)
+                    jobs.push_back(&job);
+            }
+            if (helpers_count == 1)
+                cv.notify_one();
+            else
+                cv.notify_all();
+        }
+
+        work(job, 0);
+
+        if (helpers_count == 0)
+            return;
+        std::unique_lock<std::mutex> ul(mtx);
+        jobs.erase(std::remove(jobs.begin() + static_cast<std::ptrdiff_t>(first_job), jobs.end(), &job), jobs.end());
+        if (first_job == jobs.size())
+        {
+            jobs.clear(); // capacity is kept
+            first_job = 0;
+        }
+        // all tasks are taken, helpers finish tasks which they took
+        job.cv.wait(ul, [&job]() { return job.active_helpers == 0; });
+    }
+
+    /**
+     * \brief Internal method for take tasks of job until all of them are taken
+     * \param[in] job Job
+     * \param[in] participant Participant index of current thread
+     */
+    void SearchPool::work(Job& job, size_t participant)
+    {
+        size_t task_idx;
+        while ((task_idx = job.next_task.fetch_add(1)) < job.tasks_count)
+            job.invoke(job.context, task_idx, participant);
+    }
+
+    void SearchPool::workerLoop()
+    {
+        while (true)
+        {
+            Job* job = nullptr;
+            {
+                std::unique_lock<std::mutex> ul(mtx);
+                cv.wait(ul, [this]() { return is_stopped || first_job < jobs.size(); });
+                if (is_stopped && first_job == jobs.size())
+                    return;
+                job = jobs[first_job++];
+                if (first_job == jobs.size())
+                {
+                    jobs.clear();
+                    first_job = 0;
+                }
+                else if (first_job * 2 > jobs.size())
+                {
+                    jobs.erase(jobs.begin(), jobs.begin() + static_cast<std::ptrdiff_t>(first_job)); // moves, doesn't allocate
+                    first_job = 0;
+                }
+                ++job->active_helpers;
+            }
+            // job may be already finished by other participants, then no task is taken
+            if (job->next_task.load() < job->tasks_count)
+                work(*job, job->next_participant.fetch_add(1));
+
+            std::lock_guard<std::mutex> lg(mtx);
+            if (--job->active_helpers == 0)
+                job->cv.notify_all(); // under lock: caller can destroy job right after it sees active_helpers == 0
+        }
+    }
+
+    size_t SearchPool::threadsCount() const
+    {
+        return workers.size();
+    }
+
+    size_t SearchPool::queriesInFlight() const
+    {
+        return queries_count.load();
+    }
+
+}
@@ -0,0 +1,855 @@
+#include "database_module/segmented_index.hpp"
+
+#include <config.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <optional>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        constexpr int tail_initial_rows = 4096;
+        constexpr size_t ordinals_initial_count = 1024;
+
+        /**
+         * \brief Function for mark rows of segment as deleted
+         * \param[in,out] segment Segment (its deleted_rows must not be shared with published segments)
+         * \param[in] rows Rows of segment (must be live and inside one live range)
+         */
+        void markDeleted(SegmentedIndex::Segment& segment, const RowRange& rows)
+        {
+            if (rows.rows_count == 0)
+                return;
+            std::fill(segment.deleted_rows->begin() + rows.first_row,
+                      segment.deleted_rows->begin() + rows.first_row + rows.rows_count, 1);
+            segment.deleted_count += rows.rows_count;
+
+            auto range_it = std::upper_bound(segment.live_ranges.begin(), segment.live_ranges.end(), rows.first_row,
+                                             [](int row, const RowRange& range) { return row < range.first_row; });
+            if (range_it == segment.live_ranges.begin())
+                return;
+            --range_it;
+            const RowRange live = *range_it;
+            const RowRange before = {live.first_row, rows.first_row - live.first_row};
+            const RowRange after = {rows.first_row + rows.rows_count,
+                                    live.first_row + live.rows_count - rows.first_row - rows.rows_count};
+            range_it = segment.live_ranges.erase(range_it);
+            if (after.rows_count > 0)
+                range_it = segment.live_ranges.insert(range_it, after);
+            if (before.rows_count > 0)
+                segment.live_ranges.insert(range_it, before);
+        }
+
+        void appendLiveRange(SegmentedIndex::Segment& segment, const RowRange& rows)
+        {
+            if (rows.rows_count == 0)
+                return;
+            if (!segment.live_ranges.empty())
+            {
+                RowRange& last = segment.live_ranges.back();
+                if (last.first_row + last.rows_count == rows.first_row)
+                {
+                    last.rows_count += rows.rows_count;
+                    return;
+                }
+            }
+            segment.live_ranges.push_back(rows);
+        }
+
+        size_t liveRows(const SegmentedIndex::Segment& segment)
+        {
+            return segment.descriptors.rows - segment.deleted_count;
+        }
+
+        void copyRows(const cv::Mat& source, cv::Mat& destination, int destination_row)
+        {
+            const size_t row_bytes = source.cols * source.elemSize();
+            for (int row = 0; row < source.rows; ++row)
+                std::memcpy(destination.ptr<uint8_t>(destination_row + row), source.ptr<uint8_t>(row), row_bytes);
+        }
+    }
+
+    /**
+     * \brief Method for k nearest neighbours search over live rows of all segments
+     * \param[in] query Query descriptors (CV_8UC1, 32 bytes per row)
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] matches Flat buffer with query.rows * k neighbours (rows of snapshot)
+     * \return true if search was successful
+     *
+     * Live ranges of brute force segments are split into shards of shard_rows, every shard and every
+     * indexed segment is a task of search pool, so one query uses pool workers whatever count of segments is.
+     * Per participant neighbours are merged (result is the same as single thread search).
+     */
+    bool SegmentedIndex::Snapshot::knnSearch(const cv::Mat& query, size_t k, std::vector<HammingMatch>& matches) const
+    {
+        thread_local std::vector<SearchTask> search_tasks;
+        thread_local std::vector<std::vector<HammingMatch>> participant_matches;
+
+        const size_t task_rows = search_pool ? shard_rows : static_cast<size_t>(std::numeric_limits<int>::max());
+        std::vector<SearchTask>& tasks = search_tasks;
+        tasks.clear();
+        for (const auto& segment : segments)
+        {
+            if (liveRows(*segment) == 0)
+                continue;
+            if (!segment->is_bruteforce)
+            {
+                tasks.push_back({segment.get(), {0, segment->descriptors.rows}, false});
+                continue;
+            }
+            for (const RowRange& range : segment->live_ranges)
+            {
+                const size_t end_row = range.first_row + range.rows_count;
+                for (size_t first_row = range.first_row; first_row < end_row; first_row += task_rows)
+                {
+                    const RowRange rows = {static_cast<int>(first_row), static_cast<int>(std::min(end_row - first_row, task_rows))};
+                    tasks.push_back({segment.get(), rows, true});
+                }
+            }
+        }
+
+        resetKnnMatches(matches, query.rows, k);
+        std::optional<SearchPool::QueryScope> query_scope;
+        size_t participants = 1;
+        if (search_pool && tasks.size() > 1)
+        {
+            query_scope.emplace(*search_pool);
+            participants = std::min(query_scope->parallelism(), tasks.size());
+        }
+        if (participants < 2)
+        {
+            for (const SearchTask& task : tasks)
+            {
+                if (!searchTask(task, query, k, matches))
+                    return false;
+            }
+            return true;
+        }
+
+        if (participant_matches.size() < participants)
+            participant_matches.resize(participants);
+        for (size_t i = 0; i < participants; ++i)
+            resetKnnMatches(participant_matches[i], query.rows, k);
+
+        std::vector<std::vector<HammingMatch>>& results = participant_matches;
+        std::atomic<bool> is_ok(true);
+        search_pool->run(tasks.size(), participants, [&](size_t task, size_t participant)
+        {
+            if (!searchTask(tasks[task], query, k, results[participant]))
+                is_ok = false;
+        });
+        if (!is_ok)
+            return false;
+
+        matches.swap(participant_matches[0]);
+        for (size_t i = 1; i < participants; ++i)
+            mergeKnnMatches(matches, participant_matches[i], k, 0);
+        return true;
+    }
+
+    /**
+     * \brief Internal method for run one search task
+     * \param[in] task Shard of brute force segment or indexed segment
+     * \param[in] query Query descriptors
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[in,out] matches Neighbours found by participant (rows of snapshot), task neighbours are merged into them
+     * \return true if search was successful
+     */
+    bool SegmentedIndex::Snapshot::searchTask(const SearchTask& task, const cv::Mat& query, size_t k,
+                                              std::vector<HammingMatch>& matches) const
+    {
+        thread_local std::vector<HammingMatch> task_matches;
+
+        const Segment& segment = *task.segment;
+        if (task.is_scan)
+        {
+            const cv::Mat shard_descriptors = segment.descriptors.rowRange(task.rows.first_row,
+                                                                           task.rows.first_row + task.rows.rows_count);
+            if (!hammingKnnMatch(query, shard_descriptors, k, task_matches))
+                return false;
+            mergeKnnMatches(matches, task_matches, k, segment.first_row + task.rows.first_row);
+            return true;
+        }
+
+        if (!searchSegment(segment, query, k, task_matches))
+            return false;
+        mergeKnnMatches(matches, task_matches, k, segment.first_row);
+        return true;
+    }
+
+    /**
+     * \brief Internal method for search in indexed segment without its deleted rows
+     * \param[in] segment Segment indexed by index other than brute force
+     * \param[in] query Query descriptors
+     * \param[in] k Count of neighbours for each query descriptor
+     * \param[out] matches Neighbours (rows of segment)
+     * \return true if search was successful
+     *
+     * Index is asked for more neighbours than k and deleted ones are skipped, so result is approximate
+     * until compaction. Over-fetch grows with deleted share of segment: twice the neighbours expected
+     * to contain k live ones.
+     */
+    bool SegmentedIndex::Snapshot::searchSegment(const Segment& segment, const cv::Mat& query, size_t k,
+                                                 std::vector<HammingMatch>& matches) const
+    {
+        if (segment.deleted_count == 0)
+            return segment.index->knnSearch(query, k, matches);
+
+        thread_local std::vector<HammingMatch> fetched_matches;
+        const size_t rows_count = segment.descriptors.rows;
+        const size_t live_count = std::max<size_t>(liveRows(segment), 1);
+        const size_t fetch_k = std::max(k, std::min(rows_count, 2 * ((k * rows_count + live_count - 1) / live_count)));
+        if (!segment.index->knnSearch(query, fetch_k, fetched_matches))
+            return false;
+        const std::vector<uint8_t>& deleted_rows = *segment.deleted_rows;
+        resetKnnMatches(matches, query.rows, k);
+        for (int q = 0; q < query.rows; ++q)
+        {
+            size_t found = 0;
+            for (size_t i = 0; i < fetch_k && found < k; ++i)
+            {
+                const HammingMatch& match = fetched_matches[q * fetch_k + i];
+                if (match.train_idx >= 0 && !deleted_rows[match.train_idx])
+                    matches[q * k + found++] = match;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * \brief Method for get exhibit ordinal of row
+     * \param[in] row Row of snapshot (from knnSearch result)
+     * \return Exhibit ordinal
+     */
+    SegmentedIndex::ExhibitOrdinal SegmentedIndex::Snapshot::rowOrdinal(int row) const
+    {
+        const Segment& segment = segmentOfRow(row);
+        return (*segment.row_ordinals)[row - segment.first_row];
+    }
+
+    /**
+     * \brief Method for get exhibit id by its ordinal
+     * \param[in] ordinal Exhibit ordinal (less than ordinalsCount())
+     * \return Exhibit id
+     */
+    const CassUuid& SegmentedIndex::Snapshot::ordinalExhibit(ExhibitOrdinal ordinal) const
+    {
+        return (*ordinal_ids)[ordinal];
+    }
+
+    const CassUuid& SegmentedIndex::Snapshot::rowExhibit(int row) const
+    {
+        return ordinalExhibit(rowOrdinal(row));
+    }
+
+    /**
+     * \brief Method for get keypoint coordinates of row in exhibit image
+     * \param[in] row Row of snapshot (from knnSearch result)
+     * \return Keypoint (NaN coordinates if exhibit was added without keypoints)
+     */
+    cv::Point2f SegmentedIndex::Snapshot::rowKeypoint(int row) const
+    {
+        const Segment& segment = segmentOfRow(row);
+        return segment.keypoints.at<cv::Point2f>(row - segment.first_row, 0);
+    }
+
+    /**
+     * \brief Method for get rows of exhibit in this snapshot
+     * \param[in] ordinal Exhibit ordinal (can be got from other snapshot or bag of words index)
+     * \param[out] rows Rows of exhibit
+     * \return false if exhibit has no live rows in this snapshot
+     *
+     * Rows are ordered by ordinal (exhibits are appended in order of addition and compaction keeps order),
+     * so segment and rows are found by binary search
+     */
+    bool SegmentedIndex::Snapshot::ordinalRows(ExhibitOrdinal ordinal, RowRange& rows) const
+    {
+        // only tail can be empty, it's the last segment
+        auto segment_it = std::upper_bound(segments.begin(), segments.end(), ordinal,
+                                           [](ExhibitOrdinal o, const std::shared_ptr<const Segment>& segment)
+                                           { return segment->descriptors.rows == 0 || o < (*segment->row_ordinals)[0]; });
+        if (segment_it == segments.begin())
+            return false;
+        const Segment& segment = **(segment_it - 1);
+        const auto first = segment.row_ordinals->begin();
+        const auto [begin, end] = std::equal_range(first, first + segment.descriptors.rows, ordinal);
+        if (begin == end || (*segment.deleted_rows)[begin - first])
+            return false;
+        rows = {segment.first_row + static_cast<int>(begin - first), static_cast<int>(end - begin)};
+        return true;
+    }
+
+    /**
+     * \brief Method for get descriptors of exhibit rows
+     * \param[in] rows Rows of exhibit (can be got from other snapshot)
+     * \param[out] descriptors Header of segment descriptors part
+     * \return false if rows don't belong to one exhibit in this snapshot
+     */
+    bool SegmentedIndex::Snapshot::rangeDescriptors(const RowRange& rows, cv::Mat& descriptors) const
+    {
+        if (rows.rows_count <= 0 || rows.first_row < 0 || static_cast<size_t>(rows.first_row + rows.rows_count) > rowsCount())
+            return false;
+
+        const Segment& segment = segmentOfRow(rows.first_row);
+        const int first_row = rows.first_row - segment.first_row;
+        const int end_row = first_row + rows.rows_count;
+        if (end_row > segment.descriptors.rows || (*segment.row_ordinals)[first_row] != (*segment.row_ordinals)[end_row - 1])
+            return false;
+        descriptors = segment.descriptors.rowRange(first_row, end_row);
+        return true;
+    }
+
+    /**
+     * \brief Method for copy all live rows one after another
+     * \param[out] descriptors Descriptors of live rows
+     * \param[out] row_ordinals Exhibit ordinal of every live row
+     */
+    void SegmentedIndex::Snapshot::exportLiveRows(cv::Mat& descriptors, std::vector<ExhibitOrdinal>& row_ordinals) const
+    {
+        descriptors = cv::Mat(static_cast<int>(liveRowsCount()), descriptor_bytes, CV_8UC1);
+        row_ordinals.clear();
+        row_ordinals.reserve(descriptors.rows);
+        for (const auto& segment : segments)
+        {
+            for (const RowRange& range : segment->live_ranges)
+            {
+                copyRows(segment->descriptors.rowRange(range.first_row, range.first_row + range.rows_count),
+                         descriptors, static_cast<int>(row_ordinals.size()));
+                row_ordinals.insert(row_ordinals.end(), segment->row_ordinals->begin() + range.first_row,
+                                    segment->row_ordinals->begin() + range.first_row + range.rows_count);
+            }
+        }
+    }
+
+    /**
+     * \brief Method for visit all live rows by ranges in order of rows
+     * \param[in] visitor Function called for every live range with its descriptors, keypoints and exhibit ordinals
+     */
+    void SegmentedIndex::Snapshot::visitLiveRanges(const LiveRangeVisitor& visitor) const
+    {
+        for (const auto& segment : segments)
+        {
+            for (const RowRange& range : segment->live_ranges)
+            {
+                visitor(segment->descriptors.rowRange(range.first_row, range.first_row + range.rows_count),
+                        segment->keypoints.rowRange(range.first_row, range.first_row + range.rows_count),
+                        segment->row_ordinals->data() + range.first_row);
+            }
+        }
+    }
+
+    /**
+     * \brief Count of rows including deleted ones
+     */
+    size_t SegmentedIndex::Snapshot::rowsCount() const
+    {
+        return segments.back()->first_row + segments.back()->descriptors.rows;
+    }
+
+    size_t SegmentedIndex::Snapshot::liveRowsCount() const
+    {
+        size_t rows_count = 0;
+        for (const auto& segment : segments)
+            rows_count += liveRows(*segment);
+        return rows_count;
+    }
+
+    size_t SegmentedIndex::Snapshot::segmentsCount() const
+    {
+        return segments.size();
+    }
+
+    /**
+     * \brief Count of exhibit ordinals including deleted exhibits (size of vote table)
+     */
+    size_t SegmentedIndex::Snapshot::ordinalsCount() const
+    {
+        return ordinals_count;
+    }
+
+    size_t SegmentedIndex::Snapshot::descriptorBytes() const
+    {
+        return static_cast<size_t>(descriptor_bytes);
+    }
+
+    const SegmentedIndex::Segment& SegmentedIndex::Snapshot::segmentOfRow(int row) const
+    {
+        auto segment_it = std::upper_bound(segments.begin(), segments.end(), row,
+                                           [](int r, const std::shared_ptr<const Segment>& segment) { return r < segment->first_row; });
+        return **(segment_it - 1);
+    }
+
+    /**
+     * \brief Constructor of segmented index (publishes snapshot with empty tail)
+     * \param[in] conf Project config (segment_rows, compaction_deleted_ratio and descriptor index fields)
+     * \param[in] search_pool Worker pool for parallel search (may be nullptr)
+     * \param[in] descriptor_bytes Width of descriptors (mih and hnsw indexes support only ORB width, brute force is used for others)
+     */
+    SegmentedIndex::SegmentedIndex(const Config& conf, const std::shared_ptr<SearchPool>& search_pool, size_t descriptor_bytes)
+        : snapshots(std::make_unique<Snapshot>()),
+          index_type(conf.descriptor_index_type), segment_rows(std::max<size_t>(conf.segment_rows, 1)),
+          compaction_deleted_ratio(conf.compaction_deleted_ratio),
+          descriptor_bytes(static_cast<int>(descriptor_bytes))
+    {
+        auto index_conf = std::make_shared<Config>(conf);
+        if (descriptor_bytes != FeatureTraits<FeatureType::ORB>::descriptor_bytes)
+            index_type = index_conf->descriptor_index_type = "bruteforce";
+        index_config = std::move(index_conf);
+
+        auto first = std::make_unique<Snapshot>();
+        first->descriptor_bytes = this->descriptor_bytes;
+        first->search_pool = search_pool;
+        first->shard_rows = std::max<size_t>(conf.search_shard_rows, 1);
+        first->segments.push_back(newTail(0, std::min<size_t>(tail_initial_rows, segment_rows)));
+        first->ordinal_ids = std::make_shared<std::vector<CassUuid>>(ordinals_initial_count);
+        snapshots.publish(std::move(first));
+    }
+
+    /**
+     * \brief Method for pin current snapshot (without locks)
+     * \return Guard of snapshot, snapshot isn't deleted while guard exists
+     */
+    SegmentedIndex::SnapshotGuard SegmentedIndex::snapshot() const
+    {
+        return snapshots.read();
+    }
+
+    /**
+     * \brief Internal method for create empty tail segment
+     * \param[in] first_row First row of segment
+     * \param[in] capacity Count of rows which can be added without reallocation
+     * \return Tail segment
+     */
+    std::shared_ptr<SegmentedIndex::Segment> SegmentedIndex::newTail(int first_row, size_t capacity) const
+    {
+        auto tail = std::make_shared<Segment>();
+        tail->descriptors_buffer = cv::Mat(static_cast<int>(capacity), descriptor_bytes, CV_8UC1);
+        tail->descriptors = tail->descriptors_buffer.rowRange(0, 0);
+        tail->keypoints_buffer = cv::Mat(static_cast<int>(capacity), 1, CV_32FC2);
+        tail->keypoints = tail->keypoints_buffer.rowRange(0, 0);
+        tail->row_ordinals = std::make_shared<std::vector<ExhibitOrdinal>>(capacity);
+        tail->deleted_rows = std::make_shared<std::vector<uint8_t>>(capacity, 0);
+        auto index = std::make_shared<BruteForceIndex>();
+        index->build(tail->descriptors);
+        tail->index = std::move(index);
+        tail->first_row = first_row;
+        return tail;
+    }
+
+    /**
+     * \brief Method for append exhibit descriptors to tail segment and publish new snapshot
+     * \param[in] id Exhibit id
+     * \param[in] descriptors Exhibit descriptors
+     * \param[in] keypoints Keypoint of every descriptor row (may be empty if unknown)
+     * \return Rows of exhibit
+     *
+     * Full tail is sealed (its brute force index is replaced by compaction if other index type is configured)
+     */
+    RowRange SegmentedIndex::addExhibit(const CassUuid& id, const cv::Mat& descriptors, const std::vector<cv::Point2f>& keypoints)
+    {
+        auto next = std::make_unique<Snapshot>(snapshots.writerValue());
+        const ExhibitOrdinal ordinal = static_cast<ExhibitOrdinal>(next->ordinals_count);
+        if (next->ordinals_count == next->ordinal_ids->size())
+        {
+            auto ordinal_ids = std::make_shared<std::vector<CassUuid>>(2 * next->ordinal_ids->size());
+            std::copy(next->ordinal_ids->begin(), next->ordinal_ids->end(), ordinal_ids->begin());
+            next->ordinal_ids = std::move(ordinal_ids);
+        }
+        // ordinals after ordinals_count aren't used by published snapshots
+        (*next->ordinal_ids)[ordinal] = id;
+        next->ordinals_count++;
+
+        const Segment& tail = *next->segments.back();
+        const int first_row = tail.descriptors.rows;
+        const int rows_count = first_row + descriptors.rows;
+
+        auto new_tail = std::make_shared<Segment>(tail);
+        if (rows_count > new_tail->descriptors_buffer.rows)
+        {
+            const int capacity = std::max(rows_count, 2 * new_tail->descriptors_buffer.rows);
+            new_tail->descriptors_buffer = cv::Mat(capacity, descriptor_bytes, CV_8UC1);
+            copyRows(tail.descriptors, new_tail->descriptors_buffer, 0);
+            new_tail->keypoints_buffer = cv::Mat(capacity, 1, CV_32FC2);
+            copyRows(tail.keypoints, new_tail->keypoints_buffer, 0);
+            new_tail->row_ordinals = std::make_shared<std::vector<ExhibitOrdinal>>(*tail.row_ordinals);
+            new_tail->row_ordinals->resize(capacity);
+            new_tail->deleted_rows = std::make_shared<std::vector<uint8_t>>(*tail.deleted_rows);
+            new_tail->deleted_rows->resize(capacity, 0);
+        }
+        // rows after first_row aren't used by published snapshots
+        copyRows(descriptors, new_tail->descriptors_buffer, first_row);
+        const bool has_keypoints = keypoints.size() == static_cast<size_t>(descriptors.rows);
+        const float unknown = std::numeric_limits<float>::quiet_NaN();
+        for (int row = 0; row < descriptors.rows; ++row)
+            new_tail->keypoints_buffer.at<cv::Point2f>(first_row + row, 0) = has_keypoints ? keypoints[row] : cv::Point2f(unknown, unknown);
+        std::fill(new_tail->row_ordinals->begin() + first_row, new_tail->row_ordinals->begin() + rows_count, ordinal);
+        new_tail->descriptors = new_tail->descriptors_buffer.rowRange(0, rows_count);
+        new_tail->keypoints = new_tail->keypoints_buffer.rowRange(0, rows_count);
+        appendLiveRange(*new_tail, {first_row, descriptors.rows});
+        auto index = std::make_shared<BruteForceIndex>();
+        index->build(new_tail->descriptors);
+        new_tail->index = std::move(index);
+
+        const RowRange rows = {new_tail->first_row + first_row, descriptors.rows};
+        exhibit_ordinals[id] = ordinal;
+        ordinal_rows.push_back(rows);
+
+        next->segments.back() = new_tail;
+        if (static_cast<size_t>(rows_count) >= segment_rows)
+        {
+            new_tail->is_sealed = true;
+            new_tail->is_indexed = index_type == "bruteforce";
+            new_tail->descriptors_buffer = cv::Mat();
+            new_tail->keypoints_buffer = cv::Mat();
+            next->segments.push_back(newTail(new_tail->first_row + rows_count, std::min<size_t>(tail_initial_rows, segment_rows)));
+        }
+        snapshots.publish(std::move(next));
+        return rows;
+    }
+
+    /**
+     * \brief Method for fill empty index by sealed segments over external memory (e.g. mapped snapshot file)
+     * \param[in] descriptors Descriptors of all exhibits one after another (CV_8UC1)
+     * \param[in] keypoints Keypoints of descriptors rows (CV_32FC2, one column)
+     * \param[in] exhibits Exhibits with their rows in descriptors (sorted, without gaps)
+     * \param[in] storage Owner of descriptors and keypoints memory, it's kept while segments are used
+     * \return false if index isn't empty or exhibits don't cover descriptors
+     */
+    bool SegmentedIndex::loadSealed(const cv::Mat& descriptors, const cv::Mat& keypoints,
+                                    const std::vector<std::pair<CassUuid, RowRange>>& exhibits,
+                                    const std::shared_ptr<const void>& storage)
+    {
+        return loadSealed(std::vector<SealedPart>{{descriptors, keypoints, exhibits, storage}});
+    }
+
+    /**
+     * \brief Method for fill empty index by sealed segments over several external buffers (e.g. token ranges of loader)
+     * \param[in] parts Buffers with their exhibits, rows of parts are numbered one after another
+     * \return false if index isn't empty or exhibits of some part don't cover its descriptors
+     *
+     * Descriptors aren't copied: segments are split by exhibit bounds inside every part and keep headers
+     * of descriptors parts, so segment never spans two buffers (small ones are merged by compaction).
+     * Segments are indexed by brute force, compaction builds index of configured type for them.
+     */
+    bool SegmentedIndex::loadSealed(const std::vector<SealedPart>& parts)
+    {
+        const Snapshot& current = snapshots.writerValue();
+        if (current.ordinals_count != 0 || current.rowsCount() != 0)
+            return false;
+        size_t exhibits_count = 0;
+        for (const SealedPart& part : parts)
+        {
+            const cv::Mat& descriptors = part.descriptors;
+            if (descriptors.rows != part.keypoints.rows ||
+                (descriptors.rows > 0 && (descriptors.type() != CV_8UC1 || descriptors.cols != descriptor_bytes)))
+                return false;
+            int rows_count = 0;
+            for (const auto& [id, rows] : part.exhibits)
+            {
+                if (rows.first_row != rows_count || rows.rows_count < 0)
+                    return false;
+                rows_count += rows.rows_count;
+            }
+            if (rows_count != descriptors.rows)
+                return false;
+            exhibits_count += part.exhibits.size();
+        }
+
+        auto next = std::make_unique<Snapshot>();
+        next->descriptor_bytes = descriptor_bytes;
+        next->search_pool = current.search_pool;
+        next->shard_rows = current.shard_rows;
+        next->ordinal_ids = std::make_shared<std::vector<CassUuid>>(std::max(ordinals_initial_count, 2 * exhibits_count));
+        next->ordinals_count = exhibits_count;
+        exhibit_ordinals.reserve(exhibits_count);
+        ordinal_rows.reserve(exhibits_count);
+
+        ExhibitOrdinal first_ordinal = 0;
+        int part_first_row = 0;
+        for (const SealedPart& part : parts)
+        {
+            const std::vector<std::pair<CassUuid, RowRange>>& exhibits = part.exhibits;
+            size_t first_exhibit = 0;
+            while (first_exhibit < exhibits.size())
+            {
+                // segment isn't split inside exhibit, so exhibit bigger than segment_rows gets own segment
+                const int first_row = exhibits[first_exhibit].second.first_row;
+                size_t end_exhibit = first_exhibit + 1;
+                while (end_exhibit < exhibits.size() &&
+                       static_cast<size_t>(exhibits[end_exhibit].second.first_row + exhibits[end_exhibit].second.rows_count - first_row) <= segment_rows)
+                    ++end_exhibit;
+                const int end_row = exhibits[end_exhibit - 1].second.first_row + exhibits[end_exhibit - 1].second.rows_count;
+
+                auto segment = std::make_shared<Segment>();
+                segment->descriptors = part.descriptors.rowRange(first_row, end_row);
+                segment->keypoints = part.keypoints.rowRange(first_row, end_row);
+                segment->row_ordinals = std::make_shared<std::vector<ExhibitOrdinal>>(end_row - first_row);
+                segment->deleted_rows = std::make_shared<std::vector<uint8_t>>(end_row - first_row, 0);
+                appendLiveRange(*segment, {0, end_row - first_row});
+                for (size_t e = first_exhibit; e < end_exhibit; ++e)
+                {
+                    const auto& [id, rows] = exhibits[e];
+                    const ExhibitOrdinal ordinal = first_ordinal + static_cast<ExhibitOrdinal>(e);
+                    std::fill(segment->row_ordinals->begin() + rows.first_row - first_row,
+                              segment->row_ordinals->begin() + rows.first_row - first_row + rows.rows_count, ordinal);
+                    (*next->ordinal_ids)[ordinal] = id;
+                    exhibit_ordinals[id] = ordinal;
+                    ordinal_rows.push_back({part_first_row + rows.first_row, rows.rows_count});
+                }
+                auto index = std::make_shared<BruteForceIndex>();
+                index->build(segment->descriptors);
+                segment->index = std::move(index);
+                segment->is_sealed = true;
+                segment->is_indexed = index_type == "bruteforce";
+                segment->first_row = part_first_row + first_row;
+                segment->storage = part.storage;
+                if (segment->descriptors.rows > 0)
+                    next->segments.push_back(std::move(segment));
+                first_exhibit = end_exhibit;
+            }
+            first_ordinal += static_cast<ExhibitOrdinal>(exhibits.size());
+            part_first_row += part.descriptors.rows;
+        }
+        next->segments.push_back(newTail(part_first_row, std::min<size_t>(tail_initial_rows, segment_rows)));
+        snapshots.publish(std::move(next));
+        return true;
+    }
+
+    /**
+     * \brief Method for delete exhibit (its rows are marked as deleted until compaction) and publish new snapshot
+     * \param[in] id Exhibit id
+     * \return true if exhibit was found
+     */
+    bool SegmentedIndex::removeExhibit(const CassUuid& id)
+    {
+        auto ordinal_it = exhibit_ordinals.find(id);
+        if (ordinal_it == exhibit_ordinals.end())
+            return false;
+
+        const RowRange rows = ordinal_rows[ordinal_it->second];
+        ordinal_rows[ordinal_it->second] = {-1, 0};
+        exhibit_ordinals.erase(ordinal_it);
+        if (rows.rows_count == 0)
+            return true;
+
+        auto next = std::make_unique<Snapshot>(snapshots.writerValue());
+        auto segment_it = std::upper_bound(next->segments.begin(), next->segments.end(), rows.first_row,
+                                           [](int r, const std::shared_ptr<const Segment>& segment) { return r < segment->first_row; }) - 1;
+        auto segment = std::make_shared<Segment>(**segment_it);
+        segment->deleted_rows = std::make_shared<std::vector<uint8_t>>(*segment->deleted_rows);
+        markDeleted(*segment, {rows.first_row - segment->first_row, rows.rows_count});
+        *segment_it = std::move(segment);
+        snapshots.publish(std::move(next));
+        return true;
+    }
+
+    bool SegmentedIndex::contains(const CassUuid& id) const
+    {
+        return exhibit_ordinals.find(id) != exhibit_ordinals.end();
+    }
+
+    const SegmentedIndex::ExhibitOrdinals& SegmentedIndex::exhibitOrdinals() const
+    {
+        return exhibit_ordinals;
+    }
+
+    /**
+     * \brief Method for get current rows of live exhibit
+     * \param[in] ordinal Exhibit ordinal (from exhibitOrdinals())
+     * \return Rows of exhibit in the last published snapshot
+     */
+    RowRange SegmentedIndex::exhibitRows(ExhibitOrdinal ordinal) const
+    {
+        return ordinal_rows[ordinal];
+    }
+
+    /**
+     * \brief Method for choose sealed segments for compaction (doesn't need serialization with writers)
+     * \param[out] compaction Sequence of segments to rewrite
+     * \return true if there is work for compaction
+     *
+     * Segment is compacted if it isn't indexed by configured index or has too many deleted rows,
+     * neighbour segments are merged into it while total count of live rows fits into one segment
+     */
+    bool SegmentedIndex::prepareCompaction(Compaction& compaction) const
+    {
+        SnapshotGuard current = snapshot();
+        const auto& segments = current->segments;
+        const size_t sealed_count = segments.size() - 1;
+        for (size_t i = 0; i < sealed_count; ++i)
+        {
+            size_t total_rows = liveRows(*segments[i]);
+            const bool is_mergeable = i + 1 < sealed_count && total_rows + liveRows(*segments[i + 1]) <= segment_rows;
+            if (!needsCompaction(*segments[i]) && !is_mergeable)
+                continue;
+
+            size_t end = i + 1;
+            while (end < sealed_count && total_rows + liveRows(*segments[end]) <= segment_rows)
+                total_rows += liveRows(*segments[end++]);
+
+            compaction.first_segment = i;
+            compaction.sources.assign(segments.begin() + i, segments.begin() + end);
+            compaction.result.reset();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Method for write new segment from live rows of compaction sources and build its index
+     * \param[in,out] compaction Prepared compaction
+     * \return true if successful
+     *
+     * Doesn't need serialization with writers: sources are immutable segments of snapshot
+     */
+    bool SegmentedIndex::buildCompaction(Compaction& compaction) const
+    {
+        size_t rows_count = 0;
+        for (const auto& source : compaction.sources)
+            rows_count += liveRows(*source);
+
+        auto result = std::make_shared<Segment>();
+        result->descriptors = cv::Mat(static_cast<int>(rows_count), descriptor_bytes, CV_8UC1);
+        result->keypoints = cv::Mat(static_cast<int>(rows_count), 1, CV_32FC2);
+        result->row_ordinals = std::make_shared<std::vector<ExhibitOrdinal>>();
+        result->row_ordinals->reserve(rows_count);
+        for (const auto& source : compaction.sources)
+        {
+            for (const RowRange& range : source->live_ranges)
+            {
+                copyRows(source->descriptors.rowRange(range.first_row, range.first_row + range.rows_count),
+                         result->descriptors, static_cast<int>(result->row_ordinals->size()));
+                copyRows(source->keypoints.rowRange(range.first_row, range.first_row + range.rows_count),
+                         result->keypoints, static_cast<int>(result->row_ordinals->size()));
+                result->row_ordinals->insert(result->row_ordinals->end(), source->row_ordinals->begin() + range.first_row,
+                                             source->row_ordinals->begin() + range.first_row + range.rows_count);
+            }
+        }
+        result->deleted_rows = std::make_shared<std::vector<uint8_t>>(rows_count, 0);
+        appendLiveRange(*result, {0, static_cast<int>(rows_count)});
+
+        std::shared_ptr<DescriptorIndex> index = createDescriptorIndex(*index_config);
+        if (!index || !index->build(result->descriptors))
+            return false;
+        result->index = std::move(index);
+        result->is_bruteforce = index_type == "bruteforce";
+        result->is_sealed = true;
+        result->is_indexed = true;
+        compaction.result = std::move(result);
+        return true;
+    }
+
+    /**
+     * \brief Method for replace compaction sources by built segment and publish new snapshot
+     * \param[in,out] compaction Built compaction
+     * \return false if sources were replaced after compaction was prepared (compaction is dropped)
+     *
+     * Exhibits deleted while compaction was built are marked in new segment.
+     */
+    bool SegmentedIndex::applyCompaction(Compaction& compaction)
+    {
+        const Snapshot& current = snapshots.writerValue();
+        const size_t first_segment = compaction.first_segment;
+        const size_t sources_count = compaction.sources.size();
+        if (!compaction.result || sources_count == 0 || first_segment + sources_count >= current.segments.size())
+            return false;
+        // tombstones of sources could be changed, but their rows are the same
+        for (size_t s = 0; s < sources_count; ++s)
+        {
+            if (current.segments[first_segment + s]->row_ordinals != compaction.sources[s]->row_ordinals)
+                return false;
+        }
+
+        const int old_first_row = current.segments[first_segment]->first_row;
+        int old_rows_count = 0;
+        for (size_t s = 0; s < sources_count; ++s)
+            old_rows_count += current.segments[first_segment + s]->descriptors.rows;
+        const int old_end_row = old_first_row + old_rows_count;
+
+        std::shared_ptr<Segment> result = std::move(compaction.result);
+        result->first_row = old_first_row;
+        const std::vector<ExhibitOrdinal>& row_ordinals = *result->row_ordinals;
+        for (size_t row = 0; row < row_ordinals.size();)
+        {
+            size_t end = row + 1;
+            while (end < row_ordinals.size() && row_ordinals[end] == row_ordinals[row])
+                ++end;
+            const RowRange rows = {static_cast<int>(row), static_cast<int>(end - row)};
+            RowRange& exhibit_rows = ordinal_rows[row_ordinals[row]];
+            if (exhibit_rows.first_row < 0)
+            {
+                markDeleted(*result, rows);
+            }
+            else
+            {
+                exhibit_rows.first_row = old_first_row + rows.first_row;
+            }
+            row = end;
+        }
+
+        auto next = std::make_unique<Snapshot>();
+        next->descriptor_bytes = descriptor_bytes;
+        next->search_pool = current.search_pool;
+        next->shard_rows = current.shard_rows;
+        next->ordinal_ids = current.ordinal_ids;
+        next->ordinals_count = current.ordinals_count;
+        next->segments.assign(current.segments.begin(), current.segments.begin() + first_segment);
+        if (result->descriptors.rows > 0)
+            next->segments.push_back(result);
+        int first_row = old_first_row + result->descriptors.rows;
+        for (size_t i = first_segment + sources_count; i < current.segments.size(); ++i)
+        {
+            if (current.segments[i]->first_row == first_row)
+            {
+                next->segments.push_back(current.segments[i]);
+            }
+            else
+            {
+                auto moved_segment = std::make_shared<Segment>(*current.segments[i]);
+                moved_segment->first_row = first_row;
+                next->segments.push_back(std::move(moved_segment));
+            }
+            first_row += current.segments[i]->descriptors.rows;
+        }
+
+        const int removed_rows_count = old_rows_count - result->descriptors.rows;
+        if (removed_rows_count > 0)
+        {
+            for (size_t ordinal = 0; ordinal < ordinal_rows.size(); ++ordinal)
+            {
+                RowRange& exhibit_rows = ordinal_rows[ordinal];
+                if (exhibit_rows.first_row >= old_end_row)
+                    exhibit_rows.first_row -= removed_rows_count;
+            }
+        }
+        snapshots.publish(std::move(next));
+        return true;
+    }
+
+    /**
+     * \brief Method for delete old snapshots which aren't used by readers any more
+     * \return Count of snapshots which are still waiting for readers
+     */
+    size_t SegmentedIndex::reclaim()
+    {
+        return snapshots.reclaim();
+    }
+
+    std::string SegmentedIndex::indexName() const
+    {
+        return index_type;
+    }
+
+    bool SegmentedIndex::needsCompaction(const Segment& segment) const
+    {
+        return !segment.is_indexed ||
+               (segment.deleted_count > 0 &&
+                segment.deleted_count >= compaction_deleted_ratio * segment.descriptors.rows);
+    }
+
+}
@@ -0,0 +1,631 @@
+#include "database_module/shard_protocol.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        constexpr uint32_t frame_magic = 0x5347504D; // "MPGS"
+        constexpr uint32_t protocol_version = 1;
+        constexpr uint32_t max_payload_size = 64 * 1024 * 1024;
+
+        struct FrameHeader
+        {
+            uint32_t magic;
+            uint32_t payload_size;
+        };
+
+        struct QueryHeader
+        {
+            uint32_t version;
+            uint32_t rows;
+            uint32_t cols;
+            uint32_t time_budget_ms;
+            uint32_t has_keypoints;
+        };
+
+        struct WireCandidate
+        {
+            cass_uint64_t time_and_version;
+            cass_uint64_t clock_seq_and_node;
+            uint32_t votes;
+            uint32_t processed_rows;
+            uint32_t inliers;
+            uint32_t is_verifiable;
+        };
+
+        static_assert(sizeof(FrameHeader) == 8, "shard frame header layout");
+        static_assert(sizeof(QueryHeader) == 20, "shard query header layout");
+        static_assert(sizeof(WireCandidate) == 32, "shard candidate layout");
+
+        /**
+         * \brief Milliseconds left to deadline for poll (-1 means no deadline)
+         */
+        int pollTimeout(std::chrono::steady_clock::time_point deadline)
+        {
+            if (deadline == std::chrono::steady_clock::time_point::max())
+                return -1;
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            return static_cast<int>(std::max<int64_t>(left.count(), 0));
+        }
+
+        bool waitSocket(int fd, short events, std::chrono::steady_clock::time_point deadline)
+        {
+            pollfd poll_fd{fd, events, 0};
+            int rc = 0;
+            do
+            {
+                rc = poll(&poll_fd, 1, pollTimeout(deadline));
+            } while (rc < 0 && errno == EINTR);
+            return rc > 0 && (poll_fd.revents & (events | POLLHUP | POLLERR)) != 0;
+        }
+
+        bool sendAll(int fd, const uint8_t* data, size_t size, std::chrono::steady_clock::time_point deadline)
+        {
+            while (size > 0)
+            {
+                if (!waitSocket(fd, POLLOUT, deadline))
+                    return false;
+                const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+                if (sent < 0 && (errno == EINTR || errno == EAGAIN))
+                    continue;
+                if (sent <= 0)
+                    return false;
+                data += sent;
+                size -= static_cast<size_t>(sent);
+            }
+            return true;
+        }
+
+        bool receiveAll(int fd, uint8_t* data, size_t size, std::chrono::steady_clock::time_point deadline)
+        {
+            while (size > 0)
+            {
+                if (!waitSocket(fd, POLLIN, deadline))
+                    return false;
+                const ssize_t received = recv(fd, data, size, 0);
+                if (received < 0 && (errno == EINTR || errno == EAGAIN))
+                    continue;
+                if (received <= 0)
+                    return false;
+                data += received;
+                size -= static_cast<size_t>(received);
+            }
+            return true;
+        }
+
+        bool writeFrame(int fd, const std::vector<uint8_t>& payload, std::chrono::steady_clock::time_point deadline)
+        {
+            const FrameHeader header{frame_magic, static_cast<uint32_t>(payload.size())};
+            return sendAll(fd, reinterpret_cast<const uint8_t*>(&header), sizeof(header), deadline) &&
+                   sendAll(fd, payload.data(), payload.size(), deadline);
+        }
+
+        bool readFrame(int fd, std::vector<uint8_t>& payload, std::chrono::steady_clock::time_point deadline)
+        {
+            FrameHeader header{};
+            if (!receiveAll(fd, reinterpret_cast<uint8_t*>(&header), sizeof(header), deadline) ||
+                header.magic != frame_magic || header.payload_size > max_payload_size)
+                return false;
+            payload.resize(header.payload_size);
+            return receiveAll(fd, payload.data(), payload.size(), deadline);
+        }
+
+        void appendBytes(std::vector<uint8_t>& payload, const void* bytes, size_t size)
+        {
+            const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+            payload.insert(payload.end(), begin, begin + size);
+        }
+    }
+
+    /**
+     * \brief Function for get shard of exhibit (the same in all processes)
+     * \param[in] id Exhibit id
+     * \param[in] shards_count Count of shards
+     * \return Index of shard which keeps exhibit
+     */
+    size_t exhibitShard(const CassUuid& id, size_t shards_count)
+    {
+        if (shards_count <= 1)
+            return 0;
+        // splitmix64 finalizer, std::hash isn't guaranteed to be the same in different builds
+        uint64_t value = id.time_and_version ^ (id.clock_seq_and_node * 0x9E3779B97F4A7C15ull);
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        value ^= value >> 31;
+        return static_cast<size_t>(value % shards_count);
+    }
+
+    /**
+     * \brief Function for serialize shard query
+     * \param[in] query Query (descriptors must be CV_8UC1)
+     * \param[out] payload Frame payload
+     * \return true if query is valid
+     */
+    bool encodeShardQuery(const ShardQuery& query, std::vector<uint8_t>& payload)
+    {
+        const bool has_keypoints = !query.keypoints.empty();
+        if ((!query.descriptors.empty() && query.descriptors.type() != CV_8UC1) ||
+            (has_keypoints && query.keypoints.size() != static_cast<size_t>(query.descriptors.rows)))
+            return false;
+
+        const QueryHeader header{protocol_version, static_cast<uint32_t>(query.descriptors.rows),
+                                 static_cast<uint32_t>(query.descriptors.cols), query.time_budget_ms, has_keypoints ? 1u : 0u};
+        payload.clear();
+        payload.reserve(sizeof(header) + query.descriptors.total() + query.keypoints.size() * sizeof(cv::Point2f));
+        appendBytes(payload, &header, sizeof(header));
+        for (int row = 0; row < query.descriptors.rows; ++row)
+            appendBytes(payload, query.descriptors.ptr(row), query.descriptors.cols);
+        if (has_keypoints)
+            appendBytes(payload, query.keypoints.data(), query.keypoints.size() * sizeof(cv::Point2f));
+        return true;
+    }
+
+    /**
+     * \brief Function for deserialize shard query
+     * \param[in] payload Frame payload
+     * \param[out] query Query
+     * \return true if payload is valid
+     */
+    bool decodeShardQuery(const std::vector<uint8_t>& payload, ShardQuery& query)
+    {
+        QueryHeader header{};
+        if (payload.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, payload.data(), sizeof(header));
+        const uint64_t descriptors_size = uint64_t(header.rows) * header.cols;
+        const uint64_t keypoints_size = header.has_keypoints ? uint64_t(header.rows) * sizeof(cv::Point2f) : 0;
+        if (header.version != protocol_version || payload.size() != sizeof(header) + descriptors_size + keypoints_size)
+            return false;
+
+        const uint8_t* descriptors_data = payload.data() + sizeof(header);
+        query.descriptors = cv::Mat(static_cast<int>(header.rows), static_cast<int>(header.cols), CV_8UC1);
+        if (descriptors_size > 0)
+            std::memcpy(query.descriptors.data, descriptors_data, descriptors_size);
+        query.keypoints.resize(header.has_keypoints ? header.rows : 0);
+        if (keypoints_size > 0)
+            std::memcpy(query.keypoints.data(), descriptors_data + descriptors_size, keypoints_size);
+        query.time_budget_ms = header.time_budget_ms;
+        return true;
+    }
+
+    /**
+     * \brief Function for serialize candidates found by shard
+     * \param[in] candidates Candidates
+     * \param[out] payload Frame payload
+     */
+    void encodeShardResult(const std::vector<ExhibitCandidate>& candidates, std::vector<uint8_t>& payload)
+    {
+        const uint32_t count = static_cast<uint32_t>(candidates.size());
+        payload.clear();
+        payload.reserve(sizeof(count) + candidates.size() * sizeof(WireCandidate));
+        appendBytes(payload, &count, sizeof(count));
+        for (const ExhibitCandidate& candidate : candidates)
+        {
+            const WireCandidate wire{candidate.id.time_and_version, candidate.id.clock_seq_and_node, candidate.votes,
+                                     candidate.processed_rows, candidate.inliers, candidate.is_verifiable ? 1u : 0u};
+            appendBytes(payload, &wire, sizeof(wire));
+        }
+    }
+
+    /**
+     * \brief Function for deserialize candidates found by shard
+     * \param[in] payload Frame payload
+     * \param[out] candidates Candidates
+     * \return true if payload is valid
+     */
+    bool decodeShardResult(const std::vector<uint8_t>& payload, std::vector<ExhibitCandidate>& candidates)
+    {
+        uint32_t count = 0;
+        if (payload.size() < sizeof(count))
+            return false;
+        std::memcpy(&count, payload.data(), sizeof(count));
+        if (payload.size() != sizeof(count) + uint64_t(count) * sizeof(WireCandidate))
+            return false;
+
+        candidates.resize(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            WireCandidate wire{};
+            std::memcpy(&wire, payload.data() + sizeof(count) + i * sizeof(WireCandidate), sizeof(wire));
+            candidates[i].id = CassUuid{wire.time_and_version, wire.clock_seq_and_node};
+            candidates[i].votes = wire.votes;
+            candidates[i].processed_rows = wire.processed_rows;
+            candidates[i].inliers = wire.inliers;
+            candidates[i].is_verifiable = wire.is_verifiable != 0;
+        }
+        return true;
+    }
+
+    ShardServer::~ShardServer()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Method for start listening
+     * \param[in] address Local address to bind (empty means all interfaces)
+     * \param[in] port TCP port (0 means any free port, see port())
+     * \param[in] query_handler Function which searches query in local database, it's called from connection threads
+     * \param[in] max_connections Count of connections served at once, connections above it are closed at accept
+     * \return true if server started
+     */
+    bool ShardServer::start(const std::string& address, uint16_t port, Handler query_handler, size_t max_connections)
+    {
+        handler = std::move(query_handler);
+        connections_limit = std::max<size_t>(max_connections, 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(address.empty() ? nullptr : address.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+            return false;
+
+        for (addrinfo* bind_address = addresses; bind_address && listen_fd < 0; bind_address = bind_address->ai_next)
+        {
+            listen_fd = socket(bind_address->ai_family, bind_address->ai_socktype, bind_address->ai_protocol);
+            if (listen_fd < 0)
+                continue;
+            const int enable = 1;
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            if (bind(listen_fd, bind_address->ai_addr, bind_address->ai_addrlen) != 0 || listen(listen_fd, SOMAXCONN) != 0)
+            {
+                close(listen_fd);
+                listen_fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+
+        sockaddr_storage bound_address{};
+        socklen_t address_size = sizeof(bound_address);
+        if (listen_fd < 0 || getsockname(listen_fd, reinterpret_cast<sockaddr*>(&bound_address), &address_size) != 0)
+        {
+            if (listen_fd >= 0)
+                close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        listen_port = ntohs(bound_address.ss_family == AF_INET6 ? reinterpret_cast<const sockaddr_in6&>(bound_address).sin6_port :
+                                                                  reinterpret_cast<const sockaddr_in&>(bound_address).sin_port);
+        is_stopped = false;
+        accept_thread = std::thread(&ShardServer::acceptLoop, this);
+        return true;
+    }
+
+    /**
+     * \brief Method for stop server, waits for queries in progress
+     */
+    void ShardServer::stop()
+    {
+        if (listen_fd < 0)
+            return;
+        is_stopped = true;
+        shutdown(listen_fd, SHUT_RDWR); // wakes accept
+        if (accept_thread.joinable())
+            accept_thread.join();
+        close(listen_fd);
+        listen_fd = -1;
+
+        std::lock_guard<std::mutex> lg(connections_mtx);
+        for (auto& connection : connections)
+            shutdown(connection->fd, SHUT_RDWR); // wakes recv of idle connections
+        for (auto& connection : connections)
+        {
+            connection->thread.join();
+            close(connection->fd);
+        }
+        connections.clear();
+    }
+
+    /**
+     * \brief Method for get listening port
+     * \return Port (useful if server was started on port 0)
+     */
+    uint16_t ShardServer::port() const
+    {
+        return listen_port;
+    }
+
+    /**
+     * \brief Method for get count of connections closed because of max_connections
+     * \return Count of rejected connections since start
+     */
+    uint64_t ShardServer::rejectedConnections() const
+    {
+        return rejected_connections;
+    }
+
+    void ShardServer::acceptLoop()
+    {
+        while (!is_stopped)
+        {
+            const int connection_fd = accept(listen_fd, nullptr, nullptr);
+            if (connection_fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+            const int enable = 1;
+            setsockopt(connection_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+            std::lock_guard<std::mutex> lg(connections_mtx);
+            for (auto it = connections.begin(); it != connections.end();)
+            {
+                if (!(*it)->is_finished)
+                {
+                    ++it;
+                    continue;
+                }
+                (*it)->thread.join();
+                close((*it)->fd);
+                it = connections.erase(it);
+            }
+            if (is_stopped)
+            {
+                close(connection_fd);
+                return;
+            }
+            if (connections.size() >= connections_limit)
+            {
+                // client sees closed connection and skips shard, so overload doesn't start more threads
+                ++rejected_connections;
+                close(connection_fd);
+                continue;
+            }
+            auto connection = std::make_unique<Connection>();
+            connection->fd = connection_fd;
+            connection->thread = std::thread(&ShardServer::serveConnection, this, std::ref(*connection));
+            connections.push_back(std::move(connection));
+        }
+    }
+
+    void ShardServer::serveConnection(Connection& connection)
+    {
+        std::vector<uint8_t> payload;
+        ShardQuery query;
+        while (!is_stopped && readFrame(connection.fd, payload, std::chrono::steady_clock::time_point::max()))
+        {
+            if (!decodeShardQuery(payload, query))
+                break;
+            encodeShardResult(handler(query), payload);
+            if (!writeFrame(connection.fd, payload, std::chrono::steady_clock::time_point::max()))
+                break;
+        }
+        connection.is_finished = true;
+    }
+
+    /**
+     * \brief Constructor of shard client
+     * \param[in] endpoint Shard address in "host:port" format
+     */
+    ShardClient::ShardClient(const std::string& endpoint)
+        : shard_endpoint(endpoint)
+    {
+        const size_t colon = endpoint.rfind(':');
+        host = colon == std::string::npos ? endpoint : endpoint.substr(0, colon);
+        port = colon == std::string::npos ? std::string() : endpoint.substr(colon + 1);
+    }
+
+    ShardClient::~ShardClient()
+    {
+        for (int fd : idle_fds)
+            close(fd);
+    }
+
+    /**
+     * \brief Method for search query in shard
+     * \param[in] shard_query Query
+     * \param[in] deadline Time after which shard is considered slow and its result is dropped
+     * \param[out] candidates Candidates found by shard
+     * \return true if shard answered before deadline
+     *
+     * Can be called from several threads, every query uses own connection
+     */
+    bool ShardClient::query(const ShardQuery& shard_query, std::chrono::steady_clock::time_point deadline,
+                            std::vector<ExhibitCandidate>& candidates)
+    {
+        std::vector<uint8_t> payload;
+        if (!encodeShardQuery(shard_query, payload))
+            return false;
+
+        // idle connection can be closed by restarted shard, then query is repeated on new one
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            bool is_reused = false;
+            const int fd = attempt == 0 ? acquire(deadline, is_reused) : connect(deadline);
+            if (fd < 0)
+                return false;
+
+            std::vector<uint8_t> result_payload;
+            if (writeFrame(fd, payload, deadline) && readFrame(fd, result_payload, deadline))
+            {
+                const bool is_decoded = decodeShardResult(result_payload, candidates);
+                if (is_decoded)
+                    release(fd);
+                else
+                    close(fd);
+                return is_decoded;
+            }
+            // connection state is unknown after timeout, late result mustn't be read by next query
+            close(fd);
+            if (!is_reused || std::chrono::steady_clock::now() >= deadline)
+                return false;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Method for get shard address
+     * \return Address in "host:port" format
+     */
+    const std::string& ShardClient::endpoint() const
+    {
+        return shard_endpoint;
+    }
+
+    int ShardClient::acquire(std::chrono::steady_clock::time_point deadline, bool& is_reused)
+    {
+        {
+            std::lock_guard<std::mutex> lg(idle_mtx);
+            is_reused = !idle_fds.empty();
+            if (is_reused)
+            {
+                const int fd = idle_fds.back();
+                idle_fds.pop_back();
+                return fd;
+            }
+        }
+        return connect(deadline);
+    }
+
+    void ShardClient::release(int fd)
+    {
+        std::lock_guard<std::mutex> lg(idle_mtx);
+        idle_fds.push_back(fd);
+    }
+
+    int ShardClient::connect(std::chrono::steady_clock::time_point deadline)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+            return -1;
+
+        int fd = -1;
+        for (addrinfo* address = addresses; address && fd < 0; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+            if (fd < 0)
+                continue;
+            int error = 0;
+            socklen_t error_size = sizeof(error);
+            const bool is_connected = ::connect(fd, address->ai_addr, address->ai_addrlen) == 0 ||
+                                      (errno == EINPROGRESS && waitSocket(fd, POLLOUT, deadline) &&
+                                       getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_size) == 0 && error == 0);
+            if (!is_connected)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd >= 0)
+        {
+            const int enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+        return fd;
+    }
+
+    /**
+     * \brief Method for send query to all shards
+     * \param[in] clients Shards
+     * \param[in] shard_query Query
+     * \param[in] deadline Time after which shards are considered slow and their results are dropped
+     *
+     * Query frame fits socket buffer, so sending doesn't wait for shards. Only new connections wait for connect.
+     */
+    void ShardFanout::send(const std::vector<std::unique_ptr<ShardClient>>& clients, const ShardQuery& shard_query,
+                           std::chrono::steady_clock::time_point deadline)
+    {
+        query_deadline = deadline;
+        pending.clear();
+        unsent_shards.clear();
+        if (!encodeShardQuery(shard_query, query_payload))
+        {
+            for (const auto& client : clients)
+                unsent_shards.push_back(client.get());
+            return;
+        }
+        for (const auto& client : clients)
+        {
+            if (!sendTo(client.get(), true))
+                unsent_shards.push_back(client.get());
+        }
+    }
+
+    /**
+     * \brief Method for read results of shards sent by send()
+     * \param[in, out] candidates Candidates found by shards are appended
+     * \param[out] failed_shards Shards which didn't answer before deadline
+     */
+    void ShardFanout::receive(std::vector<ExhibitCandidate>& candidates, std::vector<const ShardClient*>& failed_shards)
+    {
+        failed_shards = unsent_shards;
+        while (!pending.empty())
+        {
+            poll_fds.clear();
+            for (const PendingQuery& query : pending)
+                poll_fds.push_back(pollfd{query.fd, POLLIN, 0});
+            const int rc = poll(poll_fds.data(), poll_fds.size(), pollTimeout(query_deadline));
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                break;
+
+            // resent queries are appended to pending, indexes of polled ones below i don't change
+            for (size_t i = poll_fds.size(); i-- > 0;)
+            {
+                if (poll_fds[i].revents == 0)
+                    continue;
+                const PendingQuery query = pending[i];
+                pending.erase(pending.begin() + static_cast<std::ptrdiff_t>(i));
+                // result is small and comes in one segment, so it's read right after it starts arriving
+                if (readFrame(query.fd, result_payload, query_deadline) && decodeShardResult(result_payload, shard_candidates))
+                {
+                    query.client->release(query.fd);
+                    candidates.insert(candidates.end(), shard_candidates.begin(), shard_candidates.end());
+                    continue;
+                }
+                close(query.fd);
+                if (!query.is_reused || std::chrono::steady_clock::now() >= query_deadline || !sendTo(query.client, false))
+                    failed_shards.push_back(query.client);
+            }
+        }
+        // late results mustn't be read by next queries
+        for (const PendingQuery& query : pending)
+        {
+            close(query.fd);
+            failed_shards.push_back(query.client);
+        }
+        pending.clear();
+    }
+
+    bool ShardFanout::sendTo(ShardClient* client, bool is_idle_allowed)
+    {
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            bool is_reused = false;
+            const int fd = is_idle_allowed && attempt == 0 ? client->acquire(query_deadline, is_reused) :
+                                                             client->connect(query_deadline);
+            if (fd < 0)
+                return false;
+            if (writeFrame(fd, query_payload, query_deadline))
+            {
+                pending.push_back(PendingQuery{client, fd, is_reused});
+                return true;
+            }
+            close(fd);
+            if (!is_reused)
+                return false;
+        }
+        return false;
+    }
+
+}
@@ -0,0 +1,291 @@
+#include "database_module/snapshot_file.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        constexpr char snapshot_magic[8] = {'M', 'P', 'G', 'S', 'N', 'A', 'P', '\0'};
+
+        static_assert(sizeof(SnapshotFile::Header) == 48, "snapshot header layout");
+        static_assert(sizeof(SnapshotFile::Exhibit) == 24, "snapshot exhibit layout");
+
+        /**
+         * \brief Size of descriptors section with padding, so keypoints section is aligned for any descriptor width
+         */
+        uint64_t descriptorsSectionSize(uint64_t rows_count, uint64_t descriptor_bytes)
+        {
+            return (rows_count * descriptor_bytes + 7) / 8 * 8;
+        }
+
+        /**
+         * \brief 64 bit checksum of snapshot sections (processes 8 bytes words, bytes of unfinished word wait for next update)
+         */
+        class Checksum
+        {
+        public:
+
+            void update(const uint8_t* bytes, size_t size)
+            {
+                size_t offset = 0;
+                while (pending_bytes > 0 && offset < size)
+                    addPendingByte(bytes[offset++]);
+                for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+                {
+                    uint64_t word;
+                    std::memcpy(&word, bytes + offset, sizeof(word));
+                    mix(word);
+                }
+                while (offset < size)
+                    addPendingByte(bytes[offset++]);
+            }
+
+            uint64_t finish()
+            {
+                if (pending_bytes > 0)
+                    mix(pending_word);
+                pending_word = 0;
+                pending_bytes = 0;
+                return value;
+            }
+
+        private:
+
+            void addPendingByte(uint8_t byte)
+            {
+                pending_word |= static_cast<uint64_t>(byte) << (8 * pending_bytes);
+                if (++pending_bytes == sizeof(uint64_t))
+                {
+                    mix(pending_word);
+                    pending_word = 0;
+                    pending_bytes = 0;
+                }
+            }
+
+            void mix(uint64_t word)
+            {
+                value ^= word * 0x9E3779B97F4A7C15ull;
+                value = ((value << 29) | (value >> 35)) * 0xBF58476D1CE4E5B9ull;
+            }
+
+            uint64_t value = 0x6A09E667F3BCC908ull;
+            uint64_t pending_word = 0;
+            size_t pending_bytes = 0;
+        };
+
+        bool writeBytes(std::ofstream& stream, Checksum& checksum, const void* bytes, size_t size)
+        {
+            checksum.update(static_cast<const uint8_t*>(bytes), size);
+            stream.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+            return stream.good();
+        }
+
+        bool writeRows(std::ofstream& stream, Checksum& checksum, const cv::Mat& rows)
+        {
+            const size_t row_bytes = rows.cols * rows.elemSize();
+            if (rows.isContinuous())
+                return writeBytes(stream, checksum, rows.data, row_bytes * rows.rows);
+            for (int row = 0; row < rows.rows; ++row)
+            {
+                if (!writeBytes(stream, checksum, rows.ptr<uint8_t>(row), row_bytes))
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    SnapshotFile::~SnapshotFile()
+    {
+        close();
+    }
+
+    /**
+     * \brief Method for write live rows of local database snapshot to file
+     * \param[in] path Path of snapshot file (it's replaced atomically by rename of temporary file)
+     * \param[in] snapshot Pinned local database snapshot
+     * \param[in] synced_at_us Time (in microseconds since epoch) since which database changes can be missed by snapshot
+     * \return true if file was written
+     */
+    bool SnapshotFile::write(const std::string& path, const SegmentedIndex::Snapshot& snapshot, int64_t synced_at_us)
+    {
+        // exhibits table goes before rows, so it's collected by first pass
+        std::vector<Exhibit> exhibits;
+        SegmentedIndex::ExhibitOrdinal last_ordinal = 0;
+        int32_t rows_count = 0;
+        snapshot.visitLiveRanges([&](const cv::Mat& descriptors, const cv::Mat&, const SegmentedIndex::ExhibitOrdinal* row_ordinals)
+        {
+            for (int row = 0; row < descriptors.rows; ++row, ++rows_count)
+            {
+                if (!exhibits.empty() && row_ordinals[row] == last_ordinal)
+                {
+                    exhibits.back().rows_count++;
+                    continue;
+                }
+                last_ordinal = row_ordinals[row];
+                const CassUuid& id = snapshot.ordinalExhibit(last_ordinal);
+                exhibits.push_back({id.time_and_version, id.clock_seq_and_node, rows_count, 1});
+            }
+        });
+
+        std::error_code error;
+        const std::filesystem::path file_path(path);
+        if (file_path.has_parent_path())
+            std::filesystem::create_directories(file_path.parent_path(), error);
+        const std::string temporary_path = path + ".tmp";
+        std::ofstream stream(temporary_path, std::ios::binary | std::ios::trunc);
+        if (!stream)
+            return false;
+
+        Header file_header = {};
+        std::memcpy(file_header.magic, snapshot_magic, sizeof(snapshot_magic));
+        file_header.version = version;
+        file_header.descriptor_bytes = static_cast<uint32_t>(snapshot.descriptorBytes());
+        file_header.exhibits_count = exhibits.size();
+        file_header.rows_count = static_cast<uint64_t>(rows_count);
+        file_header.synced_at_us = synced_at_us;
+        stream.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+
+        Checksum checksum;
+        bool is_written = writeBytes(stream, checksum, exhibits.data(), exhibits.size() * sizeof(Exhibit));
+        snapshot.visitLiveRanges([&](const cv::Mat& descriptors, const cv::Mat&, const SegmentedIndex::ExhibitOrdinal*)
+        {
+            is_written = is_written && writeRows(stream, checksum, descriptors);
+        });
+        const uint64_t descriptors_bytes = static_cast<uint64_t>(rows_count) * file_header.descriptor_bytes;
+        const uint8_t padding[8] = {};
+        is_written = is_written && writeBytes(stream, checksum, padding,
+                                              descriptorsSectionSize(rows_count, file_header.descriptor_bytes) - descriptors_bytes);
+        snapshot.visitLiveRanges([&](const cv::Mat&, const cv::Mat& keypoints, const SegmentedIndex::ExhibitOrdinal*)
+        {
+            is_written = is_written && writeRows(stream, checksum, keypoints);
+        });
+
+        file_header.checksum = checksum.finish();
+        stream.seekp(0);
+        stream.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+        stream.close();
+        if (!is_written || !stream)
+        {
+            std::filesystem::remove(temporary_path, error);
+            return false;
+        }
+        std::filesystem::rename(temporary_path, path, error);
+        return !error;
+    }
+
+    /**
+     * \brief Method for map snapshot file to memory and validate it
+     * \param[in] path Path of snapshot file
+     * \param[in] descriptor_bytes Descriptor width of local database
+     * \return false if file doesn't exist, has other version or descriptor width or is damaged
+     */
+    bool SnapshotFile::open(const std::string& path, size_t descriptor_bytes)
+    {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(Header))
+        {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(file_stat.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            size = 0;
+            return false;
+        }
+        data = static_cast<uint8_t*>(mapping);
+        header = reinterpret_cast<const Header*>(data);
+
+        // counts are checked against file size before multiplication, so damaged header can't overflow it
+        const bool is_valid_header = std::memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) == 0 &&
+                                     header->version == version && header->descriptor_bytes == descriptor_bytes &&
+                                     header->rows_count <= static_cast<uint64_t>(INT32_MAX) &&
+                                     header->exhibits_count <= size / sizeof(Exhibit) &&
+                                     sizeof(Header) + header->exhibits_count * sizeof(Exhibit) +
+                                     descriptorsSectionSize(header->rows_count, descriptor_bytes) +
+                                     header->rows_count * sizeof(cv::Point2f) == size;
+        if (!is_valid_header)
+        {
+            close();
+            return false;
+        }
+        Checksum checksum;
+        checksum.update(data + sizeof(Header), size - sizeof(Header));
+        if (checksum.finish() != header->checksum)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    int64_t SnapshotFile::syncedAt() const
+    {
+        return header ? header->synced_at_us : 0;
+    }
+
+    /**
+     * \brief Method for get exhibits table
+     * \return Exhibit ids with their rows in descriptors()
+     */
+    std::vector<std::pair<CassUuid, RowRange>> SnapshotFile::exhibits() const
+    {
+        std::vector<std::pair<CassUuid, RowRange>> result;
+        if (!header)
+            return result;
+        const Exhibit* table = reinterpret_cast<const Exhibit*>(data + sizeof(Header));
+        result.reserve(header->exhibits_count);
+        for (uint64_t i = 0; i < header->exhibits_count; ++i)
+            result.push_back({CassUuid{table[i].time_and_version, table[i].clock_seq_and_node}, RowRange{table[i].first_row, table[i].rows_count}});
+        return result;
+    }
+
+    /**
+     * \brief Method for get header of mapped descriptors (read only memory, valid while file is open)
+     */
+    cv::Mat SnapshotFile::descriptors() const
+    {
+        if (!header)
+            return cv::Mat();
+        uint8_t* descriptors_data = data + sizeof(Header) + header->exhibits_count * sizeof(Exhibit);
+        return cv::Mat(static_cast<int>(header->rows_count), static_cast<int>(header->descriptor_bytes), CV_8UC1, descriptors_data);
+    }
+
+    /**
+     * \brief Method for get header of mapped keypoints (read only memory, valid while file is open)
+     */
+    cv::Mat SnapshotFile::keypoints() const
+    {
+        if (!header)
+            return cv::Mat();
+        uint8_t* keypoints_data = data + sizeof(Header) + header->exhibits_count * sizeof(Exhibit) +
+                                  descriptorsSectionSize(header->rows_count, header->descriptor_bytes);
+        return cv::Mat(static_cast<int>(header->rows_count), 1, CV_32FC2, keypoints_data);
+    }
+
+    void SnapshotFile::close()
+    {
+        if (data)
+            munmap(data, size);
+        data = nullptr;
+        size = 0;
+        header = nullptr;
+    }
+
+}
@@ -0,0 +1,214 @@
+#include "database_module/vocabulary_tree.hpp"
+
+#include <random>
+
+
+namespace MPG
+{
+
+    /**
+     * \brief Method for train vocabulary tree
+     * \param[in] descriptors Training descriptors (CV_8UC1, 32 bytes per row), large sets are subsampled
+     * \param[in] branching_factor Count of children of every inner node
+     * \param[in] tree_depth Count of levels under root (up to branching_factor ^ tree_depth words)
+     * \param[in] max_iterations Limit of k-majority iterations for one node
+     * \return true if training was successful
+     */
+    bool VocabularyTree::train(const cv::Mat& descriptors, size_t branching_factor, size_t tree_depth, size_t max_iterations)
+    {
+        if (descriptors.empty() || descriptors.type() != CV_8UC1 || descriptors.cols != descriptor_bytes ||
+            branching_factor < 2 || tree_depth == 0)
+        {
+            return false;
+        }
+
+        branching = branching_factor;
+        depth = tree_depth;
+        iterations = std::max<size_t>(max_iterations, 1);
+
+        const size_t total_rows = descriptors.rows;
+        const size_t sample_rows = std::min(total_rows, max_training_descriptors);
+        std::vector<uint8_t> rows(sample_rows * descriptor_bytes);
+        for (size_t i = 0; i < sample_rows; ++i)
+        {
+            const size_t source_row = i * total_rows / sample_rows; // uniform stride over whole database
+            std::memcpy(rows.data() + i * descriptor_bytes, descriptors.ptr<uint8_t>(static_cast<int>(source_row)), descriptor_bytes);
+        }
+        std::vector<uint8_t> buffer(rows.size());
+
+        nodes.assign(1, {0, 0, 0});
+        centers.assign(descriptor_bytes, 0);
+        words_count = 0;
+        trainNode(0, rows, buffer, 0, sample_rows, 0);
+        return true;
+    }
+
+    /**
+     * \brief Internal method for recursive k-majority clustering of tree node
+     * \param[in] node Index of node in nodes
+     * \param[in,out] rows Training descriptors, rows of node are [begin, end) and are reordered by child clusters
+     * \param[in] buffer Temporary buffer with size of rows
+     * \param[in] begin First row of node
+     * \param[in] end Row after last row of node
+     * \param[in] level Level of node (root is 0)
+     */
+    void VocabularyTree::trainNode(uint32_t node, std::vector<uint8_t>& rows, std::vector<uint8_t>& buffer,
+                                   size_t begin, size_t end, size_t level)
+    {
+        const size_t count = end - begin;
+        if (level == depth || count <= branching)
+        {
+            nodes[node].word = static_cast<uint32_t>(words_count++);
+            return;
+        }
+
+        const HammingKernel kernel = bestHammingKernel();
+        const uint8_t* node_rows = rows.data() + begin * descriptor_bytes;
+        std::mt19937 rng(node);
+        std::vector<HammingMatch> nearest(count);
+
+        // k-means++ seeding: next center is chosen with probability proportional to squared distance
+        std::vector<uint8_t> child_centers;
+        child_centers.reserve(branching * descriptor_bytes);
+        std::vector<uint64_t> min_distance(count, UINT64_MAX);
+        size_t seed_row = rng() % count;
+        for (size_t c = 0; c < branching; ++c)
+        {
+            child_centers.insert(child_centers.end(), node_rows + seed_row * descriptor_bytes,
+                                 node_rows + (seed_row + 1) * descriptor_bytes);
+            hammingKnnMatch<descriptor_bytes, 1>(kernel, node_rows, count, descriptor_bytes,
+                                                 child_centers.data() + c * descriptor_bytes, 1, descriptor_bytes, nearest.data());
+            uint64_t distances_sum = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const uint64_t distance = static_cast<uint64_t>(nearest[i].distance) * nearest[i].distance;
+                min_distance[i] = std::min(min_distance[i], distance);
+                distances_sum += min_distance[i];
+            }
+            if (distances_sum == 0)
+                break;
+
+            uint64_t target = std::uniform_int_distribution<uint64_t>(0, distances_sum - 1)(rng);
+            for (seed_row = 0; seed_row + 1 < count && target >= min_distance[seed_row]; ++seed_row)
+                target -= min_distance[seed_row];
+        }
+
+        const size_t clusters = child_centers.size() / descriptor_bytes;
+        if (clusters < 2)
+        {
+            nodes[node].word = static_cast<uint32_t>(words_count++);
+            return;
+        }
+
+        // k-majority iterations
+        std::vector<uint32_t> labels(count, UINT32_MAX);
+        std::vector<uint32_t> bit_counts(clusters * descriptor_bytes * 8);
+        std::vector<uint32_t> cluster_sizes(clusters);
+        for (size_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            hammingKnnMatch<descriptor_bytes, 1>(kernel, node_rows, count, descriptor_bytes,
+                                                 child_centers.data(), clusters, descriptor_bytes, nearest.data());
+            bool changed = false;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const uint32_t label = static_cast<uint32_t>(nearest[i].train_idx);
+                changed |= labels[i] != label;
+                labels[i] = label;
+            }
+            if (!changed)
+                break;
+
+            std::fill(bit_counts.begin(), bit_counts.end(), 0);
+            std::fill(cluster_sizes.begin(), cluster_sizes.end(), 0);
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t* counts = bit_counts.data() + labels[i] * descriptor_bytes * 8;
+                const uint8_t* row = node_rows + i * descriptor_bytes;
+                for (size_t bit = 0; bit < descriptor_bytes * 8; ++bit)
+                    counts[bit] += (row[bit / 8] >> (bit % 8)) & 1;
+                ++cluster_sizes[labels[i]];
+            }
+            for (size_t c = 0; c < clusters; ++c)
+            {
+                if (cluster_sizes[c] == 0)
+                    continue;
+                const uint32_t* counts = bit_counts.data() + c * descriptor_bytes * 8;
+                uint8_t* center = child_centers.data() + c * descriptor_bytes;
+                std::fill(center, center + descriptor_bytes, 0);
+                for (size_t bit = 0; bit < descriptor_bytes * 8; ++bit)
+                {
+                    if (counts[bit] * 2 > cluster_sizes[c])
+                        center[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+                }
+            }
+        }
+
+        // group rows by clusters, empty clusters don't get child nodes
+        std::fill(cluster_sizes.begin(), cluster_sizes.end(), 0);
+        for (size_t i = 0; i < count; ++i)
+            ++cluster_sizes[labels[i]];
+        std::vector<size_t> cluster_begin(clusters + 1, 0);
+        for (size_t c = 0; c < clusters; ++c)
+            cluster_begin[c + 1] = cluster_begin[c] + cluster_sizes[c];
+        std::vector<size_t> cluster_fill(cluster_begin.begin(), cluster_begin.end() - 1);
+        for (size_t i = 0; i < count; ++i)
+        {
+            std::memcpy(buffer.data() + (begin + cluster_fill[labels[i]]++) * descriptor_bytes,
+                        node_rows + i * descriptor_bytes, descriptor_bytes);
+        }
+        std::memcpy(rows.data() + begin * descriptor_bytes, buffer.data() + begin * descriptor_bytes, count * descriptor_bytes);
+
+        const uint32_t first_child = static_cast<uint32_t>(nodes.size());
+        uint32_t children_count = 0;
+        for (size_t c = 0; c < clusters; ++c)
+        {
+            if (cluster_sizes[c] == 0)
+                continue;
+            nodes.push_back({0, 0, 0});
+            centers.insert(centers.end(), child_centers.data() + c * descriptor_bytes,
+                           child_centers.data() + (c + 1) * descriptor_bytes);
+            ++children_count;
+        }
+        nodes[node].first_child = first_child;
+        nodes[node].children_count = children_count;
+
+        uint32_t child = first_child;
+        for (size_t c = 0; c < clusters; ++c)
+        {
+            if (cluster_sizes[c] == 0)
+                continue;
+            trainNode(child++, rows, buffer, begin + cluster_begin[c], begin + cluster_begin[c + 1], level + 1);
+        }
+    }
+
+    /**
+     * \brief Method for get visual word of descriptor
+     * \param[in] descriptor Pointer to descriptor (32 bytes)
+     * \return Word index (tree must be trained)
+     */
+    uint32_t VocabularyTree::quantize(const uint8_t* descriptor) const
+    {
+        const HammingKernel kernel = bestHammingKernel();
+        uint32_t node = 0;
+        while (nodes[node].children_count > 0)
+        {
+            HammingMatch nearest;
+            hammingKnnMatch<descriptor_bytes, 1>(kernel, descriptor, 1, descriptor_bytes,
+                                                 centers.data() + nodes[node].first_child * descriptor_bytes,
+                                                 nodes[node].children_count, descriptor_bytes, &nearest);
+            node = nodes[node].first_child + static_cast<uint32_t>(nearest.train_idx);
+        }
+        return nodes[node].word;
+    }
+
+    size_t VocabularyTree::wordsCount() const
+    {
+        return words_count;
+    }
+
+    bool VocabularyTree::empty() const
+    {
+        return words_count == 0;
+    }
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace MPG
+{
+
+    /**
+     * \brief Byte range of response body (inclusive bounds, as in Content-Range)
+     */
+    struct ByteRange
+    {
+        size_t first = 0;
+        size_t last = 0;
+    };
+
+    /**
+     * \brief Result of parsing Range header
+     */
+    enum class RangeStatus
+    {
+        Full,          // no header, several ranges or not bytes unit: whole body is sent
+        Partial,       // one satisfiable range
+        Unsatisfiable  // range is out of body
+    };
+
+    bool isETagMatched(const std::string& if_none_match, const std::string& etag);
+    RangeStatus parseByteRange(const std::string& range, size_t body_size, ByteRange& byte_range);
+    const char* imageContentType(const std::vector<uint8_t>& image);
+
+}
@@ -2,6 +2,7 @@
 
 #include <core_module/core.hpp>
 #include <server/server_utils.hpp>
+#include <server/http_utils.hpp>
 
 namespace MPG{
 
@@ -22,8 +23,14 @@ protected:
 
     void addExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
     void getExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
+    void getExhibitImage(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
     void deleteExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
     void getDatabaseChunk(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
+    void getLiveness(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
+    void getReadiness(const wfrest::HttpReq* req, wfrest::HttpResp* resp);
+
+    bool checkReady(wfrest::HttpResp* resp);
+    bool parseImageSize(const wfrest::HttpReq* req, wfrest::HttpResp* resp, std::optional<ImageRendition>& rendition);
 
     std::unique_ptr<Core> core_ptr;
     std::unique_ptr<wfrest::HttpServer> server_ptr;
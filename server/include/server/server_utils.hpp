@@ -23,6 +23,7 @@ auto bind(void handler(const wfrest::HttpReq*, wfrest::HttpResp*), TController *
 }
 
 void to_json(nlohmann::json& j, const DatabaseResponse& db_resp);
+std::string exhibitRowJson(const ExhibitRowView& row, const ChunkFields& fields);
 
 
 }
\ No newline at end of file
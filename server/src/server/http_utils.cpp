@@ -0,0 +1,110 @@
+#include <server/http_utils.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+
+
+namespace MPG
+{
+
+    namespace
+    {
+        std::string trim(const std::string& value)
+        {
+            const size_t first = value.find_first_not_of(" \t");
+            if (first == std::string::npos)
+                return std::string();
+            const size_t last = value.find_last_not_of(" \t");
+            return value.substr(first, last - first + 1);
+        }
+
+        std::optional<size_t> parseNumber(const std::string& value)
+        {
+            if (value.empty() || value.size() > 19 ||
+                !std::all_of(value.begin(), value.end(), [](unsigned char c) { return std::isdigit(c) != 0; }))
+                return std::nullopt;
+            return static_cast<size_t>(std::stoull(value));
+        }
+    }
+
+    /**
+     * \brief Function for check If-None-Match header
+     * \param[in] if_none_match Header value (list of ETags or "*")
+     * \param[in] etag ETag of current body
+     * \return true if client has current body (weak comparison, as required for If-None-Match)
+     */
+    bool isETagMatched(const std::string& if_none_match, const std::string& etag)
+    {
+        std::istringstream stream(if_none_match);
+        std::string candidate;
+        while (std::getline(stream, candidate, ','))
+        {
+            candidate = trim(candidate);
+            if (candidate.rfind("W/", 0) == 0)
+                candidate.erase(0, 2);
+            if (candidate == "*" || candidate == etag)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Function for parse Range header
+     * \param[in] range Header value ("bytes=first-last", "bytes=first-" or "bytes=-suffix_length")
+     * \param[in] body_size Size of whole body
+     * \param[out] byte_range Range clamped to body (valid if RangeStatus::Partial is returned)
+     * \return Whether whole body, range or 416 error must be sent
+     */
+    RangeStatus parseByteRange(const std::string& range, size_t body_size, ByteRange& byte_range)
+    {
+        const std::string value = trim(range);
+        if (value.rfind("bytes=", 0) != 0 || value.find(',') != std::string::npos)
+            return RangeStatus::Full; // several ranges are allowed to be answered by whole body
+        const std::string spec = trim(value.substr(6));
+        const size_t dash = spec.find('-');
+        if (dash == std::string::npos)
+            return RangeStatus::Full;
+
+        const std::string first_str = trim(spec.substr(0, dash));
+        const std::string last_str = trim(spec.substr(dash + 1));
+        const std::optional<size_t> first = parseNumber(first_str);
+        const std::optional<size_t> last = parseNumber(last_str);
+        if (first_str.empty())
+        {
+            if (!last.has_value())
+                return RangeStatus::Full;
+            if (last.value() == 0 || body_size == 0)
+                return RangeStatus::Unsatisfiable;
+            byte_range.first = body_size - std::min(last.value(), body_size);
+            byte_range.last = body_size - 1;
+            return RangeStatus::Partial;
+        }
+        if (!first.has_value() || (!last_str.empty() && (!last.has_value() || last.value() < first.value())))
+            return RangeStatus::Full; // invalid range is ignored
+        if (first.value() >= body_size)
+            return RangeStatus::Unsatisfiable;
+        byte_range.first = first.value();
+        byte_range.last = last.has_value() ? std::min(last.value(), body_size - 1) : body_size - 1;
+        return RangeStatus::Partial;
+    }
+
+    /**
+     * \brief Function for get Content-Type of image by its signature
+     * \param[in] image Encoded image
+     * \return MIME type of JPEG, PNG or WebP, application/octet-stream for others
+     */
+    const char* imageContentType(const std::vector<uint8_t>& image)
+    {
+        if (image.size() >= 3 && image[0] == 0xFF && image[1] == 0xD8 && image[2] == 0xFF)
+            return "image/jpeg";
+        constexpr uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+        if (image.size() >= 8 && std::equal(png_signature, png_signature + 8, image.begin()))
+            return "image/png";
+        if (image.size() >= 12 && std::memcmp(image.data(), "RIFF", 4) == 0 && std::memcmp(image.data() + 8, "WEBP", 4) == 0)
+            return "image/webp";
+        return "application/octet-stream";
+    }
+
+}
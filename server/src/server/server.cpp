@@ -1,5 +1,7 @@
 #include <server/server.hpp>
 
+#include <wfrest/HttpServerTask.h>
+
 namespace MPG
 {
 
@@ -10,7 +12,8 @@ namespace MPG
 */
 Server::Server(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log)
 {
-    core_ptr = std::make_unique<Core>(conf, log);
+    // database is loaded in background, server answers 503 until core is ready
+    core_ptr = std::make_unique<Core>(conf, log, true);
     server_ptr = std::make_unique<wfrest::HttpServer>();
 
     config_ptr = conf;
@@ -18,8 +21,11 @@ Server::Server(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger
 
     server_ptr->POST("/add-exhibit", bind(&Server::addExhibit, this));
     server_ptr->POST("/get-exhibit", bind(&Server::getExhibit, this));
+    server_ptr->GET("/exhibit-image/{id}", bind(&Server::getExhibitImage, this));
     server_ptr->DELETE("/delete-exhibit", bind(&Server::deleteExhibit, this));
     server_ptr->GET("/get-database-chunk", bind(&Server::getDatabaseChunk, this));
+    server_ptr->GET("/health/live", bind(&Server::getLiveness, this));
+    server_ptr->GET("/health/ready", bind(&Server::getReadiness, this));
 
     logger_ptr->LogInfo("Server: server created!");
 }
@@ -59,6 +65,8 @@ void Server::stop()
 */
 void Server::addExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 {
+    if (!checkReady(resp))
+        return;
     logger_ptr->LogInfo("Server: Start adding new exhibit");
     std::vector<uint8_t> exhibit_main_image;
     std::vector<std::vector<uint8_t>> exhibit_train_images;
@@ -89,7 +97,7 @@ void Server::addExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
         }
     }
 
-    std::cout << "Image vector size: " << (double)exhibit_main_image.size() / (1024. * 1024.) << std::endl;
+    logger_ptr->LogInfo("Server: main image size " + std::to_string(exhibit_main_image.size()) + " bytes");
 
     CoreRequest core_request;
     core_request.exhibit_description = std::move(exhibit_description);
@@ -114,9 +122,17 @@ void Server::addExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 
      HTTP query must have next fields in body (multi-form):
         - exhibit-image (.jpg image) - image for searching
+     and can have next fields in params:
+        - time-budget-ms (unsigned integer) - time for matching, the best exhibit found in it is returned
+        - image-size (thumbnail, mobile or full) - size of returned image, default_image_rendition from config by default
+        - inline-image (true or false) - return image in response (base64), inline_exhibit_image from config by default
+
+     Response has exhibit_image_url, image is returned in JSON only if it's inlined
 */
 void Server::getExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 {
+    if (!checkReady(resp))
+        return;
     logger_ptr->LogInfo("Server: Start getting exhibit");
     std::vector<uint8_t> exhibit_image;
     auto& files = req->form();
@@ -132,7 +148,14 @@ void Server::getExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
             logger_ptr->LogWarning("Server: invalid add exhibit request param with name " + key);
         }
     }
-    auto exhibit_info = core_ptr->getExhibit(std::move(exhibit_image));
+    const auto& time_budget_ms = req->query("time-budget-ms");
+    const std::chrono::milliseconds time_budget(time_budget_ms.empty() ? 0 : std::strtoul(time_budget_ms.c_str(), nullptr, 10));
+    std::optional<ImageRendition> rendition;
+    if (!parseImageSize(req, resp, rendition))
+        return;
+    const auto& inline_image = req->query("inline-image");
+    const bool is_image_inlined = inline_image.empty() ? config_ptr->inline_exhibit_image : inline_image == "true";
+    auto exhibit_info = core_ptr->getExhibit(std::move(exhibit_image), time_budget, rendition);
     if (!exhibit_info.has_value())
     {
         resp->set_status(HttpStatusBadRequest);
@@ -143,12 +166,82 @@ void Server::getExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
         data_json["exhibit_id"] = std::move(exhibit_info.value().exhibit_id);
         data_json["exhibit_title"] = std::move(exhibit_info.value().exhibit_name);
         data_json["exhibit_description"] = std::move(exhibit_info.value().exhibit_description);
-        data_json["exhibit_image"] = std::move(wfrest::Base64::encode(exhibit_info.value().exhibit_image.data(), 
-                                     exhibit_info.value().exhibit_image.size()));
+        data_json["confidence"] = exhibit_info.value().percentage_of_confidance;
+        std::string image_url = "/exhibit-image/" + data_json["exhibit_id"].get<std::string>();
+        if (rendition.has_value())
+            image_url += std::string("?image-size=") + imageRenditionName(rendition.value());
+        data_json["exhibit_image_url"] = std::move(image_url);
+        if (is_image_inlined)
+            data_json["exhibit_image"] = std::move(wfrest::Base64::encode(exhibit_info.value().exhibit_image.data(), 
+                                         exhibit_info.value().exhibit_image.size()));
         resp->Json(data_json.dump());
     }
 }
 
+/**
+     * \brief Method for processing "exhibit-image/{id}" route
+
+     HTTP query can have next fields in params:
+        - image-size (thumbnail, mobile or full) - size of image, default_image_rendition from config by default
+     and next headers:
+        - If-None-Match - ETag of cached image, 304 is returned if image isn't changed
+        - Range (single bytes range) and If-Range - part of image, 206 is returned
+
+     Image is sent as raw bytes of shared payload without copy, with ETag (hash of content computed when payload
+     is read from database) and Cache-Control headers
+*/
+void Server::getExhibitImage(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
+{
+    if (!checkReady(resp))
+        return;
+    std::optional<ImageRendition> rendition;
+    if (!parseImageSize(req, resp, rendition))
+        return;
+    ExhibitCache::Payload payload = core_ptr->getExhibitImage(req->param("id"), rendition);
+    if (!payload)
+    {
+        resp->set_status(HttpStatusNotFound);
+        return;
+    }
+
+    const std::vector<uint8_t>& image = payload->exhibit_image;
+    const std::string& etag = payload->exhibit_image_etag;
+    resp->add_header("ETag", etag);
+    resp->add_header("Cache-Control", "public, max-age=" + std::to_string(config_ptr->image_cache_max_age_s));
+    resp->add_header("Accept-Ranges", "bytes");
+    if (req->has_header("If-None-Match") && isETagMatched(req->header("If-None-Match"), etag))
+    {
+        resp->set_status(HttpStatusNotModified);
+        return;
+    }
+
+    const size_t image_size = image.size();
+    ByteRange range{0, image_size > 0 ? image_size - 1 : 0};
+    RangeStatus range_status = RangeStatus::Full;
+    // If-Range with other ETag means that client has other image, so whole image is sent
+    if (req->has_header("Range") && (!req->has_header("If-Range") || req->header("If-Range") == etag))
+        range_status = parseByteRange(req->header("Range"), image_size, range);
+    if (range_status == RangeStatus::Unsatisfiable)
+    {
+        resp->set_status(HttpStatusRequestedRangeNotSatisfiable);
+        resp->add_header("Content-Range", "bytes */" + std::to_string(image_size));
+        return;
+    }
+
+    resp->add_header("Content-Type", imageContentType(image));
+    if (range_status == RangeStatus::Partial)
+    {
+        resp->set_status(HttpStatusPartialContent);
+        resp->add_header("Content-Range", "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" +
+                                          std::to_string(image_size));
+    }
+    if (image_size == 0)
+        return;
+    // body points into payload without copy, server task keeps payload until response is sent
+    wfrest::task_of(resp)->add_callback([payload](wfrest::HttpTask*) {});
+    resp->append_output_body_nocopy(image.data() + range.first, range.last - range.first + 1);
+}
+
 /**
      * \brief Method for processing "delete-exhibit" route
 
@@ -157,6 +250,8 @@ void Server::getExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 */
 void Server::deleteExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 {
+    if (!checkReady(resp))
+        return;
     logger_ptr->LogInfo("Server: Start delete exhibit");
     auto& exhibit_id = req->query("exhibit-id");
     if (exhibit_id == "")
@@ -177,28 +272,199 @@ void Server::deleteExhibit(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 
      HTTP quety must have next fields in params:
         - next-chunk-token (base64-encoded) - cass page noken (empty for first chunk)
+     and can have:
+        - fields - comma separated columns of exhibits (id, title, description, image), all by default
+        - format (json or ndjson) - ndjson returns exhibit per line and page token in the last line, json by default
+
+     Rows are serialized one by one to response body as they are read from Cassandra result
 */
 void Server::getDatabaseChunk(const wfrest::HttpReq* req, wfrest::HttpResp* resp)
 {
+    if (!checkReady(resp))
+        return;
     logger_ptr->LogInfo("Server: Start get database chunk");
     auto& encoded_token = req->query("next-chunk-token");  
     auto next_chunk_token = wfrest::Base64::decode(encoded_token);
-    auto chunk = core_ptr->getDatabaseChunk(next_chunk_token);
+    const std::optional<ChunkFields> fields = chunkFieldsFromNames(req->query("fields"));
+    const auto& format = req->query("format");
+    if (!fields.has_value() || (!format.empty() && format != "json" && format != "ndjson"))
+    {
+        resp->set_status(HttpStatusBadRequest);
+        resp->String("Invalid fields (expected id, title, description or image) or format (expected json or ndjson)");
+        return;
+    }
+    const bool is_ndjson = format == "ndjson";
+
+    size_t exhibits_count = 0;
+    if (!is_ndjson)
+        resp->append_output_body("{\"exhibits\":[");
+    auto chunk = core_ptr->visitDatabaseChunk(next_chunk_token, fields.value(), [&](const ExhibitRowView& row)
+    {
+        std::string row_json = exhibitRowJson(row, fields.value());
+        if (is_ndjson)
+            row_json += '\n';
+        else if (exhibits_count > 0)
+            resp->append_output_body(",", 1);
+        resp->append_output_body(row_json);
+        ++exhibits_count;
+    });
     if (!chunk.has_value())
     {
+        resp->clear_output_body();
         resp->set_status(HttpStatusBadRequest);
         resp->String("No chunk or empty chunk");
         return;
     }
-    nlohmann::json data_json;
-    data_json["next_chunk_token"] = std::move(wfrest::Base64::encode(reinterpret_cast<const unsigned char*>
+
+    nlohmann::json page_json;
+    page_json["next_chunk_token"] = std::move(wfrest::Base64::encode(reinterpret_cast<const unsigned char*>
                                     (chunk.value().next_chunk_token.data()), 
                                     chunk.value().next_chunk_token.size()));
-    data_json["is_last_chunk"] = std::move(chunk.value().is_last_chunk);
-    data_json["exhibits"] = std::move(chunk.value().exhibits);
+    page_json["is_last_chunk"] = chunk.value().is_last_chunk;
+    std::string page_str = page_json.dump();
+    if (is_ndjson)
+    {
+        resp->add_header("Content-Type", "application/x-ndjson");
+        resp->append_output_body(page_str + "\n");
+    }
+    else
+    {
+        resp->add_header("Content-Type", "application/json");
+        page_str[0] = ','; // fields of page are appended to object with exhibits
+        resp->append_output_body("]" + page_str);
+    }
+}
+
+/**
+     * \brief Method for processing "health/live" route
+
+     Returns 200 while process works (also during warmup) and 503 if database initialization failed
+*/
+void Server::getLiveness(const wfrest::HttpReq*, wfrest::HttpResp* resp)
+{
+    nlohmann::json data_json;
+    if (core_ptr->state() == Core::State::Failed)
+    {
+        resp->set_status(HttpStatusServiceUnavailable);
+        data_json["status"] = "failed";
+    }
+    else
+    {
+        data_json["status"] = "alive";
+    }
     resp->Json(data_json.dump());
 }
 
+/**
+     * \brief Method for processing "health/ready" route
+
+     Returns 200 when local database is loaded and requests are served, else 503 with Retry-After header
+*/
+void Server::getReadiness(const wfrest::HttpReq*, wfrest::HttpResp* resp)
+{
+    if (!checkReady(resp))
+        return;
+    nlohmann::json data_json;
+    data_json["status"] = "ready";
+    const Core::ExtractorPool::Stats extractor_stats = core_ptr->extractorPoolStats();
+    data_json["extractor_pool"] = {{"capacity", extractor_stats.capacity},
+                                   {"in_use", extractor_stats.in_use},
+                                   {"peak_in_use", extractor_stats.peak_in_use},
+                                   {"acquired", extractor_stats.acquired_count},
+                                   {"waited", extractor_stats.waited_count},
+                                   {"wait_us", extractor_stats.wait_us}};
+    const Core::ScratchStats scratch_stats = core_ptr->scratchStats();
+    data_json["query_scratch"] = {{"queries", scratch_stats.queries_count},
+                                  {"queries_growing_buffers", scratch_stats.grown_buffer_queries_count}};
+    const QueryCache::Stats cache_stats = core_ptr->queryCacheStats();
+    data_json["query_cache"] = {{"capacity", cache_stats.capacity},
+                                {"size", cache_stats.size},
+                                {"lookups", cache_stats.lookups_count},
+                                {"hits", cache_stats.hits_count},
+                                {"hit_rate", cache_stats.lookups_count > 0 ?
+                                                 static_cast<double>(cache_stats.hits_count) / cache_stats.lookups_count : 0.0},
+                                {"insertions", cache_stats.insertions_count},
+                                {"rejections", cache_stats.rejections_count},
+                                {"invalidations", cache_stats.invalidations_count}};
+    const ExhibitCache::Stats exhibit_cache_stats = core_ptr->exhibitCacheStats();
+    data_json["exhibit_cache"] = {{"capacity_bytes", exhibit_cache_stats.capacity_bytes},
+                                  {"size_bytes", exhibit_cache_stats.size_bytes},
+                                  {"entries", exhibit_cache_stats.entries_count},
+                                  {"hits", exhibit_cache_stats.hits_count},
+                                  {"misses", exhibit_cache_stats.misses_count},
+                                  {"insertions", exhibit_cache_stats.insertions_count},
+                                  {"rejections", exhibit_cache_stats.rejections_count},
+                                  {"evictions", exhibit_cache_stats.evictions_count},
+                                  {"invalidations", exhibit_cache_stats.invalidations_count}};
+    resp->Json(data_json.dump());
+}
+
+/**
+     * \brief Internal method for reject request while core isn't ready
+     * \param[in] resp Response, it gets 503 status if core isn't ready
+     * \return true if core is ready
+*/
+bool Server::checkReady(wfrest::HttpResp* resp)
+{
+    const Core::State state = core_ptr->state();
+    if (state == Core::State::Ready)
+        return true;
+
+    nlohmann::json data_json;
+    data_json["status"] = state == Core::State::Starting ? "starting" : "failed";
+    resp->set_status(HttpStatusServiceUnavailable);
+    if (state == Core::State::Starting)
+        resp->add_header("Retry-After", std::to_string(config_ptr->warmup_retry_after_s));
+    resp->Json(data_json.dump());
+    return false;
+}
+
+/**
+     * \brief Internal method for parse image-size query parameter
+     * \param[in] req Request
+     * \param[in] resp Response, it gets 400 status if parameter is invalid
+     * \param[out] rendition Parsed size of image, std::nullopt if parameter isn't given
+     * \return true if parameter is absent or valid
+*/
+bool Server::parseImageSize(const wfrest::HttpReq* req, wfrest::HttpResp* resp, std::optional<ImageRendition>& rendition)
+{
+    const auto& image_size = req->query("image-size");
+    if (image_size.empty())
+        return true;
+    rendition = imageRenditionFromName(image_size);
+    if (rendition.has_value())
+        return true;
+    resp->set_status(HttpStatusBadRequest);
+    resp->String("Invalid image-size, expected thumbnail, mobile or full");
+    return false;
+}
+
+
+/**
+     * \brief Function for serialize exhibit of database chunk
+     * \param[in] row Exhibit row
+     * \param[in] fields Selected columns, only they are serialized
+     * \return JSON object in one line
+*/
+std::string exhibitRowJson(const ExhibitRowView& row, const ChunkFields& fields)
+{
+    nlohmann::json row_json;
+    row_json["exhibit_id"] = std::string(row.exhibit_id);
+    if (fields.title)
+        row_json["exhibit_title"] = std::string(row.exhibit_name);
+    if (fields.description)
+        row_json["exhibit_description"] = std::string(row.exhibit_description);
+    std::string row_str = row_json.dump();
+    if (fields.image)
+    {
+        // base64 doesn't need escaping, so image is appended without copy to json object
+        row_str.pop_back();
+        row_str += ",\"exhibit_image\":\"";
+        row_str += wfrest::Base64::encode(row.exhibit_image, static_cast<unsigned int>(row.exhibit_image_size));
+        row_str += "\"}";
+    }
+    return row_str;
+}
 
 void to_json(nlohmann::json& j, const DatabaseResponse& db_resp) {
     j = nlohmann::json{
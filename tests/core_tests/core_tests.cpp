@@ -1,12 +1,17 @@
 #include <core_module/core.hpp>
+#include <core_module/image_decoder.hpp>
+#include <core_module/query_cache.hpp>
 #include <config.hpp>
 #include <logger.hpp>
+#include <object_pool.hpp>
 
 #include <gtest/gtest.h>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/opencv.hpp>
 
+#include <chrono>
 #include <fstream>
+#include <thread>
 #include <filesystem>
 #include <algorithm>
 #include <bits/stl_numeric.h>
@@ -36,6 +41,7 @@ void makeTestData(const std::string& path);
 
 TEST(MPGDataBaseTest, Init) {
     CoreTestModule core(config, logger);
+    ASSERT_EQ(core.state(), Core::State::Ready);
 }
 
 TEST(MPGDataBaseTest, AddExhibit) {
@@ -58,6 +64,205 @@ TEST(MPGDataBaseTest, GetExhibit) {
 }
 
 
+TEST(MPGImageDecoderTest, ReducedDecodeAndPixelBudget) {
+    cv::Mat image(1600, 2400, CV_8UC3);
+    cv::randu(image, 0, 256);
+    std::vector<uint8_t> jpeg, png;
+    cv::imencode(".jpg", image, jpeg);
+    cv::imencode(".png", image, png);
+
+    for (const auto& encoded : {jpeg, png})
+    {
+        const std::optional<cv::Size> size = readImageSize(encoded);
+        ASSERT_TRUE(size.has_value());
+        EXPECT_EQ(size->width, 2400);
+        EXPECT_EQ(size->height, 1600);
+    }
+    EXPECT_EQ(reducedDecodeScale(cv::Size(2400, 1600), 1024), 2);
+    EXPECT_EQ(reducedDecodeScale(cv::Size(4000, 3000), 500), 8);
+    EXPECT_EQ(reducedDecodeScale(cv::Size(800, 600), 1024), 1);
+
+    const cv::Mat decoded = decodeGrayscale(jpeg, 1024, 0);
+    EXPECT_EQ(decoded.cols, 1200);
+    EXPECT_EQ(decoded.rows, 800);
+    EXPECT_EQ(decoded.type(), CV_8UC1);
+    EXPECT_EQ(decodeGrayscale(png, 0, 0).cols, 2400);
+
+    // buffer of the same size is reused, failed decoding is reported
+    cv::Mat buffer;
+    ASSERT_TRUE(decodeGrayscale(jpeg, 1024, 0, buffer));
+    const uint8_t* buffer_data = buffer.data;
+    ASSERT_TRUE(decodeGrayscale(jpeg, 1024, 0, buffer));
+    EXPECT_EQ(buffer.data, buffer_data);
+    EXPECT_FALSE(decodeGrayscale(std::vector<uint8_t>{0xFF, 0xD8, 0xFF, 0xD9}, 1024, 0, buffer));
+
+    // header of decompression bomb is rejected before decoding
+    EXPECT_TRUE(decodeGrayscale(jpeg, 1024, 2400 * 1600 - 1).empty());
+    std::vector<uint8_t> bomb = png;
+    bomb[16] = bomb[17] = bomb[20] = bomb[21] = 0x7F;
+    EXPECT_TRUE(decodeGrayscale(bomb, 1024, 50000000).empty());
+    EXPECT_TRUE(decodeGrayscale(std::vector<uint8_t>{'B', 'M', 0, 0}, 1024, 0).empty());
+
+    // formats without reduced decoding are decoded at full resolution and downscaled like JPEG
+    std::vector<uint8_t> bmp, tiff;
+    cv::imencode(".bmp", image, bmp);
+    const std::optional<cv::Size> bmp_size = readImageSize(bmp);
+    ASSERT_TRUE(bmp_size.has_value());
+    EXPECT_EQ(bmp_size->width, 2400);
+    EXPECT_EQ(bmp_size->height, 1600);
+    EXPECT_EQ(decodeGrayscale(bmp, 1024, 0).cols, 1200);
+    EXPECT_TRUE(decodeGrayscale(bmp, 1024, 2400 * 1600 - 1).empty());
+    if (cv::haveImageWriter(".tiff"))
+    {
+        cv::imencode(".tiff", image, tiff);
+        EXPECT_FALSE(readImageSize(tiff).has_value());
+        const cv::Mat tiff_decoded = decodeGrayscale(tiff, 1024, 0);
+        EXPECT_EQ(tiff_decoded.cols, 1200);
+        EXPECT_EQ(tiff_decoded.rows, 800);
+        EXPECT_TRUE(decodeGrayscale(tiff, 1024, 2400 * 1600 - 1).empty());
+    }
+    if (cv::haveImageWriter(".webp"))
+    {
+        std::vector<uint8_t> webp;
+        cv::imencode(".webp", image, webp);
+        const std::optional<cv::Size> webp_size = readImageSize(webp);
+        ASSERT_TRUE(webp_size.has_value());
+        EXPECT_EQ(webp_size->width, 2400);
+        EXPECT_EQ(webp_size->height, 1600);
+        EXPECT_EQ(decodeGrayscale(webp, 1024, 0).cols, 1200);
+    }
+
+    // renditions keep aspect ratio and aren't upscaled
+    cv::Mat color;
+    ASSERT_TRUE(decodeColor(jpeg, 1024, 0, color));
+    EXPECT_EQ(color.type(), CV_8UC3);
+    std::vector<uint8_t> rendition;
+    ASSERT_TRUE(encodeRendition(color, 256, false, 80, rendition));
+    const std::optional<cv::Size> rendition_size = readImageSize(rendition);
+    ASSERT_TRUE(rendition_size.has_value());
+    EXPECT_EQ(rendition_size->width, 256);
+    EXPECT_EQ(rendition_size->height, 171);
+    ASSERT_TRUE(encodeRendition(color, 4096, false, 80, rendition));
+    EXPECT_EQ(readImageSize(rendition)->width, 1200);
+}
+
+TEST(MPGObjectPoolTest, LeaseAndCounters) {
+    ObjectPool<int> pool(2, [] { return std::make_shared<int>(0); });
+    {
+        ObjectPool<int>::Lease first = pool.acquire();
+        ObjectPool<int>::Lease second = pool.acquire();
+        EXPECT_NE(first.get(), second.get());
+        EXPECT_FALSE(pool.tryAcquire().has_value());
+        EXPECT_EQ(pool.stats().in_use, 2u);
+
+        std::thread waiter([&pool] { ++*pool.acquire(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        first.reset();
+        waiter.join();
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&pool] { for (int i = 0; i < 1000; ++i) ++*pool.acquire(); });
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::optional<ObjectPool<int>::Lease> first = pool.tryAcquire();
+    std::optional<ObjectPool<int>::Lease> second = pool.tryAcquire();
+    ASSERT_TRUE(first.has_value() && second.has_value());
+    EXPECT_EQ(**first + **second, 4001);
+
+    const ObjectPool<int>::Stats stats = pool.stats();
+    EXPECT_EQ(stats.capacity, 2u);
+    EXPECT_EQ(stats.peak_in_use, 2u);
+    EXPECT_EQ(stats.acquired_count, 4005u);
+    EXPECT_GE(stats.waited_count, 1u);
+}
+
+TEST(MPGQueryCacheTest, HashLookupAdmissionAndInvalidation) {
+    cv::Mat darkening(80, 90, CV_8UC1);
+    cv::Mat brightening(80, 90, CV_8UC1);
+    for (int row = 0; row < darkening.rows; ++row)
+        for (int col = 0; col < darkening.cols; ++col)
+        {
+            darkening.at<uint8_t>(row, col) = static_cast<uint8_t>(255 - 2 * col);
+            brightening.at<uint8_t>(row, col) = static_cast<uint8_t>(2 * col);
+        }
+    cv::Mat smaller;
+    cv::resize(darkening, smaller, cv::Size(45, 40), 0, 0, cv::INTER_AREA);
+    EXPECT_EQ(differenceHash(darkening), ~0ull);
+    EXPECT_EQ(differenceHash(smaller), ~0ull); // hash doesn't depend on resolution
+    EXPECT_EQ(differenceHash(brightening), 0ull);
+
+    QueryCache cache(2, 2);
+    EXPECT_FALSE(cache.find(0x0, 0).has_value());
+    cache.insert(0x0, "a", 50, 0);
+    std::optional<QueryCache::Hit> hit = cache.find(0x3, 0);
+    ASSERT_TRUE(hit.has_value());
+    EXPECT_EQ(hit->exhibit_id, "a");
+    EXPECT_EQ(hit->confidence, 50u);
+    EXPECT_FALSE(cache.find(0x7, 0).has_value());
+
+    // "b" is popular but least recently used, one-off "c" isn't admitted instead of it
+    cache.insert(0xFF00, "b", 40, 0);
+    for (int i = 0; i < 3; ++i)
+        EXPECT_TRUE(cache.find(0xFF00, 0).has_value());
+    EXPECT_TRUE(cache.find(0x0, 0).has_value());
+    cache.insert(0xF0F0F0, "c", 30, 0);
+    EXPECT_FALSE(cache.find(0xF0F0F0, 0).has_value());
+    EXPECT_EQ(cache.find(0xFF01, 0)->exhibit_id, "b");
+
+    QueryCache::Stats stats = cache.stats();
+    EXPECT_EQ(stats.size, 2u);
+    EXPECT_EQ(stats.insertions_count, 2u);
+    EXPECT_EQ(stats.rejections_count, 1u);
+    EXPECT_EQ(stats.lookups_count, 9u);
+    EXPECT_EQ(stats.hits_count, 6u);
+
+    // change of database clears cache, results of queries started before it aren't added
+    cache.insert(0x0, "c", 30, 1);
+    cache.insert(0xFF00, "b", 40, 0);
+    EXPECT_FALSE(cache.find(0xFF00, 1).has_value());
+    EXPECT_EQ(cache.find(0x0, 1)->exhibit_id, "c");
+    stats = cache.stats();
+    EXPECT_EQ(stats.size, 1u);
+    EXPECT_EQ(stats.invalidations_count, 1u);
+}
+
+namespace
+{
+    std::shared_ptr<Config> unreachableDatabaseConfig(size_t max_connect_retries, size_t connect_retry_delay_ms)
+    {
+        auto unreachable_config = std::make_shared<Config>();
+        unreachable_config->database_host = "mpg-test.invalid"; // .invalid never resolves
+        unreachable_config->max_connect_retries = max_connect_retries;
+        unreachable_config->connect_retry_delay_ms = connect_retry_delay_ms;
+        return unreachable_config;
+    }
+}
+
+TEST(MPGCoreStateTest, StartingThenFailed) {
+    CoreTestModule foreground_core(unreachableDatabaseConfig(1, 0), logger);
+    EXPECT_EQ(foreground_core.state(), Core::State::Failed);
+
+    Core core(unreachableDatabaseConfig(2, 1000), logger, true);
+    EXPECT_EQ(core.state(), Core::State::Starting);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (core.state() == Core::State::Starting && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(core.state(), Core::State::Failed);
+}
+
+TEST(MPGCoreStateTest, DestructionInterruptsConnectRetries) {
+    const auto started_at = std::chrono::steady_clock::now();
+    {
+        Core core(unreachableDatabaseConfig(10, 60000), logger, true);
+        EXPECT_EQ(core.state(), Core::State::Starting);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    // without stop() destructor would wait for all retries (10 minutes)
+    EXPECT_LT(std::chrono::steady_clock::now() - started_at, std::chrono::seconds(30));
+}
 
 int main(int argc, char** argv)
 {
@@ -1,4 +1,16 @@
 #include <database_module/database.hpp>
+#include <database_module/exhibit_cache.hpp>
+#include <database_module/database_chunk.hpp>
+#include <database_module/changelog.hpp>
+#include <database_module/hamming_matcher.hpp>
+#include <database_module/mih_index.hpp>
+#include <database_module/hnsw_index.hpp>
+#include <database_module/segmented_index.hpp>
+#include <database_module/bow_index.hpp>
+#include <database_module/geometric_verifier.hpp>
+#include <database_module/snapshot_file.hpp>
+#include <database_module/shard_protocol.hpp>
+#include <database_module/search_pool.hpp>
 #include <config.hpp>
 #include <logger.hpp>
 
@@ -6,13 +18,45 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/opencv.hpp>
 
+#include <cstdlib>
 #include <fstream>
+#include <new>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <thread>
 #include <filesystem>
 #include <algorithm>
 #include <bits/stl_numeric.h>
 
 using namespace MPG;
 
+namespace
+{
+    // allocations of current thread are counted while is_allocation_counted is set
+    thread_local bool is_allocation_counted = false;
+    thread_local size_t allocations_count = 0;
+}
+
+void* operator new(size_t size)
+{
+    if (is_allocation_counted)
+        ++allocations_count;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
 class DatabaseTestModule: public DatabaseModule
 {
 public:
@@ -20,10 +64,18 @@ public:
     using ::DatabaseModule::addExhibit;
     using ::DatabaseModule::getExhibit;
     using ::DatabaseModule::findExhibitUuid;
+    using ::DatabaseModule::searchCandidates;
+    using ::DatabaseModule::selectCandidate;
 
     DatabaseTestModule(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log)
         : DatabaseModule(conf, log) {}
 
+    // local database without Cassandra for search tests
+    void setLocalDatabase(std::unique_ptr<SegmentedIndex> index)
+    {
+        local_database = std::move(index);
+    }
+
 };
 
 DatabaseRequest request;
@@ -65,6 +117,974 @@ TEST(MPGDataBaseTest, GetExhibit) {
 }
 
 
+void expectSameAsBFMatcher(const cv::Mat& query, const cv::Mat& train)
+{
+    cv::Ptr<cv::DescriptorMatcher> matcher = cv::DescriptorMatcher::create(cv::DescriptorMatcher::BRUTEFORCE_HAMMING);
+    for (size_t k = 1; k <= 4; ++k)
+    {
+        std::vector<std::vector<cv::DMatch>> cv_matches;
+        matcher->knnMatch(query, train, cv_matches, static_cast<int>(k));
+        ASSERT_EQ(cv_matches.size(), static_cast<size_t>(query.rows));
+
+        for (HammingKernel kernel : supportedHammingKernels())
+        {
+            std::vector<HammingMatch> matches;
+            ASSERT_TRUE(hammingKnnMatch(kernel, query, train, k, matches));
+            ASSERT_EQ(matches.size(), query.rows * k);
+
+            for (int q = 0; q < query.rows; ++q)
+            {
+                for (size_t i = 0; i < k; ++i)
+                {
+                    const HammingMatch& match = matches[q * k + i];
+                    if (i < cv_matches[q].size())
+                    {
+                        EXPECT_EQ(match.train_idx, cv_matches[q][i].trainIdx) << hammingKernelName(kernel) << " k=" << k;
+                        EXPECT_EQ(match.distance, static_cast<int>(cv_matches[q][i].distance)) << hammingKernelName(kernel) << " k=" << k;
+                    }
+                    else
+                    {
+                        EXPECT_EQ(match.train_idx, -1) << hammingKernelName(kernel) << " k=" << k;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(MPGHammingTest, RandomDescriptorsSameAsBFMatcher) {
+    cv::setRNGSeed(42);
+    cv::Mat train(10000, 32, CV_8UC1);
+    cv::Mat query(200, 32, CV_8UC1);
+    cv::randu(train, 0, 256);
+    cv::randu(query, 0, 256);
+
+    // equal rows and exact hits check that ties are resolved like in cv::BFMatcher
+    for (int i = 0; i < 500; ++i)
+        train.row(i).copyTo(train.row(train.rows - 1 - i));
+    for (int i = 0; i < query.rows / 2; ++i)
+        train.row(i * 7).copyTo(query.row(i));
+
+    expectSameAsBFMatcher(query, train);
+}
+
+TEST(MPGHammingTest, BriskAndAkazeWidthsSameAsBFMatcher) {
+    cv::setRNGSeed(43);
+    for (FeatureType type : {FeatureType::BRISK, FeatureType::AKAZE})
+    {
+        const int width = static_cast<int>(featureDescriptorBytes(type));
+        cv::Mat train(3000, width, CV_8UC1);
+        cv::Mat query(100, width, CV_8UC1);
+        cv::randu(train, 0, 256);
+        cv::randu(query, 0, 256);
+        for (int i = 0; i < query.rows / 2; ++i)
+            train.row(i * 5).copyTo(query.row(i));
+        expectSameAsBFMatcher(query, train);
+    }
+}
+
+TEST(MPGHammingTest, OrbDescriptorsSameAsBFMatcher) {
+    expectSameAsBFMatcher(exhibit_descr[0], request.exhibit_descriptor);
+}
+
+TEST(MPGHammingTest, TrainSmallerThanK) {
+    expectSameAsBFMatcher(exhibit_descr[0], request.exhibit_descriptor.rowRange(0, 3));
+}
+
+TEST(MPGIndexTest, MihSameAsBruteForce) {
+    cv::setRNGSeed(7);
+    cv::Mat train(20000, 32, CV_8UC1);
+    cv::Mat query(300, 32, CV_8UC1);
+    cv::randu(train, 0, 256);
+    cv::randu(query, 0, 256);
+
+    // close neighbours (few flipped bits) are found by hash probing, far ones by brute force fallback
+    for (int i = 0; i < query.rows / 2; ++i)
+    {
+        train.row(i * 13).copyTo(query.row(i));
+        query.at<uint8_t>(i, i % 32) ^= static_cast<uint8_t>(1 << (i % 8));
+    }
+    train.row(5).copyTo(train.row(train.rows - 1));
+
+    BruteForceIndex brute_force;
+    MihIndex mih;
+    ASSERT_TRUE(brute_force.build(train));
+    ASSERT_TRUE(mih.build(train));
+
+    for (size_t k = 1; k <= 4; ++k)
+    {
+        std::vector<HammingMatch> expected, actual;
+        ASSERT_TRUE(brute_force.knnSearch(query, k, expected));
+        ASSERT_TRUE(mih.knnSearch(query, k, actual));
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            EXPECT_EQ(expected[i].train_idx, actual[i].train_idx) << "k=" << k << " i=" << i;
+            EXPECT_EQ(expected[i].distance, actual[i].distance) << "k=" << k << " i=" << i;
+        }
+    }
+    EXPECT_LT(mih.distanceComputations(), 4 * query.rows * static_cast<uint64_t>(train.rows));
+
+    // k above 4 (over-fetch of segments with deleted rows) is exact too
+    const size_t big_k = 20;
+    std::vector<HammingMatch> actual;
+    ASSERT_TRUE(mih.knnSearch(query, big_k, actual));
+    ASSERT_EQ(actual.size(), query.rows * big_k);
+    for (int q = 0; q < query.rows; ++q)
+    {
+        std::vector<HammingMatch> expected(train.rows);
+        for (int row = 0; row < train.rows; ++row)
+            expected[row] = {row, static_cast<int>(cv::norm(query.row(q), train.row(row), cv::NORM_HAMMING))};
+        std::stable_sort(expected.begin(), expected.end(),
+                         [](const HammingMatch& a, const HammingMatch& b) { return a.distance < b.distance; });
+        for (size_t i = 0; i < big_k; ++i)
+        {
+            EXPECT_EQ(expected[i].train_idx, actual[q * big_k + i].train_idx) << "q=" << q << " i=" << i;
+            EXPECT_EQ(expected[i].distance, actual[q * big_k + i].distance) << "q=" << q << " i=" << i;
+        }
+    }
+    EXPECT_FALSE(mih.knnSearch(query, 0, actual));
+}
+
+TEST(MPGIndexTest, BowShortlistContainsExhibit) {
+    cv::setRNGSeed(3);
+    cv::Mat database;
+    std::vector<BowIndex::ExhibitOrdinal> row_ordinals;
+    for (BowIndex::ExhibitOrdinal i = 0; i < 50; ++i)
+    {
+        cv::Mat other_exhibit(100, 32, CV_8UC1);
+        cv::randu(other_exhibit, 0, 256);
+        database.push_back(other_exhibit);
+        row_ordinals.insert(row_ordinals.end(), other_exhibit.rows, i);
+    }
+    const BowIndex::ExhibitOrdinal exhibit_ordinal = 50;
+    database.push_back(request.exhibit_descriptor);
+    row_ordinals.insert(row_ordinals.end(), request.exhibit_descriptor.rows, exhibit_ordinal);
+
+    BowIndex bow;
+    ASSERT_TRUE(bow.build(database, row_ordinals, 10, 3, 10));
+    ASSERT_EQ(bow.exhibitsCount(), 51u);
+
+    std::vector<BowIndex::ExhibitOrdinal> shortlist;
+    bow.shortlist(exhibit_descr[0], 5, shortlist);
+    ASSERT_LE(shortlist.size(), 5u);
+    EXPECT_TRUE(std::is_sorted(shortlist.begin(), shortlist.end()));
+    EXPECT_NE(std::find(shortlist.begin(), shortlist.end(), exhibit_ordinal), shortlist.end());
+
+    ASSERT_TRUE(bow.removeExhibit(exhibit_ordinal));
+    bow.shortlist(exhibit_descr[0], 5, shortlist);
+    EXPECT_EQ(std::find(shortlist.begin(), shortlist.end(), exhibit_ordinal), shortlist.end());
+}
+
+TEST(MPGIndexTest, ParallelBruteForceSameAsSerial) {
+    cv::setRNGSeed(5);
+    cv::Mat train(10500, 32, CV_8UC1);
+    cv::Mat query(100, 32, CV_8UC1);
+    cv::randu(train, 0, 256);
+    cv::randu(query, 0, 256);
+    // equal rows in different shards, the earlier one must win as in serial search
+    train.row(10).copyTo(train.row(9000));
+
+    BruteForceIndex serial;
+    BruteForceIndex parallel(std::make_shared<SearchPool>(3), 1000);
+    ASSERT_TRUE(serial.build(train));
+    ASSERT_TRUE(parallel.build(train));
+
+    std::vector<HammingMatch> expected;
+    ASSERT_TRUE(serial.knnSearch(query, 2, expected));
+
+    // several queries in flight at once share pool workers
+    std::vector<std::vector<HammingMatch>> actual(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < actual.size(); ++t)
+        threads.emplace_back([&parallel, &query, &actual, t]() { parallel.knnSearch(query, 2, actual[t]); });
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (const auto& matches : actual)
+    {
+        ASSERT_EQ(expected.size(), matches.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            EXPECT_EQ(expected[i].train_idx, matches[i].train_idx) << "i=" << i;
+            EXPECT_EQ(expected[i].distance, matches[i].distance) << "i=" << i;
+        }
+    }
+}
+
+TEST(MPGIndexTest, SegmentedIndexDeleteAndCompact) {
+    cv::setRNGSeed(17);
+    Config conf;
+    conf.descriptor_index_type = "bruteforce";
+    conf.segment_rows = 1000;
+
+    SegmentedIndex index(conf, nullptr);
+    std::vector<cv::Mat> exhibits;
+    for (cass_uint64_t i = 0; i < 30; ++i)
+    {
+        cv::Mat exhibit(150, 32, CV_8UC1);
+        cv::randu(exhibit, 0, 256);
+        std::vector<cv::Point2f> keypoints;
+        for (int row = 0; row < exhibit.rows; ++row)
+            keypoints.emplace_back(static_cast<float>(row), static_cast<float>(i));
+        const RowRange rows = index.addExhibit(CassUuid{i, 0}, exhibit, keypoints);
+        ASSERT_EQ(rows.first_row, static_cast<int>(i) * 150);
+        exhibits.push_back(exhibit);
+    }
+    EXPECT_GT(index.snapshot()->segmentsCount(), 4u);
+
+    for (cass_uint64_t i = 0; i < 30; i += 3)
+        ASSERT_TRUE(index.removeExhibit(CassUuid{i, 0}));
+    EXPECT_FALSE(index.removeExhibit(CassUuid{0, 0}));
+    EXPECT_EQ(index.snapshot()->liveRowsCount(), 20u * 150u);
+    EXPECT_EQ(index.snapshot()->ordinalsCount(), 30u);
+
+    // every query is a copy of row of some exhibit, deleted exhibits mustn't be found
+    cv::Mat query(60, 32, CV_8UC1);
+    for (int q = 0; q < query.rows; ++q)
+        exhibits[q % 30].row(q).copyTo(query.row(q));
+
+    auto check_search = [&]()
+    {
+        std::vector<HammingMatch> matches;
+        SegmentedIndex::SnapshotGuard snapshot = index.snapshot();
+        ASSERT_TRUE(snapshot->knnSearch(query, 2, matches));
+        for (int q = 0; q < query.rows; ++q)
+        {
+            const CassUuid& best_id = snapshot->rowExhibit(matches[q * 2].train_idx);
+            EXPECT_NE(best_id.time_and_version % 3, 0u) << "q=" << q;
+            if (q % 30 % 3 != 0)
+            {
+                EXPECT_EQ(best_id.time_and_version, static_cast<cass_uint64_t>(q % 30));
+                EXPECT_EQ(matches[q * 2].distance, 0);
+            }
+        }
+    };
+    check_search();
+
+    // ordinals are resolved to rows of each snapshot, so old snapshot keeps rows before compaction
+    SegmentedIndex::SnapshotGuard old_snapshot = index.snapshot();
+    SegmentedIndex::Compaction compaction;
+    while (index.prepareCompaction(compaction))
+    {
+        ASSERT_TRUE(index.buildCompaction(compaction));
+        ASSERT_TRUE(index.applyCompaction(compaction));
+    }
+    EXPECT_EQ(index.snapshot()->rowsCount(), 20u * 150u);
+    check_search();
+
+    for (SegmentedIndex::ExhibitOrdinal ordinal = 0; ordinal < 30; ++ordinal)
+    {
+        RowRange old_rows, rows;
+        const bool is_live = ordinal % 3 != 0;
+        EXPECT_EQ(old_snapshot->ordinalRows(ordinal, old_rows), is_live);
+        EXPECT_EQ(index.snapshot()->ordinalRows(ordinal, rows), is_live);
+        if (!is_live)
+            continue;
+        EXPECT_EQ(old_rows.first_row, static_cast<int>(ordinal) * 150);
+        EXPECT_EQ(old_rows.rows_count, 150);
+        EXPECT_EQ(rows.first_row, index.exhibitRows(ordinal).first_row);
+        EXPECT_EQ(rows.rows_count, 150);
+        EXPECT_EQ(old_snapshot->rowOrdinal(old_rows.first_row + 149), ordinal);
+        EXPECT_EQ(index.snapshot()->rowOrdinal(rows.first_row), ordinal);
+    }
+    RowRange unknown_rows;
+    EXPECT_FALSE(index.snapshot()->ordinalRows(30, unknown_rows));
+
+    for (const auto& [id, ordinal] : index.exhibitOrdinals())
+    {
+        EXPECT_EQ(ordinal, id.time_and_version);
+        cv::Mat descriptors, difference;
+        ASSERT_TRUE(index.snapshot()->rangeDescriptors(index.exhibitRows(ordinal), descriptors));
+        const cv::Point2f keypoint = index.snapshot()->rowKeypoint(index.exhibitRows(ordinal).first_row + 7);
+        EXPECT_EQ(keypoint.x, 7.0f);
+        EXPECT_EQ(keypoint.y, static_cast<float>(id.time_and_version));
+        cv::bitwise_xor(descriptors, exhibits[id.time_and_version], difference);
+        EXPECT_EQ(cv::countNonZero(difference), 0);
+    }
+}
+
+TEST(MPGIndexTest, SegmentedIndexParallelSameAsSerial) {
+    cv::setRNGSeed(19);
+    Config conf;
+    conf.descriptor_index_type = "bruteforce";
+    conf.segment_rows = 1000;
+    conf.search_shard_rows = 300;
+
+    // shards of all segments are tasks of one pool, deleted rows split live ranges of segments
+    SegmentedIndex serial(conf, nullptr);
+    SegmentedIndex parallel(conf, std::make_shared<SearchPool>(3));
+    for (cass_uint64_t i = 0; i < 30; ++i)
+    {
+        cv::Mat exhibit(150, 32, CV_8UC1);
+        cv::randu(exhibit, 0, 256);
+        serial.addExhibit(CassUuid{i, 0}, exhibit);
+        parallel.addExhibit(CassUuid{i, 0}, exhibit);
+    }
+    for (cass_uint64_t i = 1; i < 30; i += 4)
+    {
+        ASSERT_TRUE(serial.removeExhibit(CassUuid{i, 0}));
+        ASSERT_TRUE(parallel.removeExhibit(CassUuid{i, 0}));
+    }
+    ASSERT_GT(parallel.snapshot()->segmentsCount(), 4u);
+
+    cv::Mat query(100, 32, CV_8UC1);
+    cv::randu(query, 0, 256);
+    std::vector<HammingMatch> expected;
+    ASSERT_TRUE(serial.snapshot()->knnSearch(query, 2, expected));
+
+    // several queries in flight at once share pool workers
+    std::vector<std::vector<HammingMatch>> actual(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < actual.size(); ++t)
+        threads.emplace_back([&parallel, &query, &actual, t]() { parallel.snapshot()->knnSearch(query, 2, actual[t]); });
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (const auto& matches : actual)
+    {
+        ASSERT_EQ(expected.size(), matches.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            EXPECT_EQ(expected[i].train_idx, matches[i].train_idx) << "i=" << i;
+            EXPECT_EQ(expected[i].distance, matches[i].distance) << "i=" << i;
+            EXPECT_NE(serial.snapshot()->rowExhibit(expected[i].train_idx).time_and_version % 4, 1u) << "i=" << i;
+        }
+    }
+}
+
+TEST(MPGIndexTest, SegmentedIndexSearchDuringWrites) {
+    cv::setRNGSeed(23);
+    Config conf;
+    conf.descriptor_index_type = "bruteforce";
+    conf.segment_rows = 500;
+
+    SegmentedIndex index(conf, nullptr);
+    cv::Mat stable(100, 32, CV_8UC1);
+    cv::randu(stable, 0, 256);
+    index.addExhibit(CassUuid{1000, 0}, stable);
+
+    // readers always find rows of stable exhibit while writer adds, deletes and compacts others
+    std::atomic<bool> is_stopped{false};
+    std::atomic<int> fails{0};
+    std::thread reader([&]()
+    {
+        std::vector<HammingMatch> matches;
+        while (!is_stopped.load())
+        {
+            SegmentedIndex::SnapshotGuard snapshot = index.snapshot();
+            if (!snapshot->knnSearch(stable.rowRange(0, 10), 1, matches))
+            {
+                fails++;
+                continue;
+            }
+            for (int q = 0; q < 10; ++q)
+            {
+                if (matches[q].distance != 0 || snapshot->rowExhibit(matches[q].train_idx).time_and_version != 1000)
+                    fails++;
+            }
+        }
+    });
+
+    SegmentedIndex::Compaction compaction;
+    for (cass_uint64_t i = 0; i < 60; ++i)
+    {
+        cv::Mat exhibit(80, 32, CV_8UC1);
+        cv::randu(exhibit, 0, 256);
+        index.addExhibit(CassUuid{i, 0}, exhibit);
+        if (i % 2 == 1)
+            index.removeExhibit(CassUuid{i - 1, 0});
+        if (index.prepareCompaction(compaction) && index.buildCompaction(compaction))
+            index.applyCompaction(compaction);
+    }
+    is_stopped.store(true);
+    reader.join();
+
+    EXPECT_EQ(fails.load(), 0);
+    EXPECT_EQ(index.snapshot()->liveRowsCount(), 100u + 30u * 80u);
+    EXPECT_EQ(index.reclaim(), 0u);
+}
+
+TEST(MPGIndexTest, SegmentedIndexDeletedNeighbours) {
+    cv::setRNGSeed(29);
+    Config conf;
+    conf.descriptor_index_type = "mih";
+    conf.segment_rows = 1000;
+    conf.compaction_deleted_ratio = 1.0f; // deleted rows stay in indexed segment
+
+    // exhibit 0 and its 4 near-duplicates, every query is nearer to duplicates than to exhibit 0
+    cv::Mat live(200, 32, CV_8UC1);
+    cv::randu(live, 0, 256);
+    cv::Mat descriptors(5 * live.rows, 32, CV_8UC1);
+    std::vector<std::pair<CassUuid, RowRange>> exhibits;
+    for (int e = 0; e < 5; ++e)
+    {
+        live.copyTo(descriptors.rowRange(e * live.rows, (e + 1) * live.rows));
+        exhibits.emplace_back(CassUuid{static_cast<cass_uint64_t>(e), 0}, RowRange{e * live.rows, live.rows});
+    }
+    cv::Mat query = live.rowRange(0, 50).clone();
+    for (int row = 0; row < descriptors.rows; ++row)
+        descriptors.at<uint8_t>(row, 0) ^= row < live.rows ? 0 : 1;
+    for (int q = 0; q < query.rows; ++q)
+        query.at<uint8_t>(q, 0) ^= 1;
+
+    SegmentedIndex index(conf, nullptr);
+    ASSERT_TRUE(index.loadSealed(descriptors, cv::Mat(descriptors.rows, 1, CV_32FC2, cv::Scalar::all(0)), exhibits, nullptr));
+    SegmentedIndex::Compaction compaction;
+    while (index.prepareCompaction(compaction))
+    {
+        ASSERT_TRUE(index.buildCompaction(compaction));
+        ASSERT_TRUE(index.applyCompaction(compaction));
+    }
+    for (cass_uint64_t e = 1; e < 5; ++e)
+        ASSERT_TRUE(index.removeExhibit(CassUuid{e, 0}));
+    ASSERT_FALSE(index.prepareCompaction(compaction));
+
+    // 4 deleted neighbours at distance 0 are skipped and live one at distance 1 is found
+    std::vector<HammingMatch> matches;
+    SegmentedIndex::SnapshotGuard snapshot = index.snapshot();
+    ASSERT_EQ(snapshot->segmentsCount(), 2u);
+    ASSERT_TRUE(snapshot->knnSearch(query, 2, matches));
+    for (int q = 0; q < query.rows; ++q)
+    {
+        ASSERT_GE(matches[q * 2].train_idx, 0) << "q=" << q;
+        EXPECT_EQ(snapshot->rowExhibit(matches[q * 2].train_idx).time_and_version, 0u);
+        EXPECT_EQ(matches[q * 2].distance, 1);
+        EXPECT_GE(matches[q * 2 + 1].train_idx, 0);
+    }
+}
+
+TEST(MPGSnapshotFileTest, RoundTrip) {
+    cv::setRNGSeed(29);
+    Config conf;
+    conf.descriptor_index_type = "bruteforce";
+    conf.segment_rows = 700;
+
+    SegmentedIndex index(conf, nullptr);
+    std::vector<cv::Mat> exhibits;
+    for (cass_uint64_t i = 0; i < 12; ++i)
+    {
+        cv::Mat exhibit(200, 32, CV_8UC1);
+        cv::randu(exhibit, 0, 256);
+        std::vector<cv::Point2f> keypoints(exhibit.rows, cv::Point2f(static_cast<float>(i), 1.0f));
+        index.addExhibit(CassUuid{i, 7}, exhibit, keypoints);
+        exhibits.push_back(exhibit);
+    }
+    ASSERT_TRUE(index.removeExhibit(CassUuid{4, 7}));
+
+    const std::string path = (std::filesystem::temp_directory_path() / "mpg_snapshot_test.bin").string();
+    ASSERT_TRUE(SnapshotFile::write(path, *index.snapshot(), 12345));
+
+    auto file = std::make_shared<SnapshotFile>();
+    ASSERT_TRUE(file->open(path));
+    EXPECT_EQ(file->syncedAt(), 12345);
+    ASSERT_EQ(file->exhibits().size(), 11u);
+
+    // loaded segments keep the mapping after file object is released
+    SegmentedIndex loaded(conf, nullptr);
+    ASSERT_TRUE(loaded.loadSealed(file->descriptors(), file->keypoints(), file->exhibits(), file));
+    file.reset();
+    EXPECT_EQ(loaded.snapshot()->liveRowsCount(), 11u * 200u);
+    EXPECT_FALSE(loaded.contains(CassUuid{4, 7}));
+    for (const auto& [id, ordinal] : loaded.exhibitOrdinals())
+    {
+        cv::Mat descriptors, difference;
+        ASSERT_TRUE(loaded.snapshot()->rangeDescriptors(loaded.exhibitRows(ordinal), descriptors));
+        cv::bitwise_xor(descriptors, exhibits[id.time_and_version], difference);
+        EXPECT_EQ(cv::countNonZero(difference), 0);
+        EXPECT_EQ(loaded.snapshot()->rowKeypoint(loaded.exhibitRows(ordinal).first_row).x, static_cast<float>(id.time_and_version));
+    }
+    loaded.addExhibit(CassUuid{100, 7}, exhibits[0]);
+    EXPECT_EQ(loaded.exhibitRows(loaded.exhibitOrdinals().at(CassUuid{100, 7})).first_row, 11 * 200);
+
+    // damaged file isn't opened
+    {
+        std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+        stream.seekg(100);
+        const char byte = static_cast<char>(stream.get());
+        stream.seekp(100);
+        stream.put(static_cast<char>(byte ^ 1));
+    }
+    SnapshotFile damaged;
+    EXPECT_FALSE(damaged.open(path));
+    std::filesystem::remove(path);
+}
+
+TEST(MPGSnapshotFileTest, AkazeWidth) {
+    cv::setRNGSeed(30);
+    Config conf;
+    conf.descriptor_index_type = "hnsw"; // isn't supported for AKAZE width, brute force is used
+    const size_t width = FeatureTraits<FeatureType::AKAZE>::descriptor_bytes;
+
+    SegmentedIndex index(conf, nullptr, width);
+    EXPECT_EQ(index.indexName(), "bruteforce");
+    cv::Mat exhibit(101, static_cast<int>(width), CV_8UC1);
+    cv::randu(exhibit, 0, 256);
+    index.addExhibit(CassUuid{1, 7}, exhibit, std::vector<cv::Point2f>(exhibit.rows, cv::Point2f(3.0f, 4.0f)));
+
+    const std::string path = (std::filesystem::temp_directory_path() / "mpg_snapshot_akaze_test.bin").string();
+    ASSERT_TRUE(SnapshotFile::write(path, *index.snapshot(), 1));
+    SnapshotFile orb_file;
+    EXPECT_FALSE(orb_file.open(path));
+
+    // keypoints go after padded descriptors, so they stay aligned for odd width
+    auto file = std::make_shared<SnapshotFile>();
+    ASSERT_TRUE(file->open(path, width));
+    cv::Mat difference;
+    cv::bitwise_xor(file->descriptors(), exhibit, difference);
+    EXPECT_EQ(cv::countNonZero(difference), 0);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(file->keypoints().data) % alignof(float), 0u);
+    EXPECT_EQ(file->keypoints().at<cv::Point2f>(100).y, 4.0f);
+    std::filesystem::remove(path);
+}
+
+TEST(MPGLoaderTest, TokenRangesCoverRing) {
+    for (size_t ranges_count : std::vector<size_t>{1, 3, 4, 64, 1000})
+    {
+        EXPECT_EQ(tokenRange(0, ranges_count).first_token, std::numeric_limits<int64_t>::min());
+        EXPECT_EQ(tokenRange(ranges_count - 1, ranges_count).last_token, std::numeric_limits<int64_t>::max());
+        const uint64_t step = std::numeric_limits<uint64_t>::max() / ranges_count;
+        for (size_t r = 0; r < ranges_count; ++r)
+        {
+            const TokenRange range = tokenRange(r, ranges_count);
+            ASSERT_LE(range.first_token, range.last_token);
+            if (r + 1 == ranges_count)
+                continue;
+            // the next range starts right after this one, so there are neither gaps nor overlaps
+            EXPECT_EQ(range.last_token + 1, tokenRange(r + 1, ranges_count).first_token) << ranges_count << " " << r;
+            EXPECT_EQ(static_cast<uint64_t>(range.last_token) - static_cast<uint64_t>(range.first_token), step - 1);
+        }
+    }
+}
+
+TEST(MPGLoaderTest, SealedPartsWithoutCopy) {
+    cv::setRNGSeed(43);
+    Config conf;
+    conf.descriptor_index_type = "bruteforce";
+    conf.segment_rows = 250;
+
+    // token ranges of different size, the second one has no exhibits
+    std::vector<SegmentedIndex::SealedPart> parts(3);
+    cass_uint64_t id = 0;
+    for (size_t p = 0; p < parts.size(); ++p)
+    {
+        const int exhibits_count = p == 0 ? 4 : (p == 1 ? 0 : 1);
+        SegmentedIndex::SealedPart& part = parts[p];
+        part.descriptors = cv::Mat(exhibits_count * 100, 32, CV_8UC1);
+        cv::randu(part.descriptors, 0, 256);
+        part.keypoints = cv::Mat(part.descriptors.rows, 1, CV_32FC2, cv::Scalar::all(1));
+        for (int e = 0; e < exhibits_count; ++e)
+            part.exhibits.emplace_back(CassUuid{id++, 0}, RowRange{e * 100, 100});
+    }
+
+    SegmentedIndex index(conf, nullptr);
+    ASSERT_TRUE(index.loadSealed(parts));
+    EXPECT_FALSE(index.loadSealed(parts)); // index isn't empty
+    SegmentedIndex::SnapshotGuard snapshot = index.snapshot();
+    EXPECT_EQ(snapshot->rowsCount(), 500u);
+    EXPECT_EQ(snapshot->segmentsCount(), 4u); // 2 segments of the first part, 1 of the third one and tail
+    for (cass_uint64_t e = 0; e < 5; ++e)
+    {
+        const SegmentedIndex::ExhibitOrdinal ordinal = index.exhibitOrdinals().at(CassUuid{e, 0});
+        EXPECT_EQ(ordinal, e);
+        const RowRange rows = index.exhibitRows(ordinal);
+        EXPECT_EQ(rows.first_row, static_cast<int>(e) * 100);
+        cv::Mat descriptors;
+        ASSERT_TRUE(snapshot->rangeDescriptors(rows, descriptors));
+        const cv::Mat& part_descriptors = e < 4 ? parts[0].descriptors : parts[2].descriptors;
+        EXPECT_EQ(descriptors.data, part_descriptors.ptr<uint8_t>(static_cast<int>(e % 4) * 100));
+    }
+
+    SegmentedIndex invalid(conf, nullptr);
+    parts[2].exhibits[0].second.rows_count = 99;
+    EXPECT_FALSE(invalid.loadSealed(parts));
+}
+
+TEST(MPGShardProtocolTest, Loopback) {
+    cv::setRNGSeed(31);
+    ShardQuery query;
+    query.descriptors = cv::Mat(50, 32, CV_8UC1);
+    cv::randu(query.descriptors, 0, 256);
+    for (int i = 0; i < query.descriptors.rows; ++i)
+        query.keypoints.emplace_back(static_cast<float>(i), 2.0f * i);
+    query.time_budget_ms = 40;
+
+    // shard answers with candidate built from query, so client sees that query came intact
+    const ShardServer::Handler handler = [](const ShardQuery& received)
+    {
+        ExhibitCandidate candidate;
+        candidate.id = CassUuid{received.descriptors.at<uint8_t>(3, 5), static_cast<cass_uint64_t>(received.keypoints.back().y)};
+        candidate.votes = static_cast<uint32_t>(received.descriptors.rows);
+        candidate.processed_rows = received.time_budget_ms;
+        candidate.inliers = 12;
+        candidate.is_verifiable = true;
+        return std::vector<ExhibitCandidate>{candidate, ExhibitCandidate()};
+    };
+    ShardServer server;
+    ASSERT_TRUE(server.start("127.0.0.1", 0, handler, 4));
+
+    ShardClient client("127.0.0.1:" + std::to_string(server.port()));
+    for (int attempt = 0; attempt < 3; ++attempt) // connection is reused
+    {
+        std::vector<ExhibitCandidate> candidates;
+        ASSERT_TRUE(client.query(query, std::chrono::steady_clock::now() + std::chrono::seconds(5), candidates));
+        ASSERT_EQ(candidates.size(), 2u);
+        EXPECT_EQ(candidates[0].id.time_and_version, query.descriptors.at<uint8_t>(3, 5));
+        EXPECT_EQ(candidates[0].id.clock_seq_and_node, 98u);
+        EXPECT_EQ(candidates[0].votes, 50u);
+        EXPECT_EQ(candidates[0].processed_rows, 40u);
+        EXPECT_EQ(candidates[0].inliers, 12u);
+        EXPECT_TRUE(candidates[0].is_verifiable);
+        EXPECT_FALSE(candidates[1].is_verifiable);
+    }
+
+    // stopped shard doesn't stall client
+    server.stop();
+    std::vector<ExhibitCandidate> candidates;
+    EXPECT_FALSE(client.query(query, std::chrono::steady_clock::now() + std::chrono::milliseconds(200), candidates));
+
+    // fanout reads results of all shards by one poll loop, stopped shard is reported as failed
+    ShardServer live_server;
+    ASSERT_TRUE(live_server.start("127.0.0.1", 0, handler, 4));
+    std::vector<std::unique_ptr<ShardClient>> clients;
+    clients.push_back(std::make_unique<ShardClient>("127.0.0.1:" + std::to_string(live_server.port())));
+    clients.push_back(std::make_unique<ShardClient>("127.0.0.1:" + std::to_string(server.port())));
+    clients.push_back(std::make_unique<ShardClient>("127.0.0.1:" + std::to_string(live_server.port())));
+    ShardFanout fanout;
+    for (int attempt = 0; attempt < 2; ++attempt) // connections are reused
+    {
+        std::vector<ExhibitCandidate> fanout_candidates{ExhibitCandidate()}; // local candidate is kept
+        std::vector<const ShardClient*> failed_shards;
+        fanout.send(clients, query, std::chrono::steady_clock::now() + std::chrono::seconds(5));
+        fanout.receive(fanout_candidates, failed_shards);
+        ASSERT_EQ(fanout_candidates.size(), 5u);
+        EXPECT_EQ(std::count_if(fanout_candidates.begin(), fanout_candidates.end(),
+                                [](const ExhibitCandidate& candidate) { return candidate.votes == 50u; }), 2);
+        ASSERT_EQ(failed_shards.size(), 1u);
+        EXPECT_EQ(failed_shards[0], clients[1].get());
+    }
+
+    // shards split exhibits evenly
+    std::vector<size_t> shard_sizes(4, 0);
+    std::mt19937_64 generator(7);
+    for (int i = 0; i < 4000; ++i)
+        ++shard_sizes[exhibitShard(CassUuid{generator(), generator()}, shard_sizes.size())];
+    for (size_t shard_size : shard_sizes)
+        EXPECT_NEAR(static_cast<double>(shard_size), 1000.0, 150.0);
+}
+
+TEST(MPGShardProtocolTest, ConnectionLimit) {
+    ShardQuery query;
+    query.descriptors = cv::Mat(4, 32, CV_8UC1, cv::Scalar(7));
+    ShardServer server;
+    ASSERT_TRUE(server.start("127.0.0.1", 0, [](const ShardQuery&) { return std::vector<ExhibitCandidate>(1); }, 1));
+
+    // idle connection of the first client occupies the only slot, the second client is refused
+    ShardClient first_client("127.0.0.1:" + std::to_string(server.port()));
+    ShardClient second_client("127.0.0.1:" + std::to_string(server.port()));
+    std::vector<ExhibitCandidate> candidates;
+    ASSERT_TRUE(first_client.query(query, std::chrono::steady_clock::now() + std::chrono::seconds(5), candidates));
+    EXPECT_FALSE(second_client.query(query, std::chrono::steady_clock::now() + std::chrono::seconds(5), candidates));
+    EXPECT_EQ(server.rejectedConnections(), 1u);
+    EXPECT_TRUE(first_client.query(query, std::chrono::steady_clock::now() + std::chrono::seconds(5), candidates));
+}
+
+TEST(MPGGeometricVerifierTest, HomographyInliers) {
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<float> coordinate(0.0f, 640.0f);
+
+    // query is exhibit rotated by 30 degrees, scaled by 0.8 and shifted, a quarter of matches is wrong
+    const float angle = 0.52f, scale = 0.8f;
+    PointCorrespondences correspondences;
+    for (int i = 0; i < 40; ++i)
+    {
+        const cv::Point2f train(coordinate(generator), coordinate(generator));
+        correspondences.train_points.push_back(train);
+        if (i % 4 == 0)
+            correspondences.query_points.emplace_back(coordinate(generator), coordinate(generator));
+        else
+            correspondences.query_points.emplace_back(scale * (std::cos(angle) * train.x - std::sin(angle) * train.y) + 50.0f,
+                                                      scale * (std::sin(angle) * train.x + std::cos(angle) * train.y) + 20.0f);
+    }
+    const size_t inliers_count = countHomographyInliers(correspondences, 3.0);
+    EXPECT_GE(inliers_count, 30u);
+    EXPECT_LE(inliers_count, 32u);
+
+    // matches with unrelated exhibit aren't consistent with any homography
+    for (cv::Point2f& point : correspondences.query_points)
+        point = cv::Point2f(coordinate(generator), coordinate(generator));
+    EXPECT_LT(countHomographyInliers(correspondences, 3.0), 10u);
+    correspondences.train_points.resize(3);
+    correspondences.query_points.resize(3);
+    EXPECT_EQ(countHomographyInliers(correspondences, 3.0), 0u);
+}
+
+TEST(MPGIndexTest, HnswIncrementalRecall) {
+    cv::setRNGSeed(11);
+    cv::Mat train(6000, 32, CV_8UC1);
+    cv::randu(train, 0, 256);
+    cv::Mat query(200, 32, CV_8UC1);
+    for (int i = 0; i < query.rows; ++i)
+    {
+        train.row(i * 29).copyTo(query.row(i));
+        query.at<uint8_t>(i, i % 32) ^= static_cast<uint8_t>(1 << (i % 8));
+    }
+
+    // half of rows are inserted on build, the rest is added like new exhibits
+    HnswIndex hnsw(16, 100, 64);
+    ASSERT_TRUE(hnsw.build(train.rowRange(0, 3000)));
+    for (int first_row = 3000; first_row < train.rows; first_row += 500)
+        ASSERT_TRUE(hnsw.add(train.rowRange(0, first_row + 500), first_row));
+    ASSERT_EQ(hnsw.size(), static_cast<size_t>(train.rows));
+
+    std::vector<HammingMatch> matches;
+    ASSERT_TRUE(hnsw.knnSearch(query, 2, matches));
+    int found = 0;
+    for (int i = 0; i < query.rows; ++i)
+    {
+        if (matches[i * 2].train_idx == i * 29 && matches[i * 2].distance == 1)
+            ++found;
+    }
+    EXPECT_GE(found, query.rows * 95 / 100);
+}
+
+/**
+ * \brief Function for create database module with local database of exhibits 1, 2, ... (without Cassandra)
+ */
+std::unique_ptr<DatabaseTestModule> makeSearchModule(size_t match_batch_rows, const std::vector<cv::Mat>& exhibits,
+                                                     const std::shared_ptr<SearchPool>& search_pool = nullptr)
+{
+    auto conf = std::make_shared<Config>();
+    conf->descriptor_index_type = "bruteforce";
+    conf->search_shard_rows = 100;
+    conf->count_matches_knn = 2;
+    conf->match_batch_rows = match_batch_rows;
+    conf->verification_candidates = 0;
+    conf->exhibit_cache_bytes = 0;
+    conf->snapshot_path.clear();
+
+    auto module = std::make_unique<DatabaseTestModule>(conf, nullptr);
+    auto index = std::make_unique<SegmentedIndex>(*conf, search_pool);
+    for (size_t i = 0; i < exhibits.size(); ++i)
+        index->addExhibit(CassUuid{i + 1, 0}, exhibits[i]);
+    module->setLocalDatabase(std::move(index));
+    return module;
+}
+
+std::vector<cv::Mat> randomExhibits(size_t count, int rows)
+{
+    std::vector<cv::Mat> exhibits(count);
+    for (cv::Mat& exhibit : exhibits)
+    {
+        exhibit = cv::Mat(rows, 32, CV_8UC1);
+        cv::randu(exhibit, 0, 256);
+    }
+    return exhibits;
+}
+
+TEST(MPGSearchCandidatesTest, EarlyExitSameAsFullScan) {
+    cv::setRNGSeed(37);
+    const std::vector<cv::Mat> exhibits = randomExhibits(2, 100);
+    std::unique_ptr<DatabaseTestModule> batched = makeSearchModule(20, exhibits);
+    std::unique_ptr<DatabaseTestModule> full = makeSearchModule(60, exhibits);
+
+    // 40 rows of exhibit 1, 10 rows of exhibit 2 and 10 rows of exhibit 1
+    cv::Mat query;
+    query.push_back(exhibits[0].rowRange(0, 40));
+    query.push_back(exhibits[1].rowRange(0, 10));
+    query.push_back(exhibits[0].rowRange(40, 50));
+    const auto no_deadline = std::chrono::steady_clock::time_point::max();
+
+    // after 2 batches leader has 40 votes and 20 remaining rows can't overtake it
+    std::vector<ExhibitCandidate> early_candidates, full_candidates;
+    ASSERT_TRUE(batched->searchCandidates(query, {}, no_deadline, early_candidates));
+    ASSERT_TRUE(full->searchCandidates(query, {}, no_deadline, full_candidates));
+    ASSERT_EQ(early_candidates.size(), 1u);
+    ASSERT_EQ(full_candidates.size(), 1u);
+    EXPECT_EQ(early_candidates[0].processed_rows, 40u);
+    EXPECT_EQ(early_candidates[0].votes, 40u);
+    EXPECT_EQ(full_candidates[0].processed_rows, 60u);
+    EXPECT_EQ(full_candidates[0].votes, 50u);
+    EXPECT_EQ(early_candidates[0].id.time_and_version, 1u);
+    EXPECT_EQ(full_candidates[0].id.time_and_version, early_candidates[0].id.time_and_version);
+    ASSERT_NE(batched->selectCandidate(early_candidates), nullptr);
+    EXPECT_EQ(batched->selectCandidate(early_candidates)->id.time_and_version, 1u);
+}
+
+TEST(MPGSearchCandidatesTest, ZeroDeadlineReturnsBestSoFar) {
+    cv::setRNGSeed(41);
+    const std::vector<cv::Mat> exhibits = randomExhibits(2, 100);
+    std::unique_ptr<DatabaseTestModule> module = makeSearchModule(20, exhibits);
+
+    // the first batch votes for exhibit 1, the rest (majority) for exhibit 2
+    cv::Mat query;
+    query.push_back(exhibits[0].rowRange(0, 20));
+    query.push_back(exhibits[1].rowRange(0, 60));
+
+    std::vector<ExhibitCandidate> candidates;
+    ASSERT_TRUE(module->searchCandidates(query, {}, std::chrono::steady_clock::now() - std::chrono::seconds(1), candidates));
+    ASSERT_EQ(candidates.size(), 1u);
+    EXPECT_EQ(candidates[0].id.time_and_version, 1u);
+    EXPECT_EQ(candidates[0].processed_rows, 20u);
+    EXPECT_EQ(candidates[0].votes, 20u);
+
+    ASSERT_TRUE(module->searchCandidates(query, {}, std::chrono::steady_clock::time_point::max(), candidates));
+    ASSERT_EQ(candidates.size(), 1u);
+    EXPECT_EQ(candidates[0].id.time_and_version, 2u);
+    EXPECT_EQ(candidates[0].processed_rows, 80u);
+    EXPECT_EQ(candidates[0].votes, 60u);
+}
+
+TEST(MPGAllocationTest, RepeatedSearchDoesntAllocate) {
+    cv::setRNGSeed(41);
+    const std::vector<cv::Mat> exhibits = randomExhibits(20, 50);
+    // 1000 rows are split into 10 tasks of search pool
+    auto search_pool = std::make_shared<SearchPool>(3);
+    std::unique_ptr<DatabaseTestModule> module = makeSearchModule(20, exhibits, search_pool);
+    const cv::Mat query = exhibits[4].clone();
+    const auto no_deadline = std::chrono::steady_clock::time_point::max();
+
+    // the first query grows buffers of request thread, the next one reuses them
+    size_t confidence = 0;
+    ASSERT_TRUE(module->findExhibitUuid(query, {}, no_deadline, confidence).has_value());
+    allocations_count = 0;
+    is_allocation_counted = true;
+    const std::optional<CassUuid> id = module->findExhibitUuid(query, {}, no_deadline, confidence);
+    is_allocation_counted = false;
+    ASSERT_TRUE(id.has_value());
+    EXPECT_EQ(id->time_and_version, 5u);
+    EXPECT_EQ(confidence, 100u);
+    EXPECT_EQ(allocations_count, 0u);
+}
+
+TEST(MPGExhibitCacheTest, AdmissionEvictionInvalidation) {
+    DatabaseResponse payload;
+    payload.exhibit_name = "title";
+    payload.exhibit_description = "description";
+    payload.exhibit_image.assign(1000, 7);
+    const size_t payload_bytes = ExhibitCache::payloadBytes(payload);
+    ExhibitCache cache(8 * payload_bytes);
+    auto id = [](uint64_t i) { return CassUuid{i, 0}; };
+    constexpr ImageRendition mobile = ImageRendition::Mobile;
+
+    // the first miss only marks exhibit, the second one caches it
+    EXPECT_EQ(cache.find(id(1), mobile), nullptr);
+    EXPECT_FALSE(cache.insert(id(1), mobile, payload, cache.generation()));
+    EXPECT_TRUE(cache.insert(id(1), mobile, payload, cache.generation()));
+    ExhibitCache::Payload cached = cache.find(id(1), mobile);
+    ASSERT_NE(cached, nullptr);
+    EXPECT_EQ(cached->exhibit_image, payload.exhibit_image);
+
+    for (uint64_t i = 2; i <= 8; ++i)
+        EXPECT_TRUE(cache.insert(id(i), mobile, payload, cache.generation(), true));
+    EXPECT_NE(cache.find(id(1), mobile), nullptr);
+    EXPECT_TRUE(cache.insert(id(9), mobile, payload, cache.generation(), true));
+    EXPECT_EQ(cache.find(id(2), mobile), nullptr); // the least recently used
+    EXPECT_NE(cache.find(id(1), mobile), nullptr);
+
+    DatabaseResponse big_payload;
+    big_payload.exhibit_image.assign(2 * payload_bytes, 7);
+    EXPECT_FALSE(cache.insert(id(10), mobile, big_payload, cache.generation(), true));
+
+    // renditions are cached separately, payload read before erase isn't cached
+    EXPECT_NE(cache.find(id(3), mobile), nullptr);
+    EXPECT_TRUE(cache.insert(id(3), ImageRendition::Thumbnail, payload, cache.generation(), true));
+    EXPECT_EQ(cache.find(id(4), mobile), nullptr);
+    const uint64_t generation = cache.generation();
+    cache.erase(id(3));
+    EXPECT_EQ(cache.find(id(3), ImageRendition::Thumbnail), nullptr);
+    EXPECT_EQ(cache.find(id(3), mobile), nullptr);
+    EXPECT_FALSE(cache.insert(id(3), mobile, payload, generation, true));
+    EXPECT_TRUE(cache.insert(id(3), mobile, payload, cache.generation(), true));
+
+    const std::vector<CassUuid> hottest = cache.hottest(1);
+    ASSERT_EQ(hottest.size(), 1u);
+    EXPECT_EQ(hottest[0].time_and_version, 1u);
+
+    const ExhibitCache::Stats stats = cache.stats();
+    EXPECT_EQ(stats.entries_count, 7u);
+    EXPECT_EQ(stats.size_bytes, 7 * payload_bytes);
+    EXPECT_EQ(stats.hits_count, 4u);
+    EXPECT_EQ(stats.misses_count, 5u);
+    EXPECT_EQ(stats.insertions_count, 11u);
+    EXPECT_EQ(stats.rejections_count, 2u);
+    EXPECT_EQ(stats.evictions_count, 2u);
+    EXPECT_EQ(stats.invalidations_count, 2u);
+
+    // shared payload is cached without copy, the same doorkeeper admits it
+    const ExhibitCache::Payload shared_payload = std::make_shared<const DatabaseResponse>(payload);
+    EXPECT_FALSE(cache.insert(id(11), mobile, shared_payload, cache.generation()));
+    EXPECT_TRUE(cache.insert(id(11), mobile, shared_payload, cache.generation()));
+    EXPECT_EQ(cache.find(id(11), mobile), shared_payload);
+
+    // ETag depends on every byte and on size
+    std::vector<uint8_t> changed_image = payload.exhibit_image;
+    changed_image[999] = 8;
+    const std::string etag = imageETag(payload.exhibit_image);
+    EXPECT_EQ(etag, imageETag(std::vector<uint8_t>(1000, 7)));
+    EXPECT_NE(etag, imageETag(changed_image));
+    EXPECT_NE(etag, imageETag(std::vector<uint8_t>(1001, 7)));
+    EXPECT_EQ(etag.front(), '"');
+    EXPECT_EQ(etag.substr(etag.size() - 5), "-3e8\""); // hex size
+}
+
+TEST(MPGDatabaseChunkTest, FieldsAndPageSize) {
+    std::optional<ChunkFields> fields = chunkFieldsFromNames("id,title");
+    ASSERT_TRUE(fields.has_value());
+    EXPECT_EQ(chunkSelectQuery(fields.value()), "select id, title from mpg_keyspace.exhibits");
+    EXPECT_EQ(chunkSelectQuery(chunkFieldsFromNames("").value()),
+              "select id, title, description, image from mpg_keyspace.exhibits");
+    EXPECT_FALSE(chunkFieldsFromNames("id,keypoints").has_value());
+    EXPECT_EQ(chunkSelectQuery(chunkFieldsFromNames("id, title ,\timage").value()),
+              "select id, title, image from mpg_keyspace.exhibits");
+    EXPECT_FALSE(chunkFieldsFromNames("id, ").has_value());
+
+    // fixed rows until average row size is known, then budget / average
+    ChunkPageSizer sizer(1000, 10, 50);
+    EXPECT_EQ(sizer.pageRows(true), 10u);
+    sizer.record(true, 10, 10 * 400);
+    EXPECT_EQ(sizer.pageRows(true), 2u);
+    EXPECT_EQ(sizer.pageRows(false), 10u);
+    sizer.record(false, 10, 10 * 4);
+    EXPECT_EQ(sizer.pageRows(false), 50u);
+    sizer.record(true, 1, 2000);
+    EXPECT_EQ(sizer.pageRows(true), 1u);
+
+    ChunkPageSizer fixed_sizer(0, 10, 50);
+    fixed_sizer.record(true, 10, 10);
+    EXPECT_EQ(fixed_sizer.pageRows(true), 10u);
+}
+
+TEST(MPGChangelogTest, DeduplicationAndLastChange) {
+    const CassUuid first_id{1, 1};
+    const CassUuid second_id{2, 2};
+    const CassUuid first_version{10, 0};
+    const CassUuid second_version{20, 0};
+
+    // own change is registered when written, so it isn't applied again when read by poll
+    AppliedChanges applied_changes;
+    EXPECT_TRUE(applied_changes.markApplied(first_version, 1000));
+    EXPECT_FALSE(applied_changes.markApplied(first_version, 1000));
+    EXPECT_TRUE(applied_changes.markApplied(second_version, 2000));
+    EXPECT_EQ(applied_changes.size(), 2u);
+
+    // versions before sync time are never read again, newer ones are still skipped
+    applied_changes.forgetBefore(1500);
+    EXPECT_EQ(applied_changes.size(), 1u);
+    EXPECT_FALSE(applied_changes.markApplied(second_version, 2000));
+    EXPECT_TRUE(applied_changes.markApplied(first_version, 1000));
+
+    // only the last change of every exhibit is applied
+    const std::vector<ExhibitChange> last_changes = lastChanges({
+        {first_id, false}, {second_id, false}, {first_id, true}, {second_id, true}, {second_id, false}});
+    ASSERT_EQ(last_changes.size(), 2u);
+    EXPECT_TRUE(CassUuidEqual()(last_changes[0].id, second_id));
+    EXPECT_FALSE(last_changes[0].is_deleted);
+    EXPECT_TRUE(CassUuidEqual()(last_changes[1].id, first_id));
+    EXPECT_TRUE(last_changes[1].is_deleted);
+    EXPECT_TRUE(lastChanges({}).empty());
+}
+
 
 int main(int argc, char** argv)
 {
@@ -0,0 +1,117 @@
+#include <server/server.hpp>
+#include <server/http_utils.hpp>
+#include <config.hpp>
+#include <logger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+using namespace MPG;
+
+class ServerTestModule: public Server
+{
+public:
+
+    using ::Server::checkReady;
+    using ::Server::getReadiness;
+    using ::Server::core_ptr;
+
+    ServerTestModule(const std::shared_ptr<Config>& conf, const std::shared_ptr<Logger>& log)
+        : Server(conf, log) {}
+
+};
+
+namespace
+{
+    std::shared_ptr<Config> unreachableDatabaseConfig(size_t max_connect_retries, size_t connect_retry_delay_ms)
+    {
+        auto config = std::make_shared<Config>();
+        config->database_host = "mpg-test.invalid"; // .invalid never resolves
+        config->max_connect_retries = max_connect_retries;
+        config->connect_retry_delay_ms = connect_retry_delay_ms;
+        config->warmup_retry_after_s = 7;
+        return config;
+    }
+}
+
+TEST(MPGReadinessTest, UnavailableWhileStartingAndAfterFailure) {
+    ServerTestModule server(unreachableDatabaseConfig(2, 2000), std::make_shared<Logger>());
+    ASSERT_EQ(server.core_ptr->state(), Core::State::Starting);
+
+    // warming up replica asks to retry later
+    wfrest::HttpResp starting_resp;
+    EXPECT_FALSE(server.checkReady(&starting_resp));
+    EXPECT_STREQ(starting_resp.get_status_code(), "503");
+    EXPECT_EQ(starting_resp.headers["Retry-After"], "7");
+
+    wfrest::HttpResp readiness_resp;
+    server.getReadiness(nullptr, &readiness_resp);
+    EXPECT_STREQ(readiness_resp.get_status_code(), "503");
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (server.core_ptr->state() == Core::State::Starting && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(server.core_ptr->state(), Core::State::Failed);
+
+    // failed replica won't become ready, retry isn't suggested
+    wfrest::HttpResp failed_resp;
+    EXPECT_FALSE(server.checkReady(&failed_resp));
+    EXPECT_STREQ(failed_resp.get_status_code(), "503");
+    EXPECT_EQ(failed_resp.headers.count("Retry-After"), 0u);
+}
+
+TEST(MPGHttpUtilsTest, ByteRanges) {
+    ByteRange range;
+    ASSERT_EQ(parseByteRange("bytes=10-19", 100, range), RangeStatus::Partial);
+    EXPECT_EQ(range.first, 10u);
+    EXPECT_EQ(range.last, 19u);
+    ASSERT_EQ(parseByteRange("bytes=90-", 100, range), RangeStatus::Partial);
+    EXPECT_EQ(range.first, 90u);
+    EXPECT_EQ(range.last, 99u);
+    ASSERT_EQ(parseByteRange("bytes=95-500", 100, range), RangeStatus::Partial);
+    EXPECT_EQ(range.last, 99u);
+
+    // suffix range is the last bytes, suffix longer than body is whole body
+    ASSERT_EQ(parseByteRange("bytes=-30", 100, range), RangeStatus::Partial);
+    EXPECT_EQ(range.first, 70u);
+    EXPECT_EQ(range.last, 99u);
+    ASSERT_EQ(parseByteRange("bytes=-500", 100, range), RangeStatus::Partial);
+    EXPECT_EQ(range.first, 0u);
+    EXPECT_EQ(range.last, 99u);
+    EXPECT_EQ(parseByteRange("bytes=-0", 100, range), RangeStatus::Unsatisfiable);
+
+    // range starting after body gets 416
+    EXPECT_EQ(parseByteRange("bytes=100-", 100, range), RangeStatus::Unsatisfiable);
+    EXPECT_EQ(parseByteRange("bytes=150-200", 100, range), RangeStatus::Unsatisfiable);
+    EXPECT_EQ(parseByteRange("bytes=0-", 0, range), RangeStatus::Unsatisfiable);
+
+    // invalid and multi ranges are answered by whole body
+    EXPECT_EQ(parseByteRange("bytes=20-10", 100, range), RangeStatus::Full);
+    EXPECT_EQ(parseByteRange("bytes=0-9,20-29", 100, range), RangeStatus::Full);
+    EXPECT_EQ(parseByteRange("items=0-9", 100, range), RangeStatus::Full);
+    EXPECT_EQ(parseByteRange("bytes=a-9", 100, range), RangeStatus::Full);
+    EXPECT_EQ(parseByteRange("bytes=5", 100, range), RangeStatus::Full);
+    EXPECT_EQ(parseByteRange("", 100, range), RangeStatus::Full);
+}
+
+TEST(MPGHttpUtilsTest, ETagMatching) {
+    const std::string etag = "\"1f2e3d-100\"";
+    EXPECT_TRUE(isETagMatched(etag, etag));
+    EXPECT_TRUE(isETagMatched("W/" + etag, etag)); // weak comparison
+    EXPECT_TRUE(isETagMatched("\"other-1\", " + etag, etag));
+    EXPECT_TRUE(isETagMatched(" W/\"other-1\" ,W/" + etag + " ", etag));
+    EXPECT_TRUE(isETagMatched("*", etag));
+    EXPECT_FALSE(isETagMatched("\"other-1\"", etag));
+    EXPECT_FALSE(isETagMatched("1f2e3d-100", etag)); // unquoted tag is other tag
+    EXPECT_FALSE(isETagMatched("", etag));
+}
+
+TEST(MPGHttpUtilsTest, ImageContentType) {
+    EXPECT_STREQ(imageContentType({0xFF, 0xD8, 0xFF, 0xE0}), "image/jpeg");
+    EXPECT_STREQ(imageContentType({0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A, 0}), "image/png");
+    EXPECT_STREQ(imageContentType({'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'E', 'B', 'P'}), "image/webp");
+    EXPECT_STREQ(imageContentType({'B', 'M', 0, 0}), "application/octet-stream");
+    EXPECT_STREQ(imageContentType({}), "application/octet-stream");
+}
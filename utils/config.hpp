@@ -3,6 +3,8 @@
 #include <nlohmann/json.hpp>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace MPG
 {
@@ -16,7 +18,6 @@ namespace MPG
         inline Config(const std::string& path);
 
         //database params
-        size_t matchers_pool_size;
         size_t max_connect_retries;
         size_t connect_retry_delay_ms;
         size_t max_matches_count;
@@ -24,16 +25,65 @@ namespace MPG
         std::string database_host;
         size_t count_matches_knn;
         size_t database_chunk_size;
+        size_t database_chunk_bytes;
+        size_t database_chunk_max_rows;
+        std::string descriptor_index_type;
+        size_t hnsw_m;
+        size_t hnsw_ef_construction;
+        size_t hnsw_ef_search;
+        size_t search_threads;
+        size_t search_shard_rows;
+        size_t segment_rows;
+        float compaction_deleted_ratio;
+        size_t verification_candidates;
+        size_t verification_min_inliers;
+        float verification_reprojection_error;
+        size_t match_batch_rows;
+        size_t match_time_budget_ms;
+        std::string snapshot_path;
+        size_t snapshot_interval_s;
+        size_t load_threads;
+        size_t load_page_size;
+        size_t changelog_poll_ms;
+        size_t changelog_ttl_s;
+        size_t exhibit_cache_bytes;
+        size_t exhibit_cache_prefetch;
+        size_t shard_count;
+        size_t shard_index;
+        size_t shard_port;
+        std::string shard_listen_address;
+        size_t shard_max_connections;
+        std::vector<std::string> shard_endpoints;
+        size_t shard_timeout_ms;
+        bool bow_enabled;
+        size_t bow_branching;
+        size_t bow_depth;
+        size_t bow_iterations;
+        size_t bow_shortlist_size;
 
         //core params
 
+        std::string feature_type;
         size_t orb_pool_size;
         size_t orb_kps_count;
         size_t max_descriptor_size;
+        size_t image_long_side;
+        size_t max_image_pixels;
+        size_t extraction_threads;
+        size_t query_cache_size;
+        size_t query_cache_max_distance;
+        size_t thumbnail_long_side;
+        size_t mobile_long_side;
+        std::string rendition_format;
+        size_t rendition_quality;
+        std::string default_image_rendition;
+        bool inline_exhibit_image;
+        size_t image_cache_max_age_s;
 
         //server params
 
         size_t server_port;
+        size_t warmup_retry_after_s;
     };
 
     /**
@@ -41,7 +91,6 @@ namespace MPG
      */
     inline Config::Config()
     {
-        matchers_pool_size = 10;
         max_connect_retries = 20;
         connect_retry_delay_ms = 10000;
         max_matches_count = 100;
@@ -49,12 +98,61 @@ namespace MPG
         database_host = "localhost";
         count_matches_knn = 2;
         database_chunk_size = 10;
+        database_chunk_bytes = 4194304;
+        database_chunk_max_rows = 1000;
+        descriptor_index_type = "bruteforce";
+        hnsw_m = 16;
+        hnsw_ef_construction = 100;
+        hnsw_ef_search = 64;
+        search_threads = 0;
+        search_shard_rows = 32768;
+        segment_rows = 65536;
+        compaction_deleted_ratio = 0.25f;
+        verification_candidates = 3;
+        verification_min_inliers = 10;
+        verification_reprojection_error = 5.0f;
+        match_batch_rows = 32;
+        match_time_budget_ms = 0;
+        snapshot_path = "";
+        snapshot_interval_s = 300;
+        load_threads = 0;
+        load_page_size = 1000;
+        changelog_poll_ms = 1000;
+        changelog_ttl_s = 604800;
+        exhibit_cache_bytes = 268435456;
+        exhibit_cache_prefetch = 256;
+        shard_count = 1;
+        shard_index = 0;
+        shard_port = 0;
+        shard_listen_address = "127.0.0.1";
+        shard_max_connections = 64;
+        shard_endpoints = {};
+        shard_timeout_ms = 300;
+        bow_enabled = false;
+        bow_branching = 10;
+        bow_depth = 4;
+        bow_iterations = 10;
+        bow_shortlist_size = 10;
 
+        feature_type = "orb";
         orb_pool_size = 10;
         orb_kps_count = 100;
         max_descriptor_size = 100;
+        image_long_side = 1024;
+        max_image_pixels = 50000000;
+        extraction_threads = 0;
+        query_cache_size = 4096;
+        query_cache_max_distance = 4;
+        thumbnail_long_side = 256;
+        mobile_long_side = 1024;
+        rendition_format = "jpeg";
+        rendition_quality = 80;
+        default_image_rendition = "mobile";
+        inline_exhibit_image = false;
+        image_cache_max_age_s = 86400;
 
         server_port = 8888;
+        warmup_retry_after_s = 5;
     }
     
     /**
@@ -73,7 +171,6 @@ namespace MPG
         fin >> config_json;
         fin.close();
 
-        matchers_pool_size = config_json["matchers_pool_size"];
         max_connect_retries = config_json["max_connect_retries"];
         connect_retry_delay_ms = config_json["connect_retry_delay_ms"];
         max_matches_count = config_json["max_matches_count"];
@@ -81,12 +178,61 @@ namespace MPG
         database_host = config_json["database_host"];
         count_matches_knn = config_json["count_matches_knn"];
         database_chunk_size = config_json["database_chunk_size"];
+        database_chunk_bytes = config_json["database_chunk_bytes"];
+        database_chunk_max_rows = config_json["database_chunk_max_rows"];
+        descriptor_index_type = config_json["descriptor_index_type"];
+        hnsw_m = config_json["hnsw_m"];
+        hnsw_ef_construction = config_json["hnsw_ef_construction"];
+        hnsw_ef_search = config_json["hnsw_ef_search"];
+        search_threads = config_json["search_threads"];
+        search_shard_rows = config_json["search_shard_rows"];
+        segment_rows = config_json["segment_rows"];
+        compaction_deleted_ratio = config_json["compaction_deleted_ratio"];
+        verification_candidates = config_json["verification_candidates"];
+        verification_min_inliers = config_json["verification_min_inliers"];
+        verification_reprojection_error = config_json["verification_reprojection_error"];
+        match_batch_rows = config_json["match_batch_rows"];
+        match_time_budget_ms = config_json["match_time_budget_ms"];
+        snapshot_path = config_json["snapshot_path"];
+        snapshot_interval_s = config_json["snapshot_interval_s"];
+        load_threads = config_json["load_threads"];
+        load_page_size = config_json["load_page_size"];
+        changelog_poll_ms = config_json["changelog_poll_ms"];
+        changelog_ttl_s = config_json["changelog_ttl_s"];
+        exhibit_cache_bytes = config_json["exhibit_cache_bytes"];
+        exhibit_cache_prefetch = config_json["exhibit_cache_prefetch"];
+        shard_count = config_json["shard_count"];
+        shard_index = config_json["shard_index"];
+        shard_port = config_json["shard_port"];
+        shard_listen_address = config_json["shard_listen_address"];
+        shard_max_connections = config_json["shard_max_connections"];
+        shard_endpoints = config_json["shard_endpoints"].get<std::vector<std::string>>();
+        shard_timeout_ms = config_json["shard_timeout_ms"];
+        bow_enabled = config_json["bow_enabled"];
+        bow_branching = config_json["bow_branching"];
+        bow_depth = config_json["bow_depth"];
+        bow_iterations = config_json["bow_iterations"];
+        bow_shortlist_size = config_json["bow_shortlist_size"];
 
+        feature_type = config_json["feature_type"];
         orb_pool_size = config_json["orb_pool_size"];
         orb_kps_count = config_json["orb_kps_count"];
         max_descriptor_size = config_json["max_descriptor_size"];
+        image_long_side = config_json["image_long_side"];
+        max_image_pixels = config_json["max_image_pixels"];
+        extraction_threads = config_json["extraction_threads"];
+        query_cache_size = config_json["query_cache_size"];
+        query_cache_max_distance = config_json["query_cache_max_distance"];
+        thumbnail_long_side = config_json["thumbnail_long_side"];
+        mobile_long_side = config_json["mobile_long_side"];
+        rendition_format = config_json["rendition_format"];
+        rendition_quality = config_json["rendition_quality"];
+        default_image_rendition = config_json["default_image_rendition"];
+        inline_exhibit_image = config_json["inline_exhibit_image"];
+        image_cache_max_age_s = config_json["image_cache_max_age_s"];
 
         server_port = config_json["server_port"];
+        warmup_retry_after_s = config_json["warmup_retry_after_s"];
     }
 
 }
\ No newline at end of file
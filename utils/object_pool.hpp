@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace MPG
+{
+
+/**
+ * \brief Fixed-size pool of reusable objects (detectors, matchers) with RAII leases
+ *
+ * Every object has own slot with busy flag, so taking and returning object is one CAS without locks.
+ * Thread tries slot it used last time first (its object is likely hot in cache), then scans other slots.
+ * Only if all objects are leased, thread sleeps on condition variable until some lease is returned.
+ */
+template <class T>
+class ObjectPool
+{
+public:
+
+    /**
+     * \brief Counters for sizing pool: waits mean pool is too small, low peak means it's too big
+     */
+    struct Stats
+    {
+        size_t capacity = 0;
+        size_t in_use = 0;          // leased now
+        size_t peak_in_use = 0;     // max leased at once since pool creation
+        uint64_t acquired_count = 0;
+        uint64_t waited_count = 0;  // acquisitions which found all objects leased
+        uint64_t wait_us = 0;       // total time of such acquisitions
+    };
+
+    /**
+     * \brief Lease of pool object, returns it to pool on destruction
+     */
+    class Lease
+    {
+    public:
+
+        Lease() = default;
+        inline Lease(Lease&& other) noexcept;
+        inline Lease& operator=(Lease&& other) noexcept;
+        inline ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        T* get() const { return object; }
+        T* operator->() const { return object; }
+        T& operator*() const { return *object; }
+        explicit operator bool() const { return object != nullptr; }
+
+        inline void reset();
+
+    private:
+
+        friend class ObjectPool;
+
+        Lease(ObjectPool* owner, size_t slot_index) : pool(owner), slot(slot_index), object(owner->slots[slot_index].object.get()) {}
+
+        ObjectPool* pool = nullptr;
+        size_t slot = 0;
+        T* object = nullptr;
+    };
+
+    template <class Factory>
+    inline ObjectPool(size_t capacity, Factory factory);
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    inline Lease acquire();
+    inline std::optional<Lease> tryAcquire();
+    inline Stats stats() const;
+    size_t capacity() const { return slots_count; }
+
+private:
+
+    struct alignas(64) Slot
+    {
+        std::shared_ptr<T> object;
+        std::atomic<bool> is_busy{false};
+    };
+
+    struct ThreadCache
+    {
+        const ObjectPool* pool = nullptr;
+        size_t slot = 0;
+    };
+
+    inline bool tryTake(size_t& slot, std::memory_order check_order = std::memory_order_relaxed);
+    inline void release(size_t slot);
+
+    std::unique_ptr<Slot[]> slots;
+    size_t slots_count = 0;
+    std::atomic<size_t> next_slot{0}; // start of scan, spreads threads without cached slot over pool
+
+    std::mutex wait_mtx;
+    std::condition_variable wait_cv;
+    std::atomic<size_t> waiters_count{0};
+
+    std::atomic<size_t> in_use{0};
+    std::atomic<size_t> peak_in_use{0};
+    std::atomic<uint64_t> acquired_count{0};
+    std::atomic<uint64_t> waited_count{0};
+    std::atomic<uint64_t> wait_us{0};
+
+    inline static thread_local ThreadCache thread_cache;
+};
+
+/**
+ * \brief Constructor of pool
+ * \param[in] capacity Count of objects (at least 1 is created)
+ * \param[in] factory Function without arguments which returns pointer convertible to std::shared_ptr<T>
+ */
+template <class T>
+template <class Factory>
+inline ObjectPool<T>::ObjectPool(size_t capacity, Factory factory)
+    : slots_count(std::max<size_t>(capacity, 1))
+{
+    slots = std::make_unique<Slot[]>(slots_count);
+    for (size_t i = 0; i < slots_count; ++i)
+        slots[i].object = factory();
+}
+
+/**
+ * \brief Method for lease object, waits until at least one object is returned if all are leased
+ * \return Lease of object
+ */
+template <class T>
+inline typename ObjectPool<T>::Lease ObjectPool<T>::acquire()
+{
+    size_t slot = 0;
+    if (!tryTake(slot))
+    {
+        const auto wait_started_at = std::chrono::steady_clock::now();
+        waiters_count.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> ul(wait_mtx);
+            wait_cv.wait(ul, [&] { return tryTake(slot, std::memory_order_seq_cst); });
+        }
+        waiters_count.fetch_sub(1);
+        const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wait_started_at);
+        waited_count.fetch_add(1, std::memory_order_relaxed);
+        wait_us.fetch_add(static_cast<uint64_t>(waited.count()), std::memory_order_relaxed);
+    }
+    return Lease(this, slot);
+}
+
+/**
+ * \brief Method for lease object without waiting
+ * \return Lease of object or std::nullopt if all objects are leased
+ */
+template <class T>
+inline std::optional<typename ObjectPool<T>::Lease> ObjectPool<T>::tryAcquire()
+{
+    size_t slot = 0;
+    if (!tryTake(slot))
+        return std::nullopt;
+    return Lease(this, slot);
+}
+
+/**
+ * \brief Method for get pool counters
+ * \return Counters (every one is read atomically, but not all together)
+ */
+template <class T>
+inline typename ObjectPool<T>::Stats ObjectPool<T>::stats() const
+{
+    Stats result;
+    result.capacity = slots_count;
+    result.in_use = in_use.load(std::memory_order_relaxed);
+    result.peak_in_use = peak_in_use.load(std::memory_order_relaxed);
+    result.acquired_count = acquired_count.load(std::memory_order_relaxed);
+    result.waited_count = waited_count.load(std::memory_order_relaxed);
+    result.wait_us = wait_us.load(std::memory_order_relaxed);
+    return result;
+}
+
+/**
+ * \brief Internal method for take free slot: cached slot of thread first, then all slots from rotating start
+ * \param[out] slot Index of taken slot
+ * \param[in] check_order Memory order of busy flag check, waiting thread needs seq_cst (see release)
+ * \return true if slot is taken
+ */
+template <class T>
+inline bool ObjectPool<T>::tryTake(size_t& slot, std::memory_order check_order)
+{
+    auto take = [this, check_order](size_t index)
+    {
+        bool is_busy = false;
+        return !slots[index].is_busy.load(check_order) &&
+               slots[index].is_busy.compare_exchange_strong(is_busy, true, std::memory_order_acquire);
+    };
+
+    bool is_taken = false;
+    if (thread_cache.pool == this && thread_cache.slot < slots_count && take(thread_cache.slot))
+    {
+        slot = thread_cache.slot;
+        is_taken = true;
+    }
+    else
+    {
+        const size_t start = next_slot.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < slots_count && !is_taken; ++i)
+        {
+            const size_t index = (start + i) % slots_count;
+            if (take(index))
+            {
+                slot = index;
+                is_taken = true;
+            }
+        }
+        if (!is_taken)
+            return false;
+        thread_cache = {this, slot};
+    }
+
+    acquired_count.fetch_add(1, std::memory_order_relaxed);
+    const size_t leased = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t peak = peak_in_use.load(std::memory_order_relaxed);
+    while (leased > peak && !peak_in_use.compare_exchange_weak(peak, leased, std::memory_order_relaxed))
+    {
+    }
+    return true;
+}
+
+/**
+ * \brief Internal method for return slot to pool and wake one waiting thread
+ * \param[in] slot Index of slot
+ */
+template <class T>
+inline void ObjectPool<T>::release(size_t slot)
+{
+    in_use.fetch_sub(1, std::memory_order_relaxed);
+    // seq_cst store and load here, seq_cst increment of waiters_count and check of busy flag in acquire:
+    // either waiter sees free slot or this thread sees waiter
+    slots[slot].is_busy.store(false);
+    if (waiters_count.load() > 0)
+    {
+        std::lock_guard<std::mutex> lg(wait_mtx);
+        wait_cv.notify_one();
+    }
+}
+
+template <class T>
+inline ObjectPool<T>::Lease::Lease(Lease&& other) noexcept
+    : pool(other.pool), slot(other.slot), object(other.object)
+{
+    other.pool = nullptr;
+    other.object = nullptr;
+}
+
+template <class T>
+inline typename ObjectPool<T>::Lease& ObjectPool<T>::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        pool = other.pool;
+        slot = other.slot;
+        object = other.object;
+        other.pool = nullptr;
+        other.object = nullptr;
+    }
+    return *this;
+}
+
+template <class T>
+inline ObjectPool<T>::Lease::~Lease()
+{
+    reset();
+}
+
+/**
+ * \brief Method for return object to pool before lease destruction
+ */
+template <class T>
+inline void ObjectPool<T>::Lease::reset()
+{
+    if (pool)
+        pool->release(slot);
+    pool = nullptr;
+    object = nullptr;
+}
+
+}